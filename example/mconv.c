@@ -32,7 +32,8 @@
     Convert encoding of given files from one to another.
 
     If INFILE is omitted, the input is taken from standard input.  If
-    OUTFILE is omitted, the output written to standard output.
+    OUTFILE is omitted, the output written to standard output.  If
+    INFILE is a regular file, it is mapped into memory if possible.
 
     The following OPTIONs are available.
 
@@ -40,7 +41,9 @@
 
     <li> -f FROMCODE
 
-    FROMCODE is the encoding of INFILE (defaults to UTF-8).
+    FROMCODE is the encoding of INFILE (defaults to UTF-8).  If
+    FROMCODE is "auto", the encoding is detected from the head of
+    INFILE.
 
     <li> -t TOCODE
 
@@ -62,6 +65,10 @@
 
     List available encodings.
 
+    <li> -d
+
+    Print the encodings INFILE can be in, the most probable first.
+
     <li> --version
 
     Print version number.
@@ -84,7 +91,8 @@
     与えられたファイルのコードを別のものに変換する。 
 
     INFILE が省略された場合は、標準入力からとる。OUTFILE が省略された 
-    場合は、標準出力へ書き出す。
+    場合は、標準出力へ書き出す。INFILE が通常のファイルならば、可能な
+    らばメモリにマップする。
 
     以下のオプションが利用できる。
 
@@ -93,6 +101,7 @@
     <li> -f FROMCODE
 
     FROMCODE は INFILE のコード系である。(デフォルトは UTF-8) 
+    FROMCODE が "auto" ならば、コード系を INFILE の先頭から検出する。
 
     <li> -t TOCODE
 
@@ -114,6 +123,10 @@
 
     利用可能なコード系を列挙する。 
 
+    <li> -d
+
+    INFILE のコード系でありうるものを、可能性の高い順に表示する。
+
     <li> --version
 
     バージョン番号を表示する。 
@@ -130,6 +143,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <m17n.h>
 #include <m17n-misc.h>
@@ -173,6 +187,28 @@ list_coding ()
 }
 
 
+/* Maximum number of bytes examined to detect the encoding.  */
+#define DETECT_BYTES 65536
+
+/* Read at most DETECT_BYTES bytes from IN into BUF, and set *NBYTES
+   to the number of bytes read.  Return an array of the encodings
+   detected from them, the most probable first, and set *N to the
+   length of the array.  */
+
+MSymbol *
+detect_encodings (FILE *in, unsigned char *buf, int *nbytes, int *n)
+{
+  MCodingDetector *detector = mconv_coding_detector (NULL, 0, DETECT_BYTES);
+  MSymbol *codings;
+
+  *nbytes = fread (buf, 1, DETECT_BYTES, in);
+  mconv_feed_detector (detector, buf, *nbytes);
+  *n = mconv_detected_codings (detector, &codings);
+  mconv_free_detector (detector);
+  return codings;
+}
+
+
 /* Print the usage of this program (the name is PROG), and exit with
    EXIT_CODE.  */
 
@@ -192,12 +228,15 @@ help_exit (char *prog, int exit_code)
   printf ("The following OPTIONs are available.\n");
   printf ("  %-13s %s", "-f FROMCODE",
 	  "FROMCODE is the encoding of INFILE (defaults to UTF-8).\n");
+  printf ("  %-13s %s", "",
+	  "If FROMCODE is \"auto\", it is detected from INFILE.\n");
   printf ("  %-13s %s", "-t TOCODE",
 	  "TOCODE is the encoding of OUTFILE (defaults to UTF-8).\n");
   printf ("  %-13s %s", "-k", "Do not stop conversion on error.\n");
   printf ("  %-13s %s", "-s", "Suppress warnings.\n");
   printf ("  %-13s %s", "-v", "Print progress information.\n");
   printf ("  %-13s %s", "-l", "List available encodings.\n");
+  printf ("  %-13s %s", "-d", "Print encodings INFILE can be in.\n");
   printf ("  %-13s %s", "--version", "Print version number.\n");
   printf ("  %-13s %s", "-h, --help", "Print this message.\n");
   exit (exit_code);
@@ -324,8 +363,13 @@ main (int argc, char **argv)
   int verbose;
   MSymbol incode, outcode;
   FILE *in, *out;
+  char *infile = NULL;
+  struct stat st;
   MText *mt;
   MConverter *converter;
+  int detect;
+  unsigned char buf[DETECT_BYTES];
+  int nbytes;
   int i;
 
   /* Initialize the m17n library.  */
@@ -338,7 +382,7 @@ main (int argc, char **argv)
   /* By default, read from standard input and write to standard output. */
   in = stdin, out = stdout;
   /* By default, all these flags are 0.  */
-  suppress_warning = verbose = continue_on_error = 0;
+  suppress_warning = verbose = continue_on_error = detect = 0;
   /* Parse the command line arguments.  */
   for (i = 1; i < argc; i++)
     {
@@ -358,10 +402,14 @@ main (int argc, char **argv)
 	  M17N_FINI ();
 	  exit (0);
 	}
+      else if (! strcmp (argv[i], "-d"))
+	detect = 1;
       else if (! strcmp (argv[i], "-f") && i + 1 < argc)
 	{
-	  incode = mconv_resolve_coding (msymbol (argv[++i]));
-	  if (incode == Mnil)
+	  /* Mnil means that the encoding is to be detected.  */
+	  if (! strcmp (argv[++i], "auto"))
+	    incode = Mnil;
+	  else if ((incode = mconv_resolve_coding (msymbol (argv[i]))) == Mnil)
 	    unknown_encoding (argv[i]);
 	}
       else if (! strcmp (argv[i], "-t") && i + 1 < argc)
@@ -380,6 +428,7 @@ main (int argc, char **argv)
 	{
 	  if (in == stdin)
 	    {
+	      infile = argv[i];
 	      in = fopen (argv[i], "r");
 	      if (! in)
 		FATAL_ERROR ("Can't read the file %s\n", argv[i]);
@@ -402,8 +451,41 @@ main (int argc, char **argv)
   /* Create an M-text to store the decoded characters.  */
   mt = mtext ();
 
-  /* Create a converter for decoding.  */
-  converter = mconv_stream_converter (incode, in);
+  nbytes = 0;
+  if (detect || incode == Mnil)
+    {
+      int n;
+      MSymbol *codings = detect_encodings (in, buf, &nbytes, &n);
+
+      if (detect)
+	{
+	  for (i = 0; i < n; i++)
+	    printf ("%s\n", msymbol_name (codings[i]));
+	  free (codings);
+	  M17N_FINI ();
+	  exit (0);
+	}
+      if (n == 0)
+	FATAL_ERROR ("%s\n", "Can't detect the encoding of the input.");
+      incode = codings[0];
+      free (codings);
+      if (verbose)
+	fprintf (stderr, "Encoding %s detected,\n", msymbol_name (incode));
+    }
+
+  /* Create a converter for decoding.  A regular file is decoded from
+     the head by a converter bound to the file.  Otherwise, the bytes
+     read for detection are decoded first.  */
+  if (infile && fstat (fileno (in), &st) == 0 && S_ISREG (st.st_mode))
+    {
+      converter = mconv_file_converter (incode, infile);
+      nbytes = 0;
+      if (! converter && merror_code == MERROR_IO)
+	FATAL_ERROR ("Can't read the file %s\n", infile);
+    }
+  else
+    converter = (nbytes > 0 ? mconv_buffer_converter (incode, buf, nbytes)
+		 : mconv_stream_converter (incode, in));
   if (! converter)
     FATAL_ERROR ("Encoding \"%s\" requires the missing library \"m17n-db\".\n",
 		 msymbol_name (incode));
@@ -412,12 +494,18 @@ main (int argc, char **argv)
      check_invalid_bytes.  */
   converter->lenient = 1;
 
+  if (nbytes > 0)
+    {
+      mconv_decode (converter, mt);
+      mconv_rebind_stream (converter, in);
+    }
   mconv_decode (converter, mt);
 
   check_invalid_bytes (mt);
   if (verbose)
     fprintf (stderr, "%d bytes (%s) decoded into %d characters,\n",
-	     converter->nbytes, msymbol_name (incode), mtext_len (mt));
+	     nbytes + converter->nbytes, msymbol_name (incode),
+	     mtext_len (mt));
 
   mconv_free_converter (converter);
 
@@ -0,0 +1,1267 @@
+/* mconvbench.c -- Benchmark of code converters.	-*- coding: utf-8; -*-
+   Copyright (C) 2026
+     National Institute of Advanced Industrial Science and Technology (AIST)
+     Registration Number H15PRO112
+
+   This file is part of the m17n library.
+
+   The m17n library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   The m17n library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the m17n library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA.  */
+
+/***en
+    @enpage m17n-conv-bench benchmark code converters
+
+    @section m17n-conv-bench-synopsis SYNOPSIS
+
+    m17n-conv-bench [ OPTION ... ] [ CODING ... ]
+
+    @section m17n-conv-bench-description DESCRIPTION
+
+    Measure the throughput of decoding and encoding by each CODING.
+    If CODING is omitted, all the available encodings are measured.
+
+    A text is generated for each CODING from characters it can
+    encode.  The text is encoded and decoded with a code converter
+    bound to a buffer (buffer), with one bound to a stream (stream),
+    character by character by mconv_getc () and mconv_putc () (getc),
+    and line by line by mconv_gets () (gets).  The text is also
+    decoded from a stream block by block by mconv_decode_sink ()
+    (sink), and from a file bound to a code converter by
+    mconv_file_converter () (file).
+
+    The result is printed in lines of tab separated fields: CODING,
+    mode, direction (decode or encode), the numbers of bytes and
+    characters converted in one round, seconds per round, megabytes
+    per second, mega-characters per second, and 1 if decoding
+    reproduced the text (else 0).  A line starting with '#' is a
+    comment.
+
+    The following OPTIONs are available.
+
+    <ul>
+
+    <li> -f FILE
+
+    Take the text from FILE (in UTF-8) instead of generating one.
+    Characters a CODING can't encode are replaced as m17n-conv -k does.
+
+    <li> -n CHARS
+
+    Generate a text of CHARS characters (defaults to 262144).
+
+    <li> -r RATIO
+
+    Percentage of words of non-ASCII characters in the generated text
+    (defaults to 50).
+
+    <li> -m MODES
+
+    Comma separated list of modes to measure (defaults to
+    "buffer,stream,getc,gets,sink,file").
+
+    <li> -t SECONDS
+
+    Repeat each measurement for at least SECONDS (defaults to 0.2).
+
+    <li> -c
+
+    Instead of measuring, check decoding and encoding by the UTF-16
+    and UTF-32 encodings of texts with and without a BOM, with
+    surrogate pairs, unpaired surrogates, and odd trailing bytes, in
+    strict and lenient modes.  Each text is decoded at once and in
+    blocks of 1 and 3 bytes.  A text longer than the runs that the
+    decoders decode at once is also checked, and so are texts decoded
+    from a file with a character encoded across the first 64K bytes,
+    by which a file mapped into memory is decoded.  Then check the
+    detection of UTF-8 texts by mconv_detect_coding (), including one
+    whose multi-byte sequence is cut off by the limit of the
+    detection.  A line of tab separated fields CODING, direction
+    (decode, encode, or detect), case, and 1 if the result is as
+    expected (else 0) is printed for each check.  The exit status is 1 if any check fails.
+
+    <li> -h, --help
+
+    Print this message.
+
+    </ul>
+*/
+/***ja
+    @japage m17n-conv-bench コードコンバータのベンチマーク
+
+    @section m17n-conv-bench-synopsis SYNOPSIS
+
+    m17n-conv-bench [ OPTION ... ] [ CODING ... ]
+
+    @section m17n-conv-bench-description 説明
+
+    各 CODING によるデコードとエンコードの速度を測る。CODING が省略さ
+    れた場合は、利用可能なすべてのコード系について測る。
+
+    各 CODING について、それがエンコードできる文字からテキストを生成す
+    る。テキストは、バッファに結び付けられたコードコンバータ (buffer)、
+    ストリームに結び付けられたもの (stream)、mconv_getc () と
+    mconv_putc () による 1 文字ずつ (getc)、mconv_gets () による 1 行
+    ずつ (gets) でエンコードおよびデコードされる。また、ストリームから
+    mconv_decode_sink () によってブロック毎に (sink)、
+    mconv_file_converter () によってコードコンバータに結び付けられたファ
+    イルから (file) デコードされる。
+
+    結果はタブで区切られたフィールドの行として表示される。フィールドは
+    CODING、モード、方向 (decode か encode)、1 回に変換されるバイト数と
+    文字数、1 回あたりの秒数、毎秒のメガバイト数、毎秒のメガ文字数、デ
+    コードがテキストを再現したなら 1 (そうでなければ 0) である。'#' で
+    始まる行は注釈である。
+
+    以下のオプションが利用できる。
+
+    <ul>
+
+    <li> -f FILE
+
+    テキストを生成する代わりに FILE (UTF-8) からとる。CODING がエンコー
+    ドできない文字は m17n-conv -k と同様に置き換えられる。
+
+    <li> -n CHARS
+
+    CHARS 文字のテキストを生成する。(デフォルトは 262144)
+
+    <li> -r RATIO
+
+    生成するテキストのうち非 ASCII 文字の語の割合 (パーセント)。(デフォ
+    ルトは 50)
+
+    <li> -m MODES
+
+    測るモードをコンマで区切って並べたもの。(デフォルトは
+    "buffer,stream,getc,gets,sink,file")
+
+    <li> -t SECONDS
+
+    各測定を少なくとも SECONDS 秒繰り返す。(デフォルトは 0.2)
+
+    <li> -c
+
+    測定する代わりに、UTF-16 と UTF-32 のエンコーディングによるデコー
+    ドとエンコードを、BOM のあるテキストとないテキスト、サロゲートペア、
+    対になっていないサロゲート、奇数個の末尾のバイトについて、厳密モー
+    ドと寛容モードで検査する。各テキストは一度に、および 1 バイトと 3
+    バイトのブロックごとにデコードされる。デコーダが一度にデコードする
+    範囲より長いテキストと、メモリにマップされたファイルをデコードする
+    単位である先頭の 64K バイトをまたいでエンコードされた文字を含むファ
+    イルからのデコードも検査する。さらに mconv_detect_coding () によ
+    る UTF-8 のテキストの検出を、検出の上限でマルチバイト列が途切れる
+    ものも含めて検査する。各検査について、CODING、方向 (decode、encode、
+    detect のいずれか)、場合、結果が期待通りなら 1 (そうでなければ 0)
+    をタブで区切ったフィールドの行が表示される。いずれかの検査が失敗す
+    れば終了ステータスは 1 である。
+
+    <li> -h, --help
+
+    このメッセージを表示する。
+
+    </ul>
+*/
+
+#ifndef FOR_DOXYGEN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <m17n.h>
+#include <m17n-misc.h>
+
+/* Return the current time in seconds.  */
+
+double
+now ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Linear congruential generator, so that the same text is generated
+   on any system.  */
+
+unsigned long random_seed;
+
+int
+random_number (int n)
+{
+  random_seed = (random_seed * 1103515245 + 12345) & 0x7FFFFFFF;
+  return (random_seed >> 8) % n;
+}
+
+/* Character ranges from which a text is generated.  The third
+   element is the step to sample a range.  */
+
+int char_ranges[][3] =
+  { { 0x21, 0x7E, 1 },		/* ASCII */
+    { 0xA1, 0x17F, 1 },		/* Latin */
+    { 0x386, 0x3CE, 1 },	/* Greek */
+    { 0x401, 0x45F, 1 },	/* Cyrillic */
+    { 0x5D0, 0x5EA, 1 },	/* Hebrew */
+    { 0x621, 0x64A, 1 },	/* Arabic */
+    { 0x905, 0x939, 1 },	/* Devanagari */
+    { 0xE01, 0xE2E, 1 },	/* Thai */
+    { 0x3041, 0x30F6, 1 },	/* Kana */
+    { 0x4E00, 0x9FA5, 7 },	/* Han */
+    { 0xAC00, 0xD7A3, 13 },	/* Hangul */
+    { 0xFF61, 0xFF9F, 1 },	/* Halfwidth kana */
+    { 0x1F600, 0x1F64F, 1 } };	/* Emoji */
+
+#define N_CHAR_RANGES (sizeof char_ranges / sizeof char_ranges[0])
+
+/* Return 1 if CONVERTER, bound to BUF of SIZE bytes, can encode C,
+   else 0.  */
+
+int
+encodable (MConverter *converter, unsigned char *buf, int size, int c)
+{
+  MText *mt = mtext ();
+  int n;
+
+  mtext_cat_char (mt, c);
+  mconv_reset_converter (converter);
+  mconv_rebind_buffer (converter, buf, size);
+  n = mconv_encode (converter, mt);
+  m17n_object_unref (mt);
+  return (n > 0 && converter->result == MCONVERSION_RESULT_SUCCESS
+	  && converter->nchars == 1);
+}
+
+/* Generate a text of NCHARS characters encodable by CODING.  A
+   word (2 to 8 characters) is made of non-ASCII characters in
+   RATIO percent, and of ASCII characters in the others.  A non-ASCII
+   word takes adjacent characters of a script.  Lines are broken
+   at about 72 columns.  */
+
+MText *
+generate_text (MSymbol coding, int nchars, int ratio)
+{
+  MConverter *converter;
+  unsigned char buf[64];
+  int *pool, npool = 0, nascii = 0;
+  int space, newline;
+  MText *mt;
+  int i, c, column = 0;
+
+  converter = mconv_buffer_converter (coding, NULL, 0);
+  if (! converter)
+    return NULL;
+  for (i = 0, c = 0; i < N_CHAR_RANGES; i++)
+    c += (char_ranges[i][1] - char_ranges[i][0]) / char_ranges[i][2] + 1;
+  pool = malloc (sizeof (int) * c);
+  for (i = 0; i < N_CHAR_RANGES; i++)
+    for (c = char_ranges[i][0]; c <= char_ranges[i][1];
+	 c += char_ranges[i][2])
+      if (encodable (converter, buf, sizeof buf, c))
+	{
+	  pool[npool++] = c;
+	  if (c < 0x80)
+	    nascii++;
+	}
+  space = encodable (converter, buf, sizeof buf, ' ');
+  newline = encodable (converter, buf, sizeof buf, '\n');
+  mconv_free_converter (converter);
+
+  mt = mtext ();
+  random_seed = 1;
+  if (npool > 0)
+    while (mtext_len (mt) < nchars)
+      {
+	int len = 2 + random_number (7);
+	int from, range;
+
+	if (nascii > 0 && (nascii == npool || random_number (100) >= ratio))
+	  from = 0, range = nascii;
+	else
+	  from = nascii, range = npool - nascii;
+	c = from + random_number (range);
+	for (i = 0; i < len; i++)
+	  {
+	    mtext_cat_char (mt, pool[c]);
+	    if (pool[c] < 0x80)
+	      c = from + random_number (range);
+	    else if (++c == npool)
+	      c = from;
+	  }
+	column += len + 1;
+	if (newline && column >= 72)
+	  mtext_cat_char (mt, '\n'), column = 0;
+	else if (space)
+	  mtext_cat_char (mt, ' ');
+      }
+  free (pool);
+  return mt;
+}
+
+/* Return a text of characters of MT, each of which is encodable by
+   CODING, or is replaced by an encodable sequence.  */
+
+MText *
+adjust_text (MSymbol coding, MText *mt)
+{
+  int size = mtext_len (mt) * 16 + 16;
+  unsigned char *buf = malloc (size);
+  MConverter *converter = mconv_buffer_converter (coding, buf, size);
+  MText *adjusted;
+  int n;
+
+  if (! converter)
+    {
+      free (buf);
+      return NULL;
+    }
+  converter->lenient = 1;
+  converter->last_block = 1;
+  n = mconv_encode (converter, mt);
+  mconv_free_converter (converter);
+  adjusted = mconv_decode_buffer (coding, buf, n);
+  free (buf);
+  return adjusted;
+}
+
+/* Benchmark context of a coding.  */
+
+typedef struct
+{
+  MSymbol coding;
+
+  /* Text to convert.  */
+  MText *mt;
+  int nchars;
+
+  /* MT encoded.  */
+  unsigned char *bytes;
+  int nbytes;
+
+  /* Work area for encoding.  */
+  unsigned char *buf;
+  int bufsize;
+
+  /* Temporary file for stream and file, and its name.  */
+  FILE *fp;
+  char *filename;
+
+  MConverter *converter;
+} BenchContext;
+
+/* Functions to convert the text once.  They return 1 if the text is
+   converted correctly, else 0.  */
+
+typedef int (*BenchFunc) (BenchContext *context);
+
+int
+decode_buffer (BenchContext *context)
+{
+  MText *mt = mtext ();
+  int ok;
+
+  mconv_reset_converter (context->converter);
+  mconv_rebind_buffer (context->converter, context->bytes, context->nbytes);
+  mconv_decode (context->converter, mt);
+  ok = mtext_cmp (mt, context->mt) == 0;
+  m17n_object_unref (mt);
+  return ok;
+}
+
+int
+encode_buffer (BenchContext *context)
+{
+  mconv_reset_converter (context->converter);
+  mconv_rebind_buffer (context->converter, context->buf, context->bufsize);
+  context->converter->last_block = 1;
+  return (mconv_encode (context->converter, context->mt) == context->nbytes
+	  && ! memcmp (context->buf, context->bytes, context->nbytes));
+}
+
+int
+decode_stream (BenchContext *context)
+{
+  MText *mt = mtext ();
+  int ok;
+
+  rewind (context->fp);
+  mconv_reset_converter (context->converter);
+  mconv_rebind_stream (context->converter, context->fp);
+  mconv_decode (context->converter, mt);
+  ok = mtext_cmp (mt, context->mt) == 0;
+  m17n_object_unref (mt);
+  return ok;
+}
+
+int
+encode_stream (BenchContext *context)
+{
+  int n;
+
+  rewind (context->fp);
+  mconv_reset_converter (context->converter);
+  mconv_rebind_stream (context->converter, context->fp);
+  context->converter->last_block = 1;
+  n = mconv_encode (context->converter, context->mt);
+  fflush (context->fp);
+  return n == context->nbytes;
+}
+
+int
+decode_getc (BenchContext *context)
+{
+  int i, c;
+  int ok = 1;
+
+  mconv_reset_converter (context->converter);
+  mconv_rebind_buffer (context->converter, context->bytes, context->nbytes);
+  for (i = 0; (c = mconv_getc (context->converter)) != EOF; i++)
+    if (i >= context->nchars || c != mtext_ref_char (context->mt, i))
+      ok = 0;
+  return ok && i == context->nchars;
+}
+
+int
+encode_putc (BenchContext *context)
+{
+  int i;
+
+  mconv_reset_converter (context->converter);
+  mconv_rebind_buffer (context->converter, context->buf, context->bufsize);
+  for (i = 0; i < context->nchars; i++)
+    if (mconv_putc (context->converter, mtext_ref_char (context->mt, i)) < 0)
+      return 0;
+  return 1;
+}
+
+int
+decode_gets (BenchContext *context)
+{
+  MText *mt = mtext ();
+  int nchars = 0;
+
+  mconv_reset_converter (context->converter);
+  mconv_rebind_buffer (context->converter, context->bytes, context->nbytes);
+  /* Count a newline, which mconv_gets () doesn't return, after each
+     line.  */
+  while (nchars < context->nchars)
+    {
+      mtext_del (mt, 0, mtext_len (mt));
+      if (! mconv_gets (context->converter, mt))
+	break;
+      nchars += mtext_len (mt) + 1;
+    }
+  m17n_object_unref (mt);
+  /* The last line may lack a newline.  */
+  return (nchars == context->nchars || nchars == context->nchars + 1);
+}
+
+/* Position in the text of a benchmark context up to which the blocks
+   given to sink () matched the text.  */
+
+typedef struct
+{
+  BenchContext *context;
+  int pos;
+  int ok;
+} SinkState;
+
+int
+sink (MText *mt, void *arg)
+{
+  SinkState *state = arg;
+  int len = mtext_len (mt);
+
+  if (state->pos + len > state->context->nchars
+      || mtext_compare (mt, 0, len, state->context->mt,
+			state->pos, state->pos + len) != 0)
+    state->ok = 0;
+  state->pos += len;
+  return 0;
+}
+
+int
+decode_sink (BenchContext *context)
+{
+  SinkState state;
+  int n;
+
+  state.context = context;
+  state.pos = 0;
+  state.ok = 1;
+  rewind (context->fp);
+  mconv_reset_converter (context->converter);
+  mconv_rebind_stream (context->converter, context->fp);
+  n = mconv_decode_sink (context->converter, sink, &state);
+  return (state.ok && n == context->nchars && state.pos == context->nchars);
+}
+
+int
+decode_file (BenchContext *context)
+{
+  MConverter *converter = mconv_file_converter (context->coding,
+						context->filename);
+  MText *mt = mtext ();
+  int ok;
+
+  if (! converter)
+    return 0;
+  converter->last_block = 1;
+  mconv_decode (converter, mt);
+  ok = mtext_cmp (mt, context->mt) == 0;
+  mconv_free_converter (converter);
+  m17n_object_unref (mt);
+  return ok;
+}
+
+/* Modes of benchmark.  */
+
+struct
+{
+  char *name;
+  BenchFunc decoder, encoder;
+  int selected;
+} modes[] =
+  { { "buffer", decode_buffer, encode_buffer },
+    { "stream", decode_stream, encode_stream },
+    { "getc", decode_getc, encode_putc },
+    { "gets", decode_gets, NULL },
+    { "sink", decode_sink, NULL },
+    { "file", decode_file, NULL } };
+
+#define N_MODES (sizeof modes / sizeof modes[0])
+
+/* Minimum seconds to repeat a measurement.  */
+double min_seconds;
+
+/* Call FUNC repeatedly for at least MIN_SECONDS, and print the
+   result.  */
+
+void
+measure (BenchContext *context, char *mode, char *direction, BenchFunc func)
+{
+  double start = now (), elapsed;
+  int rounds = 0, ok = 1;
+
+  do
+    {
+      if (! (*func) (context))
+	ok = 0;
+      rounds++;
+      elapsed = now () - start;
+    }
+  while (elapsed < min_seconds);
+  elapsed /= rounds;
+  printf ("%s\t%s\t%s\t%d\t%d\t%.6g\t%.2f\t%.2f\t%d\n",
+	  msymbol_name (context->coding), mode, direction,
+	  context->nbytes, context->nchars, elapsed,
+	  context->nbytes / elapsed / 1000000,
+	  context->nchars / elapsed / 1000000, ok);
+  fflush (stdout);
+}
+
+/* Create a temporary file, set *FP to the file opened for reading
+   and writing, and return its name.  The caller should unlink the
+   file and free the name.  If the file can't be created, return
+   NULL.  */
+
+char *
+make_temp_file (FILE **fp)
+{
+  char *dir = getenv ("TMPDIR");
+  char *name;
+  int fd;
+
+  if (! dir)
+    dir = "/tmp";
+  name = malloc (strlen (dir) + sizeof "/m17n-conv-bench.XXXXXX");
+  sprintf (name, "%s/m17n-conv-bench.XXXXXX", dir);
+  fd = mkstemp (name);
+  if (fd >= 0 && (*fp = fdopen (fd, "w+")))
+    return name;
+  if (fd >= 0)
+    {
+      close (fd);
+      unlink (name);
+    }
+  free (name);
+  return NULL;
+}
+
+/* Measure all the selected modes for CODING.  MT is the text to
+   convert, or NULL to generate one.  */
+
+void
+bench_coding (MSymbol coding, MText *mt, int nchars, int ratio)
+{
+  BenchContext context;
+  int i;
+
+  memset (&context, 0, sizeof context);
+  context.coding = coding;
+  context.mt = mt ? adjust_text (coding, mt) : generate_text (coding, nchars,
+							     ratio);
+  if (! context.mt)
+    {
+      printf ("# %s: not available\n", msymbol_name (coding));
+      return;
+    }
+  context.nchars = mtext_len (context.mt);
+  context.bufsize = context.nchars * 16 + 16;
+  context.buf = malloc (context.bufsize);
+  context.bytes = malloc (context.bufsize);
+  context.converter = mconv_buffer_converter (coding, context.bytes,
+					      context.bufsize);
+  context.converter->last_block = 1;
+  context.nbytes = mconv_encode (context.converter, context.mt);
+  context.filename = make_temp_file (&context.fp);
+  if (context.nbytes < 0 || ! context.filename)
+    printf ("# %s: can't encode the text\n", msymbol_name (coding));
+  else
+    {
+      fwrite (context.bytes, 1, context.nbytes, context.fp);
+      fflush (context.fp);
+      for (i = 0; i < N_MODES; i++)
+	if (modes[i].selected)
+	  {
+	    if (modes[i].decoder)
+	      measure (&context, modes[i].name, "decode", modes[i].decoder);
+	    if (modes[i].encoder)
+	      measure (&context, modes[i].name, "encode", modes[i].encoder);
+	  }
+    }
+  if (context.filename)
+    {
+      fclose (context.fp);
+      unlink (context.filename);
+      free (context.filename);
+    }
+  mconv_free_converter (context.converter);
+  free (context.buf);
+  free (context.bytes);
+  m17n_object_unref (context.mt);
+}
+
+/* Self-check of the UTF-16 and UTF-32 codecs.  */
+
+/* Flag of an expected character that is decoded as a byte of the
+   charset binary.  */
+#define BINARY_CHAR 0x40000000
+#define BIN(c) ((c) | BINARY_CHAR)
+
+#define SUCCESS MCONVERSION_RESULT_SUCCESS
+#define INVALID_BYTE MCONVERSION_RESULT_INVALID_BYTE
+#define INVALID_CHAR MCONVERSION_RESULT_INVALID_CHAR
+
+/* Bytes and characters terminated by -1.  */
+#define BYTES(...) ((int []) { __VA_ARGS__, -1 })
+#define CHARS(...) ((int []) { __VA_ARGS__, -1 })
+#define NONE ((int []) { -1 })
+
+/* The ASCII letters "abcdefghij" encoded in UTF-16LE, long enough
+   for the block fast paths.  */
+#define ABCDEFGHIJ_16LE \
+  'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e', 0, 'f', 0, 'g', 0, 'h', 0, \
+  'i', 0, 'j', 0
+#define ABCDEFGHIJ 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j'
+
+struct
+{
+  char *coding;
+  char *name;
+  int lenient;
+  int *bytes;
+  /* Characters decoded before the conversion stops, and the result
+     of the conversion.  */
+  int *chars;
+  enum MConversionResult result;
+} decode_checks[] =
+  { { "utf-16", "BOM big endian", 0,
+      BYTES (0xFE, 0xFF, 0x00, 'A', 0x30, 0x42),
+      CHARS ('A', 0x3042), SUCCESS },
+    { "utf-16", "BOM little endian", 0,
+      BYTES (0xFF, 0xFE, 'A', 0x00, 0x42, 0x30),
+      CHARS ('A', 0x3042), SUCCESS },
+    { "utf-16", "no BOM", 0,
+      BYTES (0x00, 'A', 0x30, 0x42),
+      CHARS ('A', 0x3042), SUCCESS },
+    { "utf-16", "BOM only", 0,
+      BYTES (0xFF, 0xFE),
+      NONE, SUCCESS },
+    { "utf-16", "odd byte of BOM", 0,
+      BYTES (0xFE),
+      NONE, INVALID_BYTE },
+    { "utf-16", "odd byte of BOM", 1,
+      BYTES (0xFE),
+      CHARS (BIN (0xFE)), SUCCESS },
+    { "utf-16be", "BOM kept", 0,
+      BYTES (0xFE, 0xFF, 0x00, 'A'),
+      CHARS (0xFEFF, 'A'), SUCCESS },
+    { "utf-16le", "BOM kept", 0,
+      BYTES (0xFF, 0xFE, 'A', 0x00),
+      CHARS (0xFEFF, 'A'), SUCCESS },
+    { "utf-16le", "BOM in the opposite order", 0,
+      BYTES (0xFE, 0xFF, 'A', 0x00),
+      CHARS (0xFFFE, 'A'), SUCCESS },
+    { "utf-16be", "surrogate pair", 0,
+      BYTES (0xD8, 0x3D, 0xDE, 0x00, 0x00, 'A'),
+      CHARS (0x1F600, 'A'), SUCCESS },
+    { "utf-16le", "surrogate pair", 0,
+      BYTES (0x3D, 0xD8, 0x00, 0xDE, 'A', 0x00),
+      CHARS (0x1F600, 'A'), SUCCESS },
+    { "utf-16be", "unpaired low surrogate", 0,
+      BYTES (0x00, 'A', 0xDC, 0x00, 0x00, 'B'),
+      CHARS ('A'), INVALID_BYTE },
+    { "utf-16be", "unpaired low surrogate", 1,
+      BYTES (0x00, 'A', 0xDC, 0x00, 0x00, 'B'),
+      CHARS ('A', BIN (0xDC00), 'B'), SUCCESS },
+    { "utf-16be", "unpaired high surrogate", 0,
+      BYTES (0xD8, 0x00, 0x00, 'A'),
+      NONE, INVALID_BYTE },
+    { "utf-16be", "unpaired high surrogate", 1,
+      BYTES (0xD8, 0x00, 0x00, 'A'),
+      CHARS (BIN (0xD800), 'A'), SUCCESS },
+    { "utf-16be", "high surrogate at the end", 0,
+      BYTES (0x00, 'A', 0xD8, 0x00),
+      CHARS ('A'), INVALID_BYTE },
+    { "utf-16be", "high surrogate at the end", 1,
+      BYTES (0x00, 'A', 0xD8, 0x00),
+      CHARS ('A', BIN (0xD8), BIN (0x00)), SUCCESS },
+    { "utf-16le", "unpaired surrogate after a run", 0,
+      BYTES (ABCDEFGHIJ_16LE, 0x00, 0xDC, 'k', 0x00),
+      CHARS (ABCDEFGHIJ), INVALID_BYTE },
+    { "utf-16le", "unpaired surrogate after a run", 1,
+      BYTES (ABCDEFGHIJ_16LE, 0x00, 0xDC, 'k', 0x00),
+      CHARS (ABCDEFGHIJ, BIN (0xDC00), 'k'), SUCCESS },
+    { "utf-16le", "odd trailing byte", 0,
+      BYTES (ABCDEFGHIJ_16LE, 'k'),
+      CHARS (ABCDEFGHIJ), INVALID_BYTE },
+    { "utf-16le", "odd trailing byte", 1,
+      BYTES (ABCDEFGHIJ_16LE, 'k'),
+      CHARS (ABCDEFGHIJ, BIN ('k')), SUCCESS },
+    { "utf-32", "BOM big endian", 0,
+      BYTES (0x00, 0x00, 0xFE, 0xFF, 0x00, 0x01, 0xF6, 0x00),
+      CHARS (0x1F600), SUCCESS },
+    { "utf-32", "BOM little endian", 0,
+      BYTES (0xFF, 0xFE, 0x00, 0x00, 0x00, 0xF6, 0x01, 0x00),
+      CHARS (0x1F600), SUCCESS },
+    { "utf-32", "no BOM", 0,
+      BYTES (0x00, 0x00, 0x00, 'A', 0x00, 0x01, 0xF6, 0x00),
+      CHARS ('A', 0x1F600), SUCCESS },
+    { "utf-32le", "BOM kept", 0,
+      BYTES (0xFF, 0xFE, 0x00, 0x00, 'A', 0x00, 0x00, 0x00),
+      CHARS (0xFEFF, 'A'), SUCCESS },
+    { "utf-32be", "surrogate", 0,
+      BYTES (0x00, 0x00, 0x00, 'A', 0x00, 0x00, 0xD8, 0x00),
+      CHARS ('A'), INVALID_BYTE },
+    { "utf-32be", "out of range", 0,
+      BYTES (0x00, 0x11, 0x00, 0x00),
+      NONE, INVALID_BYTE },
+    { "utf-32le", "out of range", 1,
+      BYTES ('A', 0x00, 0x00, 0x00, 0x00, 0x00, 0x11, 0x00),
+      CHARS ('A', BIN (0x00), BIN (0x00), BIN (0x11), BIN (0x00)),
+      SUCCESS },
+    { "utf-32be", "odd trailing bytes", 0,
+      BYTES (0x00, 0x00, 0x00, 'A', 0x00, 0x00),
+      CHARS ('A'), INVALID_BYTE },
+    { "utf-32be", "odd trailing bytes", 1,
+      BYTES (0x00, 0x00, 0x00, 'A', 0x00, 0x00),
+      CHARS ('A', BIN (0x00), BIN (0x00)), SUCCESS } };
+
+#define N_DECODE_CHECKS (sizeof decode_checks / sizeof decode_checks[0])
+
+struct
+{
+  char *coding;
+  char *name;
+  int *chars;
+  /* Bytes encoded before the conversion stops, and the result of the
+     conversion.  */
+  int *bytes;
+  enum MConversionResult result;
+} encode_checks[] =
+  { { "utf-16be", "surrogate pair",
+      CHARS ('A', 0x3042, 0x1F600),
+      BYTES (0x00, 'A', 0x30, 0x42, 0xD8, 0x3D, 0xDE, 0x00), SUCCESS },
+    { "utf-16le", "surrogate pair after a run",
+      CHARS (ABCDEFGHIJ, 0x1F600),
+      BYTES (ABCDEFGHIJ_16LE, 0x3D, 0xD8, 0x00, 0xDE), SUCCESS },
+    { "utf-16le", "surrogate",
+      CHARS (ABCDEFGHIJ, 0xDC00, 'k'),
+      BYTES (ABCDEFGHIJ_16LE), INVALID_CHAR },
+    { "utf-16be", "out of range",
+      CHARS ('A', 0x110000),
+      BYTES (0x00, 'A'), INVALID_CHAR },
+    { "utf-32be", "supplementary",
+      CHARS ('A', 0x1F600),
+      BYTES (0x00, 0x00, 0x00, 'A', 0x00, 0x01, 0xF6, 0x00), SUCCESS },
+    { "utf-32le", "supplementary",
+      CHARS ('A', 0x1F600),
+      BYTES ('A', 0x00, 0x00, 0x00, 0x00, 0xF6, 0x01, 0x00), SUCCESS },
+    { "utf-32le", "surrogate",
+      CHARS ('A', 0xD800),
+      BYTES ('A', 0x00, 0x00, 0x00), INVALID_CHAR } };
+
+#define N_ENCODE_CHECKS (sizeof encode_checks / sizeof encode_checks[0])
+
+/* Decode the Ith of decode_checks in blocks of BLOCK bytes (0 means
+   at once).  Return 1 if the result is as expected, else 0.  */
+
+int
+check_decode (int i, int block)
+{
+  int *bytes = decode_checks[i].bytes, *chars = decode_checks[i].chars;
+  unsigned char buf[64];
+  int nbytes, from, to, n;
+  MConverter *converter;
+  MText *mt = mtext ();
+  int ok = 1;
+
+  for (nbytes = 0; bytes[nbytes] >= 0; nbytes++)
+    buf[nbytes] = bytes[nbytes];
+  converter = mconv_buffer_converter (msymbol (decode_checks[i].coding),
+				      NULL, 0);
+  converter->lenient = decode_checks[i].lenient;
+  for (from = 0; from < nbytes || from == 0; from = to)
+    {
+      to = block > 0 && from + block < nbytes ? from + block : nbytes;
+      converter->last_block = to == nbytes;
+      mconv_rebind_buffer (converter, buf + from, to - from);
+      mconv_decode (converter, mt);
+      if (converter->result != SUCCESS
+	  && converter->result != MCONVERSION_RESULT_INSUFFICIENT_SRC)
+	break;
+    }
+  if (converter->result != decode_checks[i].result)
+    ok = 0;
+  for (n = 0; chars[n] >= 0; n++)
+    if (n >= mtext_len (mt)
+	|| mtext_ref_char (mt, n) != (chars[n] & ~BINARY_CHAR)
+	|| ((mtext_get_prop (mt, n, Mcharset) == Mcharset_binary)
+	    != ((chars[n] & BINARY_CHAR) != 0)))
+      ok = 0;
+  if (n != mtext_len (mt))
+    ok = 0;
+  mconv_free_converter (converter);
+  m17n_object_unref (mt);
+  return ok;
+}
+
+/* Encode the Ith of encode_checks.  Return 1 if the result is as
+   expected, else 0.  */
+
+int
+check_encode (int i)
+{
+  int *bytes = encode_checks[i].bytes, *chars = encode_checks[i].chars;
+  unsigned char buf[64];
+  MConverter *converter;
+  MText *mt = mtext ();
+  int n, ok = 1;
+
+  for (n = 0; chars[n] >= 0; n++)
+    mtext_cat_char (mt, chars[n]);
+  converter = mconv_buffer_converter (msymbol (encode_checks[i].coding),
+				      buf, sizeof buf);
+  converter->last_block = 1;
+  mconv_encode (converter, mt);
+  if (converter->result != encode_checks[i].result)
+    ok = 0;
+  for (n = 0; bytes[n] >= 0; n++)
+    if (n >= converter->nbytes || buf[n] != bytes[n])
+      ok = 0;
+  if (n != converter->nbytes)
+    ok = 0;
+  mconv_free_converter (converter);
+  m17n_object_unref (mt);
+  return ok;
+}
+
+/* Number of characters of the text decoded by check_long_run ().
+   The text is longer than the runs that the UTF-16 and UTF-32
+   decoders decode at once, and has a supplementary character at the
+   boundary of the first run.  */
+#define LONG_RUN_CHARS 0x20001
+#define LONG_RUN_SUPPLEMENTARY 0xFFFF
+
+/* Decode a long text by CODING (utf-16le or utf-32le) at once.
+   Return 1 if the result is as expected, else 0.  */
+
+int
+check_long_run (char *coding)
+{
+  int unit_bytes = strcmp (coding, "utf-16le") == 0 ? 2 : 4;
+  unsigned char *buf = malloc ((LONG_RUN_CHARS + 1) * 4), *p = buf;
+  MText *mt;
+  int i, c, ok = 1;
+
+  for (i = 0; i < LONG_RUN_CHARS; i++)
+    {
+      c = i == LONG_RUN_SUPPLEMENTARY ? 0x1F600 : 'a' + i % 26;
+      if (unit_bytes == 2 && c >= 0x10000)
+	{
+	  int high = 0xD800 + ((c - 0x10000) >> 10);
+	  int low = 0xDC00 + ((c - 0x10000) & 0x3FF);
+
+	  *p++ = high & 0xFF, *p++ = high >> 8;
+	  *p++ = low & 0xFF, *p++ = low >> 8;
+	}
+      else if (unit_bytes == 2)
+	*p++ = c & 0xFF, *p++ = c >> 8;
+      else
+	*p++ = c & 0xFF, *p++ = (c >> 8) & 0xFF, *p++ = c >> 16, *p++ = 0;
+    }
+  mt = mconv_decode_buffer (msymbol (coding), buf, p - buf);
+  if (! mt || mtext_len (mt) != LONG_RUN_CHARS)
+    ok = 0;
+  for (i = 0; ok && i < LONG_RUN_CHARS; i++)
+    if (mtext_ref_char (mt, i)
+	!= (i == LONG_RUN_SUPPLEMENTARY ? 0x1F600 : 'a' + i % 26))
+      ok = 0;
+  if (mt)
+    m17n_object_unref (mt);
+  free (buf);
+  return ok;
+}
+
+/* Texts decoded from a file bound to a code converter by
+   mconv_file_converter ().  Each is NX ASCII letters followed by
+   CHARS, the first of which is encoded across the boundary of the
+   first 64K bytes, by which a mapped file is decoded.  */
+
+struct
+{
+  char *coding, *name;
+  int nx;
+  int *chars;
+} file_checks[] =
+  { { "utf-8", "character across a block of a file", 65535,
+      CHARS (0x3042, 0x3044, 0x3046) },
+    { "utf-16le", "surrogate pair across a block of a file", 32767,
+      CHARS (0x1F600, 'y') } };
+
+#define N_FILE_CHECKS (sizeof file_checks / sizeof file_checks[0])
+
+/* Decode the Ith of file_checks by mconv_decode () and by
+   mconv_decode_sink ().  Return 1 if the results are as expected,
+   else 0.  */
+
+int
+check_file (int i)
+{
+  BenchContext context;
+  SinkState state;
+  MConverter *converter;
+  MText *mt = mtext ();
+  unsigned char *buf;
+  int n, nbytes, ok = 0;
+
+  memset (&context, 0, sizeof context);
+  context.coding = msymbol (file_checks[i].coding);
+  context.mt = mtext ();
+  for (n = 0; n < file_checks[i].nx; n++)
+    mtext_cat_char (context.mt, 'x');
+  for (n = 0; file_checks[i].chars[n] >= 0; n++)
+    mtext_cat_char (context.mt, file_checks[i].chars[n]);
+  context.nchars = mtext_len (context.mt);
+  buf = malloc (context.nchars * 4);
+  nbytes = mconv_encode_buffer (context.coding, context.mt, buf,
+				context.nchars * 4);
+  context.filename = make_temp_file (&context.fp);
+  if (nbytes > 0 && context.filename
+      && fwrite (buf, 1, nbytes, context.fp) == nbytes
+      && fflush (context.fp) == 0)
+    {
+      converter = mconv_file_converter (context.coding, context.filename);
+      if (converter)
+	{
+	  converter->last_block = 1;
+	  mconv_decode (converter, mt);
+	  ok = mtext_cmp (mt, context.mt) == 0;
+	  mconv_free_converter (converter);
+	}
+      state.context = &context;
+      state.pos = 0;
+      state.ok = 1;
+      converter = mconv_file_converter (context.coding, context.filename);
+      if (converter)
+	{
+	  converter->last_block = 1;
+	  n = mconv_decode_sink (converter, sink, &state);
+	  if (! state.ok || n != context.nchars || state.pos != n)
+	    ok = 0;
+	  mconv_free_converter (converter);
+	}
+      else
+	ok = 0;
+    }
+  if (context.filename)
+    {
+      fclose (context.fp);
+      unlink (context.filename);
+      free (context.filename);
+    }
+  free (buf);
+  m17n_object_unref (mt);
+  m17n_object_unref (context.mt);
+  return ok;
+}
+
+/* Texts whose coding system is detected by mconv_detect_coding ().
+   Each is NX ASCII letters followed by TAIL.  */
+
+struct
+{
+  char *coding, *name;
+  int nx;
+  char *tail;
+} detect_checks[] =
+  { { "utf-8", "multi-byte sequences", 16,
+      "\xE3\x81\x82\xE3\x81\x84\xE3\x81\x86" },
+    /* Only the first byte of the tail is examined.  */
+    { "utf-8", "multi-byte sequence cut off by the limit", 65535,
+      "\xE3\x81\x82\xE3\x81\x84\xE3\x81\x86" } };
+
+#define N_DETECT_CHECKS (sizeof detect_checks / sizeof detect_checks[0])
+
+/* Detect the coding system of the Ith of detect_checks.  Return 1 if
+   the result is as expected, else 0.  */
+
+int
+check_detect (int i)
+{
+  int nx = detect_checks[i].nx, len = strlen (detect_checks[i].tail);
+  unsigned char *buf = malloc (nx + len);
+  MSymbol coding;
+
+  memset (buf, 'x', nx);
+  memcpy (buf + nx, detect_checks[i].tail, len);
+  coding = mconv_detect_coding (buf, nx + len);
+  free (buf);
+  return coding == msymbol (detect_checks[i].coding);
+}
+
+/* Run all the checks, and return the number of failed ones.  */
+
+int
+check_codings ()
+{
+  int blocks[] = { 0, 1, 3 };
+  int i, j, ok, nfailed = 0;
+
+  printf ("#coding\tdirection\tcase\tok\n");
+  for (i = 0; i < N_DECODE_CHECKS; i++)
+    {
+      for (j = 0, ok = 1; j < sizeof blocks / sizeof blocks[0]; j++)
+	if (! check_decode (i, blocks[j]))
+	  ok = 0;
+      printf ("%s\tdecode\t%s%s\t%d\n", decode_checks[i].coding,
+	      decode_checks[i].name,
+	      decode_checks[i].lenient ? " (lenient)" : "", ok);
+      if (! ok)
+	nfailed++;
+    }
+  for (i = 0; i < 2; i++)
+    {
+      char *coding = i == 0 ? "utf-16le" : "utf-32le";
+
+      ok = check_long_run (coding);
+      printf ("%s\tdecode\tlong run\t%d\n", coding, ok);
+      if (! ok)
+	nfailed++;
+    }
+  for (i = 0; i < N_ENCODE_CHECKS; i++)
+    {
+      ok = check_encode (i);
+      printf ("%s\tencode\t%s\t%d\n", encode_checks[i].coding,
+	      encode_checks[i].name, ok);
+      if (! ok)
+	nfailed++;
+    }
+  for (i = 0; i < N_FILE_CHECKS; i++)
+    {
+      ok = check_file (i);
+      printf ("%s\tdecode\t%s\t%d\n", file_checks[i].coding,
+	      file_checks[i].name, ok);
+      if (! ok)
+	nfailed++;
+    }
+  for (i = 0; i < N_DETECT_CHECKS; i++)
+    {
+      ok = check_detect (i);
+      printf ("%s\tdetect\t%s\t%d\n", detect_checks[i].coding,
+	      detect_checks[i].name, ok);
+      if (! ok)
+	nfailed++;
+    }
+  return nfailed;
+}
+
+int
+compare_coding_name (const void *elt1, const void *elt2)
+{
+  const MSymbol *n1 = elt1;
+  const MSymbol *n2 = elt2;
+
+  return strcmp (msymbol_name (*n1), msymbol_name (*n2));
+}
+
+/* Print the usage of this program (the name is PROG), and exit with
+   EXIT_CODE.  */
+
+void
+help_exit (char *prog, int exit_code)
+{
+  char *p = prog;
+
+  while (*p)
+    if (*p++ == '/')
+      prog = p;
+
+  printf ("Usage: %s [ OPTION ... ] [ CODING ... ]\n", prog);
+  printf ("Measure the throughput of decoding and encoding by each CODING.\n");
+  printf ("  If CODING is omitted, all the available encodings are measured.\n");
+  printf ("The following OPTIONs are available.\n");
+  printf ("  %-13s %s", "-f FILE",
+	  "Take the text from FILE (in UTF-8).\n");
+  printf ("  %-13s %s", "-n CHARS",
+	  "Generate a text of CHARS characters (defaults to 262144).\n");
+  printf ("  %-13s %s", "-r RATIO",
+	  "Percentage of non-ASCII words (defaults to 50).\n");
+  printf ("  %-13s %s", "-m MODES",
+	  "Modes to measure, out of buffer, stream, getc, gets, sink,\n"
+	  "                and file (defaults to all).\n");
+  printf ("  %-13s %s", "-t SECONDS",
+	  "Repeat each measurement for SECONDS (defaults to 0.2).\n");
+  printf ("  %-13s %s", "-c",
+	  "Check the UTF codecs and detection instead of measuring.\n");
+  printf ("  %-13s %s", "-h, --help", "Print this message.\n");
+  exit (exit_code);
+}
+
+int
+main (int argc, char **argv)
+{
+  MSymbol *codings;
+  int ncodings = 0;
+  MText *mt = NULL;
+  int nchars = 262144, ratio = 50;
+  int check = 0;
+  int i, j;
+
+  M17N_INIT ();
+  if (merror_code != MERROR_NONE)
+    {
+      fprintf (stderr, "Fail to initialize the m17n library.\n");
+      exit (1);
+    }
+
+  min_seconds = 0.2;
+  codings = malloc (sizeof (MSymbol) * argc);
+  for (i = 1; i < argc; i++)
+    {
+      if (! strcmp (argv[i], "--help")
+	  || ! strcmp (argv[i], "-h")
+	  || ! strcmp (argv[i], "-?"))
+	help_exit (argv[0], 0);
+      else if (! strcmp (argv[i], "-f") && i + 1 < argc)
+	{
+	  FILE *fp = fopen (argv[++i], "r");
+
+	  if (! fp)
+	    {
+	      fprintf (stderr, "Can't read the file %s\n", argv[i]);
+	      exit (1);
+	    }
+	  mt = mconv_decode_stream (Mcoding_utf_8, fp);
+	  fclose (fp);
+	}
+      else if (! strcmp (argv[i], "-n") && i + 1 < argc)
+	nchars = atoi (argv[++i]);
+      else if (! strcmp (argv[i], "-r") && i + 1 < argc)
+	ratio = atoi (argv[++i]);
+      else if (! strcmp (argv[i], "-t") && i + 1 < argc)
+	min_seconds = atof (argv[++i]);
+      else if (! strcmp (argv[i], "-c"))
+	check = 1;
+      else if (! strcmp (argv[i], "-m") && i + 1 < argc)
+	{
+	  char *p = argv[++i];
+
+	  for (p = strtok (p, ","); p; p = strtok (NULL, ","))
+	    {
+	      for (j = 0; j < N_MODES; j++)
+		if (! strcmp (p, modes[j].name))
+		  break;
+	      if (j == N_MODES)
+		help_exit (argv[0], 1);
+	      modes[j].selected = 1;
+	    }
+	}
+      else if (argv[i][0] != '-')
+	{
+	  codings[ncodings] = mconv_resolve_coding (msymbol (argv[i]));
+	  if (codings[ncodings] == Mnil)
+	    {
+	      fprintf (stderr, "Unknown encoding: \"%s\"\n", argv[i]);
+	      exit (1);
+	    }
+	  ncodings++;
+	}
+      else
+	help_exit (argv[0], 1);
+    }
+  if (check)
+    {
+      i = check_codings ();
+      free (codings);
+      if (mt)
+	m17n_object_unref (mt);
+      M17N_FINI ();
+      exit (i > 0);
+    }
+
+  for (i = 0; i < N_MODES; i++)
+    if (modes[i].selected)
+      break;
+  if (i == N_MODES)
+    for (i = 0; i < N_MODES; i++)
+      modes[i].selected = 1;
+
+  if (ncodings == 0)
+    {
+      /* All the coding systems except for aliases.  */
+      free (codings);
+      ncodings = mconv_list_codings (&codings);
+      for (i = j = 0; i < ncodings; i++)
+	if (mconv_resolve_coding (codings[i]) == codings[i])
+	  codings[j++] = codings[i];
+      ncodings = j;
+      qsort (codings, ncodings, sizeof (MSymbol), compare_coding_name);
+    }
+
+  printf ("#coding\tmode\tdirection\tbytes\tchars\tseconds\tMB/s\tMchars/s\tok\n");
+  for (i = 0; i < ncodings; i++)
+    bench_coding (codings[i], mt, nchars, ratio);
+
+  free (codings);
+  if (mt)
+    m17n_object_unref (mt);
+  M17N_FINI ();
+  exit (0);
+}
+#endif /* not FOR_DOXYGEN */
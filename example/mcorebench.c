@@ -0,0 +1,581 @@
+/* mcorebench.c -- Benchmark of the core modules.	-*- coding: utf-8; -*-
+   Copyright (C) 2026
+     National Institute of Advanced Industrial Science and Technology (AIST)
+     Registration Number H15PRO112
+
+   This file is part of the m17n library.
+
+   The m17n library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   The m17n library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the m17n library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA.  */
+
+/***en
+    @enpage m17n-core-bench benchmark the core modules
+
+    @section m17n-core-bench-synopsis SYNOPSIS
+
+    m17n-core-bench [ OPTION ... ] [ TEST ... ]
+
+    @section m17n-core-bench-description DESCRIPTION
+
+    Measure the time of basic operations of the core modules.  TEST
+    is one of the following.  If TEST is omitted, all of them are
+    measured.
+
+    <ul>
+
+    <li> chartab
+
+    Look up a char-table of about 3000 random ranges by
+    mchartable_lookup () (lookup) and through a frozen copy of the
+    table (frozen).  60% of the looked up characters are ASCII, 30%
+    are in BMP, and 10% are in the supplementary planes.  The frozen
+    copy is checked against mchartable_lookup () for all the
+    characters.
+
+    <li> symbol
+
+    Intern N new symbols named "input-method-N-I" by msymbol ()
+    (intern-N), and look them up by msymbol () (msymbol-N) and by
+    msymbol_exist () (exist-N), for N of 1000, 50000, and 500000.  The
+    looked up symbols are checked against the interned ones.
+
+    <li> mtext
+
+    Insert 8 characters into and delete 8 characters from an M-text of
+    5000000 characters alternately by mtext_ins () and mtext_del ().
+    The positions are random (random-5000000) or within 100 characters
+    from the previous one (local-5000000).  The same edits on an M-text
+    of 60000 characters are checked against an array of characters.
+
+    </ul>
+
+    The result is printed in lines of tab separated fields: TEST, the
+    case measured, the number of operations in one round, seconds per
+    round, nanoseconds per operation, and 1 if the check of the case
+    succeeded (else 0).  A line starting with '#' is a comment.
+
+    The following OPTIONs are available.
+
+    <ul>
+
+    <li> -t SECONDS
+
+    Repeat each measurement for at least SECONDS (defaults to 0.2).
+
+    <li> -h, --help
+
+    Print this message.
+
+    </ul>
+*/
+/***ja
+    @japage m17n-core-bench コアモジュールのベンチマーク
+
+    @section m17n-core-bench-synopsis SYNOPSIS
+
+    m17n-core-bench [ OPTION ... ] [ TEST ... ]
+
+    @section m17n-core-bench-description 説明
+
+    コアモジュールの基本操作の時間を測る。TEST は以下のいずれかである。
+    TEST が省略された場合は、すべてを測る。
+
+    <ul>
+
+    <li> chartab
+
+    約 3000 個のランダムな範囲を持つ文字テーブルを mchartable_lookup
+    () で (lookup)、およびテーブルの凍結されたコピーを通して (frozen)
+    引く。引く文字の 60% は ASCII、30% は BMP、10% は補助面の文字であ
+    る。凍結されたコピーはすべての文字について mchartable_lookup () と
+    照合される。
+
+    <li> symbol
+
+    "input-method-N-I" という名前の N 個の新しいシンボルを msymbol ()
+    でインターンし (intern-N)、それらを msymbol () (msymbol-N) と
+    msymbol_exist () (exist-N) で引く。N は 1000、50000、500000 である。
+    引いたシンボルはインターンしたものと照合される。
+
+    <li> mtext
+
+    5000000 文字の M-text に mtext_ins () で 8 文字を挿入し、
+    mtext_del () で 8 文字を削除することを交互に行う。位置はランダム
+    (random-5000000) か、直前の位置から 100 文字以内 (local-5000000) で
+    ある。60000 文字の M-text に対する同じ編集は文字の配列と照合される。
+
+    </ul>
+
+    結果はタブで区切られたフィールドの行として表示される。フィールドは
+    TEST、測定したケース、1 回の操作数、1 回あたりの秒数、1 操作あたり
+    のナノ秒数、ケースの検査が成功したなら 1 (そうでなければ 0) である。
+    '#' で始まる行は注釈である。
+
+    以下のオプションが利用できる。
+
+    <ul>
+
+    <li> -t SECONDS
+
+    各測定を少なくとも SECONDS 秒繰り返す。(デフォルトは 0.2)
+
+    <li> -h, --help
+
+    このメッセージを表示する。
+
+    </ul>
+*/
+
+#ifndef FOR_DOXYGEN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <m17n-core.h>
+#include <m17n-misc.h>
+#include "internal.h"
+#include "chartab.h"
+
+/* Return the current time in seconds.  */
+
+double
+now ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Linear congruential generator, so that the same data are generated
+   on any system.  */
+
+unsigned long random_seed;
+
+int
+random_number (int n)
+{
+  random_seed = (random_seed * 1103515245 + 12345) & 0x7FFFFFFF;
+  return (random_seed >> 8) % n;
+}
+
+/* Minimum seconds to repeat a measurement.  */
+double min_seconds;
+
+/* Sum of the values of operations, to keep the compiler from
+   optimizing them away.  */
+unsigned long sink;
+
+/* Print the result of the case NAME of TEST, which took ELAPSED
+   seconds for NOPS operations.  OK is the result of checking the
+   case.  */
+
+void
+report (char *test, char *name, int nops, double elapsed, int ok)
+{
+  printf ("%s\t%s\t%d\t%.6g\t%.2f\t%d\n",
+	  test, name, nops, elapsed, elapsed * 1000000000 / nops, ok);
+  fflush (stdout);
+}
+
+/* Call FUNC with ARG repeatedly for at least MIN_SECONDS, and report
+   the result.  FUNC performs NOPS operations.  */
+
+void
+measure (char *test, char *name, void (*func) (void *), void *arg,
+	 int nops, int ok)
+{
+  double start = now (), elapsed;
+  int rounds = 0;
+
+  do
+    {
+      (*func) (arg);
+      rounds++;
+      elapsed = now () - start;
+    }
+  while (elapsed < min_seconds);
+  report (test, name, nops, elapsed / rounds, ok);
+}
+
+
+/* Test "chartab".  */
+
+#define CHARTAB_NRANGES 3000
+#define CHARTAB_NCHARS 65536
+
+struct ChartabBench
+{
+  MCharTable *table;
+  MFrozenCharTable *frozen;
+  int *chars;
+};
+
+void
+chartab_lookup (void *arg)
+{
+  struct ChartabBench *bench = arg;
+  int i;
+
+  for (i = 0; i < CHARTAB_NCHARS; i++)
+    sink += (unsigned long) mchartable_lookup (bench->table,
+					       bench->chars[i]);
+}
+
+void
+chartab_frozen (void *arg)
+{
+  struct ChartabBench *bench = arg;
+  int i;
+
+  for (i = 0; i < CHARTAB_NCHARS; i++)
+    sink += (unsigned long) MFROZEN_CHARTABLE_LOOKUP (bench->frozen,
+						      bench->chars[i]);
+}
+
+void
+bench_chartab ()
+{
+  struct ChartabBench bench;
+  int i, ok;
+
+  random_seed = 1;
+  bench.table = mchartable (Minteger, (void *) 0);
+  for (i = 0; i < CHARTAB_NRANGES; i++)
+    {
+      int from = (i % 10 < 6 ? random_number (0x80)
+		  : i % 10 < 9 ? random_number (0x10000)
+		  : 0x10000 + random_number (0x100000));
+      int to = from + random_number (i % 10 < 6 ? 8 : 256);
+
+      mchartable_set_range (bench.table, from, to,
+			    (void *) (long) (1 + random_number (1000)));
+    }
+  bench.chars = malloc (sizeof (int) * CHARTAB_NCHARS);
+  for (i = 0; i < CHARTAB_NCHARS; i++)
+    bench.chars[i] = (i % 10 < 6 ? random_number (0x80)
+		      : i % 10 < 9 ? random_number (0x10000)
+		      : 0x10000 + random_number (0x100000));
+  bench.frozen = mchartable__freeze (bench.table);
+
+  for (i = 0, ok = 1; i <= MCHAR_MAX; i++)
+    if (MFROZEN_CHARTABLE_LOOKUP (bench.frozen, i)
+	!= mchartable_lookup (bench.table, i))
+      ok = 0;
+
+  measure ("chartab", "lookup", chartab_lookup, &bench, CHARTAB_NCHARS, 1);
+  measure ("chartab", "frozen", chartab_frozen, &bench, CHARTAB_NCHARS, ok);
+
+  m17n_object_unref (bench.frozen);
+  m17n_object_unref (bench.table);
+  free (bench.chars);
+}
+
+
+/* Test "symbol".  */
+
+struct SymbolBench
+{
+  int n;
+  char **names;
+  MSymbol *symbols;
+};
+
+void
+symbol_msymbol (void *arg)
+{
+  struct SymbolBench *bench = arg;
+  int i;
+
+  for (i = 0; i < bench->n; i++)
+    sink += (unsigned long) msymbol (bench->names[i]);
+}
+
+void
+symbol_exist (void *arg)
+{
+  struct SymbolBench *bench = arg;
+  int i;
+
+  for (i = 0; i < bench->n; i++)
+    sink += (unsigned long) msymbol_exist (bench->names[i]);
+}
+
+void
+bench_symbol ()
+{
+  static int sizes[] = { 1000, 50000, 500000 };
+  int k;
+
+  for (k = 0; k < sizeof sizes / sizeof sizes[0]; k++)
+    {
+      struct SymbolBench bench;
+      char name[64];
+      double start;
+      int i, ok;
+
+      bench.n = sizes[k];
+      bench.names = malloc (sizeof (char *) * bench.n);
+      bench.symbols = malloc (sizeof (MSymbol) * bench.n);
+      for (i = 0; i < bench.n; i++)
+	{
+	  sprintf (name, "input-method-%d-%d", bench.n, i);
+	  bench.names[i] = strdup (name);
+	}
+
+      /* Interning new symbols can't be repeated.  */
+      start = now ();
+      for (i = 0; i < bench.n; i++)
+	bench.symbols[i] = msymbol (bench.names[i]);
+      sprintf (name, "intern-%d", bench.n);
+      report ("symbol", name, bench.n, now () - start, 1);
+
+      for (i = 0, ok = 1; i < bench.n; i++)
+	if (msymbol (bench.names[i]) != bench.symbols[i]
+	    || msymbol_exist (bench.names[i]) != bench.symbols[i]
+	    || strcmp (msymbol_name (bench.symbols[i]), bench.names[i]))
+	  ok = 0;
+      sprintf (name, "msymbol-%d", bench.n);
+      measure ("symbol", name, symbol_msymbol, &bench, bench.n, ok);
+      sprintf (name, "exist-%d", bench.n);
+      measure ("symbol", name, symbol_exist, &bench, bench.n, ok);
+
+      for (i = 0; i < bench.n; i++)
+	free (bench.names[i]);
+      free (bench.names);
+      free (bench.symbols);
+    }
+}
+
+
+/* Test "mtext".  */
+
+#define MTEXT_NEDITS 20000
+
+struct MTextBench
+{
+  MText *mt, *ins;
+  /* Nonzero if the edits are local.  */
+  int local;
+  int pos;
+  /* Characters of MT, or NULL if not checked.  */
+  int *chars;
+};
+
+/* Return a random character, which is ASCII or Han.  */
+
+int
+random_char ()
+{
+  return (random_number (2) ? 0x21 + random_number (0x5E)
+	  : 0x4E00 + random_number (0x5000));
+}
+
+/* Return the next position to edit in BENCH, which has LEN
+   characters.  */
+
+int
+mtext_bench_pos (struct MTextBench *bench, int len)
+{
+  if (bench->local)
+    {
+      bench->pos += random_number (201) - 100;
+      if (bench->pos < 0)
+	bench->pos = 0;
+      else if (bench->pos > len)
+	bench->pos = len;
+    }
+  else
+    bench->pos = random_number (len + 1);
+  return bench->pos;
+}
+
+void
+mtext_edit (void *arg)
+{
+  struct MTextBench *bench = arg;
+  int len = mtext_len (bench->mt);
+  int i, pos;
+
+  for (i = 0; i < MTEXT_NEDITS; i += 2)
+    {
+      pos = mtext_bench_pos (bench, len);
+      mtext_ins (bench->mt, pos, bench->ins);
+      if (bench->chars)
+	{
+	  memmove (bench->chars + pos + 8, bench->chars + pos,
+		   sizeof (int) * (len - pos));
+	  memcpy (bench->chars + pos, bench->chars + len + 8,
+		  sizeof (int) * 8);
+	}
+      pos = mtext_bench_pos (bench, len);
+      mtext_del (bench->mt, pos, pos + 8);
+      if (bench->chars)
+	memmove (bench->chars + pos, bench->chars + pos + 8,
+		 sizeof (int) * (len - pos));
+    }
+}
+
+/* Make BENCH have an M-text of LEN random characters.  If CHECK is
+   nonzero, keep the characters in BENCH->chars too.  */
+
+void
+mtext_bench_init (struct MTextBench *bench, int len, int check)
+{
+  int i, c;
+
+  bench->mt = mtext ();
+  bench->ins = mtext ();
+  bench->chars = check ? malloc (sizeof (int) * (len + 16)) : NULL;
+  for (i = 0; i < len; i++)
+    {
+      c = random_char ();
+      mtext_cat_char (bench->mt, c);
+      if (check)
+	bench->chars[i] = c;
+    }
+  for (i = 0; i < 8; i++)
+    {
+      c = random_char ();
+      mtext_cat_char (bench->ins, c);
+      if (check)
+	/* The characters to insert are kept after the text.  */
+	bench->chars[len + 8 + i] = c;
+    }
+  bench->pos = len / 2;
+}
+
+void
+mtext_bench_fini (struct MTextBench *bench)
+{
+  m17n_object_unref (bench->mt);
+  m17n_object_unref (bench->ins);
+  free (bench->chars);
+}
+
+void
+bench_mtext ()
+{
+  struct MTextBench bench;
+  int local, i, len, ok;
+  char name[64];
+
+  for (local = 0; local < 2; local++)
+    {
+      random_seed = 1;
+      mtext_bench_init (&bench, 60000, 1);
+      bench.local = local;
+      mtext_edit (&bench);
+      len = mtext_len (bench.mt);
+      ok = len == 60000;
+      for (i = 0; ok && i < len; i++)
+	if (mtext_ref_char (bench.mt, i) != bench.chars[i])
+	  ok = 0;
+      mtext_bench_fini (&bench);
+
+      mtext_bench_init (&bench, 5000000, 0);
+      bench.local = local;
+      sprintf (name, "%s-%d", local ? "local" : "random", 5000000);
+      measure ("mtext", name, mtext_edit, &bench, MTEXT_NEDITS, ok);
+      mtext_bench_fini (&bench);
+    }
+}
+
+
+struct
+{
+  char *name;
+  void (*func) ();
+  int selected;
+} tests[] =
+  { { "chartab", bench_chartab },
+    { "symbol", bench_symbol },
+    { "mtext", bench_mtext } };
+
+#define N_TESTS (sizeof tests / sizeof tests[0])
+
+/* Print the usage of this program (the name is PROG), and exit with
+   EXIT_CODE.  */
+
+void
+help_exit (char *prog, int exit_code)
+{
+  char *p = prog;
+  int i;
+
+  while (*p)
+    if (*p++ == '/')
+      prog = p;
+
+  printf ("Usage: %s [ OPTION ... ] [ TEST ... ]\n", prog);
+  printf ("Measure the time of basic operations of the core modules.\n");
+  printf ("  TEST is one of:");
+  for (i = 0; i < N_TESTS; i++)
+    printf (" %s", tests[i].name);
+  printf ("\n  If TEST is omitted, all of them are measured.\n");
+  printf ("The following OPTIONs are available.\n");
+  printf ("  %-13s %s", "-t SECONDS",
+	  "Repeat each measurement for SECONDS (defaults to 0.2).\n");
+  printf ("  %-13s %s", "-h, --help", "Print this message.\n");
+  exit (exit_code);
+}
+
+int
+main (int argc, char **argv)
+{
+  int nselected = 0;
+  int i, j;
+
+  M17N_INIT ();
+  if (merror_code != MERROR_NONE)
+    {
+      fprintf (stderr, "Fail to initialize the m17n library.\n");
+      exit (1);
+    }
+
+  min_seconds = 0.2;
+  for (i = 1; i < argc; i++)
+    {
+      if (! strcmp (argv[i], "--help")
+	  || ! strcmp (argv[i], "-h")
+	  || ! strcmp (argv[i], "-?"))
+	help_exit (argv[0], 0);
+      else if (! strcmp (argv[i], "-t") && i + 1 < argc)
+	min_seconds = atof (argv[++i]);
+      else if (argv[i][0] != '-')
+	{
+	  for (j = 0; j < N_TESTS; j++)
+	    if (! strcmp (argv[i], tests[j].name))
+	      break;
+	  if (j == N_TESTS)
+	    help_exit (argv[0], 1);
+	  tests[j].selected = 1;
+	  nselected++;
+	}
+      else
+	help_exit (argv[0], 1);
+    }
+
+  printf ("#test\tcase\toperations\tseconds\tns/op\tok\n");
+  for (i = 0; i < N_TESTS; i++)
+    if (! nselected || tests[i].selected)
+      (*tests[i].func) ();
+
+  M17N_FINI ();
+  exit (0);
+}
+#endif /* not FOR_DOXYGEN */
@@ -0,0 +1,449 @@
+/* minputbench.c -- Benchmark of input methods.		-*- coding: utf-8; -*-
+   Copyright (C) 2026
+     National Institute of Advanced Industrial Science and Technology (AIST)
+     Registration Number H15PRO112
+
+   This file is part of the m17n library.
+
+   The m17n library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   The m17n library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the m17n library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA.  */
+
+/***en
+    @enpage m17n-input-bench benchmark an input method
+
+    @section m17n-input-bench-synopsis SYNOPSIS
+
+    m17n-input-bench [ OPTION ... ] LANGUAGE NAME
+
+    @section m17n-input-bench-description DESCRIPTION
+
+    Replay a sequence of keys through the input method of LANGUAGE and
+    NAME by minput_filter () and minput_lookup (), and measure the
+    time.
+
+    The result is printed in a line of tab separated fields: LANGUAGE,
+    NAME, milliseconds to open the input method and to create an input
+    context, the number of keys replayed, seconds to replay them, keys
+    per second, microseconds per key, the 50th and 99th percentiles and
+    the maximum of the microseconds taken by each key, and the number
+    of calls of malloc (), calloc (), and realloc () per key.  The
+    number of calls is counted only with the GNU C library, and does
+    not include memory taken from the internal pools of the library.
+    A line starting with '#' is a comment.
+
+    The following OPTIONs are available.
+
+    <ul>
+
+    <li> -f FILE
+
+    Read keys from FILE.  Each line of FILE is the name of a key
+    symbol (e.g. "a", " ", "Return", "C-n").  If neither -f nor -s is
+    given, keys are read from the standard input.
+
+    <li> -s STRING
+
+    Use each character of STRING as a key.
+
+    <li> -r COUNT
+
+    Replay the keys COUNT times (defaults to 1).
+
+    <li> -m COUNT
+
+    Create COUNT more input contexts and print the number of bytes
+    allocated for each of them in another line of tab separated
+    fields: the number of input contexts and bytes per input context.
+    The number of bytes is measured only with the GNU C library.
+
+    <li> -p
+
+    Set the environment variable MDEBUG_INPUT_TIME to 1 so that the
+    library prints the time spent in each phase of handling keys
+    (handle_key, take_action_list, get_candidate_list, and
+    preedit_commit) on finalizing.  Measuring the phases makes the
+    replay slower.
+
+    <li> -h, --help
+
+    Print this message.
+
+    </ul>
+*/
+/***ja
+    @japage m17n-input-bench 入力メソッドのベンチマーク
+
+    @section m17n-input-bench-synopsis SYNOPSIS
+
+    m17n-input-bench [ OPTION ... ] LANGUAGE NAME
+
+    @section m17n-input-bench-description 説明
+
+    LANGUAGE と NAME の入力メソッドに minput_filter () と
+    minput_lookup () でキーの列を与え直し、時間を測る。
+
+    結果はタブで区切られたフィールドの行として表示される。フィールドは
+    LANGUAGE、NAME、入力メソッドを開いて入力コンテクストを作るのにかかっ
+    たミリ秒数、与えたキーの数、それにかかった秒数、毎秒のキー数、1 キー
+    あたりのマイクロ秒数、各キーにかかったマイクロ秒数の 50 および 99 パー
+    センタイル値と最大値、1 キーあたりの malloc ()、calloc ()、realloc
+    () の呼び出し回数である。呼び出し回数は GNU C ライブラリでのみ数え
+    られ、ライブラリ内部のプールから取られたメモリは含まない。'#' で始
+    まる行は注釈である。
+
+    以下のオプションが利用できる。
+
+    <ul>
+
+    <li> -f FILE
+
+    キーを FILE から読む。FILE の各行はキーシンボルの名前 (例えば
+    "a"、" "、"Return"、"C-n") である。-f も -s も与えられなければ、キー
+    は標準入力から読まれる。
+
+    <li> -s STRING
+
+    STRING の各文字をキーとして用いる。
+
+    <li> -r COUNT
+
+    キーを COUNT 回与える。(デフォルトは 1)
+
+    <li> -m COUNT
+
+    入力コンテクストをさらに COUNT 個作り、それぞれに割り当てられたバイ
+    ト数を、タブで区切られたフィールドの別の行に表示する。フィールドは入
+    力コンテクストの数と 1 入力コンテクストあたりのバイト数である。バイ
+    ト数は GNU C ライブラリでのみ測られる。
+
+    <li> -p
+
+    環境変数 MDEBUG_INPUT_TIME を 1 にし、キー処理の各段階
+    (handle_key、take_action_list、get_candidate_list、preedit_commit)
+    にかかった時間をライブラリの終了時にプリントさせる。段階ごとの計測
+    により与え直しは遅くなる。
+
+    <li> -h, --help
+
+    このメッセージを表示する。
+
+    </ul>
+*/
+
+#ifndef FOR_DOXYGEN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <m17n.h>
+#include <m17n-misc.h>
+
+/* Return the current time in seconds.  */
+
+double
+now ()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+  {
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+  }
+}
+
+/* Number of calls of malloc, calloc, and realloc.  With the GNU C
+   library, they are counted by wrapping the functions.  */
+long nallocs;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size)
+{
+  nallocs++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  nallocs++;
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  nallocs++;
+  return __libc_realloc (ptr, size);
+}
+#endif
+
+int
+compare_double (const void *p1, const void *p2)
+{
+  double d1 = *(double *) p1, d2 = *(double *) p2;
+
+  return (d1 < d2 ? -1 : d1 > d2);
+}
+
+/* Return the number of bytes allocated by malloc, or -1 if
+   unknown.  */
+
+double
+allocated_bytes ()
+{
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  return mallinfo2 ().uordblks;
+#elif defined (__GLIBC__)
+  return mallinfo ().uordblks;
+#else
+  return -1;
+#endif
+}
+
+/* Keys to replay.  */
+MSymbol *keys;
+int nkeys, keys_size;
+
+void
+add_key (MSymbol key)
+{
+  if (nkeys == keys_size)
+    {
+      keys_size = keys_size ? keys_size * 2 : 256;
+      keys = realloc (keys, sizeof (MSymbol) * keys_size);
+    }
+  keys[nkeys++] = key;
+}
+
+/* Read keys from FP, one key symbol name per line.  */
+
+void
+read_keys (FILE *fp)
+{
+  char line[256];
+
+  while (fgets (line, sizeof line, fp))
+    {
+      int len = strlen (line);
+
+      if (len > 0 && line[len - 1] == '\n')
+	line[--len] = '\0';
+      if (len > 0)
+	add_key (msymbol (line));
+    }
+}
+
+/* Print the usage of this program (the name is PROG), and exit with
+   EXIT_CODE.  */
+
+void
+help_exit (char *prog, int exit_code)
+{
+  char *p = prog;
+
+  while (*p)
+    if (*p++ == '/')
+      prog = p;
+
+  printf ("Usage: %s [ OPTION ... ] LANGUAGE NAME\n", prog);
+  printf ("Replay keys through an input method and measure the time.\n");
+  printf ("The following OPTIONs are available.\n");
+  printf ("  %-13s %s", "-f FILE",
+	  "Read keys from FILE, one key symbol name per line.\n");
+  printf ("  %-13s %s", "-s STRING", "Use each character of STRING as a key.\n");
+  printf ("  %-13s %s", "-r COUNT", "Replay the keys COUNT times.\n");
+  printf ("  %-13s %s", "-m COUNT",
+	  "Measure the memory of COUNT more input contexts.\n");
+  printf ("  %-13s %s", "-p",
+	  "Print the time spent in each phase of handling keys.\n");
+  printf ("  %-13s %s", "-h, --help", "Print this message.\n");
+  exit (exit_code);
+}
+
+int
+main (int argc, char **argv)
+{
+  MSymbol language = Mnil, name = Mnil;
+  MInputMethod *im;
+  MInputContext *ic;
+  MText *produced;
+  int repeat = 1, from_stdin = 1, ncontexts = 0;
+  double start, open_time, elapsed;
+  double *latency, t;
+  long allocs;
+  int i, j, k;
+
+  /* This must be done before initializing the library.  */
+  for (i = 1; i < argc; i++)
+    if (! strcmp (argv[i], "-p"))
+      setenv ("MDEBUG_INPUT_TIME", "1", 1);
+
+  M17N_INIT ();
+  if (merror_code != MERROR_NONE)
+    {
+      fprintf (stderr, "Fail to initialize the m17n library.\n");
+      exit (1);
+    }
+
+  for (i = 1; i < argc; i++)
+    {
+      if (! strcmp (argv[i], "--help")
+	  || ! strcmp (argv[i], "-h")
+	  || ! strcmp (argv[i], "-?"))
+	help_exit (argv[0], 0);
+      else if (! strcmp (argv[i], "-f") && i + 1 < argc)
+	{
+	  FILE *fp = fopen (argv[++i], "r");
+
+	  if (! fp)
+	    {
+	      fprintf (stderr, "Can't read the file %s\n", argv[i]);
+	      exit (1);
+	    }
+	  read_keys (fp);
+	  fclose (fp);
+	  from_stdin = 0;
+	}
+      else if (! strcmp (argv[i], "-s") && i + 1 < argc)
+	{
+	  char *p = argv[++i];
+	  char buf[2];
+
+	  for (buf[1] = '\0'; *p; p++)
+	    {
+	      buf[0] = *p;
+	      add_key (msymbol (buf));
+	    }
+	  from_stdin = 0;
+	}
+      else if (! strcmp (argv[i], "-r") && i + 1 < argc)
+	repeat = atoi (argv[++i]);
+      else if (! strcmp (argv[i], "-m") && i + 1 < argc)
+	ncontexts = atoi (argv[++i]);
+      else if (! strcmp (argv[i], "-p"))
+	;
+      else if (argv[i][0] != '-' && language == Mnil)
+	language = msymbol (argv[i]);
+      else if (argv[i][0] != '-' && name == Mnil)
+	name = msymbol (argv[i]);
+      else
+	help_exit (argv[0], 1);
+    }
+  if (name == Mnil)
+    help_exit (argv[0], 1);
+  if (from_stdin)
+    read_keys (stdin);
+
+  start = now ();
+  im = minput_open_im (language, name, NULL);
+  ic = im ? minput_create_ic (im, NULL) : NULL;
+  open_time = now () - start;
+  if (! ic)
+    {
+      fprintf (stderr, "Can't open the input method %s-%s\n",
+	       msymbol_name (language), msymbol_name (name));
+      exit (1);
+    }
+
+  if (nkeys * repeat <= 0)
+    {
+      fprintf (stderr, "No key to replay\n");
+      exit (1);
+    }
+  latency = malloc (sizeof (double) * nkeys * repeat);
+  if (! latency)
+    {
+      fprintf (stderr, "Too many keys to replay\n");
+      exit (1);
+    }
+
+  produced = mtext ();
+  allocs = nallocs;
+  start = t = now ();
+  for (i = k = 0; i < repeat; i++)
+    for (j = 0; j < nkeys; j++, k++)
+      {
+	double t0 = t;
+
+	if (minput_filter (ic, keys[j], NULL) == 0)
+	  minput_lookup (ic, keys[j], NULL, produced);
+	/* Don't let the produced text grow.  */
+	if (mtext_len (produced) >= 1024)
+	  mtext_del (produced, 0, mtext_len (produced));
+	t = now ();
+	latency[k] = t - t0;
+      }
+  elapsed = t - start;
+  allocs = nallocs - allocs;
+  qsort (latency, k, sizeof (double), compare_double);
+
+  printf ("#language\tname\topen-ms\tkeys\tseconds\tkeys/s\tus/key"
+	  "\tp50-us\tp99-us\tmax-us\tallocs/key\n");
+  printf ("%s\t%s\t%.3f\t%d\t%.6g\t%.0f\t%.3f\t%.3f\t%.3f\t%.3f",
+	  msymbol_name (language), msymbol_name (name), open_time * 1000,
+	  k, elapsed, k / elapsed, elapsed * 1000000 / k,
+	  latency[k / 2] * 1000000, latency[k - 1 - k / 100] * 1000000,
+	  latency[k - 1] * 1000000);
+#ifdef __GLIBC__
+  printf ("\t%.3f\n", (double) allocs / k);
+#else
+  printf ("\tunknown\n");
+#endif
+  free (latency);
+
+  if (ncontexts > 0)
+    {
+      MInputContext **ics = malloc (sizeof (MInputContext *) * ncontexts);
+      double bytes = allocated_bytes ();
+
+      for (i = 0; i < ncontexts; i++)
+	ics[i] = minput_create_ic (im, NULL);
+      if (bytes >= 0)
+	bytes = (allocated_bytes () - bytes) / ncontexts;
+      printf ("#contexts\tbytes/context\n");
+      if (bytes >= 0)
+	printf ("%d\t%.0f\n", ncontexts, bytes);
+      else
+	printf ("%d\tunknown\n", ncontexts);
+      for (i = 0; i < ncontexts; i++)
+	minput_destroy_ic (ics[i]);
+      free (ics);
+    }
+
+  m17n_object_unref (produced);
+  minput_destroy_ic (ic);
+  minput_close_im (im);
+  free (keys);
+  M17N_FINI ();
+  exit (0);
+}
+#endif /* not FOR_DOXYGEN */
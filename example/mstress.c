@@ -0,0 +1,890 @@
+/* mstress.c -- Stress test of the library from multiple threads.	-*- coding: utf-8; -*-
+   Copyright (C) 2026
+     National Institute of Advanced Industrial Science and Technology (AIST)
+     Registration Number H15PRO112
+
+   This file is part of the m17n library.
+
+   The m17n library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   The m17n library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the m17n library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301 USA.  */
+
+/***en
+    @enpage m17n-stress stress the library from multiple threads
+
+    @section m17n-stress-synopsis SYNOPSIS
+
+    m17n-stress [ OPTION ... ] [ LANGUAGE NAME ]
+
+    @section m17n-stress-description DESCRIPTION
+
+    Run the following jobs from multiple threads at once, and check
+    that each thread gets the same results as a single thread does
+    afterwards.
+
+    <ul>
+
+    <li> convert
+
+    Encode a random text by each available encoding in lenient mode,
+    and decode the result.  The code converters are made in each
+    thread, while the encodings and charsets they use are shared and
+    may be loaded lazily by any thread.
+
+    <li> mtext
+
+    Edit an M-text by random insertions, deletions, and text
+    properties, and copy and search parts of an M-text shared by all
+    the threads.  The shared M-text has a gap in the middle at first,
+    which is closed by a search while other threads read through it.
+
+    <li> input
+
+    Feed random keys to an input context by minput_filter () and
+    minput_lookup ().  The input contexts of all the threads share one
+    input method, that of LANGUAGE and NAME if specified, else an input
+    method built in this program, which has rules of a simple
+    transliteration, candidate lists with grouping, a macro,
+    variables, conditions, and undo.  The built-in input method is
+    written in a temporary directory, which is used as the user's
+    database directory (see the environment variable M17NDIR).
+
+    <li> call
+
+    Feed random keys to an input context as the job input does, mainly
+    the key "c", which the built-in input method binds to an action
+    calling an external module.  The module is a function in this
+    program, and returns a new candidate list on each call.  The job
+    also fails if the library keeps such a list after the key is
+    handled, e.g. in the cache of candidate lists of the input
+    method.  If the module can't be loaded, this check is skipped with
+    a comment.
+
+    </ul>
+
+    Thread I runs the jobs ROUNDS times with the random seed I, and the
+    results are compared with those a single thread gets with the same
+    seed.  The result is printed in lines of tab separated fields: job,
+    the numbers of threads and rounds, and 1 if all the threads got the
+    same results as a single thread (else 0).  A line starting with '#'
+    is a comment.  The exit status is 1 if any job fails.
+
+    Unless the library is configured with --enable-threads, the jobs
+    of all the threads are run one after another.
+
+    This program detects only races that change the results.  To
+    detect all data races, build the library and this program with a
+    race detector, e.g. by adding -fsanitize=thread to CFLAGS and
+    LDFLAGS of configure, and run this program.
+
+    The following OPTIONs are available.
+
+    <ul>
+
+    <li> -j THREADS
+
+    Run THREADS threads (defaults to 4).
+
+    <li> -n ROUNDS
+
+    Run the jobs ROUNDS times in each thread (defaults to 5).
+
+    <li> -h, --help
+
+    Print this message.
+
+    </ul>
+*/
+/***ja
+    @japage m17n-stress 複数のスレッドからライブラリに負荷をかける
+
+    @section m17n-stress-synopsis SYNOPSIS
+
+    m17n-stress [ OPTION ... ] [ LANGUAGE NAME ]
+
+    @section m17n-stress-description 説明
+
+    以下の仕事を複数のスレッドから同時に実行し、各スレッドが、その後に
+    単一のスレッドで得られるのと同じ結果を得ることを確かめる。
+
+    <ul>
+
+    <li> convert
+
+    ランダムなテキストを、利用可能な各エンコーディングで寛容モードでエ
+    ンコードし、結果をデコードする。コードコンバータは各スレッドで作ら
+    れるが、それが用いるエンコーディングと文字セットは共有され、どのス
+    レッドからも遅延ロードされうる。
+
+    <li> mtext
+
+    ランダムな挿入、削除、テキストプロパティによって M-text を編集し、
+    すべてのスレッドが共有する M-text の一部をコピーし、検索する。共有
+    される M-text は最初は中央にギャップを持ち、他のスレッドがそれ越し
+    に読む間に検索によって閉じられる。
+
+    <li> input
+
+    ランダムなキーを minput_filter () と minput_lookup () で入力コンテ
+    クストに与える。すべてのスレッドの入力コンテクストは一つの入力メソッ
+    ドを共有する。それは指定されれば LANGUAGE と NAME の入力メソッドで
+    あり、そうでなければこのプログラムに組み込まれた入力メソッドである。
+    後者は単純な翻字、グループ化された候補リスト、マクロ、変数、条件、
+    アンドゥの規則を持つ。組み込みの入力メソッドは一時ディレクトリに書
+    かれ、それがユーザのデータベースディレクトリとして用いられる (環境
+    変数 M17NDIR を参照)。
+
+    <li> call
+
+    仕事 input と同様にランダムなキーを入力コンテクストに与える。主な
+    キーは "c" であり、組み込みの入力メソッドはこれに外部モジュールを
+    呼ぶアクションを割り当てている。そのモジュールはこのプログラム中の
+    関数であり、呼ばれる度に新しい候補リストを返す。キーが処理された後
+    にライブラリがそのリストを (例えば入力メソッドの候補リストのキャッ
+    シュに) 保持していれば、この仕事は失敗とする。モジュールをロードで
+    きなければ、この検査は注釈を表示して省略される。
+
+    </ul>
+
+    スレッド I はランダムの種 I で仕事を ROUNDS 回実行し、結果は単一の
+    スレッドが同じ種で得るものと比較される。結果はタブで区切られたフィー
+    ルドの行として表示される。フィールドは仕事、スレッド数と回数、すべ
+    てのスレッドが単一のスレッドと同じ結果を得たなら 1 (そうでなければ
+    0) である。'#' で始まる行は注釈である。いずれかの仕事が失敗すれば
+    終了ステータスは 1 である。
+
+    ライブラリが --enable-threads で configure されていなければ、すべて
+    のスレッドの仕事は順に実行される。
+
+    このプログラムが検出するのは結果を変える競合だけである。すべてのデー
+    タ競合を検出するには、ライブラリとこのプログラムを競合検出器付きで
+    (例えば configure の CFLAGS と LDFLAGS に -fsanitize=thread を加え
+    て) ビルドし、このプログラムを実行する。
+
+    以下のオプションが利用できる。
+
+    <ul>
+
+    <li> -j THREADS
+
+    THREADS 個のスレッドを実行する。(デフォルトは 4)
+
+    <li> -n ROUNDS
+
+    各スレッドで仕事を ROUNDS 回実行する。(デフォルトは 5)
+
+    <li> -h, --help
+
+    このメッセージを表示する。
+
+    </ul>
+*/
+
+#ifndef FOR_DOXYGEN
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#ifdef M17N_THREADS
+#include <pthread.h>
+#endif
+
+#include <m17n.h>
+#include <m17n-misc.h>
+
+/* Return the current time in seconds.  */
+
+double
+now ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Linear congruential generator.  Each thread has its own SEED.  */
+
+int
+random_number (unsigned long *seed, int n)
+{
+  *seed = (*seed * 1103515245 + 12345) & 0x7FFFFFFF;
+  return (*seed >> 8) % n;
+}
+
+/* Character ranges from which a text is generated.  */
+
+int char_ranges[][2] =
+  { { 0x20, 0x7E },		/* ASCII */
+    { 0xA0, 0x17F },		/* Latin */
+    { 0x391, 0x3C9 },		/* Greek */
+    { 0x410, 0x44F },		/* Cyrillic */
+    { 0xE01, 0xE2E },		/* Thai */
+    { 0x3041, 0x30F6 },		/* Kana */
+    { 0x4E00, 0x9FA5 },		/* Han */
+    { 0xAC00, 0xD7A3 },		/* Hangul */
+    { 0x1F600, 0x1F64F } };	/* Emoji */
+
+#define N_CHAR_RANGES (sizeof char_ranges / sizeof char_ranges[0])
+
+int
+random_char (unsigned long *seed)
+{
+  int i = random_number (seed, N_CHAR_RANGES);
+
+  return (char_ranges[i][0]
+	  + random_number (seed, char_ranges[i][1] - char_ranges[i][0] + 1));
+}
+
+/* Hash of the results of a job.  */
+
+#define HASH(hash, n) ((hash) = (hash) * 31 + (unsigned) (n))
+
+unsigned
+hash_mtext (unsigned hash, MText *mt)
+{
+  int i;
+
+  HASH (hash, mtext_len (mt));
+  for (i = 0; i < mtext_len (mt); i++)
+    HASH (hash, mtext_ref_char (mt, i));
+  return hash;
+}
+
+
+/* Job "convert".  */
+
+MSymbol *codings;
+int ncodings;
+
+#define CONVERT_NCHARS 2000
+
+unsigned
+job_convert (unsigned long seed)
+{
+  MText *mt = mtext (), *decoded;
+  int bufsize = CONVERT_NCHARS * 16;
+  unsigned char *buf = malloc (bufsize);
+  MConverter *converter;
+  unsigned hash = 0;
+  int i, n;
+
+  for (i = 0; i < CONVERT_NCHARS; i++)
+    mtext_cat_char (mt, random_char (&seed));
+  for (i = 0; i < ncodings; i++)
+    {
+      converter = mconv_buffer_converter (codings[i], buf, bufsize);
+      if (! converter)
+	{
+	  HASH (hash, -1);
+	  continue;
+	}
+      converter->lenient = 1;
+      converter->last_block = 1;
+      n = mconv_encode (converter, mt);
+      mconv_free_converter (converter);
+      HASH (hash, n);
+      if (n < 0)
+	continue;
+      decoded = mconv_decode_buffer (codings[i], buf, n);
+      if (decoded)
+	{
+	  hash = hash_mtext (hash, decoded);
+	  m17n_object_unref (decoded);
+	}
+    }
+  free (buf);
+  m17n_object_unref (mt);
+  return hash;
+}
+
+
+/* Job "mtext".  */
+
+/* M-text shared by all the threads.  */
+MText *shared_mtext;
+
+#define SHARED_NCHARS 100000
+#define MTEXT_NEDITS 3000
+#define MTEXT_MAX_NCHARS 4000
+
+MSymbol Mstress;
+
+unsigned
+job_mtext (unsigned long seed)
+{
+  MText *mt = mtext (), *copy;
+  unsigned hash = 0;
+  int i, len, from, to, c;
+  char name[16];
+
+  for (i = 0; i < MTEXT_NEDITS; i++)
+    {
+      len = mtext_len (mt);
+      from = random_number (&seed, len + 1);
+      to = from + random_number (&seed, 16);
+      if (to > len)
+	to = len;
+      switch (random_number (&seed, len < MTEXT_MAX_NCHARS ? 6 : 5))
+	{
+	case 0:
+	  mtext_del (mt, from, to);
+	  break;
+	case 1:
+	  sprintf (name, "v%d", random_number (&seed, 100));
+	  if (from < to)
+	    mtext_put_prop (mt, from, to, Mstress, msymbol (name));
+	  break;
+	case 2:
+	  if (from < len)
+	    HASH (hash, (unsigned long) mtext_get_prop (mt, from, Mstress));
+	  break;
+	case 3:
+	  from = random_number (&seed, SHARED_NCHARS - 16);
+	  c = mtext_ref_char (shared_mtext, from);
+	  HASH (hash, c);
+	  HASH (hash, mtext_character (shared_mtext, from + 1,
+				       SHARED_NCHARS, c));
+	  break;
+	case 4:
+	  HASH (hash, mtext_ref_char (shared_mtext,
+				      random_number (&seed, SHARED_NCHARS)));
+	  break;
+	default:
+	  from = random_number (&seed, SHARED_NCHARS - 16);
+	  copy = mtext_duplicate (shared_mtext, from, from + 16);
+	  mtext_ins (mt, random_number (&seed, len + 1), copy);
+	  m17n_object_unref (copy);
+	  mtext_ins_char (mt, random_number (&seed, len + 1),
+			  random_char (&seed), 1);
+	}
+    }
+  hash = hash_mtext (hash, mt);
+  for (i = 0; i < mtext_len (mt); i++)
+    HASH (hash, (unsigned long) mtext_get_prop (mt, i, Mstress));
+  m17n_object_unref (mt);
+  return hash;
+}
+
+
+/* Job "input".  */
+
+MInputMethod *im;
+
+/* Source of the built-in input method.  */
+
+char *im_source = "\
+(input-method t m17n-stress)\n\
+(description \"Input method of m17n-stress\")\n\
+(title \"S\")\n\
+(variable (candidates-group-size \"group size\" 4) (count \"count\" 0))\n\
+(module (m17n-stress candidates))\n\
+(macro\n\
+ (kanji (insert ((\"漢字\" \"感じ\" \"幹事\" \"監事\" \"莞爾\" \"完治\"\n\
+		 \"換字\" \"冠辞\" \"寛治\" \"官寺\" \"乾地\" \"観自\")))\n\
+	(shift select)))\n\
+(map\n\
+ (kana\n\
+  (\"a\" \"あ\") (\"i\" \"い\") (\"u\" \"う\") (\"e\" \"え\") (\"o\" \"お\")\n\
+  (\"ka\" \"か\") (\"ki\" \"き\") (\"ku\" \"く\") (\"ke\" \"け\") (\"ko\" \"こ\")\n\
+  (\"sa\" \"さ\") (\"si\" \"し\") (\"su\" \"す\") (\"se\" \"せ\") (\"so\" \"そ\")\n\
+  (\"ta\" \"た\") (\"ti\" \"ち\") (\"tu\" \"つ\") (\"te\" \"て\") (\"to\" \"と\")\n\
+  (\"na\" \"な\") (\"ni\" \"に\") (\"nu\" \"ぬ\") (\"ne\" \"ね\") (\"no\" \"の\")\n\
+  (\"nn\" \"ん\") (\"kya\" \"きゃ\") (\"sya\" \"しゃ\") (\"tya\" \"ちゃ\")\n\
+  (\"x\" (kanji))\n\
+  (\"z\" (\"一二三四五六七八九十百千万億兆\") (shift select))\n\
+  (\"q\" (add count 1)\n\
+   (cond ((> count 2) (set count 0) (insert \"多\")) (1 (insert \"少\"))))\n\
+  (\"d\" (delete @-))\n\
+  (\"u\" (undo))\n\
+  (\"c\" (call m17n-stress candidates)))\n\
+ (choose\n\
+  (\" \" (select @+)) (\"n\" (select @+)) (\"p\" (select @-))\n\
+  (\"]\" (select @])) (\"[\" (select @[))\n\
+  (\"1\" (select 0)) (\"2\" (select 1)) (\"3\" (select 2))\n\
+  ((Return) (shift init))))\n\
+(state\n\
+ (init \"S\" (kana) (nil (commit)))\n\
+ (select \"X\" (choose)))\n";
+
+/* Directory and global data of input methods, for the case that the
+   m17n database is not installed.  */
+
+char *mdb_dir_source = "(input-method * \"*.mim\")\n";
+
+
+char *global_source = "\
+(input-method t nil global)\n\
+(description \"Global data of m17n-stress\")\n\
+(variable (candidates-group-size \"group size\" 10))\n";
+
+/* Temporary directory for the built-in input method, used as the
+   user's database directory.  */
+char im_dir[] = "/tmp/m17n-stress-XXXXXX";
+int im_dir_made;
+
+/* Write SOURCE to the file NAME in im_dir.  */
+
+void
+write_im_file (char *name, char *source)
+{
+  char path[sizeof im_dir + 64];
+  FILE *fp;
+
+  sprintf (path, "%s/%s", im_dir, name);
+  fp = fopen (path, "w");
+  if (! fp)
+    {
+      fprintf (stderr, "Can't write the file %s\n", path);
+      exit (1);
+    }
+  fputs (source, fp);
+  fclose (fp);
+}
+
+/* Make im_dir have the built-in input method, and make it the user's
+   database directory.  */
+
+void
+make_im_dir ()
+{
+  if (! mkdtemp (im_dir))
+    {
+      fprintf (stderr, "Can't make a temporary directory.\n");
+      exit (1);
+    }
+  im_dir_made = 1;
+  write_im_file ("mdb.dir", mdb_dir_source);
+  write_im_file ("global.mim", global_source);
+  write_im_file ("m17n-stress.mim", im_source);
+  setenv ("M17NDIR", im_dir, 1);
+}
+
+/* Remove im_dir and the files in it, including those the library
+   made.  */
+
+void
+remove_im_dir ()
+{
+  char path[sizeof im_dir + 256];
+  DIR *dir = opendir (im_dir);
+  struct dirent *ent;
+
+  if (dir)
+    {
+      while ((ent = readdir (dir)))
+	if (strcmp (ent->d_name, ".") && strcmp (ent->d_name, ".."))
+	  {
+	    snprintf (path, sizeof path, "%s/%s", im_dir, ent->d_name);
+	    unlink (path);
+	  }
+      closedir (dir);
+    }
+  rmdir (im_dir);
+}
+
+char *key_names[] =
+  { "a", "i", "u", "e", "o", "k", "s", "t", "n", "y", "x", "z", "q", "d",
+    " ", "p", "]", "[", "1", "2", "3", "Return", "BackSpace" };
+
+#define N_KEY_NAMES (sizeof key_names / sizeof key_names[0])
+#define INPUT_NKEYS 3000
+
+MSymbol keys[N_KEY_NAMES];
+
+unsigned
+job_input (unsigned long seed)
+{
+  MInputContext *ic = minput_create_ic (im, NULL);
+  MText *mt = mtext ();
+  MSymbol key;
+  unsigned hash = 0;
+  int i;
+
+  if (! ic)
+    return 0;
+  for (i = 0; i < INPUT_NKEYS; i++)
+    {
+      key = keys[random_number (&seed, N_KEY_NAMES)];
+      if (minput_filter (ic, key, NULL) == 0)
+	minput_lookup (ic, key, NULL, mt);
+      HASH (hash, ic->cursor_pos);
+      HASH (hash, ic->candidate_index);
+    }
+  hash = hash_mtext (hash, mt);
+  hash = hash_mtext (hash, ic->preedit);
+  m17n_object_unref (mt);
+  minput_destroy_ic (ic);
+  return hash;
+}
+
+
+/* Job "call".  */
+
+/* Argument of an input context given to minput_create_ic ().  */
+
+typedef struct
+{
+  /* Number of calls of candidates () for the input context.  */
+  int count;
+
+  /* Candidates last returned by candidates (), referred by this
+     program, or NULL.  */
+  MPlist *called;
+} CallArg;
+
+/* Number of calls of candidates () for all the input contexts, and
+   nonzero if the library kept what candidates () returned.  They are
+   updated under call_lock.  */
+int ncalls, candidates_kept;
+
+#ifdef M17N_THREADS
+pthread_mutex_t call_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_CALLS() pthread_mutex_lock (&call_lock)
+#define UNLOCK_CALLS() pthread_mutex_unlock (&call_lock)
+#else
+#define LOCK_CALLS() ((void) 0)
+#define UNLOCK_CALLS() ((void) 0)
+#endif
+
+/* The external module "m17n-stress" of the built-in input method.
+   The library loads a module by dlopen () from the directory of
+   modules, where this program is not installed.  This dlopen ()
+   takes precedence over that of the system, and gives the handle of
+   this program, which is linked with -export-dynamic, for that
+   module.  */
+
+#ifdef RTLD_NEXT
+void *
+dlopen (const char *file, int mode)
+{
+  static void *(*system_dlopen) (const char *file, int mode);
+  char *base = file ? strrchr (file, '/') : NULL;
+
+  if (! system_dlopen)
+    system_dlopen = (void *(*) (const char *, int)) dlsym (RTLD_NEXT,
+							   "dlopen");
+  if (base && ! strncmp (base + 1, "m17n-stress.", 12))
+    file = NULL;
+  return system_dlopen (file, mode);
+}
+#endif
+
+/* Function "candidates" of the module.  Return a new action list
+   that inserts a list of 8 candidates specific to the call and
+   shifts to the state "select".  */
+
+MPlist *
+candidates (MPlist *args)
+{
+  MInputContext *ic = mplist_value (args);
+  CallArg *arg = ic->arg;
+  MPlist *actions = mplist (), *action, *plist, *group;
+  MText *mt;
+  int i;
+
+  LOCK_CALLS ();
+  ncalls++;
+  UNLOCK_CALLS ();
+  plist = mplist ();
+  group = mplist ();
+  for (i = 0; i < 8; i++)
+    {
+      mt = mtext ();
+      mtext_cat_char (mt, 0x4E00 + (arg->count * 8 + i) % 0x5000);
+      mtext_cat_char (mt, 0x3041 + i);
+      mplist_add (group, Mtext, mt);
+      m17n_object_unref (mt);
+    }
+  mplist_add (plist, Mplist, group);
+  m17n_object_unref (group);
+  arg->count++;
+  if (arg->called)
+    m17n_object_unref (arg->called);
+  arg->called = plist;
+  m17n_object_ref (plist);
+
+  action = mplist ();
+  mplist_add (action, Msymbol, msymbol ("insert"));
+  mplist_add (action, Mplist, plist);
+  m17n_object_unref (plist);
+  mplist_add (actions, Mplist, action);
+  m17n_object_unref (action);
+  action = mplist ();
+  mplist_add (action, Msymbol, msymbol ("shift"));
+  mplist_add (action, Msymbol, msymbol ("select"));
+  mplist_add (actions, Mplist, action);
+  m17n_object_unref (action);
+  return actions;
+}
+
+char *call_key_names[] =
+  { "c", "c", "c", "c", " ", "n", "1", "a", "Return", "BackSpace" };
+
+#define N_CALL_KEY_NAMES (sizeof call_key_names / sizeof call_key_names[0])
+#define CALL_NKEYS 2000
+
+MSymbol call_keys[N_CALL_KEY_NAMES];
+
+unsigned
+job_call (unsigned long seed)
+{
+  CallArg arg;
+  MInputContext *ic;
+  MText *mt = mtext ();
+  MSymbol key;
+  unsigned hash = 0;
+  int i;
+
+  arg.count = 0;
+  arg.called = NULL;
+  ic = minput_create_ic (im, &arg);
+  if (! ic)
+    return 0;
+  for (i = 0; i < CALL_NKEYS; i++)
+    {
+      key = call_keys[random_number (&seed, N_CALL_KEY_NAMES)];
+      if (minput_filter (ic, key, NULL) == 0)
+	minput_lookup (ic, key, NULL, mt);
+      /* Now nothing but this program refers to the candidates.  */
+      if (arg.called)
+	{
+	  if (m17n_object_unref (arg.called) != 0)
+	    {
+	      LOCK_CALLS ();
+	      candidates_kept = 1;
+	      UNLOCK_CALLS ();
+	    }
+	  arg.called = NULL;
+	}
+      HASH (hash, ic->cursor_pos);
+      HASH (hash, ic->candidate_index);
+    }
+  hash = hash_mtext (hash, mt);
+  hash = hash_mtext (hash, ic->preedit);
+  m17n_object_unref (mt);
+  minput_destroy_ic (ic);
+  return hash;
+}
+
+
+/* Jobs.  */
+
+struct
+{
+  char *name;
+  unsigned (*func) (unsigned long seed);
+  /* Results of each thread by a single thread.  */
+  unsigned *expected;
+  /* Nonzero if a thread got a different result, or the job found an
+     error by itself.  */
+  int failed;
+} jobs[] =
+  { { "convert", job_convert },
+    { "mtext", job_mtext },
+    { "input", job_input },
+    { "call", job_call } };
+
+#define N_JOBS (sizeof jobs / sizeof jobs[0])
+
+int nthreads, nrounds;
+
+/* Results of each job of each round of each thread, indexed by
+   ((THREAD * nrounds) + ROUND) * N_JOBS + JOB.  */
+unsigned *results;
+
+void *
+run_thread (void *arg)
+{
+  int thread = (long) arg;
+  int i, j;
+
+  for (i = 0; i < nrounds; i++)
+    for (j = 0; j < N_JOBS; j++)
+      results[(thread * nrounds + i) * N_JOBS + j]
+	= (*jobs[j].func) ((unsigned long) thread);
+  return NULL;
+}
+
+/* Print the usage of this program (the name is PROG), and exit with
+   EXIT_CODE.  */
+
+void
+help_exit (char *prog, int exit_code)
+{
+  char *p = prog;
+
+  while (*p)
+    if (*p++ == '/')
+      prog = p;
+
+  printf ("Usage: %s [ OPTION ... ] [ LANGUAGE NAME ]\n", prog);
+  printf ("Stress the library from multiple threads.\n");
+  printf ("  If LANGUAGE and NAME are specified, input contexts share that input method.\n");
+  printf ("The following OPTIONs are available.\n");
+  printf ("  %-13s %s", "-j THREADS",
+	  "Run THREADS threads (defaults to 4).\n");
+  printf ("  %-13s %s", "-n ROUNDS",
+	  "Run the jobs ROUNDS times in each thread (defaults to 5).\n");
+  printf ("  %-13s %s", "-h, --help", "Print this message.\n");
+  exit (exit_code);
+}
+
+int
+main (int argc, char **argv)
+{
+  char *language_name = NULL, *name_name = NULL;
+  MSymbol language, name;
+  double start, threaded, single;
+  int i, j, k, nfailed = 0;
+#ifdef M17N_THREADS
+  pthread_t *threads;
+#endif
+
+  nthreads = 4, nrounds = 5;
+  for (i = 1; i < argc; i++)
+    {
+      if (! strcmp (argv[i], "--help")
+	  || ! strcmp (argv[i], "-h")
+	  || ! strcmp (argv[i], "-?"))
+	help_exit (argv[0], 0);
+      else if (! strcmp (argv[i], "-j") && i + 1 < argc)
+	nthreads = atoi (argv[++i]);
+      else if (! strcmp (argv[i], "-n") && i + 1 < argc)
+	nrounds = atoi (argv[++i]);
+      else if (argv[i][0] != '-' && i + 1 < argc && ! language_name)
+	{
+	  language_name = argv[i];
+	  name_name = argv[++i];
+	}
+      else
+	help_exit (argv[0], 1);
+    }
+  if (nthreads < 1 || nrounds < 1)
+    help_exit (argv[0], 1);
+  if (! language_name)
+    {
+      make_im_dir ();
+      language_name = "t", name_name = "m17n-stress";
+    }
+
+  M17N_INIT ();
+  if (merror_code != MERROR_NONE)
+    {
+      fprintf (stderr, "Fail to initialize the m17n library.\n");
+      exit (1);
+    }
+
+  /* All the coding systems except for aliases.  */
+  ncodings = mconv_list_codings (&codings);
+  for (i = j = 0; i < ncodings; i++)
+    if (mconv_resolve_coding (codings[i]) == codings[i])
+      codings[j++] = codings[i];
+  ncodings = j;
+
+  {
+    unsigned long seed = 0;
+
+    shared_mtext = mtext ();
+    for (i = 0; i < SHARED_NCHARS; i++)
+      mtext_cat_char (shared_mtext, random_char (&seed));
+    /* Make a gap in the middle.  */
+    mtext_del (shared_mtext, SHARED_NCHARS / 2, SHARED_NCHARS / 2 + 1);
+    mtext_ins_char (shared_mtext, SHARED_NCHARS / 2,
+		    random_char (&seed), 1);
+  }
+  Mstress = msymbol ("m17n-stress");
+
+  language = msymbol (language_name), name = msymbol (name_name);
+  im = minput_open_im (language, name, NULL);
+  if (! im)
+    {
+      fprintf (stderr, "Input method %s %s not available.\n",
+	       language_name, name_name);
+      if (im_dir_made)
+	remove_im_dir ();
+      exit (1);
+    }
+  for (i = 0; i < N_KEY_NAMES; i++)
+    keys[i] = msymbol (key_names[i]);
+  for (i = 0; i < N_CALL_KEY_NAMES; i++)
+    call_keys[i] = msymbol (call_key_names[i]);
+
+  results = malloc (sizeof (unsigned) * nthreads * nrounds * N_JOBS);
+  start = now ();
+#ifdef M17N_THREADS
+  threads = malloc (sizeof (pthread_t) * nthreads);
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create (threads + i, NULL, run_thread, (void *) (long) i))
+      {
+	fprintf (stderr, "Can't create a thread.\n");
+	exit (1);
+      }
+  for (i = 0; i < nthreads; i++)
+    pthread_join (threads[i], NULL);
+  free (threads);
+#else
+  printf ("# The library is not configured with --enable-threads.\n");
+  for (i = 0; i < nthreads; i++)
+    run_thread ((void *) (long) i);
+#endif
+  threaded = now () - start;
+
+  start = now ();
+  for (j = 0; j < N_JOBS; j++)
+    {
+      jobs[j].expected = malloc (sizeof (unsigned) * nthreads);
+      for (i = 0; i < nthreads; i++)
+	jobs[j].expected[i] = (*jobs[j].func) ((unsigned long) i);
+    }
+  single = (now () - start) * nrounds;
+
+  printf ("# %d encodings, input method %s %s\n", ncodings,
+	  msymbol_name (language), msymbol_name (name));
+  if (ncalls == 0)
+    printf ("# The external module is not called.  Only results are compared.\n");
+  printf ("# %.3f seconds by %d threads, %.3f seconds by a single thread\n",
+	  threaded, nthreads, single);
+  printf ("#job\tthreads\trounds\tok\n");
+  for (j = 0; j < N_JOBS; j++)
+    {
+      for (i = 0; i < nthreads; i++)
+	for (k = 0; k < nrounds; k++)
+	  if (results[(i * nrounds + k) * N_JOBS + j] != jobs[j].expected[i])
+	    jobs[j].failed = 1;
+      if (jobs[j].func == job_call && candidates_kept)
+	jobs[j].failed = 1;
+      printf ("%s\t%d\t%d\t%d\n", jobs[j].name, nthreads, nrounds,
+	      ! jobs[j].failed);
+      if (jobs[j].failed)
+	nfailed++;
+      free (jobs[j].expected);
+    }
+
+  free (results);
+  free (codings);
+  m17n_object_unref (shared_mtext);
+  minput_close_im (im);
+  M17N_FINI ();
+  if (im_dir_made)
+    remove_im_dir ();
+  exit (nfailed > 0);
+}
+#endif /* not FOR_DOXYGEN */
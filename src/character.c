@@ -138,6 +138,7 @@ mchar__define_prop (MSymbol key, MSymbol type, void *mdb)
 {
   MCharPropRecord *record;
 
+  M17N_LOCK_REGISTRY ();
   if (char_prop_list)
     record = mplist_get (char_prop_list, key);
   else
@@ -167,6 +168,43 @@ mchar__define_prop (MSymbol key, MSymbol type, void *mdb)
 	default_value = (void *) -1;
       record->table = mchartable (type, default_value);
     }
+  M17N_UNLOCK_REGISTRY ();
+}
+
+/* Set *TABLE (and *TYPE if TYPE is not NULL) to the char-table (and
+   the type) of character property KEY while loading the char-table
+   from the database if necessary.  Return 0 on success.  If no
+   character property is defined, return -1.  If KEY is not a
+   character property, return -2.  If the char-table can't be loaded,
+   return -3.  */
+
+static int
+get_prop_table (MSymbol key, MCharTable **table, MSymbol *type)
+{
+  MCharPropRecord *record;
+  int ret = 0;
+
+  M17N_LOCK_REGISTRY ();
+  if (! char_prop_list)
+    ret = -1;
+  else if (! (record = mplist_get (char_prop_list, key)))
+    ret = -2;
+  else
+    {
+      if (record->mdb)
+	{
+	  record->table = mdatabase_load (record->mdb);
+	  if (record->table)
+	    record->mdb = NULL;
+	}
+      if (! record->table)
+	ret = -3;
+      *table = record->table;
+      if (type)
+	*type = record->type;
+    }
+  M17N_UNLOCK_REGISTRY ();
+  return ret;
 }
 
 
@@ -537,21 +575,14 @@ mchar_define_property (const char *name, MSymbol type)
 void *
 mchar_get_prop (int c, MSymbol key)
 {
-  MCharPropRecord *record;
+  MCharTable *table;
+  int ret = get_prop_table (key, &table, NULL);
 
-  if (! char_prop_list)
+  if (ret == -3)
+    MERROR (MERROR_DB, NULL);
+  if (ret < 0)
     return NULL;
-  record = mplist_get (char_prop_list, key);
-  if (! record)
-    return NULL;
-  if (record->mdb)
-    {
-      record->table = mdatabase_load (record->mdb);
-      if (! record->table)
-	MERROR (MERROR_DB, NULL);
-      record->mdb = NULL;
-    }
-  return mchartable_lookup (record->table, c);
+  return mchartable_lookup (table, c);
 }
 
 /*=*/
@@ -584,21 +615,16 @@ mchar_get_prop (int c, MSymbol key)
 int
 mchar_put_prop (int c, MSymbol key, void *val)
 {
-  MCharPropRecord *record;
+  MCharTable *table;
+  int ret = get_prop_table (key, &table, NULL);
 
-  if (! char_prop_list)
+  if (ret == -1)
     MERROR (MERROR_CHAR, -1);
-  record = mplist_get (char_prop_list, key);
-  if (! record)
+  if (ret == -3)
+    MERROR (MERROR_DB, -1);
+  if (ret < 0)
     return -1;
-  if (record->mdb)
-    {
-      record->table = mdatabase_load (record->mdb);
-      if (! record->table)
-	MERROR (MERROR_DB, -1);
-      record->mdb = NULL;
-    }
-  return mchartable_set (record->table, c, val);
+  return mchartable_set (table, c, val);
 }
 
 /*=*/
@@ -631,23 +657,14 @@ mchar_put_prop (int c, MSymbol key, void *val)
 MCharTable *
 mchar_get_prop_table (MSymbol key, MSymbol *type)
 {
-  MCharPropRecord *record;
+  MCharTable *table;
+  int ret = get_prop_table (key, &table, type);
 
-  if (! char_prop_list)
+  if (ret == -3)
+    MERROR (MERROR_DB, NULL);
+  if (ret < 0)
     return NULL;
-  record = mplist_get (char_prop_list, key);
-  if (! record)
-    return NULL;
-  if (record->mdb)
-    {
-      record->table = mdatabase_load (record->mdb);
-      if (! record->table)
-	MERROR (MERROR_DB, NULL);
-      record->mdb = NULL;
-    }
-  if (type)
-    *type = record->type;
-  return record->table;
+  return table;
 }
 
 /*** @} */
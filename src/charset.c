@@ -87,6 +87,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#if defined (HAVE_SYS_MMAN_H) && defined (HAVE_MMAP)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define USE_CHARSET_CACHE
+#endif
 
 #include "m17n.h"
 #include "m17n-misc.h"
@@ -238,6 +246,189 @@ make_charset (MCharset *charset)
   return charset;
 }
 
+/* Cache of charset maps.
+
+   A charset map loaded from a text file of the database is saved in
+   a cache file in the user's database directory, and the next
+   loading maps the cache file into memory instead of parsing the
+   text file again.  The cache file consists of MCharsetCache, the
+   decoder of the charset, and the memory block of the frozen
+   encoder, each aligned to CHARSET_CACHE_ALIGN bytes.  */
+
+#ifdef USE_CHARSET_CACHE
+
+#define CHARSET_CACHE_MAGIC "M17NMAP"
+#define CHARSET_CACHE_VERSION 2
+#define CHARSET_CACHE_ALIGN 8
+#define CHARSET_CACHE_ALIGNED(n)					\
+  (((n) + CHARSET_CACHE_ALIGN - 1) & ~(CHARSET_CACHE_ALIGN - 1))
+
+typedef struct
+{
+  char magic[8];
+  int version;
+
+  /* Size of a pointer, as the frozen encoder holds an array of
+     pointers.  */
+  int pointer_size;
+
+  /* Identity of the map file.  */
+  MDatabaseStamp source;
+
+  /* Parameters of the charset that determine the layout of the
+     decoder.  */
+  int dimension;
+  unsigned min_code, max_code;
+  int code_range[16];
+
+  /* Number of elements of the decoder.  */
+  int size;
+
+  /* Range of characters in the encoder.  */
+  int min_char, max_char;
+
+  /* Number of bytes of the arrays of the frozen encoder.  */
+  int values_bytes, index2_bytes, nbytes;
+} MCharsetCache;
+
+/* Return the number of elements of the decoder of CHARSET.  */
+#define DECODER_SIZE(charset)					\
+  ((charset)->code_range[15]					\
+   - ((charset)->min_code - (charset)->code_range_min_code))
+
+/* Set the decoder and the frozen encoder of CHARSET from the cache
+   file for MDB.  Return 0 on success, and -1 if the cache is not
+   available.  */
+
+static int
+load_charset_cache (MCharset *charset, MDatabase *mdb)
+{
+  char *file = mdatabase__cache_file (mdb);
+  MCharsetCache *cache;
+  MFrozenCharTable *frozen;
+  struct stat buf;
+  char *data;
+  int *decoder;
+  int fd, offset, i;
+
+  if (! file)
+    return -1;
+  fd = open (file, O_RDONLY);
+  free (file);
+  if (fd < 0)
+    return -1;
+  if (fstat (fd, &buf) < 0 || buf.st_size < sizeof (MCharsetCache)
+      || ((data = mmap (NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+	  == MAP_FAILED))
+    {
+      close (fd);
+      return -1;
+    }
+  close (fd);
+  cache = (MCharsetCache *) data;
+  offset = (CHARSET_CACHE_ALIGNED (sizeof (MCharsetCache))
+	    + CHARSET_CACHE_ALIGNED (sizeof (int) * cache->size));
+  if (memcmp (cache->magic, CHARSET_CACHE_MAGIC, sizeof cache->magic)
+      || cache->version != CHARSET_CACHE_VERSION
+      || cache->pointer_size != sizeof (void *)
+      || cache->dimension != charset->dimension
+      || cache->min_code != charset->min_code
+      || cache->max_code != charset->max_code
+      || memcmp (cache->code_range, charset->code_range,
+		 sizeof cache->code_range)
+      || cache->size != DECODER_SIZE (charset)
+      || cache->min_char < 0 || cache->min_char > cache->max_char
+      || cache->max_char > MCHAR_MAX
+      || cache->nbytes < 0 || buf.st_size - offset != cache->nbytes
+      || ! mdatabase__cache_valid_p (mdb, &cache->source))
+    {
+      munmap (data, buf.st_size);
+      return -1;
+    }
+  /* The file may be corrupted, so check every element that is used
+     as an index or a character.  */
+  decoder = (int *) (data + CHARSET_CACHE_ALIGNED (sizeof (MCharsetCache)));
+  for (i = 0; i < cache->size; i++)
+    if (decoder[i] < -1 || decoder[i] > MCHAR_MAX)
+      break;
+  if (i < cache->size
+      || ! (frozen = mchartable__frozen_from_data (data + offset,
+						   cache->nbytes,
+						   cache->values_bytes,
+						   cache->index2_bytes)))
+    {
+      munmap (data, buf.st_size);
+      return -1;
+    }
+  charset->decoder = decoder;
+  charset->frozen_encoder = frozen;
+  charset->min_char = cache->min_char;
+  charset->max_char = cache->max_char;
+  charset->cache = data;
+  charset->cache_bytes = buf.st_size;
+  return 0;
+}
+
+/* Save the decoder and the frozen encoder of CHARSET, just loaded
+   from MDB, in the cache file for MDB.  The file is written under a
+   temporary name and then renamed, so that other processes never
+   see it half-written.  Failures are silently ignored.  */
+
+static void
+save_charset_cache (MCharset *charset, MDatabase *mdb)
+{
+  MFrozenCharTable *frozen = charset->frozen_encoder;
+  char *file, *temp;
+  static const char padding[CHARSET_CACHE_ALIGN];
+  MCharsetCache cache;
+  FILE *fp;
+  int ok;
+
+  memset (&cache, 0, sizeof cache);
+  if (mdatabase__stamp (mdb, &cache.source) < 0
+      || ! (file = mdatabase__cache_file (mdb)))
+    return;
+  if (! (temp = malloc (strlen (file) + 12)))
+    {
+      free (file);
+      return;
+    }
+  sprintf (temp, "%s.%X", file, (unsigned) getpid ());
+
+  memcpy (cache.magic, CHARSET_CACHE_MAGIC, sizeof cache.magic);
+  cache.version = CHARSET_CACHE_VERSION;
+  cache.pointer_size = sizeof (void *);
+  cache.dimension = charset->dimension;
+  cache.min_code = charset->min_code;
+  cache.max_code = charset->max_code;
+  memcpy (cache.code_range, charset->code_range, sizeof cache.code_range);
+  cache.size = DECODER_SIZE (charset);
+  cache.min_char = charset->min_char;
+  cache.max_char = charset->max_char;
+  cache.values_bytes = (char *) frozen->index2 - (char *) frozen->values;
+  cache.index2_bytes = (char *) frozen->index1 - (char *) frozen->index2;
+  cache.nbytes = frozen->nbytes;
+
+  if ((fp = fopen (temp, "w")))
+    {
+      int decoder_bytes = sizeof (int) * cache.size;
+
+      ok = (fwrite (&cache, sizeof cache, 1, fp) == 1
+	    && fwrite (padding, CHARSET_CACHE_ALIGNED (sizeof cache)
+		       - sizeof cache, 1, fp) <= 1
+	    && fwrite (charset->decoder, decoder_bytes, 1, fp) == 1
+	    && fwrite (padding, CHARSET_CACHE_ALIGNED (decoder_bytes)
+		       - decoder_bytes, 1, fp) <= 1
+	    && fwrite (frozen->values, frozen->nbytes, 1, fp) == 1);
+      if (fclose (fp) != 0 || ! ok || rename (temp, file) < 0)
+	unlink (temp);
+    }
+  free (temp);
+  free (file);
+}
+
+#endif /* USE_CHARSET_CACHE */
+
 static int
 load_charset_fully (MCharset *charset)
 {
@@ -307,23 +498,51 @@ load_charset_fully (MCharset *charset)
       MDatabase *mdb = mdatabase_find (Mcharset, charset->name, Mnil, Mnil);
       MPlist *plist;
 
-      if (! mdb || ! (plist = mdatabase_load (mdb)))
+      if (! mdb)
 	MERROR (MERROR_CHARSET, -1);
-      charset->decoder = mplist_value (plist);
-      charset->encoder = mplist_value (mplist_next (plist));
-      M17N_OBJECT_UNREF (plist);
-      mchartable_range (charset->encoder,
-			&charset->min_char, &charset->max_char);
+#ifdef USE_CHARSET_CACHE
+      if (load_charset_cache (charset, mdb) < 0)
+#endif
+	{
+	  if (! (plist = mdatabase_load (mdb)))
+	    MERROR (MERROR_CHARSET, -1);
+	  charset->decoder = mplist_value (plist);
+	  charset->encoder = mplist_value (mplist_next (plist));
+	  M17N_OBJECT_UNREF (plist);
+	  charset->frozen_encoder = mchartable__freeze (charset->encoder);
+	  mchartable_range (charset->encoder,
+			    &charset->min_char, &charset->max_char);
+#ifdef USE_CHARSET_CACHE
+	  save_charset_cache (charset, mdb);
+#endif
+	}
       if (charset->method == Mmap)
-	charset->simple = charset->no_code_gap;
+	M17N_STORE_RELEASE (charset->simple, charset->no_code_gap);
       else
 	charset->max_char = charset->unified_max + 1 + charset->code_range[15];
     }
 
-  charset->fully_loaded = 1;
+  M17N_STORE_RELEASE (charset->fully_loaded, 1);
   return 0;
 }
 
+/* Make sure that CHARSET is fully loaded.  Other threads may read
+   CHARSET while it is being loaded, so they see only the flags
+   <simple> and <fully_loaded>, which are set after the data they
+   guard.  */
+
+static int
+prepare_charset (MCharset *charset)
+{
+  int ret = 0;
+
+  M17N_LOCK_REGISTRY ();
+  if (! charset->fully_loaded)
+    ret = load_charset_fully (charset);
+  M17N_UNLOCK_REGISTRY ();
+  return ret;
+}
+
 /** Load a data of type @c charset from the file FD.  */
 
 static void *
@@ -403,6 +622,113 @@ load_charset (FILE *fp, MSymbol charset_name)
   return plist;
 }
 
+/* Subroutine of mchar_define_charset.  Called with the registry
+   lock held.  */
+
+static MSymbol
+define_charset (const char *name, MPlist *plist)
+{
+  MSymbol sym = msymbol (name);
+  MCharset *charset;
+  int i;
+  unsigned min_range, max_range;
+  MPlist *pl;
+  MText *mapfile = (MText *) mplist_get (plist, Mmapfile);
+
+  MSTRUCT_CALLOC (charset, MERROR_CHARSET);
+  charset->name = sym;
+  charset->method = (MSymbol) mplist_get (plist, Mmethod);
+  if (! charset->method)
+    {
+      if (mapfile)
+	charset->method = Mmap;
+      else
+	charset->method = Moffset;
+    }
+  if (charset->method == Mmap || charset->method == Munify)
+    {
+      if (! mapfile)
+	MERROR (MERROR_CHARSET, Mnil);
+      mdatabase_define (Mcharset, sym, Mnil, Mnil, NULL, mapfile->data);
+    }
+  if (! (charset->dimension = (int) mplist_get (plist, Mdimension)))
+    charset->dimension = 1;
+
+  min_range = (unsigned) mplist_get (plist, Mmin_range);
+  if ((pl = mplist_find_by_key (plist, Mmax_range)))
+    {
+      max_range = (unsigned) MPLIST_VAL (pl);
+      if (max_range >= 0x1000000)
+	charset->dimension = 4;
+      else if (max_range >= 0x10000 && charset->dimension < 3)
+	charset->dimension = 3;
+      else if (max_range >= 0x100 && charset->dimension < 2)
+	charset->dimension = 2;
+    }
+  else if (charset->dimension == 1)
+    max_range = 0xFF;
+  else if (charset->dimension == 2)
+    max_range = 0xFFFF;
+  else if (charset->dimension == 3)
+    max_range = 0xFFFFFF;
+  else
+    max_range = 0xFFFFFFFF;
+
+  memset (charset->code_range, 0, sizeof charset->code_range);
+  for (i = 0; i < charset->dimension; i++, min_range >>= 8, max_range >>= 8)
+    {
+      charset->code_range[i * 4] = min_range & 0xFF;
+      charset->code_range[i * 4 + 1] = max_range & 0xFF;
+    }
+  if ((charset->min_code = (int) mplist_get (plist, Mmin_code)) < min_range)
+    charset->min_code = min_range;
+  if ((charset->max_code = (int) mplist_get (plist, Mmax_code)) > max_range)
+    charset->max_code = max_range;
+  charset->ascii_compatible
+    = (MSymbol) mplist_get (plist, Mascii_compatible) != Mnil;
+  charset->final_byte = (int) mplist_get (plist, Mfinal_byte);
+  charset->revision = (int) mplist_get (plist, Mrevision);
+  charset->min_char = (int) mplist_get (plist, Mmin_char);
+  pl = (MPlist *) mplist_get (plist, Mparents);
+  charset->nparents = pl ? mplist_length (pl) : 0;
+  if (charset->nparents > 8)
+    charset->nparents = 8;
+  for (i = 0; i < charset->nparents; i++, pl = MPLIST_NEXT (pl))
+    {
+      MSymbol parent_name;
+
+      if (MPLIST_KEY (pl) != Msymbol)
+	MERROR (MERROR_CHARSET, Mnil);
+      parent_name = MPLIST_SYMBOL (pl);
+      if (! (charset->parents[i] = MCHARSET (parent_name)))
+	MERROR (MERROR_CHARSET, Mnil);
+    }
+
+  charset->subset_offset = (int) mplist_get (plist, Msubset_offset);
+
+  msymbol_put (sym, Mcharset, charset);
+  charset = make_charset (charset);
+  if (! charset)
+    return Mnil;
+  msymbol_put (msymbol__canonicalize (sym), Mcharset, charset);
+
+  for (pl = (MPlist *) mplist_get (plist, Maliases);
+       pl && MPLIST_KEY (pl) == Msymbol;
+       pl = MPLIST_NEXT (pl))
+    {
+      MSymbol alias = MPLIST_SYMBOL (pl);
+
+      msymbol_put (alias, Mcharset, charset);
+      msymbol_put (msymbol__canonicalize (alias), Mcharset, charset);
+    }
+
+  if (mplist_get (plist, Mdefine_coding)
+      && charset->dimension == 1
+      && charset->code_range[0] == 0 && charset->code_range[1] == 255)
+    mconv__register_charset_coding (sym);
+  return (sym);
+}
+
 
 /* Internal API */
 
@@ -502,10 +828,17 @@ mcharset__fini (void)
     {
       MCharset *charset = charset_list.charsets[i];
 
+#ifdef USE_CHARSET_CACHE
+      if (charset->cache)
+	munmap (charset->cache, charset->cache_bytes);
+      else
+#endif
       if (charset->decoder)
 	free (charset->decoder);
       if (charset->encoder)
 	M17N_OBJECT_UNREF (charset->encoder);
+      if (charset->frozen_encoder)
+	M17N_OBJECT_UNREF (charset->frozen_encoder);
       free (charset);
     }
   M17N_OBJECT_UNREF (mcharset__cache);
@@ -522,21 +855,28 @@ mcharset__find (MSymbol name)
 {
   MCharset *charset;
 
+  M17N_LOCK_REGISTRY ();
   charset = msymbol_get (name, Mcharset);
   if (! charset)
     {
       MPlist *param = mplist_get (charset_definition_list, name);
 
-      MPLIST_KEY (mcharset__cache) = Mt;
-      if (! param)
-	return NULL;
-      param = mplist__from_plist (param);
-      mchar_define_charset (MSYMBOL_NAME (name), param);
-      charset = msymbol_get (name, Mcharset);
-      M17N_OBJECT_UNREF (param);
+      if (param)
+	{
+	  param = mplist__from_plist (param);
+	  mchar_define_charset (MSYMBOL_NAME (name), param);
+	  charset = msymbol_get (name, Mcharset);
+	  M17N_OBJECT_UNREF (param);
+	}
     }
-  MPLIST_KEY (mcharset__cache) = name;
-  MPLIST_VAL (mcharset__cache) = charset;
+  if (charset)
+    {
+      MPLIST_KEY (mcharset__cache) = name;
+      MPLIST_VAL (mcharset__cache) = charset;
+    }
+  else
+    MPLIST_KEY (mcharset__cache) = Mt;
+  M17N_UNLOCK_REGISTRY ();
   return charset;
 }
 
@@ -554,8 +894,8 @@ mcharset__decode_char (MCharset *charset, unsigned code)
   if (code < charset->min_code || code > charset->max_code)
     return -1;
 
-  if (! charset->fully_loaded
-      && load_charset_fully (charset) < 0)
+  if (! M17N_LOAD_ACQUIRE (charset->fully_loaded)
+      && prepare_charset (charset) < 0)
     MERROR (MERROR_CHARSET, -1);
 
   if (charset->method == Msubset)
@@ -608,8 +948,8 @@ mcharset__decode_char (MCharset *charset, unsigned code)
 unsigned
 mcharset__encode_char (MCharset *charset, int c)
 {
-  if (! charset->fully_loaded
-      && load_charset_fully (charset) < 0)
+  if (! M17N_LOAD_ACQUIRE (charset->fully_loaded)
+      && prepare_charset (charset) < 0)
     MERROR (MERROR_CHARSET, MCHAR_INVALID_CODE);
 
   if (charset->method == Msubset)
@@ -644,7 +984,7 @@ mcharset__encode_char (MCharset *charset, int c)
     return MCHAR_INVALID_CODE;
 
   if (charset->method == Mmap)
-    return (unsigned) mchartable_lookup (charset->encoder, c);
+    return (unsigned) MFROZEN_CHARTABLE_LOOKUP (charset->frozen_encoder, c);
 
   if (charset->method == Munify)
     {
@@ -653,7 +993,7 @@ mcharset__encode_char (MCharset *charset, int c)
 	  c -= charset->unified_max - 1;
 	  return INDEX_TO_CODE_POINT (charset, c);
 	}
-      return (unsigned) mchartable_lookup (charset->encoder, c);
+      return (unsigned) MFROZEN_CHARTABLE_LOOKUP (charset->frozen_encoder, c);
     }
 
   /* Now charset->method should be Moffset */
@@ -1236,105 +1576,12 @@ MSymbol Msuperset;
 MSymbol
 mchar_define_charset (const char *name, MPlist *plist)
 {
-  MSymbol sym = msymbol (name);
-  MCharset *charset;
-  int i;
-  unsigned min_range, max_range;
-  MPlist *pl;
-  MText *mapfile = (MText *) mplist_get (plist, Mmapfile);
-
-  MSTRUCT_CALLOC (charset, MERROR_CHARSET);
-  charset->name = sym;
-  charset->method = (MSymbol) mplist_get (plist, Mmethod);
-  if (! charset->method)
-    {
-      if (mapfile)
-	charset->method = Mmap;
-      else
-	charset->method = Moffset;
-    }
-  if (charset->method == Mmap || charset->method == Munify)
-    {
-      if (! mapfile)
-	MERROR (MERROR_CHARSET, Mnil);
-      mdatabase_define (Mcharset, sym, Mnil, Mnil, NULL, mapfile->data);
-    }
-  if (! (charset->dimension = (int) mplist_get (plist, Mdimension)))
-    charset->dimension = 1;
-
-  min_range = (unsigned) mplist_get (plist, Mmin_range);
-  if ((pl = mplist_find_by_key (plist, Mmax_range)))
-    {
-      max_range = (unsigned) MPLIST_VAL (pl);
-      if (max_range >= 0x1000000)
-	charset->dimension = 4;
-      else if (max_range >= 0x10000 && charset->dimension < 3)
-	charset->dimension = 3;
-      else if (max_range >= 0x100 && charset->dimension < 2)
-	charset->dimension = 2;
-    }
-  else if (charset->dimension == 1)
-    max_range = 0xFF;
-  else if (charset->dimension == 2)
-    max_range = 0xFFFF;
-  else if (charset->dimension == 3)
-    max_range = 0xFFFFFF;
-  else
-    max_range = 0xFFFFFFFF;
-
-  memset (charset->code_range, 0, sizeof charset->code_range);
-  for (i = 0; i < charset->dimension; i++, min_range >>= 8, max_range >>= 8)
-    {
-      charset->code_range[i * 4] = min_range & 0xFF;
-      charset->code_range[i * 4 + 1] = max_range & 0xFF;
-    }
-  if ((charset->min_code = (int) mplist_get (plist, Mmin_code)) < min_range)
-    charset->min_code = min_range;
-  if ((charset->max_code = (int) mplist_get (plist, Mmax_code)) > max_range)
-    charset->max_code = max_range;
-  charset->ascii_compatible
-    = (MSymbol) mplist_get (plist, Mascii_compatible) != Mnil;
-  charset->final_byte = (int) mplist_get (plist, Mfinal_byte);
-  charset->revision = (int) mplist_get (plist, Mrevision);
-  charset->min_char = (int) mplist_get (plist, Mmin_char);
-  pl = (MPlist *) mplist_get (plist, Mparents);
-  charset->nparents = pl ? mplist_length (pl) : 0;
-  if (charset->nparents > 8)
-    charset->nparents = 8;
-  for (i = 0; i < charset->nparents; i++, pl = MPLIST_NEXT (pl))
-    {
-      MSymbol parent_name;
+  MSymbol sym;
 
-      if (MPLIST_KEY (pl) != Msymbol)
-	MERROR (MERROR_CHARSET, Mnil);
-      parent_name = MPLIST_SYMBOL (pl);
-      if (! (charset->parents[i] = MCHARSET (parent_name)))
-	MERROR (MERROR_CHARSET, Mnil);
-    }
-
-  charset->subset_offset = (int) mplist_get (plist, Msubset_offset);
-
-  msymbol_put (sym, Mcharset, charset);
-  charset = make_charset (charset);
-  if (! charset)
-    return Mnil;
-  msymbol_put (msymbol__canonicalize (sym), Mcharset, charset);
-
-  for (pl = (MPlist *) mplist_get (plist, Maliases);
-       pl && MPLIST_KEY (pl) == Msymbol;
-       pl = MPLIST_NEXT (pl))
-    {
-      MSymbol alias = MPLIST_SYMBOL (pl);
-
-      msymbol_put (alias, Mcharset, charset);
-      msymbol_put (msymbol__canonicalize (alias), Mcharset, charset);
-    }
-
-  if (mplist_get (plist, Mdefine_coding)
-      && charset->dimension == 1
-      && charset->code_range[0] == 0 && charset->code_range[1] == 255)
-    mconv__register_charset_coding (sym);
-  return (sym);
+  M17N_LOCK_REGISTRY ();
+  sym = define_charset (name, plist);
+  M17N_UNLOCK_REGISTRY ();
+  return sym;
 }
 
 /*=*/
@@ -1391,9 +1638,11 @@ mchar_list_charset (MSymbol **symbols)
 {
   int i;
 
+  M17N_LOCK_REGISTRY ();
   MTABLE_MALLOC ((*symbols), charset_list.used, MERROR_CHARSET);
   for (i = 0; i < charset_list.used; i++)
     (*symbols)[i] = charset_list.charsets[i]->name;
+  M17N_UNLOCK_REGISTRY ();
   return i;
 }
 
@@ -1533,6 +1782,26 @@ mchar_map_charset (MSymbol charset_name,
 	  c = next_c;
 	}
     }
+  else if (charset->frozen_encoder)
+    {
+      /* The map was loaded from the cache.  */
+      MFrozenCharTable *frozen = charset->frozen_encoder;
+      int c, from = -1;
+
+      for (c = charset->min_char; c <= charset->max_char; c++)
+	if ((int) MFROZEN_CHARTABLE_LOOKUP (frozen, c) >= 0)
+	  {
+	    if (from < 0)
+	      from = c;
+	  }
+	else if (from >= 0)
+	  {
+	    (*func) (from, c - 1, func_arg);
+	    from = -1;
+	  }
+      if (from >= 0)
+	(*func) (from, charset->max_char, func_arg);
+    }
   else
     (*func) (charset->min_char, charset->max_char, func_arg);
   return 0;
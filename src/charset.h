@@ -27,6 +27,8 @@
     @brief Header for charset handlers.
 */
 
+#include "chartab.h"
+
 enum mcharset_method
   {
     MCHARSET_METHOD_OFFSET,
@@ -118,6 +120,18 @@ struct MCharset
       charset.  Used only when <method> is Mmap or Munify.  */
   MCharTable *encoder;
 
+  /** Frozen char-table of <encoder> to look up a code-point in
+      constant time.  */
+  MFrozenCharTable *frozen_encoder;
+
+  /** Memory block mapped from the cache file that holds <decoder>
+      and the arrays of <frozen_encoder>, or NULL.  If it is not
+      NULL, <encoder> is NULL.  */
+  void *cache;
+
+  /** Number of bytes of <cache>.  */
+  int cache_bytes;
+
   int unified_max;
 
   /** Array of pointers to parent charsets.  Used only when <method>
@@ -142,6 +156,13 @@ extern MPlist *mcharset__cache;
 
 /** Return a charset associated with the symbol CHARSET_SYM.  */
 
+#ifdef M17N_THREADS
+
+/* The one-entry cache can't be shared among threads.  */
+#define MCHARSET(charset_sym) mcharset__find (charset_sym)
+
+#else  /* not M17N_THREADS */
+
 #define MCHARSET(charset_sym)					\
   (((charset_sym) == MPLIST_KEY (mcharset__cache)		\
     || (MPLIST_KEY (mcharset__cache) = (charset_sym),		\
@@ -150,6 +171,8 @@ extern MPlist *mcharset__cache;
    ? MPLIST_VAL (mcharset__cache)				\
    : mcharset__find (charset_sym))
 
+#endif /* not M17N_THREADS */
+
 
 /** Return index of a character whose code-point in CHARSET is CODE.
     If CODE is not valid, return -1.  */
@@ -198,7 +221,7 @@ extern MPlist *mcharset__cache;
    ? (int) (code)							\
    : ((code) < (charset)->min_code || (code) > (charset)->max_code)	\
    ? -1									\
-   : ! (charset)->simple						\
+   : ! M17N_LOAD_ACQUIRE ((charset)->simple)				\
    ? mcharset__decode_char ((charset), (code))				\
    : (charset)->method == Moffset					\
    ? (code) - (charset)->min_code + (charset)->min_char			\
@@ -209,13 +232,13 @@ extern MPlist *mcharset__cache;
     does not contain C, return MCHAR_INVALID_CODE.  */
 
 #define ENCODE_CHAR(charset, c)					\
-  (! (charset)->simple						\
+  (! M17N_LOAD_ACQUIRE ((charset)->simple)			\
    ? mcharset__encode_char ((charset), (c))			\
    : ((c) < (charset)->min_char || (c) > (charset)->max_char)	\
    ? MCHAR_INVALID_CODE						\
    : (charset)->method == Moffset				\
    ? (c) - (charset)->min_char + (charset)->min_code		\
-   : (unsigned) mchartable_lookup ((charset)->encoder, (c)))
+   : (unsigned) MFROZEN_CHARTABLE_LOOKUP ((charset)->frozen_encoder, (c)))
 
 
 extern MCharset *mcharset__ascii;
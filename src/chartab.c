@@ -74,6 +74,7 @@
 #include "m17n-misc.h"
 #include "internal.h"
 #include "symbol.h"
+#include "chartab.h"
 
 static M17NObjectArray chartable_table;
 
@@ -596,6 +597,118 @@ dump_sub_chartab (MSubCharTable *table, void *default_value,
 }
 
 
+/* Support functions for frozen char-tables.  */
+
+/** Numbers of characters covered by an element of INDEX1 and INDEX2
+    of a frozen char-table.  */
+#define FROZEN_CHARS_1 0x1000
+#define FROZEN_CHARS_2 0x80
+
+/** Number of elements of a block of INDEX2.  */
+#define FROZEN_SLOTS_1 (FROZEN_CHARS_1 / FROZEN_CHARS_2)
+
+/** Set of blocks of the same size without duplication.  */
+
+typedef struct
+{
+  /* Number of bytes of each block.  */
+  int block_bytes;
+
+  /* Blocks stored contiguously.  */
+  char *data;
+
+  /* Number of blocks in use and allocated.  */
+  int used, size;
+
+  /* Hash table of blocks.  A nonzero element is an index of a block
+     plus one.  */
+  int *slots;
+  int nslots;
+} FrozenBlocks;
+
+static unsigned
+hash_block (const char *block, int nbytes)
+{
+  unsigned hash = 2166136261u;
+
+  while (nbytes-- > 0)
+    hash = (hash ^ (unsigned char) *block++) * 16777619u;
+  return hash;
+}
+
+static void
+rehash_blocks (FrozenBlocks *blocks)
+{
+  int i;
+
+  free (blocks->slots);
+  blocks->nslots *= 2;
+  MTABLE_CALLOC (blocks->slots, blocks->nslots, MERROR_CHARTABLE);
+  for (i = 0; i < blocks->used; i++)
+    {
+      unsigned j = hash_block (blocks->data + blocks->block_bytes * i,
+			       blocks->block_bytes);
+
+      for (j &= blocks->nslots - 1; blocks->slots[j];
+	   j = (j + 1) & (blocks->nslots - 1));
+      blocks->slots[j] = i + 1;
+    }
+}
+
+/** Return the index of a block in BLOCKS whose contents are the same
+    as BLOCK.  If there is no such block, add BLOCK to BLOCKS.  */
+
+static int
+intern_block (FrozenBlocks *blocks, const void *block)
+{
+  int nbytes = blocks->block_bytes;
+  unsigned i = hash_block (block, nbytes) & (blocks->nslots - 1);
+
+  for (; blocks->slots[i]; i = (i + 1) & (blocks->nslots - 1))
+    if (! memcmp (blocks->data + nbytes * (blocks->slots[i] - 1),
+		  block, nbytes))
+      return blocks->slots[i] - 1;
+  if (blocks->used == blocks->size)
+    {
+      blocks->size *= 2;
+      MTABLE_REALLOC (blocks->data, nbytes * blocks->size, MERROR_CHARTABLE);
+    }
+  memcpy (blocks->data + nbytes * blocks->used, block, nbytes);
+  blocks->slots[i] = ++blocks->used;
+  if (blocks->used * 2 > blocks->nslots)
+    rehash_blocks (blocks);
+  return blocks->used - 1;
+}
+
+static void
+init_blocks (FrozenBlocks *blocks, int block_bytes)
+{
+  blocks->block_bytes = block_bytes;
+  blocks->used = 0;
+  blocks->size = 16;
+  MTABLE_MALLOC (blocks->data, block_bytes * blocks->size, MERROR_CHARTABLE);
+  blocks->nslots = 64;
+  MTABLE_CALLOC (blocks->slots, blocks->nslots, MERROR_CHARTABLE);
+}
+
+static void
+free_blocks (FrozenBlocks *blocks)
+{
+  free (blocks->data);
+  free (blocks->slots);
+}
+
+static void
+free_frozen_chartable (void *object)
+{
+  MFrozenCharTable *frozen = (MFrozenCharTable *) object;
+
+  M17N_OBJECT_UNREF (frozen->table);
+  if (! frozen->external)
+    free (frozen->values);
+  free (frozen);
+}
+
 /* Internal API */
 
 int
@@ -616,6 +729,150 @@ mchartable__lookup (MCharTable *table, int c, int *next_c, int default_p)
   return lookup_chartable (&table->subtable, c, next_c, default_p);
 }
 
+/** Create a frozen char-table from TABLE.  TABLE must not be
+    modified while the returned object is alive.  The caller must
+    unref the returned object when it is no longer used.  */
+
+MFrozenCharTable *
+mchartable__freeze (MCharTable *table)
+{
+  MFrozenCharTable *frozen;
+  FrozenBlocks values, index2;
+  int nindex1 = (MCHAR_MAX / FROZEN_CHARS_1) + 1;
+  unsigned *index1;
+  void *value_block[FROZEN_CHARS_2];
+  unsigned index_block[FROZEN_SLOTS_1];
+  int values_bytes, index2_bytes, index1_bytes;
+  char *data;
+  void *val = NULL;
+  int i, j, k, c, next_c;
+  /* Offset of the last block of VALUES filled with UNIFORM_VAL, or
+     -1.  Most of the table is covered by such blocks, so they are
+     given without hashing.  */
+  int uniform = -1;
+  void *uniform_val = NULL;
+
+  init_blocks (&values, sizeof value_block);
+  init_blocks (&index2, sizeof index_block);
+  MTABLE_MALLOC (index1, nindex1, MERROR_CHARTABLE);
+
+  for (i = c = next_c = 0; i < nindex1; i++)
+    {
+      for (j = 0; j < FROZEN_SLOTS_1; j++)
+	{
+	  if (c == next_c)
+	    val = lookup_chartable (&table->subtable, c, &next_c, 0);
+	  if (c + FROZEN_CHARS_2 <= next_c)
+	    {
+	      if (uniform < 0 || uniform_val != val)
+		{
+		  for (k = 0; k < FROZEN_CHARS_2; k++)
+		    value_block[k] = val;
+		  uniform = intern_block (&values, value_block) * FROZEN_CHARS_2;
+		  uniform_val = val;
+		}
+	      index_block[j] = uniform;
+	      c += FROZEN_CHARS_2;
+	      continue;
+	    }
+	  for (k = 0; k < FROZEN_CHARS_2; k++, c++)
+	    {
+	      if (c == next_c)
+		val = lookup_chartable (&table->subtable, c, &next_c, 0);
+	      value_block[k] = val;
+	    }
+	  index_block[j] = intern_block (&values, value_block) * FROZEN_CHARS_2;
+	}
+      /* Most of the blocks of INDEX2 are the same as the previous one.  */
+      if (i > 0
+	  && ! memcmp (index2.data + index1[i - 1] / FROZEN_SLOTS_1
+		       * index2.block_bytes, index_block, sizeof index_block))
+	index1[i] = index1[i - 1];
+      else
+	index1[i] = intern_block (&index2, index_block) * FROZEN_SLOTS_1;
+    }
+
+  values_bytes = values.block_bytes * values.used;
+  index2_bytes = index2.block_bytes * index2.used;
+  index1_bytes = sizeof (unsigned) * nindex1;
+  MTABLE_MALLOC (data, values_bytes + index2_bytes + index1_bytes,
+		 MERROR_CHARTABLE);
+  memcpy (data, values.data, values_bytes);
+  memcpy (data + values_bytes, index2.data, index2_bytes);
+  memcpy (data + values_bytes + index2_bytes, index1, index1_bytes);
+  free_blocks (&values);
+  free_blocks (&index2);
+  free (index1);
+
+  M17N_OBJECT (frozen, free_frozen_chartable, MERROR_CHARTABLE);
+  frozen->table = table;
+  M17N_OBJECT_REF (table);
+  frozen->values = (void **) data;
+  frozen->index2 = (unsigned *) (data + values_bytes);
+  frozen->index1 = (unsigned *) (data + values_bytes + index2_bytes);
+  frozen->nbytes = values_bytes + index2_bytes + index1_bytes;
+  return frozen;
+}
+
+/** Return a frozen char-table whose arrays are in DATA, a copy of the
+    memory block of another frozen char-table.  DATA has NBYTES bytes,
+    the first VALUES_BYTES bytes of which are for <values>, and the
+    next INDEX2_BYTES bytes are for <index2>.  DATA must be kept while
+    the returned object is alive, and is not freed with it.  The
+    returned object has no original char-table.
+
+    As DATA may come from a file, return NULL if the sizes do not
+    agree with NBYTES or an element of <index1> or <index2> points
+    outside of the array it indexes, so that no lookup can read
+    outside of DATA.  */
+
+MFrozenCharTable *
+mchartable__frozen_from_data (char *data, int nbytes, int values_bytes,
+			      int index2_bytes)
+{
+  MFrozenCharTable *frozen;
+  int nindex1 = (MCHAR_MAX / FROZEN_CHARS_1) + 1;
+  int index1_bytes = sizeof (unsigned) * nindex1;
+  unsigned nvalues, nindex2, *index1, *index2;
+  int i;
+
+  if (values_bytes < 0 || index2_bytes < 0
+      || values_bytes % (sizeof (void *) * FROZEN_CHARS_2)
+      || index2_bytes % (sizeof (unsigned) * FROZEN_SLOTS_1)
+      || nbytes < index1_bytes
+      || values_bytes > nbytes - index1_bytes
+      || index2_bytes != nbytes - index1_bytes - values_bytes)
+    return NULL;
+  nvalues = values_bytes / sizeof (void *);
+  nindex2 = index2_bytes / sizeof (unsigned);
+  index2 = (unsigned *) (data + values_bytes);
+  index1 = (unsigned *) (data + values_bytes + index2_bytes);
+  for (i = 0; i < nindex1; i++)
+    if (index1[i] % FROZEN_SLOTS_1 || index1[i] >= nindex2)
+      return NULL;
+  for (i = 0; i < nindex2; i++)
+    if (index2[i] % FROZEN_CHARS_2 || index2[i] >= nvalues)
+      return NULL;
+
+  M17N_OBJECT (frozen, free_frozen_chartable, MERROR_CHARTABLE);
+  frozen->values = (void **) data;
+  frozen->index2 = (unsigned *) (data + values_bytes);
+  frozen->index1 = (unsigned *) (data + values_bytes + index2_bytes);
+  frozen->nbytes = values_bytes + index2_bytes + index1_bytes;
+  frozen->external = 1;
+  return frozen;
+}
+
+/** Return the value of character C in frozen char-table FROZEN.  If C
+    is not a valid character, return NULL.  */
+
+void *
+mchartable__frozen_lookup (MFrozenCharTable *frozen, int c)
+{
+  M_CHECK_CHAR (c, NULL);
+  return MFROZEN_CHARTABLE_LOOKUP (frozen, c);
+}
+
 /*** @} */
 #endif /* !FOR_DOXYGEN || DOXYGEN_INTERNAL_MODULE */
 
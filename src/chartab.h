@@ -26,5 +26,52 @@
 extern void *mchartable__lookup (MCharTable *table, int c,
 				 int *next_c, int default_p);
 
+/** Frozen char-table.
+
+    A frozen char-table is an immutable snapshot of a char-table in a
+    three-stage lookup array.  The value of character C is
+    VALUES[INDEX2[INDEX1[C >> 12] + ((C >> 7) & 0x1F)] + (C & 0x7F)].
+    Identical blocks of INDEX2 and VALUES are shared, and all arrays
+    are allocated in one memory block.  */
+
+typedef struct
+{
+  M17NObject control;
+
+  /** The original char-table.  It must not be modified while the
+      frozen char-table is alive.  */
+  MCharTable *table;
+
+  /** Offsets into <index2> for each 4096 characters.  */
+  unsigned *index1;
+
+  /** Offsets into <values> for each 128 characters.  */
+  unsigned *index2;
+
+  /** Values of characters.  */
+  void **values;
+
+  /** Number of bytes of the memory block holding the arrays.  */
+  int nbytes;
+
+  /** Nonzero if the memory block is not owned by the frozen
+      char-table (e.g. it is mapped from a file).  */
+  int external;
+} MFrozenCharTable;
+
+#define MFROZEN_CHARTABLE_LOOKUP(frozen, c)				\
+  ((frozen)->values[(frozen)->index2[(frozen)->index1[(c) >> 12]	\
+				     + (((c) >> 7) & 0x1F)]		\
+		    + ((c) & 0x7F)])
+
+extern MFrozenCharTable *mchartable__freeze (MCharTable *table);
+
+extern void *mchartable__frozen_lookup (MFrozenCharTable *frozen, int c);
+
+extern MFrozenCharTable *mchartable__frozen_from_data (char *data,
+						       int nbytes,
+						       int values_bytes,
+						       int index2_bytes);
+
 #endif /* not _M17N_CHARTAB_H_ */
 
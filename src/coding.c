@@ -63,8 +63,18 @@
 #include <ctype.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#if defined (HAVE_SYS_MMAN_H) && defined (HAVE_MMAP)
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
+#if defined (__SSE2__) && defined (__GNUC__)
+#include <immintrin.h>
+#endif
 
 #include "m17n.h"
 #include "m17n-misc.h"
@@ -196,6 +206,38 @@ typedef struct {
     作業領域 */
   MText *work_mt;
 
+  /**en
+     Characters decoded ahead by mconv_getc () and not yet read.  */
+  /**ja
+     mconv_getc () が先読みしてデコードした、まだ読まれていない文字 */
+  MText *ahead;
+
+  /**en
+     Number of bytes already read in ahead. */
+  /**ja
+     ahead 内ですでに読まれたバイト数 */
+  int ahead_used;
+
+  /**en
+     Nonzero if buf is a file mapped by mconv_file_converter ().  */
+  /**ja
+     buf が mconv_file_converter () によってマップされたファイルならば
+     0 以外 */
+  int mapped;
+
+  /**en
+     Number of bytes at the head of the mapped file whose pages are
+     already released.  */
+  /**ja
+     マップされたファイルの先頭で、ページがすでに解放されたバイト数 */
+  int released;
+
+  /**en
+     Nonzero if fp was opened by mconv_file_converter ().  */
+  /**ja
+     fp が mconv_file_converter () によって開かれたならば 0 以外 */
+  int owns_fp;
+
   int seekable;
 } MConverterStatus;
 
@@ -363,6 +405,25 @@ typedef struct {
   } while (0)
 
 
+/* Copy a run of ASCII characters at SRC to DST at once.  This is for
+   an encoder that encodes ASCII characters as is.  The run is
+   truncated so that it fits in the space left in DST.  */
+
+#define COPY_ASCII_SPAN(format)					\
+  do {								\
+    if (format <= MTEXT_FORMAT_UTF_8				\
+	&& src < src_end && *src < 0x80)			\
+      {								\
+	int n = mtext__ascii_span (src, src_end);		\
+								\
+	if (n > dst_end - dst)					\
+	  n = dst_end - dst;					\
+	memcpy (dst, src, n);					\
+	dst += n, src += n, nchars += n;			\
+      }								\
+  } while (0)
+
+
 static int
 encode_unsupporeted_char (int c, unsigned char *dst, unsigned char *dst_end,
 			  MText *mt, int pos)
@@ -615,6 +676,8 @@ encode_coding_charset (MText *mt, int from, int to,
     {
       int c, bytes;
 
+      if (ascii_compatible)
+	COPY_ASCII_SPAN (format);
       ONE_MORE_CHAR (c, bytes, format);
 
       if (c < 0x80 && ascii_compatible)
@@ -738,6 +801,28 @@ decode_coding_utf_8 (const unsigned char *source, int src_bytes, MText *mt,
       int c, c1, bytes;
       MCharset *this_charset = NULL;
 
+      if (src_stop == src_end && ! charset)
+	{
+	  /* Copy a run of ASCII characters at once.  */
+	  int n = mtext__ascii_span (src, src_end);
+
+	  if (at_most > 0 && n > at_most - nchars)
+	    n = at_most - nchars;
+	  if (n > 0)
+	    {
+	      if (dst + n + 1 > dst_end)
+		{
+		  int len = dst - mt->data;
+
+		  mtext__enlarge (mt, len + n + (src_end - src));
+		  dst = mt->data + len;
+		  dst_end = mt->data + mt->allocated;
+		}
+	      memcpy (dst, src, n);
+	      dst += n, src += n, nchars += n;
+	    }
+	}
+
       ONE_MORE_BASE_BYTE (c);
 
       if (!(c & 0x80))
@@ -923,6 +1008,312 @@ reset_coding_utf (MConverter *converter)
   return 0;
 }
 
+/* Fast paths for UTF-16 and UTF-32.
+
+   decode_utf_16_run () and decode_utf_32_run () convert code units
+   to UTF-8 sequences until they meet a code unit that the generic
+   loop of a decoder must handle (a surrogate, or an invalid code for
+   UTF-32).  encode_utf_16_run () and encode_utf_32_run () do the
+   reverse for UTF-8 M-text data until they meet a character outside
+   of BMP (for UTF-16) or an invalid character.  The byte order is
+   resolved once per call by byte indices instead of being checked
+   for each code unit.  With SSE2, runs of ASCII characters are
+   converted 16 bytes at a time, the byte order is handled by shifting
+   whole vectors, and UTF-16 code units are checked for surrogates 8
+   at a time.  */
+
+/* Maximum number of code units that the UTF-16 and UTF-32 decoders
+   decode by one call of decode_utf_16_run () or decode_utf_32_run ().
+   The room for the worst case is made before each call, so this
+   bounds the room made beyond the decoded bytes.  */
+#define UTF_RUN_MAX_UNITS 0x10000
+
+/* Decode at most NUNITS UTF-16 code units at *SRCP into UTF-8
+   sequences at *DSTP, which must have room for 3 bytes per code unit.
+   Stop at a surrogate.  Update *SRCP and *DSTP, and return the number
+   of decoded characters.  */
+
+static int
+decode_utf_16_run (const unsigned char **srcp, unsigned char **dstp,
+		   int nunits, int big_endian)
+{
+  const unsigned char *src = *srcp;
+  const unsigned char *src_end = src + nunits * 2;
+  unsigned char *dst = *dstp;
+  int hi = big_endian ? 0 : 1;
+  int c;
+
+#if defined (__SSE2__) && defined (__GNUC__)
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i non_ascii = _mm_set1_epi16 ((short) (big_endian ? 0x80FF : 0xFF80));
+  __m128i surrogate_mask = _mm_set1_epi16 ((short) 0xF800);
+  __m128i surrogate = _mm_set1_epi16 ((short) 0xD800);
+
+  while (src_end - src >= 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) src);
+      const unsigned char *block_end = src + 16;
+
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi16 (_mm_and_si128 (v, non_ascii),
+					      zero)) == 0xFFFF)
+	{
+	  if (big_endian)
+	    v = _mm_srli_epi16 (v, 8);
+	  _mm_storel_epi64 ((__m128i *) dst, _mm_packus_epi16 (v, v));
+	  src += 16, dst += 8;
+	  continue;
+	}
+      if (big_endian)
+	v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi16 (_mm_and_si128 (v,
+							     surrogate_mask),
+					      surrogate)))
+	break;
+      for (; src < block_end; src += 2)
+	{
+	  c = (src[hi] << 8) | src[hi ^ 1];
+	  dst += CHAR_STRING (c, dst);
+	}
+    }
+#endif	/* __SSE2__ && __GNUC__ */
+
+  for (; src < src_end; src += 2)
+    {
+      c = (src[hi] << 8) | src[hi ^ 1];
+      if (c >= 0xD800 && c < 0xE000)
+	break;
+      dst += CHAR_STRING (c, dst);
+    }
+  nunits = (src - *srcp) / 2;
+  *srcp = src;
+  *dstp = dst;
+  return nunits;
+}
+
+/* Decode at most NUNITS UTF-32 code units at *SRCP into UTF-8
+   sequences at *DSTP, which must have room for 4 bytes per code unit.
+   Stop at an invalid code.  Update *SRCP and *DSTP, and return the
+   number of decoded characters.  */
+
+static int
+decode_utf_32_run (const unsigned char **srcp, unsigned char **dstp,
+		   int nunits, int big_endian)
+{
+  const unsigned char *src = *srcp;
+  const unsigned char *src_end = src + nunits * 4;
+  unsigned char *dst = *dstp;
+  int lo = big_endian ? 3 : 0;
+  unsigned c;
+
+#if defined (__SSE2__) && defined (__GNUC__)
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i non_ascii = _mm_set1_epi32 ((int) (big_endian ? 0x80FFFFFF
+						: 0xFFFFFF80));
+
+  while (src_end - src >= 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) src);
+      const unsigned char *block_end = src + 16;
+
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (_mm_and_si128 (v, non_ascii),
+					      zero)) == 0xFFFF)
+	{
+	  int word;
+
+	  if (big_endian)
+	    v = _mm_srli_epi32 (v, 24);
+	  v = _mm_packs_epi32 (v, v);
+	  word = _mm_cvtsi128_si32 (_mm_packus_epi16 (v, v));
+	  memcpy (dst, &word, 4);
+	  src += 16, dst += 4;
+	  continue;
+	}
+      for (; src < block_end; src += 4)
+	{
+	  c = (src[lo] | (src[lo ^ 1] << 8) | (src[lo ^ 2] << 16)
+	       | ((unsigned) src[lo ^ 3] << 24));
+	  if (c >= 0x110000 || (c >= 0xD800 && c < 0xE000))
+	    break;
+	  dst += CHAR_STRING (c, dst);
+	}
+      if (src < block_end)
+	break;
+    }
+#endif	/* __SSE2__ && __GNUC__ */
+
+  for (; src < src_end; src += 4)
+    {
+      c = (src[lo] | (src[lo ^ 1] << 8) | (src[lo ^ 2] << 16)
+	   | ((unsigned) src[lo ^ 3] << 24));
+      if (c >= 0x110000 || (c >= 0xD800 && c < 0xE000))
+	break;
+      dst += CHAR_STRING (c, dst);
+    }
+  nunits = (src - *srcp) / 4;
+  *srcp = src;
+  *dstp = dst;
+  return nunits;
+}
+
+/* Encode the characters of UTF-8 M-text data at *SRCP (not beyond
+   SRC_END) into UTF-16 code units at *DSTP (not beyond DST_END).
+   Stop at a surrogate or a character outside of BMP.  Update *SRCP
+   and *DSTP, and return the number of encoded characters.  */
+
+static int
+encode_utf_16_run (unsigned char **srcp, unsigned char *src_end,
+		   unsigned char **dstp, unsigned char *dst_end,
+		   int big_endian)
+{
+  unsigned char *src = *srcp;
+  unsigned char *dst = *dstp;
+  int hi = big_endian ? 0 : 1;
+  int nchars = 0;
+  int c, bytes;
+
+#if defined (__SSE2__) && defined (__GNUC__)
+  __m128i zero = _mm_setzero_si128 ();
+
+  while (src_end - src >= 16 && dst_end - dst >= 32)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) src);
+      unsigned char *block_end = src + 16;
+
+      if (_mm_movemask_epi8 (v))
+	{
+	  /* Encode the characters starting in this block one by one.
+	     They need at most 32 bytes.  */
+	  while (src < block_end)
+	    {
+	      c = STRING_CHAR_AND_BYTES (src, bytes);
+	      if (c >= 0x10000 || (c >= 0xD800 && c < 0xE000))
+		break;
+	      dst[hi] = c >> 8;
+	      dst[hi ^ 1] = c & 0xFF;
+	      src += bytes, dst += 2, nchars++;
+	    }
+	  if (src < block_end)
+	    break;
+	  continue;
+	}
+      if (big_endian)
+	{
+	  _mm_storeu_si128 ((__m128i *) dst, _mm_unpacklo_epi8 (zero, v));
+	  _mm_storeu_si128 ((__m128i *) (dst + 16),
+			    _mm_unpackhi_epi8 (zero, v));
+	}
+      else
+	{
+	  _mm_storeu_si128 ((__m128i *) dst, _mm_unpacklo_epi8 (v, zero));
+	  _mm_storeu_si128 ((__m128i *) (dst + 16),
+			    _mm_unpackhi_epi8 (v, zero));
+	}
+      src += 16, dst += 32, nchars += 16;
+    }
+#endif	/* __SSE2__ && __GNUC__ */
+
+  while (src < src_end && dst + 2 <= dst_end)
+    {
+      c = STRING_CHAR_AND_BYTES (src, bytes);
+      if (c >= 0x10000 || (c >= 0xD800 && c < 0xE000))
+	break;
+      dst[hi] = c >> 8;
+      dst[hi ^ 1] = c & 0xFF;
+      src += bytes, dst += 2, nchars++;
+    }
+  *srcp = src;
+  *dstp = dst;
+  return nchars;
+}
+
+/* Encode the characters of UTF-8 M-text data at *SRCP (not beyond
+   SRC_END) into UTF-32 code units at *DSTP (not beyond DST_END).
+   Stop at an invalid character.  Update *SRCP and *DSTP, and return
+   the number of encoded characters.  */
+
+static int
+encode_utf_32_run (unsigned char **srcp, unsigned char *src_end,
+		   unsigned char **dstp, unsigned char *dst_end,
+		   int big_endian)
+{
+  unsigned char *src = *srcp;
+  unsigned char *dst = *dstp;
+  int lo = big_endian ? 3 : 0;
+  int nchars = 0;
+  int c, bytes;
+
+#if defined (__SSE2__) && defined (__GNUC__)
+  __m128i zero = _mm_setzero_si128 ();
+
+  while (src_end - src >= 16 && dst_end - dst >= 64)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) src);
+      unsigned char *block_end = src + 16;
+      __m128i v0, v1;
+
+      if (_mm_movemask_epi8 (v))
+	{
+	  /* Encode the characters starting in this block one by one.
+	     They need at most 64 bytes.  */
+	  while (src < block_end)
+	    {
+	      c = STRING_CHAR_AND_BYTES (src, bytes);
+	      if (c >= 0x110000 || (c >= 0xD800 && c < 0xE000))
+		break;
+	      dst[lo] = c & 0xFF;
+	      dst[lo ^ 1] = (c >> 8) & 0xFF;
+	      dst[lo ^ 2] = c >> 16;
+	      dst[lo ^ 3] = 0;
+	      src += bytes, dst += 4, nchars++;
+	    }
+	  if (src < block_end)
+	    break;
+	  continue;
+	}
+      if (big_endian)
+	{
+	  v0 = _mm_unpacklo_epi8 (zero, v);
+	  v1 = _mm_unpackhi_epi8 (zero, v);
+	  _mm_storeu_si128 ((__m128i *) dst, _mm_unpacklo_epi16 (zero, v0));
+	  _mm_storeu_si128 ((__m128i *) (dst + 16),
+			    _mm_unpackhi_epi16 (zero, v0));
+	  _mm_storeu_si128 ((__m128i *) (dst + 32),
+			    _mm_unpacklo_epi16 (zero, v1));
+	  _mm_storeu_si128 ((__m128i *) (dst + 48),
+			    _mm_unpackhi_epi16 (zero, v1));
+	}
+      else
+	{
+	  v0 = _mm_unpacklo_epi8 (v, zero);
+	  v1 = _mm_unpackhi_epi8 (v, zero);
+	  _mm_storeu_si128 ((__m128i *) dst, _mm_unpacklo_epi16 (v0, zero));
+	  _mm_storeu_si128 ((__m128i *) (dst + 16),
+			    _mm_unpackhi_epi16 (v0, zero));
+	  _mm_storeu_si128 ((__m128i *) (dst + 32),
+			    _mm_unpacklo_epi16 (v1, zero));
+	  _mm_storeu_si128 ((__m128i *) (dst + 48),
+			    _mm_unpackhi_epi16 (v1, zero));
+	}
+      src += 16, dst += 64, nchars += 16;
+    }
+#endif	/* __SSE2__ && __GNUC__ */
+
+  while (src < src_end && dst + 4 <= dst_end)
+    {
+      c = STRING_CHAR_AND_BYTES (src, bytes);
+      if (c >= 0x110000 || (c >= 0xD800 && c < 0xE000))
+	break;
+      dst[lo] = c & 0xFF;
+      dst[lo ^ 1] = (c >> 8) & 0xFF;
+      dst[lo ^ 2] = c >> 16;
+      dst[lo ^ 3] = 0;
+      src += bytes, dst += 4, nchars++;
+    }
+  *srcp = src;
+  *dstp = dst;
+  return nchars;
+}
+
 static int
 decode_coding_utf_16 (const unsigned char *source, int src_bytes, MText *mt,
 		      MConverter *converter)
@@ -972,6 +1363,30 @@ decode_coding_utf_16 (const unsigned char *source, int src_bytes, MText *mt,
       int c, c1;
       MCharset *this_charset = NULL;
 
+      if (src_stop == src_end && ! charset)
+	{
+	  /* Decode a run of BMP characters at once.  */
+	  int n = (src_end - src) / 2;
+
+	  if (n > UTF_RUN_MAX_UNITS)
+	    n = UTF_RUN_MAX_UNITS;
+	  if (at_most > 0 && n > at_most - nchars)
+	    n = at_most - nchars;
+	  if (n > 0)
+	    {
+	      if (dst + n * 3 + 1 > dst_end)
+		{
+		  int len = dst - mt->data;
+
+		  mtext__enlarge (mt, len + n * 3 + 1);
+		  dst = mt->data + len;
+		  dst_end = mt->data + mt->allocated;
+		}
+	      nchars += decode_utf_16_run (&src, &dst, n,
+					   status->endian == UTF_BIG_ENDIAN);
+	    }
+	}
+
       ONE_MORE_BASE_BYTE (b1);
       ONE_MORE_BYTE (b2);
       if (status->endian == UTF_BIG_ENDIAN)
@@ -1078,6 +1493,30 @@ decode_coding_utf_32 (const unsigned char *source, int src_bytes, MText *mt,
       unsigned c;
       MCharset *this_charset = NULL;
 
+      if (src_stop == src_end && ! charset)
+	{
+	  /* Decode a run of valid characters at once.  */
+	  int n = (src_end - src) / 4;
+
+	  if (n > UTF_RUN_MAX_UNITS)
+	    n = UTF_RUN_MAX_UNITS;
+	  if (at_most > 0 && n > at_most - nchars)
+	    n = at_most - nchars;
+	  if (n > 0)
+	    {
+	      if (dst + n * 4 + 1 > dst_end)
+		{
+		  int len = dst - mt->data;
+
+		  mtext__enlarge (mt, len + n * 4 + 1);
+		  dst = mt->data + len;
+		  dst_end = mt->data + mt->allocated;
+		}
+	      nchars += decode_utf_32_run (&src, &dst, n,
+					   status->endian == UTF_BIG_ENDIAN);
+	    }
+	}
+
       ONE_MORE_BASE_BYTE (b1);
       ONE_MORE_BYTE (b2);
       ONE_MORE_BYTE (b3);
@@ -1145,6 +1584,8 @@ encode_coding_utf_16 (MText *mt, int from, int to,
     {
       int c, bytes;
 
+      if (format <= MTEXT_FORMAT_UTF_8)
+	nchars += encode_utf_16_run (&src, src_end, &dst, dst_end, big_endian);
       ONE_MORE_CHAR (c, bytes, format);
 
       if (c < 0xD800 || (c >= 0xE000 && c < 0x10000))
@@ -1233,6 +1674,8 @@ encode_coding_utf_32 (MText *mt, int from, int to,
     {
       int c, bytes;
 
+      if (format <= MTEXT_FORMAT_UTF_8)
+	nchars += encode_utf_32_run (&src, src_end, &dst, dst_end, big_endian);
       ONE_MORE_CHAR (c, bytes, format);
 
       if (c < 0xD800 || (c >= 0xE000 && c < 0x110000))
@@ -2322,6 +2765,8 @@ encode_coding_iso_2022 (MText *mt, int from, int to,
     {
       int bytes, c;
 
+      if (ascii_compatible && ! status->utf8_shifting)
+	COPY_ASCII_SPAN (format);
       dst_base = dst;
       ONE_MORE_CHAR (c, bytes, format);
 
@@ -2641,11 +3086,21 @@ reset_coding_sjis (MConverter *converter)
       MSymbol kana_sym = msymbol ("jisx0201-kana");
       MCharset *kana = MCHARSET (kana_sym);
 
+      MCharset *roman = coding->charsets[0];
+      int c;
+
       if (! kanji || ! kana)
 	return -1;
       coding->ncharsets = 3;
       coding->charsets[1] = kanji;
       coding->charsets[2] = kana;
+      /* The encoder emits a graphic ASCII character as is if it is
+	 in the roman charset.  If all of them are, ASCII runs can be
+	 copied at once.  */
+      for (c = 0x21; c < 0x7F; c++)
+	if (ENCODE_CHAR (roman, c) == MCHAR_INVALID_CODE)
+	  break;
+      coding->ascii_compatible = c == 0x7F;
     }
   coding->ready = 1;
   return 0;
@@ -2752,6 +3207,7 @@ encode_coding_sjis (MText *mt, int from, int to,
   MCharset *charset_roman = coding->charsets[0];
   MCharset *charset_kanji = coding->charsets[1];
   MCharset *charset_kana = coding->charsets[2];
+  int ascii_compatible = coding->ascii_compatible;
   enum MTextFormat format = mt->format;
 
   SET_SRC (mt, format, from, to);
@@ -2761,6 +3217,8 @@ encode_coding_sjis (MText *mt, int from, int to,
       int c, bytes, len;
       unsigned code;
 
+      if (ascii_compatible)
+	COPY_ASCII_SPAN (format);
       ONE_MORE_CHAR (c, bytes, format);
 
       if (c <= 0x20 || c == 0x7F)
@@ -2818,73 +3276,1456 @@ encode_coding_sjis (MText *mt, int from, int to,
 }
 
 
-static MCodingSystem *
-find_coding (MSymbol name)
+/* Subroutine of mconv_define_coding.  Called with the registry lock
+   held.  */
+
+static MSymbol
+define_coding (const char *name, MPlist *plist,
+	       int (*resetter) (MConverter *),
+	       int (*decoder) (const unsigned char *, int, MText *,
+			       MConverter *),
+	       int (*encoder) (MText *, int, int,
+			       unsigned char *, int,
+			       MConverter *),
+	       void *extra_info)
 {
-  MCodingSystem *coding = (MCodingSystem *) msymbol_get (name, Mcoding);
+  MSymbol sym = msymbol (name);
+  int i;
+  MCodingSystem *coding;
+  MPlist *pl;
 
-  if (! coding)
+  MSTRUCT_MALLOC (coding, MERROR_CODING);
+  coding->name = sym;
+  if ((coding->type = (MSymbol) mplist_get (plist, Mtype)) == Mnil)
+    coding->type = Mcharset;
+  pl = (MPlist *) mplist_get (plist, Mcharsets);
+  if (! pl)
+    MERROR (MERROR_CODING, Mnil);
+  coding->ncharsets = mplist_length (pl);
+  if (coding->ncharsets > NUM_SUPPORTED_CHARSETS)
+    coding->ncharsets = NUM_SUPPORTED_CHARSETS;
+  for (i = 0; i < coding->ncharsets; i++, pl = MPLIST_NEXT (pl))
     {
-      MPlist *plist, *pl;
-      MSymbol sym = msymbol__canonicalize (name);
+      MSymbol charset_name;
 
-      plist = mplist_find_by_key (coding_definition_list, sym);
-      if (! plist)
-	return NULL;
-      pl = MPLIST_PLIST (plist);
-      name = MPLIST_VAL (pl);
-      mconv_define_coding (MSYMBOL_NAME (name), MPLIST_NEXT (pl),
-			   NULL, NULL, NULL, NULL);
-      coding = (MCodingSystem *) msymbol_get (name, Mcoding);
-      plist = mplist_pop (plist);
-      M17N_OBJECT_UNREF (plist);
+      if (MPLIST_KEY (pl) != Msymbol)
+	MERROR (MERROR_CODING, Mnil);
+      charset_name = MPLIST_SYMBOL (pl);
+      if (! (coding->charsets[i] = MCHARSET (charset_name)))
+	MERROR (MERROR_CODING, Mnil);
     }
-  return coding;
-}
-
-#define BINDING_NONE 0
-#define BINDING_BUFFER 1
-#define BINDING_STREAM 2
-
-#define CONVERT_WORKSIZE 0x10000
-
-
-/* Internal API */
-
-int
-mcoding__init (void)
-{
-  int i;
-  MPlist *param, *charsets, *pl;
-
-  MLIST_INIT1 (&coding_list, codings, 128);
-  coding_definition_list = mplist ();
 
-  /* ISO-2022 specific initialize routine.  */
-  for (i = 0; i < 0x20; i++)
-    iso_2022_code_class[i] = ISO_control_0;
-  for (i = 0x21; i < 0x7F; i++)
-    iso_2022_code_class[i] = ISO_graphic_plane_0;
-  for (i = 0x80; i < 0xA0; i++)
-    iso_2022_code_class[i] = ISO_control_1;
-  for (i = 0xA1; i < 0xFF; i++)
-    iso_2022_code_class[i] = ISO_graphic_plane_1;
-  iso_2022_code_class[0x20] = iso_2022_code_class[0x7F] = ISO_0x20_or_0x7F;
-  iso_2022_code_class[0xA0] = iso_2022_code_class[0xFF] = ISO_0xA0_or_0xFF;
-  iso_2022_code_class[0x0E] = ISO_shift_out;
-  iso_2022_code_class[0x0F] = ISO_shift_in;
-  iso_2022_code_class[0x19] = ISO_single_shift_2_7;
-  iso_2022_code_class[0x1B] = ISO_escape;
-  iso_2022_code_class[0x8E] = ISO_single_shift_2;
-  iso_2022_code_class[0x8F] = ISO_single_shift_3;
-  iso_2022_code_class[0x9B] = ISO_control_sequence_introducer;
+  coding->resetter = resetter;
+  coding->decoder = decoder;
+  coding->encoder = encoder;
+  coding->ascii_compatible = 0;
+  coding->extra_info = extra_info;
+  coding->extra_spec = NULL;
+  coding->ready = 0;
 
-  Mcoding = msymbol ("coding");
+  if (coding->type == Mcharset)
+    {
+      if (! coding->resetter)
+	coding->resetter = reset_coding_charset;
+      if (! coding->decoder)
+	coding->decoder = decode_coding_charset;
+      if (! coding->encoder)
+	coding->encoder = encode_coding_charset;
+    }
+  else if (coding->type == Mutf)
+    {
+      MCodingInfoUTF *info = malloc (sizeof (MCodingInfoUTF));
+      MSymbol val;
 
-  Mutf = msymbol ("utf");
-  Miso_2022 = msymbol ("iso-2022");
+      if (! coding->resetter)
+	coding->resetter = reset_coding_utf;
 
-  Mreset_at_eol = msymbol ("reset-at-eol");
+      info->code_unit_bits = (int) mplist_get (plist, Mcode_unit);
+      if (info->code_unit_bits == 8)
+	{
+	  if (! coding->decoder)
+	    coding->decoder = decode_coding_utf_8;
+	  if (! coding->encoder)
+	    coding->encoder = encode_coding_utf_8;
+	}
+      else if (info->code_unit_bits == 16)
+	{
+	  if (! coding->decoder)
+	    coding->decoder = decode_coding_utf_16;
+	  if (! coding->encoder)
+	    coding->encoder = encode_coding_utf_16;
+	}
+      else if (info->code_unit_bits == 32)
+	{
+	  if (! coding->decoder)
+	    coding->decoder = decode_coding_utf_32;
+	  if (! coding->encoder)
+	    coding->encoder = encode_coding_utf_32;
+	}
+      else
+	MERROR (MERROR_CODING, Mnil);
+      val = (MSymbol) mplist_get (plist, Mbom);
+      if (val == Mnil)
+	info->bom = 1;
+      else if (val == Mmaybe)
+	info->bom = 0;
+      else
+	info->bom = 2;
+
+      info->endian = (mplist_get (plist, Mlittle_endian) ? 1 : 0);
+      coding->extra_info = info;
+    }
+  else if (coding->type == Miso_2022)
+    {
+      MCodingInfoISO2022 *info = malloc (sizeof (MCodingInfoISO2022));
+
+      if (! coding->resetter)
+	coding->resetter = reset_coding_iso_2022;
+      if (! coding->decoder)
+	coding->decoder = decode_coding_iso_2022;
+      if (! coding->encoder)
+	coding->encoder = encode_coding_iso_2022;
+
+      info->initial_invocation[0] = 0;
+      info->initial_invocation[1] = -1;
+      pl = (MPlist *) mplist_get (plist, Minvocation);
+      if (pl)
+	{
+	  if (MPLIST_KEY (pl) != Minteger)
+	    MERROR (MERROR_CODING, Mnil);
+	  info->initial_invocation[0] = MPLIST_INTEGER (pl);
+	  if (! MPLIST_TAIL_P (pl))
+	    {
+	      pl = MPLIST_NEXT (pl);
+	      if (MPLIST_KEY (pl) != Minteger)
+		MERROR (MERROR_CODING, Mnil);
+	      info->initial_invocation[1] = MPLIST_INTEGER (pl);
+	    }
+	}
+      memset (info->designations, 0, sizeof (info->designations));
+      for (i = 0, pl = (MPlist *) mplist_get (plist, Mdesignation);
+	   i < 32 && pl && MPLIST_KEY (pl) == Minteger;
+	   i++, pl = MPLIST_NEXT (pl))
+	info->designations[i] = MPLIST_INTEGER (pl);
+
+      info->flags = 0;
+      MPLIST_DO (pl, (MPlist *) mplist_get (plist, Mflags))
+	{
+	  MSymbol val;
+
+	  if (MPLIST_KEY (pl) != Msymbol)
+	    MERROR (MERROR_CODING, Mnil);
+	  val = MPLIST_SYMBOL (pl);
+	  if (val == Mreset_at_eol)
+	    info->flags |= MCODING_ISO_RESET_AT_EOL;
+	  else if (val == Mreset_at_cntl)
+	    info->flags |= MCODING_ISO_RESET_AT_CNTL;
+	  else if (val == Meight_bit)
+	    info->flags |= MCODING_ISO_EIGHT_BIT;
+	  else if (val == Mlong_form)
+	    info->flags |= MCODING_ISO_LOCKING_SHIFT;
+	  else if (val == Mdesignation_g0)
+	    info->flags |= MCODING_ISO_DESIGNATION_G0;
+	  else if (val == Mdesignation_g1)
+	    info->flags |= MCODING_ISO_DESIGNATION_G1;
+	  else if (val == Mdesignation_ctext)
+	    info->flags |= MCODING_ISO_DESIGNATION_CTEXT;
+	  else if (val == Mdesignation_ctext_ext)
+	    info->flags |= MCODING_ISO_DESIGNATION_CTEXT_EXT;
+	  else if (val == Mlocking_shift)
+	    info->flags |= MCODING_ISO_LOCKING_SHIFT;
+	  else if (val == Msingle_shift)
+	    info->flags |= MCODING_ISO_SINGLE_SHIFT;
+	  else if (val == Msingle_shift_7)
+	    info->flags |= MCODING_ISO_SINGLE_SHIFT_7;
+	  else if (val == Meuc_tw_shift)
+	    info->flags |= MCODING_ISO_EUC_TW_SHIFT;
+	  else if (val == Miso_6429)
+	    info->flags |= MCODING_ISO_ISO6429;
+	  else if (val == Mrevision_number)
+	    info->flags |= MCODING_ISO_REVISION_NUMBER;
+	  else if (val == Mfull_support)
+	    info->flags |= MCODING_ISO_FULL_SUPPORT;
+	}
+
+      coding->extra_info = info;
+    }
+  else
+    {
+      if (! coding->decoder || ! coding->encoder)
+	MERROR (MERROR_CODING, Mnil);
+      if (! coding->resetter)
+	coding->ready = 1;
+    }
+
+  msymbol_put (sym, Mcoding, coding);
+  msymbol_put (msymbol__canonicalize (sym), Mcoding, coding);
+  plist = (MPlist *) mplist_get (plist, Maliases);
+  if (plist)
+    {
+      MPLIST_DO (pl, plist)
+	{
+	  MSymbol alias;
+
+	  if (MPLIST_KEY (pl) != Msymbol)
+	    continue;
+	  alias = MPLIST_SYMBOL (pl);
+	  msymbol_put (alias, Mcoding, coding);
+	  msymbol_put (msymbol__canonicalize (alias), Mcoding, coding);
+	}
+    }
+
+  MLIST_APPEND1 (&coding_list, codings, coding, MERROR_CODING);
+
+  return sym;
+}
+
+
+static MCodingSystem *
+find_coding (MSymbol name)
+{
+  MCodingSystem *coding;
+
+  M17N_LOCK_REGISTRY ();
+  coding = (MCodingSystem *) msymbol_get (name, Mcoding);
+  if (! coding)
+    {
+      MPlist *plist, *pl;
+      MSymbol sym = msymbol__canonicalize (name);
+
+      plist = mplist_find_by_key (coding_definition_list, sym);
+      if (plist)
+	{
+	  pl = MPLIST_PLIST (plist);
+	  name = MPLIST_VAL (pl);
+	  define_coding (MSYMBOL_NAME (name), MPLIST_NEXT (pl),
+			 NULL, NULL, NULL, NULL);
+	  coding = (MCodingSystem *) msymbol_get (name, Mcoding);
+	  plist = mplist_pop (plist);
+	  M17N_OBJECT_UNREF (plist);
+	}
+    }
+  M17N_UNLOCK_REGISTRY ();
+  return coding;
+}
+
+/* Call the resetter of CODING for CONVERTER.  The first call of it
+   may set up CODING, so it is done with the registry lock held.  */
+
+static int
+reset_coding (MCodingSystem *coding, MConverter *converter)
+{
+  int result = 0;
+
+  if (coding->resetter)
+    {
+      M17N_LOCK_REGISTRY ();
+      result = (*coding->resetter) (converter);
+      M17N_UNLOCK_REGISTRY ();
+    }
+  return result;
+}
+
+#define BINDING_NONE 0
+#define BINDING_BUFFER 1
+#define BINDING_STREAM 2
+
+#define CONVERT_WORKSIZE 0x10000
+
+/* Unmap the file or close the stream that CONVERTER has opened by
+   itself.  */
+
+static void
+release_file (MConverterStatus *internal)
+{
+#ifdef USE_MMAP
+  if (internal->mapped)
+    munmap ((void *) internal->buf.in, internal->bufsize);
+#endif
+  internal->mapped = 0;
+  if (internal->owns_fp)
+    fclose (internal->fp);
+  internal->owns_fp = 0;
+}
+
+/* Release the pages of the mapped file that the decoder has passed
+   through, so that decoding a large file does not keep all of it in
+   memory.  */
+
+static void
+release_consumed_pages (MConverterStatus *internal)
+{
+#if defined (USE_MMAP) && defined (HAVE_MADVISE)
+  static int page_size;
+  int end;
+
+  if (! page_size)
+    page_size = sysconf (_SC_PAGESIZE);
+  end = internal->used - internal->used % page_size;
+  if (end > internal->released)
+    {
+      madvise ((void *) (internal->buf.in + internal->released),
+	       end - internal->released, MADV_DONTNEED);
+      internal->released = end;
+    }
+#endif
+}
+
+/* Decoding a large buffer by multiple threads.  */
+
+#ifdef M17N_THREADS
+
+/* Minimum number of bytes decoded by one thread.  */
+#define PARALLEL_CHUNK_BYTES 0x100000
+
+/* Maximum number of threads that decode one buffer.  */
+#define PARALLEL_MAX_THREADS 16
+
+/* Number of threads that decode one buffer.  It is the number of
+   online processors, or the value of the environment variable
+   M17N_DECODE_THREADS if it is set.  */
+static int decode_threads;
+
+static pthread_once_t decode_threads_once = PTHREAD_ONCE_INIT;
+
+static void
+init_decode_threads (void)
+{
+  char *env = getenv ("M17N_DECODE_THREADS");
+  long n = env ? atol (env) : sysconf (_SC_NPROCESSORS_ONLN);
+
+  decode_threads = (n < 1 ? 1
+		    : n > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS
+		    : n);
+}
+
+/* Type of a function that returns the first position not less than
+   FROM in the byte sequence P where the decoding can start without
+   looking at the preceding bytes, or TO if there is no such position
+   before TO.  */
+
+typedef int (*MSplitFunc) (MConverter *converter, const unsigned char *p,
+			   int from, int to);
+
+/* For codings that decode each byte into one character.  */
+
+static int
+split_anywhere (MConverter *converter, const unsigned char *p,
+		int from, int to)
+{
+  return from;
+}
+
+/* For UTF-8, don't split before a continuation byte.  */
+
+static int
+split_utf_8 (MConverter *converter, const unsigned char *p, int from, int to)
+{
+  while (from < to && (p[from] & 0xC0) == 0x80)
+    from++;
+  return from;
+}
+
+/* For UTF-16, split at a code unit boundary but not in a surrogate
+   pair, nor after a high surrogate.  */
+
+static int
+split_utf_16 (MConverter *converter, const unsigned char *p, int from, int to)
+{
+  struct utf_status *status = (struct utf_status *) &(converter->status);
+  int high = status->endian == UTF_BIG_ENDIAN ? 0 : 1;
+
+  for (from += from & 1; from + 1 < to; from += 2)
+    if ((p[from + high] & 0xFC) != 0xDC
+	&& (p[from - 2 + high] & 0xFC) != 0xD8)
+      return from;
+  return to;
+}
+
+/* For UTF-32, split at a code unit boundary.  */
+
+static int
+split_utf_32 (MConverter *converter, const unsigned char *p, int from, int to)
+{
+  from = (from + 3) & ~3;
+  return (from < to ? from : to);
+}
+
+/* For multi-byte codings where a newline is never a part of a
+   multi-byte sequence, split after a newline.  */
+
+static int
+split_after_newline (MConverter *converter, const unsigned char *p,
+		     int from, int to)
+{
+  const unsigned char *nl = memchr (p + from, '\n', to - from);
+
+  return (nl ? nl + 1 - p : to);
+}
+
+/* Return a function to split the source for CONVERTER if its coding
+   system is stateless and the source can be decoded in parallel.
+   Otherwise, return NULL.  */
+
+static MSplitFunc
+parallel_splitter (MConverter *converter)
+{
+  MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
+  MCodingSystem *coding = internal->coding;
+  struct utf_status *status = (struct utf_status *) &(converter->status);
+  int i, j;
+
+  pthread_once (&decode_threads_once, init_decode_threads);
+  if (decode_threads < 2
+      || converter->at_most > 0 || internal->carryover_bytes > 0)
+    return NULL;
+  if (coding->decoder == decode_coding_utf_8)
+    return split_utf_8;
+  if (coding->decoder == decode_coding_utf_16)
+    return (status->bom == UTF_BOM_NO ? split_utf_16 : NULL);
+  if (coding->decoder == decode_coding_utf_32)
+    return (status->bom == UTF_BOM_NO ? split_utf_32 : NULL);
+  if (coding->decoder == decode_coding_sjis)
+    return split_after_newline;
+  if (coding->decoder != decode_coding_charset)
+    return NULL;
+  for (i = 0; i < coding->ncharsets; i++)
+    if (coding->charsets[i]->dimension > 1)
+      break;
+  if (i == coding->ncharsets)
+    return split_anywhere;
+  for (; i < coding->ncharsets; i++)
+    for (j = 0; j < coding->charsets[i]->dimension; j++)
+      if (coding->charsets[i]->code_range[j * 4] <= '\n'
+	  && coding->charsets[i]->code_range[j * 4 + 1] >= '\n')
+	return NULL;
+  return split_after_newline;
+}
+
+/* A part of the source decoded by a thread.  */
+
+typedef struct
+{
+  MConverter converter;
+  MConverterStatus internal;
+  const unsigned char *source;
+  int src_bytes;
+  MText *mt;
+  pthread_t thread;
+  int started;
+} MDecodeChunk;
+
+static void *
+decode_chunk (void *arg)
+{
+  MDecodeChunk *chunk = (MDecodeChunk *) arg;
+
+  (*chunk->internal.coding->decoder) (chunk->source, chunk->src_bytes,
+				      chunk->mt, &chunk->converter);
+  return NULL;
+}
+
+/* Decode SOURCE of SRC_BYTES bytes into MT as the decoder of
+   CONVERTER does.  If SOURCE is large and SPLITTER finds safe
+   boundaries in it, the parts after the first one are decoded by
+   other threads with private copies of CONVERTER, and the results
+   are appended to MT in order.  */
+
+static int
+decode_parallel (MConverter *converter, MSplitFunc splitter,
+		 const unsigned char *source, int src_bytes, MText *mt)
+{
+  MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
+  int nchunks = src_bytes / PARALLEL_CHUNK_BYTES;
+  int last_block = converter->last_block;
+  MDecodeChunk *chunks;
+  int from, i, n;
+
+  if (nchunks > decode_threads)
+    nchunks = decode_threads;
+  if (nchunks < 2)
+    return (*internal->coding->decoder) (source, src_bytes, mt, converter);
+  MTABLE_ALLOCA (chunks, nchunks, MERROR_CODING);
+
+  /* Find the boundaries.  CHUNKS[0] is decoded by CONVERTER itself.  */
+  chunks[0].source = source;
+  for (i = n = 1; i < nchunks; i++)
+    {
+      from = splitter (converter, source,
+		       (long long) src_bytes * i / nchunks, src_bytes);
+      if (from >= src_bytes)
+	break;
+      if (from <= chunks[n - 1].source - source)
+	continue;
+      chunks[n - 1].src_bytes = from - (chunks[n - 1].source - source);
+      chunks[n++].source = source + from;
+    }
+  chunks[n - 1].src_bytes = src_bytes - (chunks[n - 1].source - source);
+  nchunks = n;
+
+  for (i = 1; i < nchunks; i++)
+    {
+      MDecodeChunk *chunk = chunks + i;
+
+      chunk->converter = *converter;
+      chunk->internal = *internal;
+      chunk->converter.internal_info = &chunk->internal;
+      chunk->converter.nchars = chunk->converter.nbytes = 0;
+      chunk->converter.result = MCONVERSION_RESULT_SUCCESS;
+      chunk->converter.last_block = i < nchunks - 1 ? 1 : last_block;
+      chunk->mt = mtext ();
+      mtext__adjust_format (chunk->mt, MTEXT_FORMAT_UTF_8);
+      mtext__enlarge (chunk->mt, chunk->src_bytes + MAX_UTF8_CHAR_BYTES);
+      chunk->started = pthread_create (&chunk->thread, NULL,
+				       decode_chunk, chunk) == 0;
+    }
+
+  converter->last_block = 1;
+  (*internal->coding->decoder) (source, chunks[0].src_bytes, mt, converter);
+  converter->last_block = last_block;
+
+  for (i = 1; i < nchunks; i++)
+    {
+      MDecodeChunk *chunk = chunks + i;
+
+      if (chunk->started)
+	pthread_join (chunk->thread, NULL);
+      else
+	decode_chunk (chunk);
+    }
+
+  /* Append the results up to the first invalid byte.  */
+  for (i = 1; i < nchunks; i++)
+    {
+      MDecodeChunk *chunk = chunks + i;
+
+      if (converter->result == MCONVERSION_RESULT_SUCCESS)
+	{
+	  mtext_cat (mt, chunk->mt);
+	  converter->nchars += chunk->converter.nchars;
+	  converter->nbytes += chunk->converter.nbytes;
+	  converter->result = chunk->converter.result;
+	  if (chunk->internal.carryover_bytes > 0)
+	    {
+	      memcpy (internal->carryover, chunk->internal.carryover,
+		      chunk->internal.carryover_bytes);
+	      internal->carryover_bytes = chunk->internal.carryover_bytes;
+	    }
+	}
+      M17N_OBJECT_UNREF (chunk->mt);
+    }
+  /* The next call of a decoder will write into MT directly.  */
+  MTEXT_FLATTEN (mt);
+  return (converter->result == MCONVERSION_RESULT_INVALID_BYTE ? -1 : 0);
+}
+
+#endif /* M17N_THREADS */
+
+/* Decode SOURCE of SRC_BYTES bytes into MT by the decoder of
+   CONVERTER, in parallel if possible.  */
+
+static int
+decode_buffer (MConverter *converter, const unsigned char *source,
+	       int src_bytes, MText *mt)
+{
+  MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
+#ifdef M17N_THREADS
+  MSplitFunc splitter = parallel_splitter (converter);
+
+  if (splitter)
+    return decode_parallel (converter, splitter, source, src_bytes, mt);
+#endif
+  return (*internal->coding->decoder) (source, src_bytes, mt, converter);
+}
+
+/* Maximum number of characters decoded at once by decode_block ()
+   from a buffer or an unseekable stream.  */
+#define CONVERT_AHEAD_CHARS 0x1000
+
+/* Replace the contents of MT with the next block of characters
+   decoded from the source bound to CONVERTER, and return the number
+   of decoded characters.  From a seekable stream, one block of
+   CONVERT_WORKSIZE bytes is read, and the bytes not consumed by the
+   decoder are pushed back.  Otherwise, at most CONVERT_AHEAD_CHARS
+   characters are decoded.  */
+
+static int
+decode_block (MConverter *converter, MText *mt)
+{
+  MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
+  int at_most = converter->at_most;
+
+  mtext_reset (mt);
+  if (internal->binding == BINDING_STREAM && internal->seekable)
+    {
+      unsigned char work[CONVERT_WORKSIZE];
+      int last_block = converter->last_block;
+      int nbytes = 0;
+
+      if (mt->format != MTEXT_FORMAT_UTF_8)
+	mtext__adjust_format (mt, MTEXT_FORMAT_UTF_8);
+      if (! mt->data)
+	mtext__enlarge (mt, MAX_UTF8_CHAR_BYTES);
+      converter->nchars = converter->nbytes = 0;
+      converter->result = MCONVERSION_RESULT_SUCCESS;
+      if (! feof (internal->fp))
+	nbytes = fread (work, sizeof (unsigned char), CONVERT_WORKSIZE,
+			internal->fp);
+      if (ferror (internal->fp))
+	{
+	  converter->result = MCONVERSION_RESULT_IO_ERROR;
+	  return 0;
+	}
+      if (nbytes > 0)
+	converter->last_block = 0;
+      converter->at_most = 0;
+      (*internal->coding->decoder) (work, nbytes, mt, converter);
+      if (converter->nbytes < nbytes)
+	fseek (internal->fp, converter->nbytes - nbytes, SEEK_CUR);
+      converter->last_block = last_block;
+    }
+  else
+    {
+      converter->at_most = CONVERT_AHEAD_CHARS;
+      mconv_decode (converter, mt);
+    }
+  converter->at_most = at_most;
+  return mt->nchars;
+}
+
+/* Coding system detector.  */
+
+/* Default number of bytes examined by a coding system detector.  */
+#define DETECT_DEFAULT_LIMIT 0x10000
+
+/* Weights of bytes supporting or denying a coding system.  A byte of
+   a well-formed multi-byte sequence is a stronger evidence than a
+   non-ASCII byte of a single-byte charset, and a designation escape
+   sequence is the strongest.  */
+#define DETECT_WEIGHT_MULTI_BYTE 2
+#define DETECT_WEIGHT_SINGLE_BYTE 1
+#define DETECT_WEIGHT_ESCAPE 4
+#define DETECT_PENALTY_CONTROL 4
+
+/* Nonzero if C is a control code rarely found in text, i.e. other
+   than TAB, LF, VT, FF, CR, and ESC.  */
+#define DETECT_CONTROL_P(c)	\
+  ((c) < 0x20 ? ! ((0x08003E00 >> (c)) & 1) : (c) == 0x7F)
+
+enum detect_kind
+  {
+    DETECT_UTF_8,
+    DETECT_UTF_16,
+    DETECT_UTF_32,
+    DETECT_ISO_2022,
+    DETECT_SJIS,
+    DETECT_CHARSET,
+    DETECT_SINGLE_BYTE
+  };
+
+/* Classes of bytes for a coding system of single-byte charsets.  */
+
+enum detect_byte_class
+  {
+    DETECT_BYTE_INVALID,
+    DETECT_BYTE_ASCII,
+    DETECT_BYTE_CONTROL,
+    DETECT_BYTE_GRAPHIC
+  };
+
+/* Status of a coding system examined by a detector.  */
+
+typedef struct
+{
+  MCodingSystem *coding;
+
+  enum detect_kind kind;
+
+  /* Preference among coding systems of the same score.  Smaller is
+     preferred.  */
+  int rank;
+
+  /* Nonzero if a byte sequence invalid in CODING was found.  */
+  int invalid;
+
+  /* Nonzero if the first character or code unit was examined.  */
+  int started;
+
+  /* Nonzero if the bytes start with a byte order mark (signature)
+     CODING recognizes.  Negative while the first character of UTF-8
+     is being examined.  */
+  int bom;
+
+  /* Sum of the weights of the examined bytes.  */
+  int score;
+
+  /* Bytes of an incomplete sequence.  */
+  unsigned char pending[8];
+  int npending;
+
+  /* Number of the remaining bytes of the current multi-byte
+     character, and the bytes of it so far (for UTF-8), or a pending
+     high surrogate (for UTF-16).  */
+  int rest;
+  unsigned code;
+
+  /* For UTF-16 and UTF-32.  */
+  int big_endian;
+
+  /* For ISO-2022.  */
+  MCharset *designation[4];
+  int invocation[2];
+  int single_shift;
+
+  /* For DETECT_SINGLE_BYTE, the class of each byte.  */
+  unsigned char byte_class[256];
+} MDetectProbe;
+
+struct MCodingDetector
+{
+  /* Number of bytes to examine.  */
+  int limit;
+
+  /* Number of bytes examined so far.  */
+  int nbytes;
+
+  /* Number of control codes rarely found in text.  They deny all
+     byte-oriented coding systems equally.  */
+  int controls;
+
+  int nprobes, nalive;
+  MDetectProbe *probes;
+};
+
+/* Return the weight of a byte of code unit for character C in UTF-16
+   or UTF-32.  Only a character less than LIMIT, whose code unit
+   contains a zero byte, is weighted.  Text in another coding system
+   rarely contains a zero byte, whereas the other code units may well
+   be made of such text.  */
+
+static int
+detect_unicode_weight (int c, int limit)
+{
+  if (c < 0x80)
+    return (DETECT_CONTROL_P (c) ? - DETECT_PENALTY_CONTROL
+	    : DETECT_WEIGHT_MULTI_BYTE);
+  if (c < 0xA0)
+    return - DETECT_PENALTY_CONTROL;
+  return c < limit ? DETECT_WEIGHT_MULTI_BYTE : 0;
+}
+
+static void
+detect_utf_8 (MDetectProbe *probe, const unsigned char *p,
+	      const unsigned char *pend)
+{
+  int full = probe->coding->charsets[0] == mcharset__m17n;
+
+  while (p < pend)
+    {
+      int c;
+
+      if (probe->rest == 0)
+	{
+	  int n = mtext__ascii_span (p, pend);
+
+	  if (n > 0)
+	    p += n, probe->started = 1;
+	  if (p == pend)
+	    break;
+	  c = *p++;
+	  if (! probe->started)
+	    probe->bom = -1, probe->started = 1;
+	  if (c < 0xC0)
+	    goto invalid;
+	  else if (c < 0xE0)
+	    probe->rest = 1, probe->code = c & 0x1F;
+	  else if (c < 0xF0)
+	    probe->rest = 2, probe->code = c & 0x0F;
+	  else if (c < 0xF8)
+	    probe->rest = 3, probe->code = c & 0x07;
+	  else if (c < 0xFC)
+	    probe->rest = 4, probe->code = c & 0x03;
+	  else if (c < 0xFE)
+	    probe->rest = 5, probe->code = c & 0x01;
+	  else
+	    goto invalid;
+	  probe->npending = probe->rest + 1;
+	  continue;
+	}
+      c = *p++;
+      if ((c & 0xC0) != 0x80)
+	goto invalid;
+      probe->code = (probe->code << 6) | (c & 0x3F);
+      if (--probe->rest > 0)
+	continue;
+      if (! full
+	  && (probe->code >= 0x110000
+	      || (probe->code >= 0xD800 && probe->code < 0xE000)))
+	goto invalid;
+      if (probe->bom < 0)
+	probe->bom = probe->code == 0xFEFF;
+      probe->score += DETECT_WEIGHT_MULTI_BYTE * probe->npending;
+    }
+  return;
+
+ invalid:
+  probe->invalid = 1;
+}
+
+/* Examine the next code unit C of UTF-16 or UTF-32 for the first
+   one.  Return nonzero if C is a BOM consumed here.  */
+
+static int
+detect_utf_bom (MDetectProbe *probe, unsigned c, unsigned bom_be,
+		unsigned bom_le)
+{
+  MCodingInfoUTF *spec = (MCodingInfoUTF *) probe->coding->extra_spec;
+
+  probe->started = 1;
+  if (spec->bom == UTF_BOM_NO)
+    return 0;
+  if (c == bom_be || c == bom_le)
+    {
+      /* C was taken in the big endian order.  */
+      probe->big_endian = c == bom_be;
+      probe->bom = 1;
+      return 1;
+    }
+  if (spec->bom == UTF_BOM_YES)
+    probe->invalid = 1;
+  /* Without a BOM, the decoder assumes big endian.  */
+  probe->big_endian = 1;
+  return 0;
+}
+
+static void
+detect_utf_16 (MDetectProbe *probe, const unsigned char *p,
+	       const unsigned char *pend)
+{
+  while (p < pend && ! probe->invalid)
+    {
+      const unsigned char *unit;
+      int hi, c;
+
+      if (probe->npending > 0 || pend - p < 2)
+	{
+	  probe->pending[probe->npending++] = *p++;
+	  if (probe->npending < 2)
+	    continue;
+	  probe->npending = 0;
+	  unit = probe->pending;
+	}
+      else
+	unit = p, p += 2;
+      hi = probe->big_endian ? 0 : 1;
+      if (! probe->started)
+	{
+	  /* A BOM is examined in the big endian order, as the decoder
+	     does.  */
+	  if (detect_utf_bom (probe, (unit[0] << 8) | unit[1],
+			      0xFEFF, 0xFFFE))
+	    continue;
+	  hi = probe->big_endian ? 0 : 1;
+	}
+      c = (unit[hi] << 8) | unit[hi ^ 1];
+      if (probe->code)
+	{
+	  if (c < 0xDC00 || c >= 0xE000)
+	    probe->invalid = 1;
+	  probe->code = 0;
+	}
+      else if (c >= 0xD800 && c < 0xDC00)
+	probe->code = c;
+      else if (c >= 0xDC00 && c < 0xE000)
+	probe->invalid = 1;
+      else
+	probe->score += detect_unicode_weight (c, 0x100) * 2;
+    }
+}
+
+static void
+detect_utf_32 (MDetectProbe *probe, const unsigned char *p,
+	       const unsigned char *pend)
+{
+  while (p < pend && ! probe->invalid)
+    {
+      const unsigned char *unit;
+      int lo;
+      unsigned c;
+
+      if (probe->npending > 0 || pend - p < 4)
+	{
+	  probe->pending[probe->npending++] = *p++;
+	  if (probe->npending < 4)
+	    continue;
+	  probe->npending = 0;
+	  unit = probe->pending;
+	}
+      else
+	unit = p, p += 4;
+      if (! probe->started
+	  && detect_utf_bom (probe, ((unit[0] << 24) | (unit[1] << 16)
+				     | (unit[2] << 8) | unit[3]),
+			     0x0000FEFF, 0xFFFE0000))
+	continue;
+      lo = probe->big_endian ? 3 : 0;
+      c = (unit[lo] | (unit[lo ^ 1] << 8) | (unit[lo ^ 2] << 16)
+	   | ((unsigned) unit[lo ^ 3] << 24));
+      if (c >= 0x110000 || (c >= 0xD800 && c < 0xE000))
+	probe->invalid = 1;
+      else
+	probe->score += detect_unicode_weight (c, 0x110000) * 4;
+    }
+}
+
+/* Handle the escape sequence in PROBE->pending for ISO-2022.  Return
+   -1 if it is not valid for the coding system, else 0.  */
+
+static int
+detect_iso_2022_escape (MDetectProbe *probe)
+{
+  MCodingSystem *coding = probe->coding;
+  struct iso_2022_spec *spec = (struct iso_2022_spec *) coding->extra_spec;
+  unsigned char *esc = probe->pending;
+  int n = probe->npending;
+  int final = esc[n - 1];
+  int reg, dim, chars, i;
+  MCharset *charset;
+
+  if (n == 2)
+    {
+      if (final == 'n' || final == 'o')
+	{
+	  reg = final - 'n' + 2;
+	  if (! (spec->flags & MCODING_ISO_LOCKING_SHIFT)
+	      || ! probe->designation[reg])
+	    return -1;
+	  probe->invocation[0] = reg;
+	}
+      else if (final == 'N' || final == 'O')
+	{
+	  reg = final - 'N' + 2;
+	  if (! (spec->flags & MCODING_ISO_SINGLE_SHIFT)
+	      || ! probe->designation[reg])
+	    return -1;
+	  probe->single_shift = reg;
+	}
+      return 0;
+    }
+  if (esc[1] == '$')
+    {
+      dim = 2;
+      if (n == 3 && final >= '@' && final <= 'B')
+	reg = 0, chars = 94;
+      else if (n == 4 && esc[2] >= 0x28 && esc[2] <= 0x2B)
+	reg = esc[2] - 0x28, chars = 94;
+      else if (n == 4 && esc[2] >= 0x2C && esc[2] <= 0x2F)
+	reg = esc[2] - 0x2C, chars = 96;
+      else
+	return -1;
+    }
+  else if (n == 3 && esc[1] >= 0x28 && esc[1] <= 0x2B)
+    dim = 1, reg = esc[1] - 0x28, chars = 94;
+  else if (n == 3 && esc[1] >= 0x2C && esc[1] <= 0x2F)
+    dim = 1, reg = esc[1] - 0x2C, chars = 96;
+  else
+    /* Sequences for revision, direction, etc. are not checked.  */
+    return 0;
+
+  if (! (spec->flags & MCODING_ISO_DESIGNATION_MASK))
+    return -1;
+  charset = MCHARSET_ISO_2022 (dim, chars, final);
+  if (! charset)
+    return -1;
+  if (! (spec->flags & MCODING_ISO_FULL_SUPPORT))
+    {
+      for (i = 0; i < coding->ncharsets; i++)
+	if (coding->charsets[i] == charset)
+	  break;
+      if (i == coding->ncharsets)
+	return -1;
+    }
+  probe->designation[reg] = charset;
+  probe->score += DETECT_WEIGHT_ESCAPE * n;
+  return 0;
+}
+
+/* Start a character of CHARSET for ISO-2022 by the byte C.  Return
+   -1 if C can't start it, else 0.  */
+
+static int
+detect_iso_2022_char (MDetectProbe *probe, MCharset *charset, int c)
+{
+  int c7 = c & 0x7F;
+
+  if (! charset
+      || c7 < 0x20
+      || ((c7 == 0x20 || c7 == 0x7F)
+	  && charset->code_range[0] != 32 && charset->code_range[1] != 255))
+    return -1;
+  if (charset != mcharset__ascii)
+    {
+      probe->rest = charset->dimension - 1;
+      probe->code = (charset->code_range[0] != 32
+		     && charset->code_range[1] != 255);
+      probe->score += DETECT_WEIGHT_MULTI_BYTE;
+    }
+  return 0;
+}
+
+static void
+detect_iso_2022 (MDetectProbe *probe, const unsigned char *p,
+		 const unsigned char *pend)
+{
+  struct iso_2022_spec *spec
+    = (struct iso_2022_spec *) probe->coding->extra_spec;
+
+  while (p < pend)
+    {
+      int c = *p++;
+      MCharset *charset;
+
+      if (probe->npending > 0)
+	{
+	  /* In an escape sequence.  */
+	  probe->pending[probe->npending++] = c;
+	  if (c >= 0x20 && c <= 0x2F && probe->npending < 4)
+	    continue;
+	  if (c < 0x30 || c > 0x7E
+	      || detect_iso_2022_escape (probe) < 0)
+	    goto invalid;
+	  probe->npending = 0;
+	  continue;
+	}
+      if (probe->rest > 0)
+	{
+	  /* In a multi-byte character.  PROBE->code is nonzero if the
+	     charset has 94 characters.  */
+	  int c7 = c & 0x7F;
+
+	  if (c7 < 0x20 || (probe->code && (c7 == 0x20 || c7 == 0x7F)))
+	    goto invalid;
+	  probe->rest--;
+	  probe->score += DETECT_WEIGHT_MULTI_BYTE;
+	  continue;
+	}
+      if (probe->single_shift)
+	{
+	  charset = probe->designation[probe->single_shift];
+	  probe->single_shift = 0;
+	  if (detect_iso_2022_char (probe, charset, c) < 0)
+	    goto invalid;
+	  continue;
+	}
+      if (c < 0x20)
+	{
+	  if (c == ISO_CODE_ESC && spec->use_esc)
+	    probe->pending[probe->npending++] = c;
+	  else if (c == ISO_CODE_SO
+		   && (spec->flags & MCODING_ISO_LOCKING_SHIFT)
+		   && probe->designation[1])
+	    probe->invocation[0] = 1;
+	  else if (c == ISO_CODE_SI
+		   && (spec->flags & MCODING_ISO_LOCKING_SHIFT))
+	    probe->invocation[0] = 0;
+	  else if (c == ISO_CODE_SS2_7
+		   && (spec->flags & MCODING_ISO_SINGLE_SHIFT_7)
+		   && probe->designation[2])
+	    probe->single_shift = 2;
+	  else
+	    continue;
+	  /* The detector counted the shift code as a control code.  */
+	  if (c != ISO_CODE_ESC)
+	    probe->score += DETECT_PENALTY_CONTROL + DETECT_WEIGHT_ESCAPE;
+	  continue;
+	}
+      if (c < 0x80)
+	{
+	  charset = (probe->invocation[0] >= 0
+		     ? probe->designation[probe->invocation[0]] : NULL);
+	  if ((c == 0x20 || c == 0x7F)
+	      && (! charset
+		  || (charset->code_range[0] != 32
+		      && charset->code_range[1] != 255)))
+	    continue;
+	}
+      else if (c < 0xA0)
+	{
+	  if (c == ISO_CODE_SS2 && (spec->flags & MCODING_ISO_EUC_TW_SHIFT))
+	    {
+	      /* A plane selector and a 2-byte code follow.  */
+	      probe->rest = 3;
+	      probe->code = 1;
+	      continue;
+	    }
+	  if ((c == ISO_CODE_SS2 || c == ISO_CODE_SS3)
+	      && (spec->flags & MCODING_ISO_SINGLE_SHIFT)
+	      && probe->designation[c - ISO_CODE_SS2 + 2])
+	    {
+	      probe->single_shift = c - ISO_CODE_SS2 + 2;
+	      continue;
+	    }
+	  goto invalid;
+	}
+      else
+	charset = (probe->invocation[1] >= 0
+		   ? probe->designation[probe->invocation[1]] : NULL);
+      if (detect_iso_2022_char (probe, charset, c) < 0)
+	goto invalid;
+    }
+  return;
+
+ invalid:
+  probe->invalid = 1;
+}
+
+static void
+detect_sjis (MDetectProbe *probe, const unsigned char *p,
+	     const unsigned char *pend)
+{
+  while (p < pend)
+    {
+      int c;
+
+      if (probe->rest == 0)
+	{
+	  p += mtext__ascii_span (p, pend);
+	  if (p == pend)
+	    break;
+	  c = *p++;
+	  if ((c >= 0x81 && c <= 0x9F) || (c >= 0xE0 && c <= 0xEF))
+	    probe->rest = 1;
+	  else if (c >= 0xA1 && c <= 0xDF)
+	    probe->score += DETECT_WEIGHT_SINGLE_BYTE;
+	  else
+	    goto invalid;
+	  continue;
+	}
+      c = *p++;
+      if (c < 0x40 || c == 0x7F || c > 0xFC)
+	goto invalid;
+      probe->rest = 0;
+      probe->score += DETECT_WEIGHT_MULTI_BYTE * 2;
+    }
+  return;
+
+ invalid:
+  probe->invalid = 1;
+}
+
+/* Return the class of byte(s) decoded into C by a charset of
+   dimension 1.  */
+
+static enum detect_byte_class
+detect_char_class (int c)
+{
+  return (c < 0 ? DETECT_BYTE_INVALID
+	  : c < 0x80 ? DETECT_BYTE_ASCII
+	  : c < 0xA0 ? DETECT_BYTE_CONTROL
+	  : DETECT_BYTE_GRAPHIC);
+}
+
+static int detect_class_weight[] =
+  { 0, 0, - DETECT_PENALTY_CONTROL, DETECT_WEIGHT_SINGLE_BYTE };
+
+static void
+detect_single_byte (MDetectProbe *probe, const unsigned char *p,
+		    const unsigned char *pend)
+{
+  for (; p < pend; p++)
+    {
+      int class = probe->byte_class[*p];
+
+      if (class == DETECT_BYTE_INVALID)
+	{
+	  probe->invalid = 1;
+	  return;
+	}
+      probe->score += detect_class_weight[class];
+    }
+}
+
+/* For a coding system of type charset, decode bytes as
+   decode_coding_charset () does.  Only non-ASCII bytes of multi-byte
+   characters are weighted, because a charset of ISO-2022 style maps
+   ASCII bytes too.  */
+
+static void
+detect_charset (MDetectProbe *probe, const unsigned char *p,
+		const unsigned char *pend)
+{
+  MCodingSystem *coding = probe->coding;
+  unsigned *code_charset_table = (unsigned *) coding->extra_spec;
+
+  while (p < pend)
+    {
+      unsigned mask;
+      int idx = 0;
+
+      if (probe->npending == 0 && coding->ascii_compatible)
+	{
+	  p += mtext__ascii_span (p, pend);
+	  if (p == pend)
+	    break;
+	}
+      probe->pending[probe->npending++] = *p++;
+      mask = code_charset_table[probe->pending[0]];
+      for (; mask; mask >>= 1, idx++)
+	{
+	  MCharset *charset;
+	  unsigned code = 0;
+	  int dim, i, c, weight;
+
+	  if (! (mask & 1))
+	    continue;
+	  charset = coding->charsets[idx];
+	  dim = charset->dimension;
+	  if (dim > probe->npending)
+	    break;
+	  if (dim < probe->npending)
+	    continue;
+	  for (i = 0; i < dim; i++)
+	    code = (code << 8) | probe->pending[i];
+	  c = DECODE_CHAR (charset, code);
+	  if (c < 0)
+	    continue;
+	  if (dim == 1)
+	    weight = detect_class_weight[detect_char_class (c)];
+	  else
+	    for (i = weight = 0; i < dim; i++)
+	      if (probe->pending[i] >= 0x80)
+		weight += DETECT_WEIGHT_MULTI_BYTE;
+	  probe->score += weight;
+	  probe->npending = 0;
+	  break;
+	}
+      if (! mask)
+	{
+	  probe->invalid = 1;
+	  return;
+	}
+    }
+}
+
+/* Return the weight of the bytes of an incomplete multi-byte
+   sequence at the end of those examined by PROBE.  They are weighted
+   as if the sequence were completed, which is used when the sequence
+   was cut off by the limit of the detector.  Otherwise its bytes
+   would count only for single-byte charsets.  */
+
+static int
+detect_pending_weight (MDetectProbe *probe)
+{
+  int i, weight = 0;
+
+  switch (probe->kind)
+    {
+    case DETECT_UTF_8:
+      if (probe->rest > 0)
+	weight = DETECT_WEIGHT_MULTI_BYTE * (probe->npending - probe->rest);
+      break;
+    case DETECT_SJIS:
+      if (probe->rest > 0)
+	weight = DETECT_WEIGHT_MULTI_BYTE;
+      break;
+    case DETECT_CHARSET:
+      for (i = 0; i < probe->npending; i++)
+	if (probe->pending[i] >= 0x80)
+	  weight += DETECT_WEIGHT_MULTI_BYTE;
+      break;
+    default:
+      break;
+    }
+  return weight;
+}
+
+/* Set up PROBE for CODING.  Return -1 if CODING is not of a type
+   that can be examined, else 0.  */
+
+static int
+detect_setup_probe (MDetectProbe *probe, MCodingSystem *coding)
+{
+  memset (probe, 0, sizeof (MDetectProbe));
+  probe->coding = coding;
+  if (coding->type == Mutf)
+    {
+      MCodingInfoUTF *spec = (MCodingInfoUTF *) coding->extra_spec;
+
+      if (spec->code_unit_bits == 8)
+	{
+	  probe->kind = DETECT_UTF_8;
+	  probe->rank = coding->charsets[0] == mcharset__m17n ? 2 : 0;
+	}
+      else
+	{
+	  probe->kind = (spec->code_unit_bits == 16
+			 ? DETECT_UTF_16 : DETECT_UTF_32);
+	  probe->rank = 5;
+	  probe->big_endian = spec->endian == UTF_BIG_ENDIAN;
+	}
+    }
+  else if (coding->type == Miso_2022)
+    {
+      struct iso_2022_spec *spec
+	= (struct iso_2022_spec *) coding->extra_spec;
+      int i;
+
+      probe->kind = DETECT_ISO_2022;
+      probe->rank = spec->flags & MCODING_ISO_EIGHT_BIT ? 3 : 2;
+      for (i = 0; i < 4; i++)
+	probe->designation[i] = spec->initial_designation[i];
+      probe->invocation[0] = spec->initial_invocation[0];
+      probe->invocation[1] = spec->initial_invocation[1];
+    }
+  else if (coding->decoder == decode_coding_sjis)
+    probe->kind = DETECT_SJIS, probe->rank = 3;
+  else if (coding->decoder == decode_coding_charset)
+    {
+      unsigned *code_charset_table = (unsigned *) coding->extra_spec;
+      int i, c;
+
+      for (i = 0; i < coding->ncharsets; i++)
+	if (coding->charsets[i]->dimension > 1)
+	  break;
+      if (i < coding->ncharsets)
+	{
+	  probe->kind = DETECT_CHARSET, probe->rank = 3;
+	  return 0;
+	}
+      /* All charsets are of dimension 1.  Classify each byte in
+	 advance.  */
+      probe->kind = DETECT_SINGLE_BYTE;
+      probe->rank = 1;
+      for (c = 0; c < 256; c++)
+	{
+	  unsigned mask = code_charset_table[c];
+
+	  for (i = 0; mask; mask >>= 1, i++)
+	    if ((mask & 1)
+		&& (probe->byte_class[c]
+		    = detect_char_class (DECODE_CHAR (coding->charsets[i],
+						      c))))
+	      break;
+	  if (c >= 0x80 && probe->byte_class[c])
+	    probe->rank = 4;
+	}
+    }
+  else
+    return -1;
+  return 0;
+}
+
+/* Ranking of a coding system.  */
+
+typedef struct
+{
+  MDetectProbe *probe;
+  int score;
+  int index;
+} MDetectRank;
+
+static int
+detect_compare (const void *p1, const void *p2)
+{
+  const MDetectRank *r1 = (const MDetectRank *) p1;
+  const MDetectRank *r2 = (const MDetectRank *) p2;
+
+  if (r1->probe->bom != r2->probe->bom)
+    return r2->probe->bom - r1->probe->bom;
+  if (r1->score != r2->score)
+    return r2->score - r1->score;
+  if (r1->probe->rank != r2->probe->rank)
+    return r1->probe->rank - r2->probe->rank;
+  return r1->index - r2->index;
+}
+
+/* Return the coding system named NAME after setting it up, or NULL
+   if it is not available.  */
+
+static MCodingSystem *
+detect_find_coding (MSymbol name)
+{
+  MCodingSystem *coding = find_coding (name);
+  MConverter converter;
+  MConverterStatus internal;
+
+  if (! coding)
+    return NULL;
+  memset (&converter, 0, sizeof converter);
+  memset (&internal, 0, sizeof internal);
+  converter.internal_info = &internal;
+  internal.coding = coding;
+  if (reset_coding (coding, &converter) < 0)
+    return NULL;
+  return coding;
+}
+
+static void
+detect_probe (MDetectProbe *probe, const unsigned char *p,
+	      const unsigned char *pend)
+{
+  switch (probe->kind)
+    {
+    case DETECT_UTF_8:
+      detect_utf_8 (probe, p, pend);
+      break;
+    case DETECT_UTF_16:
+      detect_utf_16 (probe, p, pend);
+      break;
+    case DETECT_UTF_32:
+      detect_utf_32 (probe, p, pend);
+      break;
+    case DETECT_ISO_2022:
+      detect_iso_2022 (probe, p, pend);
+      break;
+    case DETECT_SJIS:
+      detect_sjis (probe, p, pend);
+      break;
+    case DETECT_CHARSET:
+      detect_charset (probe, p, pend);
+      break;
+    default:
+      detect_single_byte (probe, p, pend);
+    }
+}
+
+
+/* Internal API */
+
+int
+mcoding__init (void)
+{
+  int i;
+  MPlist *param, *charsets, *pl;
+
+  MLIST_INIT1 (&coding_list, codings, 128);
+  coding_definition_list = mplist ();
+
+  /* ISO-2022 specific initialize routine.  */
+  for (i = 0; i < 0x20; i++)
+    iso_2022_code_class[i] = ISO_control_0;
+  for (i = 0x21; i < 0x7F; i++)
+    iso_2022_code_class[i] = ISO_graphic_plane_0;
+  for (i = 0x80; i < 0xA0; i++)
+    iso_2022_code_class[i] = ISO_control_1;
+  for (i = 0xA1; i < 0xFF; i++)
+    iso_2022_code_class[i] = ISO_graphic_plane_1;
+  iso_2022_code_class[0x20] = iso_2022_code_class[0x7F] = ISO_0x20_or_0x7F;
+  iso_2022_code_class[0xA0] = iso_2022_code_class[0xFF] = ISO_0xA0_or_0xFF;
+  iso_2022_code_class[0x0E] = ISO_shift_out;
+  iso_2022_code_class[0x0F] = ISO_shift_in;
+  iso_2022_code_class[0x19] = ISO_single_shift_2_7;
+  iso_2022_code_class[0x1B] = ISO_escape;
+  iso_2022_code_class[0x8E] = ISO_single_shift_2;
+  iso_2022_code_class[0x8F] = ISO_single_shift_3;
+  iso_2022_code_class[0x9B] = ISO_control_sequence_introducer;
+
+  Mcoding = msymbol ("coding");
+
+  Mutf = msymbol ("utf");
+  Miso_2022 = msymbol ("iso-2022");
+
+  Mreset_at_eol = msymbol ("reset-at-eol");
   Mreset_at_cntl = msymbol ("reset-at-cntl");
   Meight_bit = msymbol ("eight-bit");
   Mlong_form = msymbol ("long-form");
@@ -3791,196 +5632,13 @@ mconv_define_coding (const char *name, MPlist *plist,
 		     int (*encoder) (MText *, int, int,
 				     unsigned char *, int,
 				     MConverter *),
-		     void *extra_info)
-{
-  MSymbol sym = msymbol (name);
-  int i;
-  MCodingSystem *coding;
-  MPlist *pl;
-
-  MSTRUCT_MALLOC (coding, MERROR_CODING);
-  coding->name = sym;
-  if ((coding->type = (MSymbol) mplist_get (plist, Mtype)) == Mnil)
-    coding->type = Mcharset;
-  pl = (MPlist *) mplist_get (plist, Mcharsets);
-  if (! pl)
-    MERROR (MERROR_CODING, Mnil);
-  coding->ncharsets = mplist_length (pl);
-  if (coding->ncharsets > NUM_SUPPORTED_CHARSETS)
-    coding->ncharsets = NUM_SUPPORTED_CHARSETS;
-  for (i = 0; i < coding->ncharsets; i++, pl = MPLIST_NEXT (pl))
-    {
-      MSymbol charset_name;
-
-      if (MPLIST_KEY (pl) != Msymbol)
-	MERROR (MERROR_CODING, Mnil);
-      charset_name = MPLIST_SYMBOL (pl);
-      if (! (coding->charsets[i] = MCHARSET (charset_name)))
-	MERROR (MERROR_CODING, Mnil);
-    }
-
-  coding->resetter = resetter;
-  coding->decoder = decoder;
-  coding->encoder = encoder;
-  coding->ascii_compatible = 0;
-  coding->extra_info = extra_info;
-  coding->extra_spec = NULL;
-  coding->ready = 0;
-
-  if (coding->type == Mcharset)
-    {
-      if (! coding->resetter)
-	coding->resetter = reset_coding_charset;
-      if (! coding->decoder)
-	coding->decoder = decode_coding_charset;
-      if (! coding->encoder)
-	coding->encoder = encode_coding_charset;
-    }
-  else if (coding->type == Mutf)
-    {
-      MCodingInfoUTF *info = malloc (sizeof (MCodingInfoUTF));
-      MSymbol val;
-
-      if (! coding->resetter)
-	coding->resetter = reset_coding_utf;
-
-      info->code_unit_bits = (int) mplist_get (plist, Mcode_unit);
-      if (info->code_unit_bits == 8)
-	{
-	  if (! coding->decoder)
-	    coding->decoder = decode_coding_utf_8;
-	  if (! coding->encoder)
-	    coding->encoder = encode_coding_utf_8;
-	}
-      else if (info->code_unit_bits == 16)
-	{
-	  if (! coding->decoder)
-	    coding->decoder = decode_coding_utf_16;
-	  if (! coding->encoder)
-	    coding->encoder = encode_coding_utf_16;
-	}
-      else if (info->code_unit_bits == 32)
-	{
-	  if (! coding->decoder)
-	    coding->decoder = decode_coding_utf_32;
-	  if (! coding->encoder)
-	    coding->encoder = encode_coding_utf_32;
-	}
-      else
-	MERROR (MERROR_CODING, Mnil);
-      val = (MSymbol) mplist_get (plist, Mbom);
-      if (val == Mnil)
-	info->bom = 1;
-      else if (val == Mmaybe)
-	info->bom = 0;
-      else
-	info->bom = 2;
-
-      info->endian = (mplist_get (plist, Mlittle_endian) ? 1 : 0);
-      coding->extra_info = info;
-    }
-  else if (coding->type == Miso_2022)
-    {
-      MCodingInfoISO2022 *info = malloc (sizeof (MCodingInfoISO2022));
-
-      if (! coding->resetter)
-	coding->resetter = reset_coding_iso_2022;
-      if (! coding->decoder)
-	coding->decoder = decode_coding_iso_2022;
-      if (! coding->encoder)
-	coding->encoder = encode_coding_iso_2022;
-
-      info->initial_invocation[0] = 0;
-      info->initial_invocation[1] = -1;
-      pl = (MPlist *) mplist_get (plist, Minvocation);
-      if (pl)
-	{
-	  if (MPLIST_KEY (pl) != Minteger)
-	    MERROR (MERROR_CODING, Mnil);
-	  info->initial_invocation[0] = MPLIST_INTEGER (pl);
-	  if (! MPLIST_TAIL_P (pl))
-	    {
-	      pl = MPLIST_NEXT (pl);
-	      if (MPLIST_KEY (pl) != Minteger)
-		MERROR (MERROR_CODING, Mnil);
-	      info->initial_invocation[1] = MPLIST_INTEGER (pl);
-	    }
-	}
-      memset (info->designations, 0, sizeof (info->designations));
-      for (i = 0, pl = (MPlist *) mplist_get (plist, Mdesignation);
-	   i < 32 && pl && MPLIST_KEY (pl) == Minteger;
-	   i++, pl = MPLIST_NEXT (pl))
-	info->designations[i] = MPLIST_INTEGER (pl);
-
-      info->flags = 0;
-      MPLIST_DO (pl, (MPlist *) mplist_get (plist, Mflags))
-	{
-	  MSymbol val;
-
-	  if (MPLIST_KEY (pl) != Msymbol)
-	    MERROR (MERROR_CODING, Mnil);
-	  val = MPLIST_SYMBOL (pl);
-	  if (val == Mreset_at_eol)
-	    info->flags |= MCODING_ISO_RESET_AT_EOL;
-	  else if (val == Mreset_at_cntl)
-	    info->flags |= MCODING_ISO_RESET_AT_CNTL;
-	  else if (val == Meight_bit)
-	    info->flags |= MCODING_ISO_EIGHT_BIT;
-	  else if (val == Mlong_form)
-	    info->flags |= MCODING_ISO_LOCKING_SHIFT;
-	  else if (val == Mdesignation_g0)
-	    info->flags |= MCODING_ISO_DESIGNATION_G0;
-	  else if (val == Mdesignation_g1)
-	    info->flags |= MCODING_ISO_DESIGNATION_G1;
-	  else if (val == Mdesignation_ctext)
-	    info->flags |= MCODING_ISO_DESIGNATION_CTEXT;
-	  else if (val == Mdesignation_ctext_ext)
-	    info->flags |= MCODING_ISO_DESIGNATION_CTEXT_EXT;
-	  else if (val == Mlocking_shift)
-	    info->flags |= MCODING_ISO_LOCKING_SHIFT;
-	  else if (val == Msingle_shift)
-	    info->flags |= MCODING_ISO_SINGLE_SHIFT;
-	  else if (val == Msingle_shift_7)
-	    info->flags |= MCODING_ISO_SINGLE_SHIFT_7;
-	  else if (val == Meuc_tw_shift)
-	    info->flags |= MCODING_ISO_EUC_TW_SHIFT;
-	  else if (val == Miso_6429)
-	    info->flags |= MCODING_ISO_ISO6429;
-	  else if (val == Mrevision_number)
-	    info->flags |= MCODING_ISO_REVISION_NUMBER;
-	  else if (val == Mfull_support)
-	    info->flags |= MCODING_ISO_FULL_SUPPORT;
-	}
-
-      coding->extra_info = info;
-    }
-  else
-    {
-      if (! coding->decoder || ! coding->encoder)
-	MERROR (MERROR_CODING, Mnil);
-      if (! coding->resetter)
-	coding->ready = 1;
-    }
-
-  msymbol_put (sym, Mcoding, coding);
-  msymbol_put (msymbol__canonicalize (sym), Mcoding, coding);
-  plist = (MPlist *) mplist_get (plist, Maliases);
-  if (plist)
-    {
-      MPLIST_DO (pl, plist)
-	{
-	  MSymbol alias;
-
-	  if (MPLIST_KEY (pl) != Msymbol)
-	    continue;
-	  alias = MPLIST_SYMBOL (pl);
-	  msymbol_put (alias, Mcoding, coding);
-	  msymbol_put (msymbol__canonicalize (alias), Mcoding, coding);
-	}
-    }
-
-  MLIST_APPEND1 (&coding_list, codings, coding, MERROR_CODING);
+		     void *extra_info)
+{
+  MSymbol sym;
 
+  M17N_LOCK_REGISTRY ();
+  sym = define_coding (name, plist, resetter, decoder, encoder, extra_info);
+  M17N_UNLOCK_REGISTRY ();
   return sym;
 }
 
@@ -4034,10 +5692,12 @@ mconv_resolve_coding (MSymbol symbol)
 int
 mconv_list_codings (MSymbol **symbols)
 {
-  int i = coding_list.used + mplist_length (coding_definition_list);
+  int i;
   int j;
   MPlist *plist;
 
+  M17N_LOCK_REGISTRY ();
+  i = coding_list.used + mplist_length (coding_definition_list);
   MTABLE_MALLOC ((*symbols), i, MERROR_CODING);
   i = 0;
   MPLIST_DO (plist, coding_definition_list)
@@ -4049,6 +5709,7 @@ mconv_list_codings (MSymbol **symbols)
     if (! mplist_find_by_key (coding_definition_list, 
 			      coding_list.codings[j]->name))
       (*symbols)[i++] = coding_list.codings[j]->name;
+  M17N_UNLOCK_REGISTRY ();
   return i;
 }
 
@@ -4111,8 +5772,7 @@ mconv_buffer_converter (MSymbol name, const unsigned char *buf, int n)
   MSTRUCT_CALLOC (internal, MERROR_CODING);
   converter->internal_info = internal;
   internal->coding = coding;
-  if (coding->resetter
-      && (*coding->resetter) (converter) < 0)
+  if (reset_coding (coding, converter) < 0)
     {
       free (internal);
       free (converter);
@@ -4122,6 +5782,8 @@ mconv_buffer_converter (MSymbol name, const unsigned char *buf, int n)
   internal->unread = mtext ();
   internal->work_mt = mtext ();
   mtext__enlarge (internal->work_mt, MAX_UTF8_CHAR_BYTES);
+  internal->ahead = mtext ();
+  mtext__enlarge (internal->ahead, MAX_UTF8_CHAR_BYTES);
   internal->buf.in = buf;
   internal->used = 0;
   internal->bufsize = n;
@@ -4190,8 +5852,7 @@ mconv_stream_converter (MSymbol name, FILE *fp)
   MSTRUCT_CALLOC (internal, MERROR_CODING);
   converter->internal_info = internal;
   internal->coding = coding;
-  if (coding->resetter
-      && (*coding->resetter) (converter) < 0)
+  if (reset_coding (coding, converter) < 0)
     {
       free (internal);
       free (converter);
@@ -4213,6 +5874,8 @@ mconv_stream_converter (MSymbol name, FILE *fp)
   internal->unread = mtext ();
   internal->work_mt = mtext ();
   mtext__enlarge (internal->work_mt, MAX_UTF8_CHAR_BYTES);
+  internal->ahead = mtext ();
+  mtext__enlarge (internal->ahead, MAX_UTF8_CHAR_BYTES);
   internal->fp = fp;
   internal->binding = BINDING_STREAM;
 
@@ -4221,6 +5884,112 @@ mconv_stream_converter (MSymbol name, FILE *fp)
 
 /*=*/
 
+/***en
+    @brief Create a code converter bound to a file.
+
+    The mconv_file_converter () function creates a pointer to a code
+    converter for coding system $NAME.  The code converter is bound
+    to the contents of the file $FILENAME, and is used only for
+    decoding.
+
+    If possible, the file is mapped into memory, and the decoder reads
+    the mapped bytes directly.  The pages already decoded are released
+    while decoding, so that a large file can be decoded (for instance
+    by mconv_decode_sink ()) without keeping all of it in memory.  If
+    the file can't be mapped, it is read as a stream.  The file is
+    unmapped or closed when another buffer area or stream is bound to
+    the code converter, or when the code converter is freed.
+
+    $NAME can be #Mnil.  In this case, a coding system associated
+    with the current locale (LC_CTYPE) is used.
+
+    @return
+    If the operation was successful, mconv_file_converter () returns
+    the created code converter.  Otherwise it returns @c NULL and
+    assigns an error code to the external variable #merror_code.  */
+
+/***ja
+    @brief ファイルに結び付けられたコードコンバータを作る.
+
+    関数 mconv_file_converter () は、コード系 $NAME 用のコードコンバー
+    タを作る。このコードコンバータはファイル $FILENAME の内容に結び付け
+    られ、デコードにのみ使われる。
+
+    可能ならばファイルはメモリにマップされ、デコーダはマップされたバイ
+    トを直接読む。デコード済みのページはデコード中に解放されるので、大
+    きなファイルも（例えば mconv_decode_sink () によって）全体をメモリ
+    に保持することなくデコードできる。ファイルがマップできない場合はス
+    トリームとして読まれる。ファイルは、コードコンバータに別のバッファ
+    領域あるいはストリームが結び付けられるか、コードコンバータが解放さ
+    れるときに、アンマップあるいはクローズされる。
+
+    $NAME は #Mnil であってもよい。この場合は現在のロケール
+    (LC_CTYPE) に関連付けられたコード系が使われる。
+
+    @return
+    もし処理が成功すれば、mconv_file_converter () は作成したコードコン
+    バータを返す。そうでなければ @c NULL を返し、外部変数 #merror_code
+    にエラーコードを設定する。  */
+
+/***
+    @errors
+    @c MERROR_SYMBOL, @c MERROR_CODING, @c MERROR_IO
+
+    @seealso
+    mconv_buffer_converter (), mconv_stream_converter ()  */
+
+MConverter *
+mconv_file_converter (MSymbol name, const char *filename)
+{
+  MConverter *converter;
+  FILE *fp;
+  int fd = open (filename, O_RDONLY);
+
+  if (fd < 0)
+    MERROR (MERROR_IO, NULL);
+#ifdef USE_MMAP
+  {
+    struct stat st;
+    void *addr;
+
+    if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode)
+	&& st.st_size > 0 && st.st_size <= INT_MAX
+	&& (addr = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+	!= MAP_FAILED)
+      {
+	close (fd);
+#ifdef HAVE_MADVISE
+	madvise (addr, st.st_size, MADV_SEQUENTIAL);
+#endif
+	converter = mconv_buffer_converter (name, addr, st.st_size);
+	if (! converter)
+	  {
+	    munmap (addr, st.st_size);
+	    return NULL;
+	  }
+	((MConverterStatus *) converter->internal_info)->mapped = 1;
+	return converter;
+      }
+  }
+#endif
+  fp = fdopen (fd, "r");
+  if (! fp)
+    {
+      close (fd);
+      MERROR (MERROR_IO, NULL);
+    }
+  converter = mconv_stream_converter (name, fp);
+  if (! converter)
+    {
+      fclose (fp);
+      return NULL;
+    }
+  ((MConverterStatus *) converter->internal_info)->owns_fp = 1;
+  return converter;
+}
+
+/*=*/
+
 /***en
     @brief Reset a code converter.
 
@@ -4252,10 +6021,11 @@ mconv_reset_converter (MConverter *converter)
   converter->result = MCONVERSION_RESULT_SUCCESS;
   internal->carryover_bytes = 0;
   internal->used = 0;
+  internal->released = 0;
   mtext_reset (internal->unread);
-  if (internal->coding->resetter)
-    return (*internal->coding->resetter) (converter);
-  return 0;
+  mtext_reset (internal->ahead);
+  internal->ahead_used = 0;
+  return reset_coding (internal->coding, converter);
 }
 
 /*=*/
@@ -4279,6 +6049,8 @@ mconv_free_converter (MConverter *converter)
 
   M17N_OBJECT_UNREF (internal->work_mt);
   M17N_OBJECT_UNREF (internal->unread);
+  M17N_OBJECT_UNREF (internal->ahead);
+  release_file (internal);
   free (internal);
   free (converter);
 }
@@ -4317,10 +6089,13 @@ mconv_rebind_buffer (MConverter *converter, const unsigned char *buf, int n)
 {
   MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
 
+  release_file (internal);
   internal->buf.in = buf;
   internal->used = 0;
   internal->bufsize = n;
   internal->binding = BINDING_BUFFER;
+  mtext_reset (internal->ahead);
+  internal->ahead_used = 0;
   return converter;
 }
 
@@ -4365,8 +6140,11 @@ mconv_rebind_stream (MConverter *converter, FILE *fp)
     }
   else
     internal->seekable = 1;
+  release_file (internal);
   internal->fp = fp;
   internal->binding = BINDING_STREAM;
+  mtext_reset (internal->ahead);
+  internal->ahead_used = 0;
   return converter;
 }
 
@@ -4417,6 +6195,7 @@ mconv_decode (MConverter *converter, MText *mt)
 
   if (mt->format != MTEXT_FORMAT_UTF_8)
     mtext__adjust_format (mt, MTEXT_FORMAT_UTF_8);
+  MTEXT_FLATTEN (mt);
 
   if (! mt->data)
     mtext__enlarge (mt, MAX_UTF8_CHAR_BYTES);
@@ -4436,19 +6215,70 @@ mconv_decode (MConverter *converter, MText *mt)
       for (i = 0, n -= 1; i < limit; i++, converter->nchars++, n--)
 	mtext_cat_char (mt, mtext_ref_char (internal->unread, n));
       mtext_del (internal->unread, n + 1, internal->unread->nchars);
-      if (at_most > 0)
+    }
+
+  if (internal->ahead_used < internal->ahead->nbytes
+      && (at_most < 0 || converter->nchars < at_most))
+    {
+      MText *ahead = internal->ahead;
+      int from = POS_BYTE_TO_CHAR (ahead, internal->ahead_used);
+      int to = ahead->nchars;
+
+      if (at_most > 0 && to - from > at_most - converter->nchars)
+	to = from + at_most - converter->nchars;
+      mtext_copy (mt, mt->nchars, ahead, from, to);
+      converter->nchars += to - from;
+      internal->ahead_used = POS_CHAR_TO_BYTE (ahead, to);
+    }
+
+  if (at_most > 0 && converter->nchars > 0)
+    {
+      if (converter->nchars == at_most)
+	return mt;
+      converter->at_most -= converter->nchars;
+    }
+
+  if (internal->binding == BINDING_BUFFER && internal->mapped)
+    {
+      /* Decode a mapped file by CONVERT_WORKSIZE bytes to release the
+	 pages already decoded.  */
+      int last_block = converter->last_block;
+      int worksize = CONVERT_WORKSIZE;
+
+#ifdef M17N_THREADS
+      if (parallel_splitter (converter))
+	worksize = decode_threads * PARALLEL_CHUNK_BYTES;
+#endif
+      while (1)
 	{
-	  if (at_most == limit)
-	    return mt;
-	  converter->at_most -= converter->nchars;
+	  int nbytes = internal->bufsize - internal->used;
+	  int prev_nbytes = converter->nbytes;
+
+	  if (nbytes > worksize)
+	    {
+	      nbytes = worksize;
+	      converter->last_block = 0;
+	    }
+	  else
+	    converter->last_block = last_block;
+	  if (at_most > 0)
+	    converter->at_most = at_most - converter->nchars;
+	  converter->result = MCONVERSION_RESULT_SUCCESS;
+	  decode_buffer (converter, internal->buf.in + internal->used,
+			 nbytes, mt);
+	  internal->used += converter->nbytes - prev_nbytes;
+	  release_consumed_pages (internal);
+	  if (converter->nbytes - prev_nbytes < nbytes
+	      || internal->used == internal->bufsize
+	      || (at_most > 0 && converter->nchars >= at_most))
+	    break;
 	}
+      converter->last_block = last_block;
     }
-
-  if (internal->binding == BINDING_BUFFER)
+  else if (internal->binding == BINDING_BUFFER)
     {
-      (*internal->coding->decoder) (internal->buf.in + internal->used,
-				    internal->bufsize - internal->used,
-				    mt, converter);
+      decode_buffer (converter, internal->buf.in + internal->used,
+		     internal->bufsize - internal->used, mt);
       internal->used += converter->nbytes;
     }  
   else if (internal->binding == BINDING_STREAM)
@@ -4485,6 +6315,8 @@ mconv_decode (MConverter *converter, MText *mt)
 
 	  if (nbytes == 0)
 	    converter->last_block = last_block;
+	  if (at_most > 0)
+	    converter->at_most = at_most - converter->nchars;
 	  prev_nbytes = converter->nbytes;
 	  (*internal->coding->decoder) (work, nbytes, mt, converter);
 	  if (converter->nbytes - prev_nbytes < nbytes)
@@ -4497,8 +6329,7 @@ mconv_decode (MConverter *converter, MText *mt)
 	      break;
 	    }
 	  if (nbytes == 0
-	      || (converter->at_most > 0
-		  && converter->nchars == converter->at_most))
+	      || (at_most > 0 && converter->nchars >= at_most))
 	    break;
 	}
       converter->last_block = last_block;
@@ -4617,6 +6448,92 @@ mconv_decode_stream (MSymbol name, FILE *fp)
 
 /*=*/
 
+/***en
+    @brief Decode a byte sequence block by block.
+
+    The mconv_decode_sink () function decodes the whole byte sequence
+    taken from the buffer area or the stream that is currently bound
+    to $CONVERTER.  Instead of accumulating the result, it decodes the
+    byte sequence block by block into a UTF-8 M-text, and calls $FUNC
+    with the M-text and $ARG for each block.  The M-text is reused
+    for the next block, thus the memory used does not depend on the
+    size of the input.  $FUNC must not keep the M-text.  If $FUNC
+    returns a nonzero value, mconv_decode_sink () stops decoding.
+
+    @return
+    If the operation was successful, mconv_decode_sink () returns the
+    number of decoded characters.  Otherwise it returns -1 and assigns
+    an error code to the external variable #merror_code.  */
+
+/***ja
+    @brief バイト列をブロック毎にデコードする.
+
+    関数 mconv_decode_sink () は、$CONVERTER に現在結び付けられている
+    バッファ領域あるいはストリームから取られるバイト列全体をデコードす
+    る。結果を蓄積する代わりに、バイト列をブロック毎に UTF-8 の M-text
+    にデコードし、各ブロックについてその M-text と $ARG を引数として
+    $FUNC を呼ぶ。M-text は次のブロックに再利用されるので、使用するメモ
+    リは入力の大きさによらない。$FUNC はこの M-text を保持してはならな
+    い。$FUNC が 0 以外の値を返すと、mconv_decode_sink () はデコードを
+    中止する。
+
+    @return
+    もし処理が成功すれば、mconv_decode_sink () はデコードした文字数を返
+    す。そうでなければ -1 を返し、外部変数 #merror_code にエラーコード
+    を設定する。  */
+
+/***
+    @errors
+    @c MERROR_IO, @c MERROR_CODING
+
+    @seealso
+    mconv_decode (), mconv_decode_stream ()  */
+
+int
+mconv_decode_sink (MConverter *converter, MConverterSinkFunc func, void *arg)
+{
+  MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
+  MText *mt;
+  int at_most = converter->at_most;
+  int nchars = 0, n;
+  int stopped = 0;
+
+  if (internal->binding == BINDING_NONE)
+    MERROR (MERROR_CODING, -1);
+  mt = mtext ();
+  while (! stopped)
+    {
+      if (internal->unread->nchars > 0
+	  || internal->ahead_used < internal->ahead->nbytes)
+	{
+	  /* Characters pushed back or decoded ahead come first.  */
+	  mtext_reset (mt);
+	  converter->at_most = CONVERT_AHEAD_CHARS;
+	  mconv_decode (converter, mt);
+	  converter->at_most = at_most;
+	  n = mt->nchars;
+	}
+      else
+	n = decode_block (converter, mt);
+      if (n == 0)
+	break;
+      nchars += n;
+      stopped = (*func) (mt, arg);
+    }
+  M17N_OBJECT_UNREF (mt);
+  converter->nchars = nchars;
+  if (! stopped)
+    {
+      if (converter->result == MCONVERSION_RESULT_IO_ERROR)
+	MERROR (MERROR_IO, -1);
+      if (converter->result == MCONVERSION_RESULT_INVALID_BYTE)
+	MERROR (MERROR_CODING, -1);
+    }
+  return nchars;
+}
+
+/*=*/
+
 /***en @brief Encode an M-text into a byte sequence.
 
     The mconv_encode () function encodes M-text $MT and writes the
@@ -4696,6 +6613,8 @@ mconv_encode_range (MConverter *converter, MText *mt, int from, int to)
 
   M_CHECK_POS_X (mt, from, -1);
   M_CHECK_POS_X (mt, to, -1);
+  if (internal->mapped)
+    MERROR (MERROR_CODING, -1);
   if (to < from)
     to = from;
 
@@ -4706,6 +6625,7 @@ mconv_encode_range (MConverter *converter, MText *mt, int from, int to)
   converter->result = MCONVERSION_RESULT_SUCCESS;
 
   mtext_put_prop (mt, from, to, Mcoding, internal->coding->name);
+  MTEXT_FLATTEN (mt);
   if (internal->binding == BINDING_BUFFER)
     {
       (*internal->coding->encoder) (mt, from, to,
@@ -4721,6 +6641,7 @@ mconv_encode_range (MConverter *converter, MText *mt, int from, int to)
       while (from < to)
 	{
 	  int written = 0;
+	  int prev_nchars = converter->nchars;
 	  int prev_nbytes = converter->nbytes;
 	  int this_nbytes;
 
@@ -4741,7 +6662,10 @@ mconv_encode_range (MConverter *converter, MText *mt, int from, int to)
 	      converter->result = MCONVERSION_RESULT_IO_ERROR;
 	      break;
 	    }
-	  from += converter->nchars;
+	  /* The encoder accumulates CONVERTER->nchars.  */
+	  if (converter->nchars == prev_nchars)
+	    break;
+	  from += converter->nchars - prev_nchars;
 	}
     }
   else 				/* fail safe */
@@ -4858,6 +6782,12 @@ mconv_encode_stream (MSymbol name, MText *mt, FILE *fp)
     sequence.  The internal status of $CONVERTER is updated
     appropriately.
 
+    To read characters efficiently, mconv_getc () decodes a block of
+    the source at once.  The characters decoded ahead are kept in
+    $CONVERTER and are read by the subsequent mconv_getc (),
+    mconv_gets (), and mconv_decode () calls.  They are discarded
+    when another buffer area or stream is bound to $CONVERTER.
+
     @return
     If the operation was successful, mconv_getc () returns the
     character read in.  If the input source reaches EOF, it returns @c
@@ -4873,6 +6803,12 @@ mconv_encode_stream (MSymbol name, MText *mt, FILE *fp)
     バイト列のデコードには $CONVERTER のデコーダが用いられる。
     $CONVERTER の内部状態は必要に応じて更新される。
 
+    効率よく読み込むため、mconv_getc () は入力源をブロック単位でまとめてデ
+    コードする。先読みしてデコードされた文字は $CONVERTER 内に保持され、
+    これ以降の mconv_getc ()、mconv_gets ()、mconv_decode () の呼び出し
+    で読まれる。これらの文字は、$CONVERTER に別のバッファ領域あるいはス
+    トリームが結び付けられると捨てられる。
+
     @return
     処理が成功すれば、mconv_getc () は読み込まれた文字を返す。入力源が 
     EOF に達した場合は、外部変数 #merror_code を変えずに @c EOF 
@@ -4891,14 +6827,31 @@ mconv_getc (MConverter *converter)
 {
   MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
   int at_most = converter->at_most;
+  unsigned char *p;
+  int c;
 
-  mtext_reset (internal->work_mt);
-  converter->at_most = 1;
-  mconv_decode (converter, internal->work_mt);
-  converter->at_most = at_most;
-  return (converter->nchars == 1
-	  ? STRING_CHAR (internal->work_mt->data)
-	  : EOF);
+  if (internal->unread->nchars > 0)
+    {
+      mtext_reset (internal->work_mt);
+      converter->at_most = 1;
+      mconv_decode (converter, internal->work_mt);
+      converter->at_most = at_most;
+      return (converter->nchars == 1
+	      ? STRING_CHAR (internal->work_mt->data)
+	      : EOF);
+    }
+  if (internal->ahead_used == internal->ahead->nbytes)
+    {
+      internal->ahead_used = 0;
+      if (decode_block (converter, internal->ahead) == 0)
+	return EOF;
+    }
+  p = internal->ahead->data + internal->ahead_used;
+  c = STRING_CHAR_ADVANCE (p);
+  internal->ahead_used = p - internal->ahead->data;
+  converter->nchars = 1;
+  converter->result = MCONVERSION_RESULT_SUCCESS;
+  return c;
 }
 
 /*=*/
@@ -5047,6 +7000,8 @@ mconv_putc (MConverter *converter, int c)
 MText *
 mconv_gets (MConverter *converter, MText *mt)
 {
+  MConverterStatus *internal = (MConverterStatus *) converter->internal_info;
+  MText *ahead = internal->ahead;
   int c;
 
   M_CHECK_READONLY (mt, NULL);
@@ -5055,6 +7010,23 @@ mconv_gets (MConverter *converter, MText *mt)
 
   while (1)
     {
+      if (internal->unread->nchars == 0
+	  && internal->ahead_used < ahead->nbytes)
+	{
+	  /* Copy characters up to a newline directly from the
+	     characters decoded ahead.  */
+	  unsigned char *p = ahead->data + internal->ahead_used;
+	  unsigned char *pend = ahead->data + ahead->nbytes;
+	  unsigned char *q = memchr (p, '\n', pend - p);
+
+	  mtext__cat_data (mt, p, (q ? q : pend) - p, MTEXT_FORMAT_UTF_8);
+	  internal->ahead_used = (q ? q + 1 : pend) - ahead->data;
+	  if (q)
+	    {
+	      c = '\n';
+	      break;
+	    }
+	}
       c = mconv_getc (converter);
       if (c == EOF || c == '\n')
 	break;
@@ -5068,6 +7040,326 @@ mconv_gets (MConverter *converter, MText *mt)
 
 /*=*/
 
+/***en
+    @brief Create a coding system detector.
+
+    The mconv_coding_detector () function creates a detector that
+    guesses the coding system of a byte sequence.  The detector
+    examines bytes given by mconv_feed_detector () for all coding
+    systems in a single pass, and keeps only those for which the
+    bytes are valid.
+
+    $CODINGS is an array of $N symbols representing the coding systems
+    to examine.  If $CODINGS is @c NULL, all the coding systems listed
+    by mconv_list_codings () are examined.  Coding systems whose type
+    is not known to the detector are ignored.
+
+    $LIMIT is the maximum number of bytes to examine.  If it is not
+    positive, 65536 is used.
+
+    @return
+    If the operation was successful, mconv_coding_detector () returns
+    the created detector.  Otherwise it returns @c NULL and assigns an
+    error code to the external variable #merror_code.  */
+
+/***ja
+    @brief コード系検出器を作る.
+
+    関数 mconv_coding_detector () は、バイト列のコード系を推定する検出
+    器を作る。検出器は mconv_feed_detector () で与えられたバイトをすべ
+    てのコード系について一度に調べ、そのバイト列が正しいコード系だけを
+    残す。
+
+    $CODINGS は調べるコード系を示す $N 個のシンボルの配列である。
+    $CODINGS が @c NULL ならば mconv_list_codings () が列挙するすべての
+    コード系を調べる。検出器が知らないタイプのコード系は無視される。
+
+    $LIMIT は調べるバイト数の最大値である。正でなければ 65536 が用いら
+    れる。
+
+    @return
+    処理が成功すれば mconv_coding_detector () は作成した検出器を返す。
+    そうでなければ @c NULL を返し、外部変数 #merror_code にエラーコード
+    を設定する。  */
+
+/***
+    @errors
+    @c MERROR_CODING
+
+    @seealso
+    mconv_feed_detector (), mconv_detected_codings (),
+    mconv_free_detector (), mconv_detect_coding ()  */
+
+MCodingDetector *
+mconv_coding_detector (MSymbol *codings, int n, int limit)
+{
+  MCodingDetector *detector;
+  MSymbol *all = NULL;
+  int i, j;
+
+  if (! codings)
+    {
+      n = mconv_list_codings (&all);
+      codings = all;
+    }
+  MSTRUCT_CALLOC (detector, MERROR_CODING);
+  detector->limit = limit > 0 ? limit : DETECT_DEFAULT_LIMIT;
+  if (n > 0)
+    MTABLE_CALLOC (detector->probes, n, MERROR_CODING);
+  for (i = 0; i < n; i++)
+    {
+      MCodingSystem *coding = detect_find_coding (codings[i]);
+      MDetectProbe *probe = detector->probes + detector->nprobes;
+
+      if (! coding)
+	continue;
+      /* An alias names the same coding system.  */
+      for (j = 0; j < detector->nprobes; j++)
+	if (detector->probes[j].coding == coding)
+	  break;
+      if (j < detector->nprobes)
+	continue;
+      if (detect_setup_probe (probe, coding) == 0)
+	detector->nprobes++;
+    }
+  detector->nalive = detector->nprobes;
+  free (all);
+  return detector;
+}
+
+/*=*/
+
+/***en
+    @brief Give bytes to a coding system detector.
+
+    The mconv_feed_detector () function gives the detector $DETECTOR
+    the next $N bytes pointed to by $BUF.  The bytes following those
+    given previously are examined up to the limit specified to
+    mconv_coding_detector ().
+
+    @return
+    If the detector has examined bytes up to the limit, or no coding
+    system is left valid, mconv_feed_detector () returns 1, and more
+    bytes are useless.  Otherwise it returns 0.  */
+
+/***ja
+    @brief コード系検出器にバイトを与える.
+
+    関数 mconv_feed_detector () は、検出器 $DETECTOR に $BUF が指す次
+    の $N バイトを与える。これまでに与えられたバイトに続くものとして、
+    mconv_coding_detector () に指定した上限まで調べられる。
+
+    @return
+    検出器が上限までバイトを調べたか、正しいコード系が一つも残っていな
+    ければ、mconv_feed_detector () は 1 を返し、それ以上バイトを与えて
+    も意味がない。そうでなければ 0 を返す。  */
+
+/***
+    @seealso
+    mconv_coding_detector (), mconv_detected_codings ()  */
+
+int
+mconv_feed_detector (MCodingDetector *detector,
+		     const unsigned char *buf, int n)
+{
+  const unsigned char *p, *pend;
+  int i;
+
+  if (n > detector->limit - detector->nbytes)
+    n = detector->limit - detector->nbytes;
+  if (n > 0)
+    {
+      detector->nbytes += n;
+      for (p = buf, pend = buf + n; p < pend; p++)
+	if (DETECT_CONTROL_P (*p))
+	  detector->controls++;
+      for (i = 0; i < detector->nprobes; i++)
+	{
+	  MDetectProbe *probe = detector->probes + i;
+
+	  if (probe->invalid)
+	    continue;
+	  detect_probe (probe, buf, buf + n);
+	  if (probe->invalid)
+	    detector->nalive--;
+	}
+    }
+  return (detector->nbytes >= detector->limit || detector->nalive == 0);
+}
+
+/*=*/
+
+/***en
+    @brief Get coding systems detected by a coding system detector.
+
+    The mconv_detected_codings () function makes an array of symbols
+    representing the coding systems for which all the bytes given to
+    the detector $DETECTOR so far are valid, stores the pointer to the
+    array in a place pointed to by $CODINGS, and returns the length of
+    the array.  The caller should free the array by free ().
+
+    The array is sorted from the most probable coding system.  A
+    coding system that recognizes a byte order mark (signature) at the
+    head of the bytes precedes the others.  The rest are ordered by
+    the bytes supporting them, i.e. well-formed multi-byte sequences,
+    escape sequences, and graphic characters of non-ASCII bytes, and
+    control codes rarely found in text count against them.  A
+    multi-byte sequence cut off by the limit of the detector counts as
+    if it were complete.  Among equally supported coding systems, UTF-8 is preferred to the others
+    (for instance, US-ASCII and ISO-8859-1), because bytes not examined
+    yet may be non-ASCII, and are likely to be UTF-8.
+
+    The detection is based only on the structure of the coding
+    systems, not on the statistics of languages.  Thus coding systems
+    that share the same byte structure (for instance, EUC-JP and
+    EUC-KR) may be returned in any order.
+
+    @return
+    If no coding system is valid, mconv_detected_codings () returns 0
+    and stores @c NULL in $CODINGS.  */
+
+/***ja
+    @brief コード系検出器が検出したコード系を得る.
+
+    関数 mconv_detected_codings () は、検出器 $DETECTOR にこれまでに与
+    えられたバイトがすべて正しいコード系を示すシンボルを並べた配列を作
+    り、$CODINGS でポイントされた場所にこの配列へのポインタを置き、配
+    列の長さを返す。呼び出し側は配列を free () で解放すべきである。
+
+    配列は可能性の高いコード系から順に並ぶ。バイト列の先頭のバイトオー
+    ダーマーク(シグネチャ)を認識するコード系が他に優先する。残りは、
+    それを支持するバイト、すなわち正しいマルチバイト列、エスケープシー
+    ケンス、非 ASCII バイトによる図形文字によって順位付けされ、テキスト
+    にはまれな制御コードは不利に働く。検出器の上限で途切れたマルチバイ
+    ト列は、完全なものとして数えられる。同程度に支持されるコード系の
+    間では、UTF-8 が他のもの (例えば US-ASCII や ISO-8859-1) より優先
+    される。まだ調べていないバイトが非 ASCII であるかもしれず、それは
+    UTF-8 である可能性が高いからである。
+
+    検出はコード系の構造のみに基づき、言語の統計は用いない。したがって
+    同じバイト構造を持つコード系 (例えば EUC-JP と EUC-KR) の順序は定ま
+    らない。
+
+    @return
+    正しいコード系が一つもなければ、mconv_detected_codings () は 0 を返
+    し、$CODINGS に @c NULL を置く。  */
+
+/***
+    @errors
+    @c MERROR_CODING
+
+    @seealso
+    mconv_coding_detector (), mconv_feed_detector ()  */
+
+int
+mconv_detected_codings (MCodingDetector *detector, MSymbol **codings)
+{
+  MDetectRank *ranks;
+  int i, n;
+
+  *codings = NULL;
+  if (detector->nalive == 0)
+    return 0;
+  MTABLE_MALLOC (ranks, detector->nalive, MERROR_CODING);
+  for (i = n = 0; i < detector->nprobes; i++)
+    {
+      MDetectProbe *probe = detector->probes + i;
+
+      if (probe->invalid)
+	continue;
+      ranks[n].probe = probe;
+      ranks[n].score = probe->score;
+      if (detector->nbytes >= detector->limit)
+	ranks[n].score += detect_pending_weight (probe);
+      /* Control codes are counted in UTF-16 and UTF-32 by the
+	 probes.  */
+      if (probe->kind != DETECT_UTF_16 && probe->kind != DETECT_UTF_32)
+	ranks[n].score -= detector->controls * DETECT_PENALTY_CONTROL;
+      ranks[n].index = i;
+      n++;
+    }
+  qsort (ranks, n, sizeof (MDetectRank), detect_compare);
+  MTABLE_MALLOC (*codings, n, MERROR_CODING);
+  for (i = 0; i < n; i++)
+    (*codings)[i] = ranks[i].probe->coding->name;
+  free (ranks);
+  return n;
+}
+
+/*=*/
+
+/***en
+    @brief Free a coding system detector.
+
+    The mconv_free_detector () function frees the coding system
+    detector $DETECTOR.  */
+
+/***ja
+    @brief コード系検出器を解放する.
+
+    関数 mconv_free_detector () はコード系検出器 $DETECTOR を解放す
+    る。  */
+
+/***
+    @seealso
+    mconv_coding_detector ()  */
+
+void
+mconv_free_detector (MCodingDetector *detector)
+{
+  free (detector->probes);
+  free (detector);
+}
+
+/*=*/
+
+/***en
+    @brief Detect the coding system of a byte sequence.
+
+    The mconv_detect_coding () function guesses the coding system of
+    the byte sequence of $N bytes pointed to by $BUF among all the
+    coding systems, as mconv_detected_codings () does for a detector
+    given the bytes.  At most 65536 bytes are examined.
+
+    @return
+    If a coding system is detected, mconv_detect_coding () returns the
+    symbol representing the most probable one.  Otherwise it returns
+    #Mnil.  */
+
+/***ja
+    @brief バイト列のコード系を検出する.
+
+    関数 mconv_detect_coding () は、$BUF が指す $N バイトのバイト列の
+    コード系を、それを与えた検出器について mconv_detected_codings () が
+    するように、すべてのコード系の中から推定する。調べるのは高々 65536
+    バイトである。
+
+    @return
+    コード系が検出されれば、mconv_detect_coding () は最も可能性の高いも
+    のを示すシンボルを返す。そうでなければ #Mnil を返す。  */
+
+/***
+    @seealso
+    mconv_coding_detector ()  */
+
+MSymbol
+mconv_detect_coding (const unsigned char *buf, int n)
+{
+  MCodingDetector *detector = mconv_coding_detector (NULL, 0, 0);
+  MSymbol *codings, name = Mnil;
+
+  if (! detector)
+    return Mnil;
+  mconv_feed_detector (detector, buf, n);
+  if (mconv_detected_codings (detector, &codings) > 0)
+    name = codings[0];
+  free (codings);
+  mconv_free_detector (detector);
+  return name;
+}
+
+/*=*/
+
 /*** @} */
 
 /*
@@ -758,6 +758,77 @@ expand_wildcard_database (MPlist *plist)
   return 0;
 }
 
+/* Subroutine of mdatabase_list.  Called with the registry lock
+   held.  */
+
+static MPlist *
+list_databases (MSymbol tag0, MSymbol tag1, MSymbol tag2, MSymbol tag3)
+{
+  MPlist *plist = mplist (), *pl = plist;
+  MPlist *p, *p0, *p1, *p2, *p3;
+
+  mdatabase__update ();
+
+  MPLIST_DO (p, mdatabase__list)
+    {
+      p0 = MPLIST_PLIST (p);
+      /* P0 ::= (TAG0 (TAG1 (TAG2 (TAG3 MDB) ...) ...) ...) */
+      if (MPLIST_SYMBOL (p0) == Masterisk
+	  || (tag0 != Mnil && MPLIST_SYMBOL (p0) != tag0))
+	continue;
+      MPLIST_DO (p0, MPLIST_NEXT (p0))
+	{
+	  p1 = MPLIST_PLIST (p0);
+	  if (MPLIST_SYMBOL (p1) == Masterisk)
+	    {
+	      if (expand_wildcard_database (p1))
+		{
+		  M17N_OBJECT_UNREF (plist);
+		  return list_databases (tag0, tag1, tag2, tag3);
+		}
+	      continue;
+	    }
+	  if (tag1 != Mnil && MPLIST_SYMBOL (p1) != tag1)
+	    continue;
+	  MPLIST_DO (p1, MPLIST_NEXT (p1))
+	    {
+	      p2 = MPLIST_PLIST (p1);
+	      if (MPLIST_SYMBOL (p2) == Masterisk)
+		{
+		  if (expand_wildcard_database (p2))
+		    {
+		      M17N_OBJECT_UNREF (plist);
+		      return list_databases (tag0, tag1, tag2, tag3);
+		    }
+		  continue;
+		}
+	      if (tag2 != Mnil && MPLIST_SYMBOL (p2) != tag2)
+		continue;
+	      MPLIST_DO (p2, MPLIST_NEXT (p2))
+		{
+		  p3 = MPLIST_PLIST (p2);
+		  if (MPLIST_SYMBOL (p3) == Masterisk)
+		    {
+		      if (expand_wildcard_database (p3))
+			{
+			  M17N_OBJECT_UNREF (plist);
+			  return list_databases (tag0, tag1, tag2, tag3);
+			}
+		      continue;
+		    }
+		  if (tag3 != Mnil && MPLIST_SYMBOL (p3) != tag3)
+		    continue;
+		  p3 = MPLIST_NEXT (p3);
+		  pl = mplist_add (pl, Mt, MPLIST_VAL (p3));
+		}
+	    }
+	}
+    }
+  if (MPLIST_TAIL_P (plist))
+    M17N_OBJECT_UNREF (plist);
+  return plist;
+}
+
 
 /* Internal API */
 
@@ -1083,6 +1154,78 @@ mdatabase__file (MDatabase *mdb)
   return get_database_file (db_info, NULL, NULL);
 }
 
+/* Return a newly allocated name of the file to cache the data of MDB
+   in a compiled form, or NULL if MDB is not loaded from a file or
+   there is no directory for the user's database.  The file is in
+   that directory and is named by appending ".cache" to the basename
+   of the file of MDB.  The directory is created if necessary.  */
+
+char *
+mdatabase__cache_file (MDatabase *mdb)
+{
+  MDatabaseInfo *dir_info = MPLIST_VAL (mdatabase__dir_list);
+  char *file = mdatabase__file (mdb);
+  char *base, *cache;
+  struct stat buf;
+
+  if (! file || ! dir_info->filename)
+    return NULL;
+  base = strrchr (file, PATH_SEPARATOR);
+  base = base ? base + 1 : file;
+  cache = malloc (dir_info->len + strlen (base) + 7);
+  if (! cache)
+    return NULL;
+  sprintf (cache, "%s%s.cache", dir_info->filename, base);
+  if (stat (dir_info->filename, &buf) < 0
+      && mkdir (dir_info->filename, 0777) < 0)
+    {
+      free (cache);
+      return NULL;
+    }
+  return cache;
+}
+
+/* Set STAMP to the device and inode numbers, the size, and the
+   modification time of the file of MDB.  Return 0 on success, and -1
+   if MDB is not loaded from a file or the file is not accessible.  */
+
+int
+mdatabase__stamp (MDatabase *mdb, MDatabaseStamp *stamp)
+{
+  struct stat buf;
+  int result = -1;
+
+  if (mdb->loader != load_database
+      || ! get_database_file (mdb->extra_info, &buf, &result)
+      || result < 0)
+    return -1;
+  memset (stamp, 0, sizeof (MDatabaseStamp));
+  stamp->dev = buf.st_dev;
+  stamp->ino = buf.st_ino;
+  stamp->size = buf.st_size;
+  stamp->mtime = buf.st_mtime;
+  return 0;
+}
+
+/* Check if the data of MDB cached with STAMP are still valid, i.e.
+   STAMP is exactly that of the current file of MDB.  A cache made
+   from another file (e.g. one that has been removed or replaced by
+   an older one) is never valid even if it is newer than the current
+   file.  If the data are valid, MDB is regarded as loaded now, and 1
+   is returned.  Otherwise, 0 is returned.  */
+
+int
+mdatabase__cache_valid_p (MDatabase *mdb, MDatabaseStamp *stamp)
+{
+  MDatabaseStamp current;
+
+  if (mdatabase__stamp (mdb, &current) < 0
+      || memcmp (&current, stamp, sizeof (MDatabaseStamp)))
+    return 0;
+  ((MDatabaseInfo *) mdb->extra_info)->time = time (NULL);
+  return 1;
+}
+
 int
 mdatabase__lock (MDatabase *mdb)
 {
@@ -1295,10 +1438,14 @@ MDatabase *
 mdatabase_find (MSymbol tag0, MSymbol tag1, MSymbol tag2, MSymbol tag3)
 {
   MSymbol tags[4];
+  MDatabase *mdb;
 
+  M17N_LOCK_REGISTRY ();
   mdatabase__update ();
   tags[0] = tag0, tags[1] = tag1, tags[2] = tag2, tags[3] = tag3;
-  return find_database (tags);
+  mdb = find_database (tags);
+  M17N_UNLOCK_REGISTRY ();
+  return mdb;
 }
 
 /*=*/
@@ -1321,68 +1468,11 @@ mdatabase_find (MSymbol tag0, MSymbol tag1, MSymbol tag2, MSymbol tag3)
 MPlist *
 mdatabase_list (MSymbol tag0, MSymbol tag1, MSymbol tag2, MSymbol tag3)
 {
-  MPlist *plist = mplist (), *pl = plist;
-  MPlist *p, *p0, *p1, *p2, *p3;
-
-  mdatabase__update ();
+  MPlist *plist;
 
-  MPLIST_DO (p, mdatabase__list)
-    {
-      p0 = MPLIST_PLIST (p);
-      /* P0 ::= (TAG0 (TAG1 (TAG2 (TAG3 MDB) ...) ...) ...) */
-      if (MPLIST_SYMBOL (p0) == Masterisk
-	  || (tag0 != Mnil && MPLIST_SYMBOL (p0) != tag0))
-	continue;
-      MPLIST_DO (p0, MPLIST_NEXT (p0))
-	{
-	  p1 = MPLIST_PLIST (p0);
-	  if (MPLIST_SYMBOL (p1) == Masterisk)
-	    {
-	      if (expand_wildcard_database (p1))
-		{
-		  M17N_OBJECT_UNREF (plist);
-		  return mdatabase_list (tag0, tag1, tag2, tag3);
-		}
-	      continue;
-	    }
-	  if (tag1 != Mnil && MPLIST_SYMBOL (p1) != tag1)
-	    continue;
-	  MPLIST_DO (p1, MPLIST_NEXT (p1))
-	    {
-	      p2 = MPLIST_PLIST (p1);
-	      if (MPLIST_SYMBOL (p2) == Masterisk)
-		{
-		  if (expand_wildcard_database (p2))
-		    {
-		      M17N_OBJECT_UNREF (plist);
-		      return mdatabase_list (tag0, tag1, tag2, tag3);
-		    }
-		  continue;
-		}
-	      if (tag2 != Mnil && MPLIST_SYMBOL (p2) != tag2)
-		continue;
-	      MPLIST_DO (p2, MPLIST_NEXT (p2))
-		{
-		  p3 = MPLIST_PLIST (p2);
-		  if (MPLIST_SYMBOL (p3) == Masterisk)
-		    {
-		      if (expand_wildcard_database (p3))
-			{
-			  M17N_OBJECT_UNREF (plist);
-			  return mdatabase_list (tag0, tag1, tag2, tag3);
-			}
-		      continue;
-		    }
-		  if (tag3 != Mnil && MPLIST_SYMBOL (p3) != tag3)
-		    continue;
-		  p3 = MPLIST_NEXT (p3);
-		  pl = mplist_add (pl, Mt, MPLIST_VAL (p3));
-		}
-	    }
-	}
-    }
-  if (MPLIST_TAIL_P (plist))
-    M17N_OBJECT_UNREF (plist);
+  M17N_LOCK_REGISTRY ();
+  plist = list_databases (tag0, tag1, tag2, tag3);
+  M17N_UNLOCK_REGISTRY ();
   return plist;
 }
 
@@ -1442,7 +1532,9 @@ mdatabase_define (MSymbol tag0, MSymbol tag1, MSymbol tag2, MSymbol tag3,
   tags[0] = tag0, tags[1] = tag1, tags[2] = tag2, tags[3] = tag3;
   if (! loader)
     loader = load_database;
+  M17N_LOCK_REGISTRY ();
   mdb = register_database (tags, loader, extra_info, MDB_STATUS_EXPLICIT, NULL);
+  M17N_UNLOCK_REGISTRY ();
   return mdb;
 }
 
@@ -1503,7 +1595,12 @@ mdatabase_define (MSymbol tag0, MSymbol tag1, MSymbol tag2, MSymbol tag3,
 void *
 mdatabase_load (MDatabase *mdb)
 {
-  return (*mdb->loader) (mdb->tag, mdb->extra_info);
+  void *data;
+
+  M17N_LOCK_REGISTRY ();
+  data = (*mdb->loader) (mdb->tag, mdb->extra_info);
+  M17N_UNLOCK_REGISTRY ();
+  return data;
 }
 
 /*=*/
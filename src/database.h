@@ -82,6 +82,20 @@ extern char *mdatabase__find_file (char *filename);
 
 extern char *mdatabase__file (MDatabase *mdb);
 
+/** Identity of the file of a database, saved with a cache of its
+    data to tell if the cache was made from the current file.  */
+
+typedef struct
+{
+  long long dev, ino, size, mtime;
+} MDatabaseStamp;
+
+extern char *mdatabase__cache_file (MDatabase *mdb);
+
+extern int mdatabase__stamp (MDatabase *mdb, MDatabaseStamp *stamp);
+
+extern int mdatabase__cache_valid_p (MDatabase *mdb, MDatabaseStamp *stamp);
+
 extern int mdatabase__lock (MDatabase *mdb);
 
 extern int mdatabase__save (MDatabase *mdb, MPlist *data);
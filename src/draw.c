@@ -1499,10 +1499,10 @@ get_gstring (MFrame *frame, MText *mt, int pos, int to, MDrawControl *control)
       MTextProperty *prop = mtext_get_property (mt, pos, M_glyph_string);
 
       if (prop
-	  && ((prop->start != 0
-	       && mtext_ref_char (mt, prop->start - 1) != '\n')
-	      || (prop->end < mtext_nchars (mt)
-		  && mtext_ref_char (mt, prop->end - 1) != '\n')))
+	  && ((MTEXTPROP_START (prop) != 0
+	       && mtext_ref_char (mt, MTEXTPROP_START (prop) - 1) != '\n')
+	      || (MTEXTPROP_END (prop) < mtext_nchars (mt)
+		  && mtext_ref_char (mt, MTEXTPROP_END (prop) - 1) != '\n')))
 	{
 	  mtext_detach_property (prop);
 	  prop = NULL;
@@ -152,6 +152,11 @@
 #ifdef HAVE_DLFCN_H
 #include <dlfcn.h>
 #endif
+#if defined (HAVE_SYS_MMAN_H) && defined (HAVE_MMAP)
+#include <sys/mman.h>
+#include <fcntl.h>
+#define USE_IM_IMAGE
+#endif
 
 #include "m17n.h"
 #include "m17n-misc.h"
@@ -161,10 +166,58 @@
 #include "symbol.h"
 #include "plist.h"
 #include "database.h"
+#include "character.h"
 #include "charset.h"
 
 static int mdebug_flag = MDEBUG_INPUT;
 
+/* Phases of handling a key whose time is measured if the debug flag
+   MDEBUG_INPUT_TIME is set.  The time of a phase includes the time of
+   the phases it calls.  Each thread has its own nesting levels and
+   stack of start times, and adds the results to the counters
+   atomically.  */
+
+enum im_phase
+  {
+    IM_PHASE_HANDLE_KEY,
+    IM_PHASE_ACTIONS,
+    IM_PHASE_CANDIDATES,
+    IM_PHASE_COMMIT,
+    IM_PHASE_MAX
+  };
+
+static struct
+{
+  char *name;
+  /* Number of times the phase was entered, and microseconds spent in
+     it.  */
+  long count, usec;
+} im_phases[IM_PHASE_MAX] =
+  { { "handle_key" }, { "take_action_list" },
+    { "get_candidate_list" }, { "preedit_commit" } };
+
+/* Nesting level of each phase in this thread.  Only the outermost one
+   is timed.  */
+static M17N_THREAD_LOCAL int im_phase_depth[IM_PHASE_MAX];
+
+#define IM_PHASE_BEGIN(phase)					\
+  do {								\
+    if (mdebug__flags[MDEBUG_INPUT_TIME]			\
+	&& im_phase_depth[phase]++ == 0)			\
+      mdebug__push_time ();					\
+  } while (0)
+
+#define IM_PHASE_END(phase)						\
+  do {									\
+    if (mdebug__flags[MDEBUG_INPUT_TIME]				\
+	&& --im_phase_depth[phase] == 0)				\
+      {									\
+	M17N_ADD_COUNTER (im_phases[phase].usec,			\
+			  mdebug__pop_elapsed_time ());			\
+	M17N_ADD_COUNTER (im_phases[phase].count, 1);			\
+      }									\
+  } while (0)
+
 static int fully_initialized;
 
 /** Symbols to load an input method data.  */
@@ -201,6 +254,14 @@ static MSymbol Mdescription, Mcommand, Mvariable, Mglobal, Mconfig;
 
 static MSymbol M_gettext;
 
+/** Slot of a hash table of submaps.  */
+
+typedef struct
+{
+  MSymbol key;
+  MIMMap *map;
+} MIMSubmapSlot;
+
 /** Structure to hold a map.  */
 
 struct MIMMap
@@ -212,10 +273,25 @@ struct MIMMap
   /** List of deeper maps.  If NULL, this is a terminal map.  */
   MPlist *submaps;
 
+  /** The tail of <submaps>, and the number of maps in it.  */
+  MPlist *submaps_tail;
+  int nsubmaps;
+
+  /** Open-addressing hash table of <submaps> indexed by a key, or
+      NULL if there are only a few submaps.  The number of slots is
+      <submap_mask> + 1, a power of 2.  */
+  MIMSubmapSlot *submap_table;
+  unsigned submap_mask;
+
   /** List of actions to take when we leave the map successfully.  In
       a root map, the actions are executed only when none of submaps
       handle the current key.  */
   MPlist *branch_actions;
+
+  /** If not NULL, the above members are not yet set, and the map is
+      to be expanded from the map at <node> of the compiled image.  */
+  MIMImage *image;
+  unsigned node;
 };
 
 typedef MPlist *(*MIMExternalFunc) (MPlist *plist);
@@ -240,6 +316,9 @@ struct MIMState
   /** Key translation map of the state.  Built by merging all maps of
       branches.  */
   MIMMap *map;
+
+  /** Compiled image from which <map> is expanded, or NULL.  */
+  MIMImage *image;
 };
 
 #define CUSTOM_FILE "config.mic"
@@ -276,6 +355,8 @@ static MPlist *fallback_input_methods;
 static int update_global_info (void);
 static int update_custom_info (void);
 static MInputMethodInfo *get_im_info (MSymbol, MSymbol, MSymbol, MSymbol);
+static void expand_map (MIMMap *map);
+static void free_candidates_cache (MIMCandidatesCache *cache);
 
 
 /* Initialize fallback_input_methods.  Called by fully_initialize ()
@@ -574,25 +655,79 @@ marker_code (MSymbol sym, int surrounding)
 }
 
 
-/* Return a plist containing an integer value of VAR.  The plist must
-   not be UNREFed. */
+/* Return a plist containing the value of VAR, or NULL if VAR has no
+   value.  The plist may be shared with the input method, and thus
+   must be neither modified nor UNREFed.  */
 
 static MPlist *
-resolve_variable (MInputContextInfo *ic_info, MSymbol var)
+find_variable (MInputContextInfo *ic_info, MSymbol var)
 {
-  MPlist *plist = mplist__assq (ic_info->vars, var);
+  MPlist *plist;
 
-  if (plist)
+  if (ic_info->vars
+      && (plist = mplist__assq (ic_info->vars, var)))
+    return MPLIST_NEXT (MPLIST_PLIST (plist));
+  if (ic_info->configured_vars
+      && (plist = mplist__assq (ic_info->configured_vars, var)))
     {
-      plist = MPLIST_PLIST (plist);
-      return MPLIST_NEXT (plist);
+      /* PLIST is (VAR DESCRIPTION STATUS [VALUE VALID-VALUE ...]).  */
+      plist = MPLIST_NEXT (MPLIST_NEXT (MPLIST_NEXT (MPLIST_PLIST (plist))));
+      if (MPLIST_KEY (plist) != Mt)
+	return plist;
     }
+  return NULL;
+}
 
-  plist = mplist ();
+/* Add the variable VAR of which value is KEY and VAL to
+   IC_INFO->vars, and return a plist containing the value.  */
+
+static MPlist *
+add_variable (MInputContextInfo *ic_info, MSymbol var, MSymbol key, void *val)
+{
+  MPlist *plist = mplist ();
+
+  if (! ic_info->vars)
+    ic_info->vars = mplist ();
   mplist_push (ic_info->vars, Mplist, plist);
   M17N_OBJECT_UNREF (plist);
-  plist = mplist_add (plist, Msymbol, var);
-  plist = mplist_add (plist, Minteger, (void *) 0);
+  mplist_add (plist, Msymbol, var);
+  return mplist_add (plist, key, val);
+}
+
+/* Return a plist containing an integer value of VAR.  The plist must
+   not be UNREFed. */
+
+static MPlist *
+resolve_variable (MInputContextInfo *ic_info, MSymbol var)
+{
+  MPlist *plist = find_variable (ic_info, var);
+
+  if (plist)
+    return plist;
+  return add_variable (ic_info, var, Minteger, (void *) 0);
+}
+
+/* Like resolve_variable, but the returned plist is owned by IC_INFO
+   and can be modified.  A configured value of VAR is copied to
+   IC_INFO->vars and IC_INFO->vars_saved on the first call.  */
+
+static MPlist *
+resolve_variable_for_set (MInputContextInfo *ic_info, MSymbol var)
+{
+  MPlist *plist;
+
+  if (ic_info->vars
+      && (plist = mplist__assq (ic_info->vars, var)))
+    return MPLIST_NEXT (MPLIST_PLIST (plist));
+  plist = find_variable (ic_info, var);
+  if (! plist)
+    return add_variable (ic_info, var, Minteger, (void *) 0);
+  plist = add_variable (ic_info, var, MPLIST_KEY (plist), MPLIST_VAL (plist));
+  /* The configured value is a part of the original values.  */
+  if (! ic_info->vars_saved)
+    ic_info->vars_saved = mplist ();
+  mplist_push (ic_info->vars_saved, Mplist,
+	       MPLIST_PLIST (ic_info->vars));
   return plist;
 }
 
@@ -1051,6 +1186,92 @@ resolve_command (MPlist *cmds, MSymbol command)
   return plist;
 }
 
+/* Submaps of a map.  While a map has less than SUBMAP_TABLE_MIN
+   submaps, they are looked up in the list.  */
+
+#define SUBMAP_TABLE_MIN 8
+
+/* Put SUBMAP into the hash table of MAP by KEY.  */
+
+static void
+put_submap_slot (MIMMap *map, MSymbol key, MIMMap *submap)
+{
+  unsigned i = key->hash & map->submap_mask;
+
+  while (map->submap_table[i].key)
+    i = (i + 1) & map->submap_mask;
+  map->submap_table[i].key = key;
+  map->submap_table[i].map = submap;
+}
+
+/* Add SUBMAP of MAP for KEY.  KEY must not have a submap yet.  */
+
+static void
+add_submap (MIMMap *map, MSymbol key, MIMMap *submap)
+{
+  if (! map->submaps)
+    map->submaps = map->submaps_tail = mplist ();
+  mplist_add (map->submaps_tail, key, submap);
+  map->submaps_tail = MPLIST_NEXT (map->submaps_tail);
+  map->nsubmaps++;
+  if (map->nsubmaps < SUBMAP_TABLE_MIN)
+    return;
+  if (! map->submap_table || map->nsubmaps * 2 > map->submap_mask + 1)
+    {
+      /* Rebuild the table keeping its load factor at most 1/2.  */
+      unsigned size = SUBMAP_TABLE_MIN * 2;
+      MPlist *plist;
+
+      while (size < map->nsubmaps * 2)
+	size <<= 1;
+      free (map->submap_table);
+      MTABLE_CALLOC (map->submap_table, size, MERROR_IM);
+      map->submap_mask = size - 1;
+      MPLIST_DO (plist, map->submaps)
+	put_submap_slot (map, MPLIST_KEY (plist), MPLIST_VAL (plist));
+    }
+  else
+    put_submap_slot (map, key, submap);
+}
+
+/* Return the submap of MAP for KEY, or NULL.  */
+
+static MIMMap *
+find_submap (MIMMap *map, MSymbol key)
+{
+  if (map->submap_table)
+    {
+      unsigned i = key->hash & map->submap_mask;
+
+      for (; map->submap_table[i].key; i = (i + 1) & map->submap_mask)
+	if (map->submap_table[i].key == key)
+	  return map->submap_table[i].map;
+      return NULL;
+    }
+  return map->submaps ? mplist_get (map->submaps, key) : NULL;
+}
+
+/* Return the submap of MAP for KEY or for an alias of KEY, or NULL.
+   If ALIAS is not NULL, set *ALIAS to the key found, or to the last
+   alias tried.  */
+
+static MIMMap *
+lookup_submap (MIMMap *map, MSymbol key, MSymbol *alias)
+{
+  MIMMap *submap = find_submap (map, key);
+  MSymbol this = key;
+
+  while (! submap
+	 && (this = msymbol_get (this, M_key_alias))
+	 && this != key)
+    submap = find_submap (map, this);
+  if (alias)
+    *alias = this;
+  if (submap && M17N_LOAD_ACQUIRE (submap->image))
+    expand_map (submap);
+  return submap;
+}
+
 /* Load a translation into MAP from PLIST.
    PLIST has this form:
       PLIST ::= ( KEYSEQ MAP-ACTION * )  */
@@ -1105,17 +1326,13 @@ load_translation (MIMMap *map, MPlist *keylist, MPlist *map_actions,
 
   for (i = 0; i < len; i++)
     {
-      MIMMap *deeper = NULL;
+      MIMMap *deeper = find_submap (map, keyseq[i]);
 
-      if (map->submaps)
-	deeper = mplist_get (map->submaps, keyseq[i]);
-      else
-	map->submaps = mplist ();
       if (! deeper)
 	{
 	  /* Fixme: It is better to make all deeper maps at once.  */
 	  MSTRUCT_CALLOC (deeper, MERROR_IM);
-	  mplist_put (map->submaps, keyseq[i], deeper);
+	  add_submap (map, keyseq[i], deeper);
 	}
       map = deeper;
     }
@@ -1141,6 +1358,11 @@ load_translation (MIMMap *map, MPlist *keylist, MPlist *map_actions,
   return 0;
 }
 
+/* Number of times load_branch () has taken a map or a key sequence
+   from the configuration.  States loaded while it increases depend
+   on the configuration, and are not saved in a compiled image.  */
+static int load_branch_configured;
+
 /* Load a branch from PLIST into MAP.  PLIST has this form:
       PLIST ::= ( MAP-NAME BRANCH-ACTION * )  */
 
@@ -1184,6 +1406,7 @@ load_branch (MInputMethodInfo *im_info, MPlist *plist, MIMMap *map)
 	      p = MPLIST_NEXT (MPLIST_NEXT (MPLIST_NEXT (MPLIST_PLIST (p))));
 	      if (MPLIST_SYMBOL_P (p))
 		plist = mplist_get (im_info->maps, MPLIST_SYMBOL (p));
+	      load_branch_configured++;
 	    }
 	}
       if (plist)
@@ -1206,6 +1429,7 @@ load_branch (MInputMethodInfo *im_info, MPlist *plist, MIMMap *map)
 		  pl = resolve_command (im_info->configured_cmds, command);
 		  if (MFAILP (pl))
 		    continue;
+		  load_branch_configured++;
 		  MPLIST_DO (pl, pl)
 		    load_translation (map, pl, map_actions, branch_actions,
 				      im_info->macros);
@@ -1319,6 +1543,7 @@ free_map (MIMMap *map, int top)
       MPLIST_DO (plist, map->submaps)
 	free_map ((MIMMap *) MPLIST_VAL (plist), 0);
       M17N_OBJECT_UNREF (map->submaps);
+      free (map->submap_table);
     }
   M17N_OBJECT_UNREF (map->branch_actions);
   free (map);
@@ -1332,6 +1557,7 @@ free_state (void *object)
   M17N_OBJECT_UNREF (state->title);
   if (state->map)
     free_map (state->map, 1);
+  M17N_OBJECT_UNREF (state->image);
   free (state);
 }
 
@@ -1452,6 +1678,13 @@ fini_im_info (MInputMethodInfo *im_info)
 	}
       M17N_OBJECT_UNREF (im_info->maps);
     }
+  M17N_OBJECT_UNREF (im_info->image);
+  im_info->image = NULL;
+  if (im_info->candidates_cache)
+    {
+      free_candidates_cache (im_info->candidates_cache);
+      im_info->candidates_cache = NULL;
+    }
 
   im_info->tick = 0;
 }
@@ -1586,40 +1819,808 @@ update_custom_info (void)
       im_info = new_im_info (NULL, language, name, extra, im_custom_list);
       load_im_info (im_data, im_info);
     }
-  M17N_OBJECT_UNREF (plist);
-  return 0;
+  M17N_OBJECT_UNREF (plist);
+  return 0;
+}
+
+static int
+update_global_info (void)
+{
+  MPlist *plist;
+
+  if (global_info)
+    {
+      int ret = mdatabase__check (global_info->mdb);
+
+      if (ret)
+	return ret;
+      fini_im_info (global_info);
+    }
+  else
+    {
+      MDatabase *mdb = mdatabase_find (Minput_method, Mt, Mnil, Mglobal);
+
+      if (! mdb)
+	return -1;
+      global_info = new_im_info (mdb, Mt, Mnil, Mglobal, im_info_list);
+    }
+  if (! global_info->mdb
+      || ! (plist = mdatabase_load (global_info->mdb)))
+    return -1;
+
+  load_im_info (plist, global_info);
+  M17N_OBJECT_UNREF (plist);
+  return 0;
+}
+
+
+/* Compiled images of input methods.
+
+   When an input method is loaded from a file of the database, its
+   states are saved in a compiled image file in the user's database
+   directory, and the next loading maps the image into memory instead
+   of parsing the file.  The image is mapped read-only, and a map of
+   a state is expanded from the image only when a key reaches it.
+
+   An image is an array of 32-bit words that starts with
+   MIMImageHeader.  An offset in the image counts words.  The image
+   has three tables, each of which is an array of offsets.
+
+   symbols: A symbol name is a word of the length followed by the
+   bytes of the name.
+
+   plists: A plist is a word of the number of elements followed by a
+   pair of words (TYPE VALUE) for each element.  VALUE is a symbol
+   index, an integer, the offset of an M-text, or the index of a
+   preceding plist, according to TYPE (enum im_image_type).  An
+   M-text is a word of the length followed by the UTF-8 bytes.
+
+   states: A state is a word of the symbol index of the name, a word
+   of the offset of the title or 0, and a word of the offset of the
+   map.
+
+   A map is a word of the plist index plus 1 of the map actions (0 if
+   none), the same of the branch actions, a word of the number of
+   submaps, and a pair of words (KEY MAP) for each submap, where KEY
+   is a symbol index and MAP is the offset of the submap.
+
+   The other parts of the input method (title, commands, variables,
+   macros, etc.) are saved in the plist "rest" as they are in the
+   file, and loaded by load_im_info ().  */
+
+#define IM_IMAGE_MAGIC "M17NIMG"
+#define IM_IMAGE_VERSION 2
+
+/* Number of words to store NBYTES bytes.  */
+#define IM_IMAGE_WORDS(nbytes) ((nbytes) / 4 + ((nbytes) % 4 != 0))
+
+/* Check if N words at OFFSET are in an image of NWORDS words.  */
+#define IM_IMAGE_RANGE_P(nwords, offset, n)	\
+  ((offset) <= (nwords) && (n) <= (nwords) - (offset))
+
+enum im_image_type
+  {
+    IM_IMAGE_SYMBOL,
+    IM_IMAGE_INTEGER,
+    IM_IMAGE_MTEXT,
+    IM_IMAGE_PLIST
+  };
+
+typedef struct
+{
+  char magic[8];
+  int version;
+
+  /* Identity of the file of the input method.  */
+  MDatabaseStamp source;
+
+  /* Number of words of the image.  */
+  unsigned nwords;
+
+  /* Offsets and lengths of the tables.  */
+  unsigned symbols, nsymbols;
+  unsigned plists, nplists;
+  unsigned states, nstates;
+
+  /* Index of the plist of the other parts.  */
+  unsigned rest;
+} MIMImageHeader;
+
+struct MIMImage
+{
+  M17NObject control;
+
+  /* Words of the mapped image.  */
+  unsigned *words;
+  unsigned nwords;
+
+  /* Symbols of the symbol table.  */
+  MSymbol *symbols;
+  unsigned nsymbols;
+
+  /* The plist table, and plists decoded from it.  An element of
+     <plists> is NULL until the plist is decoded.  */
+  unsigned *plist_table;
+  MPlist **plists;
+  unsigned nplists;
+};
+
+/* Return the M-text at OFFSET of IMAGE, or NULL if OFFSET is
+   invalid.  */
+
+static MText *
+image_get_mtext (MIMImage *image, unsigned offset)
+{
+  unsigned nbytes;
+
+  if (! IM_IMAGE_RANGE_P (image->nwords, offset, 1))
+    return NULL;
+  nbytes = image->words[offset];
+  if (! IM_IMAGE_RANGE_P (image->nwords, offset + 1, IM_IMAGE_WORDS (nbytes)))
+    return NULL;
+  return mtext__from_data (image->words + offset + 1, nbytes,
+			   MTEXT_FORMAT_UTF_8, 1);
+}
+
+/* Return the plist of index IDX in IMAGE, or NULL if IDX is invalid.
+   The plist is decoded at the first call, and is kept in IMAGE.  */
+
+static MPlist *
+image_get_plist (MIMImage *image, unsigned idx)
+{
+  MPlist *plist, *tail;
+  unsigned offset, n, i, *p;
+
+  if (idx >= image->nplists)
+    return NULL;
+  if (image->plists[idx])
+    return image->plists[idx];
+  offset = image->plist_table[idx];
+  if (! IM_IMAGE_RANGE_P (image->nwords, offset, 1))
+    return NULL;
+  n = image->words[offset];
+  if (n > image->nwords / 2
+      || ! IM_IMAGE_RANGE_P (image->nwords, offset + 1, n * 2))
+    return NULL;
+  plist = tail = mplist ();
+  for (i = 0, p = image->words + offset + 1; i < n; i++, p += 2)
+    {
+      if (p[0] == IM_IMAGE_SYMBOL && p[1] < image->nsymbols)
+	tail = mplist_add (tail, Msymbol, image->symbols[p[1]]);
+      else if (p[0] == IM_IMAGE_INTEGER)
+	tail = mplist_add (tail, Minteger, (void *) (long) (int) p[1]);
+      else if (p[0] == IM_IMAGE_MTEXT)
+	{
+	  MText *mt = image_get_mtext (image, p[1]);
+
+	  if (! mt)
+	    break;
+	  tail = mplist_add (tail, Mtext, mt);
+	  M17N_OBJECT_UNREF (mt);
+	}
+      else if (p[0] == IM_IMAGE_PLIST && p[1] < idx)
+	{
+	  MPlist *pl = image_get_plist (image, p[1]);
+
+	  if (! pl)
+	    break;
+	  tail = mplist_add (tail, Mplist, pl);
+	}
+      else
+	break;
+    }
+  if (i < n)
+    {
+      M17N_OBJECT_UNREF (plist);
+      return NULL;
+    }
+  image->plists[idx] = plist;
+  return plist;
+}
+
+/* Expand MAP from the compiled image.  The submaps of MAP are created
+   but not yet expanded.  Other threads may be looking up MAP.  */
+
+static void
+expand_map (MIMMap *map)
+{
+  MIMImage *image;
+
+  M17N_LOCK_REGISTRY ();
+  image = map->image;
+  if (image)
+    {
+      unsigned *p, n, i;
+
+      if (IM_IMAGE_RANGE_P (image->nwords, map->node, 3)
+	  && ((n = image->words[map->node + 2])
+	      <= (image->nwords - map->node - 3) / 2))
+	{
+	  p = image->words + map->node;
+	  if (p[0])
+	    map->map_actions = image_get_plist (image, p[0] - 1);
+	  if (p[1]
+	      && (map->branch_actions = image_get_plist (image, p[1] - 1)))
+	    M17N_OBJECT_REF (map->branch_actions);
+	  for (i = 0, p += 3; i < n; i++, p += 2)
+	    if (p[0] < image->nsymbols)
+	      {
+		MIMMap *submap;
+
+		MSTRUCT_CALLOC (submap, MERROR_IM);
+		submap->image = image;
+		submap->node = p[1];
+		add_submap (map, image->symbols[p[0]], submap);
+	      }
+	}
+      M17N_STORE_RELEASE (map->image, NULL);
+    }
+  M17N_UNLOCK_REGISTRY ();
+}
+
+#ifdef USE_IM_IMAGE
+
+static void
+free_im_image (void *object)
+{
+  MIMImage *image = object;
+  unsigned i;
+
+  for (i = 0; i < image->nplists; i++)
+    M17N_OBJECT_UNREF (image->plists[i]);
+  free (image->plists);
+  free (image->symbols);
+  munmap (image->words, sizeof (unsigned) * image->nwords);
+  free (image);
+}
+
+/* Load the states of IM_INFO from the compiled image file for
+   IM_INFO->mdb, and the other parts by load_im_info ().  Return 0 on
+   success, and -1 if the image is not available.  */
+
+static int
+load_im_image (MInputMethodInfo *im_info)
+{
+  char *file = mdatabase__cache_file (im_info->mdb);
+  MIMImageHeader *header;
+  MIMImage *image;
+  MPlist *rest;
+  struct stat buf;
+  unsigned *words, nwords, i;
+  int fd, valid;
+
+  if (! file)
+    return -1;
+  fd = open (file, O_RDONLY);
+  free (file);
+  if (fd < 0)
+    return -1;
+  if (fstat (fd, &buf) < 0 || buf.st_size < sizeof (MIMImageHeader)
+      || buf.st_size % sizeof (unsigned) != 0
+      || ((words = mmap (NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0))
+	  == MAP_FAILED))
+    {
+      close (fd);
+      return -1;
+    }
+  close (fd);
+  header = (MIMImageHeader *) words;
+  nwords = buf.st_size / sizeof (unsigned);
+  if (memcmp (header->magic, IM_IMAGE_MAGIC, sizeof header->magic)
+      || header->version != IM_IMAGE_VERSION
+      || header->nwords != nwords
+      || ! IM_IMAGE_RANGE_P (nwords, header->symbols, header->nsymbols)
+      || ! IM_IMAGE_RANGE_P (nwords, header->plists, header->nplists)
+      || ! IM_IMAGE_RANGE_P (nwords, header->states, header->nstates)
+      || header->rest >= header->nplists
+      || ! mdatabase__cache_valid_p (im_info->mdb, &header->source))
+    {
+      munmap (words, buf.st_size);
+      return -1;
+    }
+
+  M17N_OBJECT (image, free_im_image, MERROR_IM);
+  image->words = words;
+  image->nwords = nwords;
+  image->nsymbols = header->nsymbols;
+  image->plist_table = words + header->plists;
+  image->nplists = header->nplists;
+  MTABLE_CALLOC (image->symbols, image->nsymbols + 1, MERROR_IM);
+  MTABLE_CALLOC (image->plists, image->nplists + 1, MERROR_IM);
+  for (i = 0; i < image->nsymbols; i++)
+    {
+      unsigned offset = words[header->symbols + i];
+
+      if (! IM_IMAGE_RANGE_P (nwords, offset, 1)
+	  || ! IM_IMAGE_RANGE_P (nwords, offset + 1,
+				 IM_IMAGE_WORDS (words[offset])))
+	break;
+      image->symbols[i] = msymbol__with_len ((char *) (words + offset + 1),
+					     words[offset]);
+    }
+  valid = i == image->nsymbols;
+  for (i = 0; valid && i < header->nstates; i++)
+    {
+      unsigned offset = words[header->states + i];
+
+      valid = (IM_IMAGE_RANGE_P (nwords, offset, 3)
+	       && words[offset] < image->nsymbols);
+    }
+  if (! valid || ! (rest = image_get_plist (image, header->rest)))
+    {
+      M17N_OBJECT_UNREF (image);
+      return -1;
+    }
+
+  update_global_info ();
+  load_im_info (rest, im_info);
+  if (! im_info->states)
+    im_info->states = mplist ();
+  for (i = 0; i < header->nstates; i++)
+    {
+      unsigned *p = words + words[header->states + i];
+      MIMState *state;
+
+      M17N_OBJECT (state, free_state, MERROR_IM);
+      state->name = image->symbols[p[0]];
+      if (p[1] && (state->title = image_get_mtext (image, p[1])))
+	mtext_put_prop (state->title, 0, mtext_nchars (state->title),
+			Mlanguage, im_info->language);
+      MSTRUCT_CALLOC (state->map, MERROR_IM);
+      state->map->image = image;
+      state->map->node = p[2];
+      expand_map (state->map);
+      if (state->map->map_actions)
+	M17N_OBJECT_REF (state->map->map_actions);
+      state->image = image;
+      M17N_OBJECT_REF (image);
+      mplist_put (im_info->states, state->name, state);
+    }
+  im_info->image = image;
+  return 0;
+}
+
+/* Load the maps of IM_INFO, whose states are loaded from a compiled
+   image, from the database.  Another input method may include
+   them.  */
+
+static void
+load_im_maps (MInputMethodInfo *im_info)
+{
+  unsigned long tick = im_info->tick;
+  MPlist *plist;
+
+  mplist_push (load_im_info_keys, Mmap, Mt);
+  plist = mdatabase__load_for_keys (im_info->mdb, load_im_info_keys);
+  mplist_pop (load_im_info_keys);
+  if (! plist)
+    return;
+  load_im_info (plist, im_info);
+  M17N_OBJECT_UNREF (plist);
+  im_info->tick = tick;
+}
+
+/* Table of symbols or plists put in an image.  */
+
+typedef struct
+{
+  /* Offsets of the entries in the image.  */
+  unsigned *offsets;
+  int used, size;
+
+  /* Open-addressing hash table of the entries.  A slot has the
+     pointer to an entry and its index plus 1, or 0 if empty.  */
+  void **keys;
+  unsigned *indices;
+  unsigned mask;
+  int nkeys;
+} MIMImageTable;
+
+#define IM_IMAGE_HASH(key)	\
+  ((unsigned) ((unsigned long) (key) >> 3) * 2654435761U)
+
+typedef struct
+{
+  /* Words of the image.  */
+  unsigned *words;
+  int used, size;
+
+  MIMImageTable symbols, plists;
+
+  /* Plist of the parts of the input method other than maps and
+     states, and its index.  */
+  MPlist *rest;
+  int rest_index;
+} MIMImageWriter;
+
+/* Reserve N words in the image of WRITER, and return the offset.  */
+
+static unsigned
+image_alloc (MIMImageWriter *writer, int n)
+{
+  unsigned offset = writer->used;
+
+  if (writer->used + n > writer->size)
+    {
+      while (writer->used + n > writer->size)
+	writer->size = writer->size ? writer->size * 2 : 4096;
+      MTABLE_REALLOC (writer->words, writer->size, MERROR_IM);
+    }
+  writer->used += n;
+  return offset;
+}
+
+/* Make the hash table of TABLE empty with MASK + 1 slots.  */
+
+static void
+image_table_init (MIMImageTable *table, unsigned mask)
+{
+  table->mask = mask;
+  table->nkeys = 0;
+  MTABLE_CALLOC (table->keys, mask + 1, MERROR_IM);
+  MTABLE_CALLOC (table->indices, mask + 1, MERROR_IM);
+}
+
+/* Return the slot of KEY in the hash table of TABLE, or the empty
+   slot for KEY if KEY is not in TABLE.  */
+
+static unsigned
+image_table_slot (MIMImageTable *table, void *key)
+{
+  unsigned i;
+
+  for (i = IM_IMAGE_HASH (key) & table->mask; table->indices[i];
+       i = (i + 1) & table->mask)
+    if (table->keys[i] == key)
+      break;
+  return i;
+}
+
+/* Return the index of KEY in TABLE, or -1 if KEY is not in TABLE.  */
+
+static int
+image_table_lookup (MIMImageTable *table, void *key)
+{
+  return (int) table->indices[image_table_slot (table, key)] - 1;
+}
+
+/* Add KEY, which is put at OFFSET, to TABLE, and return its index.  */
+
+static int
+image_table_add (MIMImageTable *table, void *key, unsigned offset)
+{
+  unsigned i;
+
+  if (table->used == table->size)
+    {
+      table->size = table->size ? table->size * 2 : 256;
+      MTABLE_REALLOC (table->offsets, table->size, MERROR_IM);
+    }
+  table->offsets[table->used++] = offset;
+  if (++table->nkeys * 2 > table->mask + 1)
+    {
+      void **keys = table->keys;
+      unsigned *indices = table->indices, mask = table->mask;
+
+      image_table_init (table, mask * 2 + 1);
+      for (i = 0; i <= mask; i++)
+	if (indices[i])
+	  {
+	    unsigned slot = image_table_slot (table, keys[i]);
+
+	    table->keys[slot] = keys[i];
+	    table->indices[slot] = indices[i];
+	    table->nkeys++;
+	  }
+      free (keys);
+      free (indices);
+    }
+  i = image_table_slot (table, key);
+  table->keys[i] = key;
+  table->indices[i] = table->used;
+  return table->used - 1;
+}
+
+static void
+image_table_free (MIMImageTable *table)
+{
+  free (table->offsets);
+  free (table->keys);
+  free (table->indices);
+}
+
+/* Put the name of SYM in the image of WRITER (if not yet), and return
+   the symbol index.  */
+
+static unsigned
+image_put_symbol (MIMImageWriter *writer, MSymbol sym)
+{
+  int idx = image_table_lookup (&writer->symbols, sym);
+
+  if (idx < 0)
+    {
+      int len = MSYMBOL_NAMELEN (sym);
+      unsigned offset = image_alloc (writer, 1 + IM_IMAGE_WORDS (len));
+
+      writer->words[offset + IM_IMAGE_WORDS (len)] = 0;
+      writer->words[offset] = len;
+      memcpy (writer->words + offset + 1, MSYMBOL_NAME (sym), len);
+      idx = image_table_add (&writer->symbols, sym, offset);
+    }
+  return idx;
+}
+
+/* Put MT in the image of WRITER in UTF-8, and return the offset.  */
+
+static unsigned
+image_put_mtext (MIMImageWriter *writer, MText *mt)
+{
+  int nchars = mtext_nchars (mt), nbytes = 0, i;
+  unsigned char *buf;
+  unsigned offset;
+
+  MTABLE_MALLOC (buf, nchars * MAX_UTF8_CHAR_BYTES + 1, MERROR_IM);
+  for (i = 0; i < nchars; i++)
+    {
+      int c = mtext_ref_char (mt, i);
+
+      nbytes += CHAR_STRING_UTF8 (c, buf + nbytes);
+    }
+  offset = image_alloc (writer, 1 + IM_IMAGE_WORDS (nbytes));
+  writer->words[offset + IM_IMAGE_WORDS (nbytes)] = 0;
+  writer->words[offset] = nbytes;
+  memcpy (writer->words + offset + 1, buf, nbytes);
+  free (buf);
+  return offset;
+}
+
+/* Put PLIST in the image of WRITER (if not yet), and return the plist
+   index.  If PLIST has an element that can't be put, return -1.  */
+
+static int
+image_put_plist (MIMImageWriter *writer, MPlist *plist)
+{
+  int idx = image_table_lookup (&writer->plists, plist);
+  int n = 0, i = 0;
+  unsigned *elts, offset;
+  MPlist *pl;
+
+  if (idx >= 0)
+    return idx;
+  MPLIST_DO (pl, plist)
+    n++;
+  MTABLE_MALLOC (elts, n * 2 + 1, MERROR_IM);
+  MPLIST_DO (pl, plist)
+    {
+      if (MPLIST_SYMBOL_P (pl))
+	{
+	  elts[i++] = IM_IMAGE_SYMBOL;
+	  elts[i++] = image_put_symbol (writer, MPLIST_SYMBOL (pl));
+	}
+      else if (MPLIST_INTEGER_P (pl))
+	{
+	  elts[i++] = IM_IMAGE_INTEGER;
+	  elts[i++] = MPLIST_INTEGER (pl);
+	}
+      else if (MPLIST_MTEXT_P (pl))
+	{
+	  elts[i++] = IM_IMAGE_MTEXT;
+	  elts[i++] = image_put_mtext (writer, MPLIST_MTEXT (pl));
+	}
+      else if (MPLIST_PLIST_P (pl)
+	       && (idx = image_put_plist (writer, MPLIST_PLIST (pl))) >= 0)
+	{
+	  elts[i++] = IM_IMAGE_PLIST;
+	  elts[i++] = idx;
+	}
+      else
+	break;
+    }
+  idx = -1;
+  if (i == n * 2)
+    {
+      offset = image_alloc (writer, 1 + n * 2);
+      writer->words[offset] = n;
+      memcpy (writer->words + offset + 1, elts, sizeof (unsigned) * n * 2);
+      idx = image_table_add (&writer->plists, plist, offset);
+    }
+  free (elts);
+  return idx;
 }
 
-static int
-update_global_info (void)
+/* Put MAP and its submaps in the image of WRITER, and return the
+   offset of MAP.  If MAP can't be put, return 0.  */
+
+static unsigned
+image_put_map (MIMImageWriter *writer, MIMMap *map)
 {
-  MPlist *plist;
+  int n = map->nsubmaps, i = 3, idx;
+  unsigned *elts, offset = 0;
+  MPlist *pl;
 
-  if (global_info)
+  if (map->image)
+    return 0;
+  MTABLE_MALLOC (elts, n * 2 + 3, MERROR_IM);
+  elts[0] = elts[1] = 0;
+  elts[2] = n;
+  if (map->map_actions)
     {
-      int ret = mdatabase__check (global_info->mdb);
+      idx = image_put_plist (writer, map->map_actions);
+      elts[0] = idx + 1;
+      if (idx < 0)
+	i = 0;
+    }
+  if (map->branch_actions)
+    {
+      idx = image_put_plist (writer, map->branch_actions);
+      elts[1] = idx + 1;
+      if (idx < 0)
+	i = 0;
+    }
+  if (i > 0 && map->submaps)
+    MPLIST_DO (pl, map->submaps)
+      {
+	unsigned submap = image_put_map (writer, (MIMMap *) MPLIST_VAL (pl));
 
-      if (ret)
-	return ret;
-      fini_im_info (global_info);
+	if (! submap)
+	  break;
+	elts[i++] = image_put_symbol (writer, MPLIST_KEY (pl));
+	elts[i++] = submap;
+      }
+  if (i == n * 2 + 3)
+    {
+      offset = image_alloc (writer, i);
+      memcpy (writer->words + offset, elts, sizeof (unsigned) * i);
     }
-  else
+  free (elts);
+  return offset;
+}
+
+static void
+free_im_image_writer (MIMImageWriter *writer)
+{
+  free (writer->words);
+  image_table_free (&writer->symbols);
+  image_table_free (&writer->plists);
+  M17N_OBJECT_UNREF (writer->rest);
+  free (writer);
+}
+
+/* Return a new writer of a compiled image for the input method to be
+   loaded from PLIST.  The parts of the input method other than maps
+   and states are put in the image now, because load_im_info ()
+   modifies them.  If the input method includes maps or states from
+   another one, it can't be compiled, and NULL is returned.  */
+
+static MIMImageWriter *
+im_image_writer (MPlist *plist)
+{
+  MIMImageWriter *writer;
+  MPlist *pl;
+
+  MSTRUCT_CALLOC (writer, MERROR_IM);
+  writer->rest = mplist ();
+  MPLIST_DO (pl, plist)
     {
-      MDatabase *mdb = mdatabase_find (Minput_method, Mt, Mnil, Mglobal);
+      if (MPLIST_PLIST_P (pl) && MPLIST_SYMBOL_P (MPLIST_PLIST (pl)))
+	{
+	  MPlist *elt = MPLIST_PLIST (pl);
+	  MSymbol key = MPLIST_SYMBOL (elt);
 
-      if (! mdb)
-	return -1;
-      global_info = new_im_info (mdb, Mt, Mnil, Mglobal, im_info_list);
+	  if (key == Mmap || key == Mstate)
+	    continue;
+	  if (key == Minclude)
+	    {
+	      /* ELT ::= include (tag1 tag2 ...) key item ... */
+	      elt = MPLIST_NEXT (MPLIST_NEXT (elt));
+	      if (! MPLIST_SYMBOL_P (elt)
+		  || MPLIST_SYMBOL (elt) == Mmap
+		  || MPLIST_SYMBOL (elt) == Mstate)
+		break;
+	    }
+	}
+      mplist_add (writer->rest, MPLIST_KEY (pl), MPLIST_VAL (pl));
     }
-  if (! global_info->mdb
-      || ! (plist = mdatabase_load (global_info->mdb)))
-    return -1;
+  image_alloc (writer, IM_IMAGE_WORDS (sizeof (MIMImageHeader)));
+  image_table_init (&writer->symbols, 255);
+  image_table_init (&writer->plists, 1023);
+  if (! MPLIST_TAIL_P (pl)
+      || (writer->rest_index = image_put_plist (writer, writer->rest)) < 0)
+    {
+      free_im_image_writer (writer);
+      return NULL;
+    }
+  /* load_im_info () may free some of the plists put above.  Forget
+     them so that new plists at the same addresses are put anew.  */
+  free (writer->plists.keys);
+  free (writer->plists.indices);
+  image_table_init (&writer->plists, 1023);
+  return writer;
+}
 
-  load_im_info (plist, global_info);
-  M17N_OBJECT_UNREF (plist);
-  return 0;
+/* Put the states of IM_INFO, just loaded, in the image of WRITER,
+   save the image in the compiled image file for IM_INFO->mdb, and
+   free WRITER.  CONFIGURED is the value of load_branch_configured
+   before loading.  If it has changed, the states depend on the
+   configuration, and nothing is saved.  The file is written under a
+   temporary name and then renamed, so that other processes never see
+   it half-written.  Failures are silently ignored.  */
+
+static void
+save_im_image (MIMImageWriter *writer, MInputMethodInfo *im_info,
+	       int configured)
+{
+  char *file = NULL, *temp;
+  MIMImageHeader header;
+  unsigned *states;
+  int nstates = 0;
+  MPlist *plist;
+  FILE *fp;
+  int ok;
+
+  if (im_info->states)
+    nstates = MPLIST_LENGTH (im_info->states);
+  memset (&header, 0, sizeof header);
+  if (configured != load_branch_configured
+      || nstates == 0 || im_info->name == Mnil
+      || mdatabase__stamp (im_info->mdb, &header.source) < 0
+      || ! (file = mdatabase__cache_file (im_info->mdb)))
+    goto finish;
+
+  states = alloca (sizeof (unsigned) * nstates);
+  nstates = 0;
+  MPLIST_DO (plist, im_info->states)
+    {
+      MIMState *state = MPLIST_VAL (plist);
+      unsigned name = image_put_symbol (writer, state->name);
+      unsigned title = (state->title
+			? image_put_mtext (writer, state->title) : 0);
+      unsigned map = image_put_map (writer, state->map);
+
+      if (! map)
+	goto finish;
+      states[nstates] = image_alloc (writer, 3);
+      writer->words[states[nstates]] = name;
+      writer->words[states[nstates] + 1] = title;
+      writer->words[states[nstates] + 2] = map;
+      nstates++;
+    }
+
+  memcpy (header.magic, IM_IMAGE_MAGIC, sizeof header.magic);
+  header.version = IM_IMAGE_VERSION;
+  header.nsymbols = writer->symbols.used;
+  header.symbols = image_alloc (writer, header.nsymbols);
+  memcpy (writer->words + header.symbols, writer->symbols.offsets,
+	  sizeof (unsigned) * header.nsymbols);
+  header.nplists = writer->plists.used;
+  header.plists = image_alloc (writer, header.nplists);
+  memcpy (writer->words + header.plists, writer->plists.offsets,
+	  sizeof (unsigned) * header.nplists);
+  header.nstates = nstates;
+  header.states = image_alloc (writer, nstates);
+  memcpy (writer->words + header.states, states, sizeof (unsigned) * nstates);
+  header.rest = writer->rest_index;
+  header.nwords = writer->used;
+  memcpy (writer->words, &header, sizeof header);
+
+  MTABLE_MALLOC (temp, strlen (file) + 12, MERROR_IM);
+  sprintf (temp, "%s.%X", file, (unsigned) getpid ());
+  if ((fp = fopen (temp, "w")))
+    {
+      ok = (fwrite (writer->words, sizeof (unsigned), writer->used, fp)
+	    == writer->used);
+      if (fclose (fp) != 0 || ! ok || rename (temp, file) < 0)
+	unlink (temp);
+    }
+  free (temp);
+
+ finish:
+  free (file);
+  free_im_image_writer (writer);
 }
 
+#endif /* USE_IM_IMAGE */
+
 
 /* Return an IM_INFO for the input method specified by LANGUAGE, NAME,
    and EXTRA.  KEY, if not Mnil, tells which kind of information about
@@ -1632,6 +2633,10 @@ get_im_info (MSymbol language, MSymbol name, MSymbol extra, MSymbol key)
   MPlist *plist;
   MInputMethodInfo *im_info;
   MDatabase *mdb;
+#ifdef USE_IM_IMAGE
+  MIMImageWriter *writer = NULL;
+  int configured = load_branch_configured;
+#endif
 
   if (name == Mnil && extra == Mnil)
     language = Mt, extra = Mglobal;
@@ -1658,6 +2663,10 @@ get_im_info (MSymbol language, MSymbol name, MSymbol extra, MSymbol key)
 
   if (key == Mnil)
     {
+#ifdef USE_IM_IMAGE
+      if (load_im_image (im_info) == 0)
+	goto loaded;
+#endif
       plist = mdatabase_load (im_info->mdb);
     }
   else
@@ -1670,8 +2679,19 @@ get_im_info (MSymbol language, MSymbol name, MSymbol extra, MSymbol key)
   if (! plist)
     MERROR (MERROR_IM, im_info);
   update_global_info ();
+#ifdef USE_IM_IMAGE
+  if (key == Mnil)
+    writer = im_image_writer (plist);
+#endif
   load_im_info (plist, im_info);
+#ifdef USE_IM_IMAGE
+  if (writer)
+    save_im_image (writer, im_info, configured);
+#endif
   M17N_OBJECT_UNREF (plist);
+#ifdef USE_IM_IMAGE
+ loaded:
+#endif
   if (key == Mnil)
     {
       if (! im_info->cmds)
@@ -2426,6 +3446,10 @@ load_im_info (MPlist *plist, MInputMethodInfo *im_info)
 	    elt = MPLIST_NEXT (elt);
 	    if (key == Mmap)
 	      {
+#ifdef USE_IM_IMAGE
+		if (temp->image && ! temp->maps)
+		  load_im_maps (temp);
+#endif
 		if (! temp->maps || MPLIST_TAIL_P (temp->maps))
 		  continue;
 		if (! im_info->maps)
@@ -2487,9 +3511,26 @@ load_im_info (MPlist *plist, MInputMethodInfo *im_info)
 
 
 
-static int take_action_list (MInputContext *ic, MPlist *action_list);
+static int take_action_list (MInputContext *ic, MPlist *action_list,
+			     int cacheable);
 static void preedit_commit (MInputContext *ic, int need_prefix);
 
+/* Save IC->preedit in IC_INFO->preedit_saved, which is created on
+   demand because most contexts spend their life with empty
+   preedit.  */
+
+static void
+save_preedit (MInputContext *ic, MInputContextInfo *ic_info)
+{
+  if (! ic_info->preedit_saved)
+    {
+      if (mtext_nchars (ic->preedit) == 0)
+	return;
+      ic_info->preedit_saved = mtext ();
+    }
+  mtext_cpy (ic_info->preedit_saved, ic->preedit);
+}
+
 /* Shift to the state of name STATE_NAME.  If STATE_NAME is `t', shift
    to the previous state (if any).  If STATE_NAME is `nil', shift to
    the initial state.  */
@@ -2540,7 +3581,7 @@ shift_state (MInputContext *ic, MSymbol state_name)
       && orig_state)
     /* We have shifted to the initial state.  */
     preedit_commit (ic, 0);
-  mtext_cpy (ic_info->preedit_saved, ic->preedit);
+  save_preedit (ic, ic_info);
   ic_info->state_pos = ic->cursor_pos;
   if (state != orig_state || state_name == Mnil)
     {
@@ -2549,7 +3590,8 @@ shift_state (MInputContext *ic, MSymbol state_name)
 	  /* Shifted to the initial state.  */
 	  ic_info->prev_state = NULL;
 	  M17N_OBJECT_UNREF (ic_info->vars_saved);
-	  ic_info->vars_saved = mplist_copy (ic_info->vars);
+	  ic_info->vars_saved = (ic_info->vars
+				 ? mplist_copy (ic_info->vars) : NULL);
 	}
       else
 	ic_info->prev_state = orig_state;
@@ -2611,22 +3653,24 @@ adjust_markers (MInputContext *ic, int from, int to, int ins)
 
   if (from == to)
     {
-      MPLIST_DO (markers, ic_info->markers)
-	if (MPLIST_INTEGER (markers) > from)
-	  MPLIST_VAL (markers) = (void *) (MPLIST_INTEGER (markers) + ins);
+      if (ic_info->markers)
+	MPLIST_DO (markers, ic_info->markers)
+	  if (MPLIST_INTEGER (markers) > from)
+	    MPLIST_VAL (markers) = (void *) (MPLIST_INTEGER (markers) + ins);
       if (ic->cursor_pos >= from)
 	ic->cursor_pos += ins;
     }
   else
     {
-      MPLIST_DO (markers, ic_info->markers)
-	{
-	  if (MPLIST_INTEGER (markers) >= to)
-	    MPLIST_VAL (markers)
-	      = (void *) (MPLIST_INTEGER (markers) + ins - (to - from));
-	  else if (MPLIST_INTEGER (markers) > from)
-	    MPLIST_VAL (markers) = (void *) from;
-	}
+      if (ic_info->markers)
+	MPLIST_DO (markers, ic_info->markers)
+	  {
+	    if (MPLIST_INTEGER (markers) >= to)
+	      MPLIST_VAL (markers)
+		= (void *) (MPLIST_INTEGER (markers) + ins - (to - from));
+	    else if (MPLIST_INTEGER (markers) > from)
+	      MPLIST_VAL (markers) = (void *) from;
+	  }
       if (ic->cursor_pos >= to)
 	ic->cursor_pos += ins - (to - from);
       else if (ic->cursor_pos > from)
@@ -2693,6 +3737,7 @@ preedit_commit (MInputContext *ic, int need_prefix)
   MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
   int preedit_len = mtext_nchars (ic->preedit);
 
+  IM_PHASE_BEGIN (IM_PHASE_COMMIT);
   if (preedit_len > 0)
     {
       MPlist *p;
@@ -2721,9 +3766,11 @@ preedit_commit (MInputContext *ic, int need_prefix)
 	}
 
       mtext_reset (ic->preedit);
-      mtext_reset (ic_info->preedit_saved);
-      MPLIST_DO (p, ic_info->markers)
-	MPLIST_VAL (p) = 0;
+      if (ic_info->preedit_saved)
+	mtext_reset (ic_info->preedit_saved);
+      if (ic_info->markers)
+	MPLIST_DO (p, ic_info->markers)
+	  MPLIST_VAL (p) = 0;
       ic->cursor_pos = ic_info->state_pos = 0;
       ic->preedit_changed = 1;
       ic_info->commit_key_head = ic_info->key_head;
@@ -2741,6 +3788,7 @@ preedit_commit (MInputContext *ic, int need_prefix)
 	  ic->candidates_changed |= MINPUT_CANDIDATES_SHOW_CHANGED;
 	}
     }
+  IM_PHASE_END (IM_PHASE_COMMIT);
 }
 
 static int
@@ -2773,7 +3821,7 @@ new_index (MInputContext *ic, int current, int limit, MSymbol sym, MText *mt)
 	    : code == '=' ? current
 	    : code - '0' > limit ? limit
 	    : code - '0');
-  if (! ic)  
+  if (! ic || ! ((MInputContextInfo *) ic->info)->markers)
     return 0;
   return (int) mplist_get (((MInputContextInfo *) ic->info)->markers, sym);
 }
@@ -2932,83 +3980,103 @@ adjust_candidates (MPlist *plist, MCharset *charset)
   return plist;
 }
 
-/* The returned Plist must be UNREFed.  */
+/* Return nonzero if CHARSET encodes all the characters of MT.  */
 
-static MPlist *
-get_candidate_list (MInputContextInfo *ic_info, MPlist *args)
+static int
+mtext_in_charset (MText *mt, MCharset *charset)
 {
-  MCharset *charset = get_select_charset (ic_info);
-  MPlist *plist;
-  int column;
-  int i, len;
+  int i;
 
-  plist = resolve_variable (ic_info, Mcandidates_group_size);
-  column = MPLIST_INTEGER (plist);
+  for (i = mtext_nchars (mt) - 1; i >= 0; i--)
+    if (ENCODE_CHAR (charset, mtext_ref_char (mt, i)) == MCHAR_INVALID_CODE)
+      return 0;
+  return 1;
+}
 
-  plist = MPLIST_PLIST (args);
-  if (! plist)
-    return NULL;
-  if (charset)
-    {
-      plist = adjust_candidates (plist, charset);
-      if (! plist)
-	return NULL;
-    }
-  else
-    M17N_OBJECT_REF (plist);
+/* Build a candidate list from PLIST by regrouping the candidates into
+   groups of COLUMN (> 0) candidates.  If CHARSET is non-NULL, a
+   candidate not encoded by CHARSET is skipped while regrouping, so
+   no filtered copy of PLIST is made.  If no candidate is left, return
+   NULL.  The returned plist must be UNREFed.  */
 
-  if (column == 0)
-    return plist;
+static MPlist *
+build_candidate_list (MPlist *plist, MCharset *charset, int column)
+{
+  MPlist *new = mplist ();
 
   if (MPLIST_MTEXT_P (plist))
     {
-      MText *mt = MPLIST_MTEXT (plist);
-      MPlist *next = MPLIST_NEXT (plist);
+      /* plist ::= MTEXT ...  Each character is a candidate.  */
+      MText *group = NULL;
+      int count = 0;
 
-      if (MPLIST_TAIL_P (next))
-	M17N_OBJECT_REF (mt);
-      else
+      MPLIST_DO (plist, plist)
 	{
-	  mt = mtext_dup (mt);
-	  while (! MPLIST_TAIL_P (next))
+	  MText *mt = MPLIST_MTEXT (plist);
+	  int len = mtext_nchars (mt);
+	  int i = 0, j;
+
+	  while (i < len)
 	    {
-	      mt = mtext_cat (mt, MPLIST_MTEXT (next));
-	      next = MPLIST_NEXT (next);
+	      if (charset)
+		{
+		  while (i < len
+			 && (ENCODE_CHAR (charset, mtext_ref_char (mt, i))
+			     == MCHAR_INVALID_CODE))
+		    i++;
+		  for (j = i; j < len && j - i < column - count; j++)
+		    if (ENCODE_CHAR (charset, mtext_ref_char (mt, j))
+			== MCHAR_INVALID_CODE)
+		      break;
+		}
+	      else
+		j = (len - i < column - count ? len : i + column - count);
+	      if (i == j)
+		break;
+	      if (! group)
+		group = mtext ();
+	      mtext_copy (group, count, mt, i, j);
+	      count += j - i;
+	      i = j;
+	      if (count == column)
+		{
+		  mplist_add (new, Mtext, group);
+		  M17N_OBJECT_UNREF (group);
+		  group = NULL;
+		  count = 0;
+		}
 	    }
 	}
-      M17N_OBJECT_UNREF (plist);
-      plist = mplist ();
-      len = mtext_nchars (mt);
-      if (len <= column)
-	mplist_add (plist, Mtext, mt);
-      else
+      if (group)
 	{
-	  for (i = 0; i < len; i += column)
-	    {
-	      int to = (i + column < len ? i + column : len);
-	      MText *sub = mtext_copy (mtext (), 0, mt, i, to);
-						       
-	      mplist_add (plist, Mtext, sub);
-	      M17N_OBJECT_UNREF (sub);
-	    }
+	  mplist_add (new, Mtext, group);
+	  M17N_OBJECT_UNREF (group);
+	}
+      else if (MPLIST_TAIL_P (new) && ! charset)
+	{
+	  /* All the M-texts are empty.  Keep an empty group as
+	     before.  */
+	  group = mtext ();
+	  mplist_add (new, Mtext, group);
+	  M17N_OBJECT_UNREF (group);
 	}
-      M17N_OBJECT_UNREF (mt);
     }
   else if (MPLIST_PLIST_P (plist))
     {
-      MPlist *tail = plist;
-      MPlist *new = mplist ();
+      /* plist ::= (MTEXT ...) ...  Each M-text is a candidate.  */
       MPlist *this = mplist ();
-      int count = 0;
+      int count = 0, total = 0;
 
-      MPLIST_DO (tail, tail)
+      MPLIST_DO (plist, plist)
 	{
-	  MPlist *p = MPLIST_PLIST (tail);
+	  MPlist *p = MPLIST_PLIST (plist);
 
 	  MPLIST_DO (p, p)
 	    {
 	      MText *mt = MPLIST_MTEXT (p);
 
+	      if (charset && ! mtext_in_charset (mt, charset))
+		continue;
 	      if (count == column)
 		{
 		  mplist_add (new, Mplist, this);
@@ -3018,51 +4086,290 @@ get_candidate_list (MInputContextInfo *ic_info, MPlist *args)
 		}
 	      mplist_add (this, Mtext, mt);
 	      count++;
+	      total++;
 	    }
 	}
-      mplist_add (new, Mplist, this);
+      if (! charset || total > 0)
+	mplist_add (new, Mplist, this);
       M17N_OBJECT_UNREF (this);
-      mplist_set (plist, Mnil, NULL);
-      MPLIST_DO (tail, new)
+    }
+
+  if (MPLIST_TAIL_P (new))
+    {
+      M17N_OBJECT_UNREF (new);
+      return NULL;
+    }
+  return new;
+}
+
+/* Cache of candidate lists built from the arguments of "candidates"
+   actions of an input method.  Building a list from thousands of
+   candidates takes a visible time, so a list is built once for each
+   combination of an argument, the value of candidates-charset, and
+   that of candidates-group-size, and shared by all the input contexts
+   of the input method.  The cache is accessed under the registry
+   lock.  */
+
+typedef struct
+{
+  /* Argument of the action (referred), or NULL if the slot is
+     empty.  */
+  MPlist *source;
+  MCharset *charset;
+  int column;
+  /* Candidate list built from <source> (referred), or NULL if no
+     candidate is left.  */
+  MPlist *list;
+} MIMCandidatesSlot;
+
+struct MIMCandidatesCache
+{
+  /* Open-addressing hash table of <nslots> (power of 2) slots.  */
+  MIMCandidatesSlot *slots;
+  unsigned nslots;
+  int used;
+};
+
+/* Initial number of slots of a candidates cache.  */
+#define CANDIDATES_CACHE_MIN 64
+
+/* Maximum number of lists in a candidates cache.  When it gets full,
+   all the lists are discarded.  */
+#define CANDIDATES_CACHE_MAX 4096
+
+#define CANDIDATES_CACHE_HASH(source, charset, column)			\
+  ((unsigned) (((unsigned long) (source) >> 3)				\
+	       ^ ((unsigned long) (charset) >> 5) ^ (column))		\
+   * 2654435761U)
+
+/* Return the slot for SOURCE, CHARSET, and COLUMN in CACHE.  If they
+   are not cached, return the empty slot for them.  */
+
+static MIMCandidatesSlot *
+candidates_cache_slot (MIMCandidatesCache *cache, MPlist *source,
+		       MCharset *charset, int column)
+{
+  unsigned mask = cache->nslots - 1;
+  unsigned i = CANDIDATES_CACHE_HASH (source, charset, column) & mask;
+
+  for (; cache->slots[i].source; i = (i + 1) & mask)
+    if (cache->slots[i].source == source
+	&& cache->slots[i].charset == charset
+	&& cache->slots[i].column == column)
+      break;
+  return cache->slots + i;
+}
+
+static void
+clear_candidates_cache (MIMCandidatesCache *cache)
+{
+  unsigned i;
+
+  for (i = 0; i < cache->nslots; i++)
+    if (cache->slots[i].source)
+      {
+	M17N_OBJECT_UNREF (cache->slots[i].source);
+	if (cache->slots[i].list)
+	  M17N_OBJECT_UNREF (cache->slots[i].list);
+      }
+  memset (cache->slots, 0, sizeof (MIMCandidatesSlot) * cache->nslots);
+  cache->used = 0;
+}
+
+static void
+free_candidates_cache (MIMCandidatesCache *cache)
+{
+  clear_candidates_cache (cache);
+  free (cache->slots);
+  free (cache);
+}
+
+/* Put LIST built from SOURCE, CHARSET, and COLUMN in CACHE.  If they
+   are already cached, return the cached list.  Otherwise, return
+   LIST.  The returned plist must be UNREFed.  */
+
+static MPlist *
+candidates_cache_put (MIMCandidatesCache *cache, MPlist *source,
+		      MCharset *charset, int column, MPlist *list)
+{
+  MIMCandidatesSlot *slot;
+
+  if (cache->used >= CANDIDATES_CACHE_MAX)
+    clear_candidates_cache (cache);
+  else if ((cache->used + 1) * 2 > cache->nslots)
+    {
+      MIMCandidatesSlot *slots = cache->slots;
+      unsigned nslots = cache->nslots, i;
+
+      MTABLE_CALLOC (cache->slots, nslots * 2, MERROR_IM);
+      cache->nslots = nslots * 2;
+      for (i = 0; i < nslots; i++)
+	if (slots[i].source)
+	  *candidates_cache_slot (cache, slots[i].source, slots[i].charset,
+				  slots[i].column) = slots[i];
+      free (slots);
+    }
+  slot = candidates_cache_slot (cache, source, charset, column);
+  if (slot->source)
+    {
+      /* Another input context has built the same list meanwhile.  */
+      if (list)
+	M17N_OBJECT_UNREF (list);
+      list = slot->list;
+    }
+  else
+    {
+      slot->source = source;
+      M17N_OBJECT_REF (source);
+      slot->charset = charset;
+      slot->column = column;
+      slot->list = list;
+      cache->used++;
+    }
+  if (list)
+    M17N_OBJECT_REF (list);
+  return list;
+}
+
+/* Return a candidate list for the argument ARGS of a "candidates"
+   action taken in the input context IC.  If CACHEABLE is zero, ARGS
+   is not a part of the input method (e.g. it was returned by an
+   external module), and the list is neither looked up nor put in the
+   cache of the input method, as ARGS is never used again.  The
+   returned plist must be UNREFed.  */
+
+static MPlist *
+get_candidate_list (MInputContext *ic, MPlist *args, int cacheable)
+{
+  MInputMethodInfo *im_info = (MInputMethodInfo *) ic->im->info;
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+  MCharset *charset = get_select_charset (ic_info);
+  MPlist *plist;
+  int column;
+
+  plist = resolve_variable (ic_info, Mcandidates_group_size);
+  column = MPLIST_INTEGER (plist);
+
+  plist = MPLIST_PLIST (args);
+  if (! plist)
+    return NULL;
+  if (column == 0 && ! charset)
+    {
+      M17N_OBJECT_REF (plist);
+      return plist;
+    }
+  if (! cacheable)
+    return (column == 0 ? adjust_candidates (plist, charset)
+	    : build_candidate_list (plist, charset, column));
+
+  M17N_LOCK_REGISTRY ();
+  if (im_info->candidates_cache)
+    {
+      MIMCandidatesSlot *slot
+	= candidates_cache_slot (im_info->candidates_cache, plist,
+				 charset, column);
+
+      if (slot->source)
 	{
-	  MPlist *elt = MPLIST_PLIST (tail);
+	  MPlist *list = slot->list;
 
-	  mplist_add (plist, Mplist, elt);
+	  if (list)
+	    M17N_OBJECT_REF (list);
+	  M17N_UNLOCK_REGISTRY ();
+	  return list;
 	}
-      M17N_OBJECT_UNREF (new);
     }
+  M17N_UNLOCK_REGISTRY ();
 
-  return plist;
+  /* Build the list without the lock.  It may take time.  */
+  args = (column == 0 ? adjust_candidates (plist, charset)
+	  : build_candidate_list (plist, charset, column));
+
+  M17N_LOCK_REGISTRY ();
+  if (! im_info->candidates_cache)
+    {
+      MSTRUCT_CALLOC (im_info->candidates_cache, MERROR_IM);
+      MTABLE_CALLOC (im_info->candidates_cache->slots,
+		     CANDIDATES_CACHE_MIN, MERROR_IM);
+      im_info->candidates_cache->nslots = CANDIDATES_CACHE_MIN;
+    }
+  args = candidates_cache_put (im_info->candidates_cache, plist,
+			       charset, column, args);
+  M17N_UNLOCK_REGISTRY ();
+  return args;
+}
+
+/* Return the action in the element ELT of an action list if the
+   element is already regularized by regularize_action, or return
+   NULL.  This can be called without the registry lock while another
+   thread is regularizing ELT.  */
+
+static MPlist *
+regular_action (MPlist *elt)
+{
+  MPlist *action;
+  MSymbol name;
+
+  if (M17N_LOAD_ACQUIRE (MPLIST_KEY (elt)) != Mplist)
+    return NULL;
+  action = MPLIST_PLIST (elt);
+  if (! MPLIST_SYMBOL_P (action))
+    return NULL;
+  name = (MSymbol) M17N_LOAD_ACQUIRE (MPLIST_VAL (action));
+  if (name == Minsert && MPLIST_PLIST_P (MPLIST_NEXT (action)))
+    return NULL;
+  return action;
 }
 
+/* Set ACTION as the value of the element ELT of an action list.  The
+   value is stored before the key so that regular_action never sees
+   the new key with the old value.  */
+
+static void
+set_action (MPlist *elt, MPlist *action)
+{
+  MSymbol key = MPLIST_KEY (elt);
+  void *val = MPLIST_VAL (elt);
+
+  M17N_OBJECT_REF (action);
+  M17N_STORE_RELEASE (MPLIST_VAL (elt), (void *) action);
+  M17N_STORE_RELEASE (MPLIST_KEY (elt), Mplist);
+  if (key->managing_key)
+    M17N_OBJECT_UNREF (val);
+}
 
 static MPlist *
 regularize_action (MPlist *action_list, MInputContextInfo *ic_info)
 {
-  MPlist *action = NULL;
+  MPlist *action = NULL, *value = NULL;
   MSymbol name;
   MPlist *args;
 
   if (MPLIST_SYMBOL_P (action_list))
     {
       MSymbol var = MPLIST_SYMBOL (action_list);
-      MPlist *p;
 
-      MPLIST_DO (p, ic_info->vars)
-	if (MPLIST_SYMBOL (MPLIST_PLIST (p)) == var)
-	  break;
-      if (MPLIST_TAIL_P (p))
+      action = find_variable (ic_info, var);
+      if (! action)
 	return NULL;
-      action = MPLIST_NEXT (MPLIST_PLIST (p));
       /* We should not set the element of action_list to the resolved
 	 value.  If the variable is resolved to a symbol, that symbol
 	 may be a variable that is resolved next time to the different
 	 value.
 	mplist_set (action_list, MPLIST_KEY (action), MPLIST_VAL (action));
       */
-      action_list = action;
-    }
-
+      if (! regular_action (action))
+	/* The value may be shared with the input method.  Regularize
+	   our own copy of it.  */
+	action = resolve_variable_for_set (ic_info, var);
+      action_list = value = action;
+    }
+
+  /* Action lists are shared by all input contexts of the input
+     method.  Regularize them in place only once, under the lock.  */
+  if ((action = regular_action (action_list)))
+    return action;
+  M17N_LOCK_REGISTRY ();
   if (MPLIST_PLIST_P (action_list))
     {
       action = MPLIST_PLIST (action_list);
@@ -3072,14 +4379,14 @@ regularize_action (MPlist *action_list, MInputContextInfo *ic_info)
 	  args = MPLIST_NEXT (action);
 	  if (name == Minsert
 	      && MPLIST_PLIST_P (args))
-	    mplist_set (action, Msymbol, M_candidates);
+	    M17N_STORE_RELEASE (MPLIST_VAL (action), (void *) M_candidates);
 	}
       else if (MPLIST_MTEXT_P (action) || MPLIST_PLIST_P (action))
 	{
 	  action = mplist ();
 	  mplist_push (action, Mplist, MPLIST_VAL (action_list));
 	  mplist_push (action, Msymbol, M_candidates);
-	  mplist_set (action_list, Mplist, action);
+	  set_action (action_list, action);
 	  M17N_OBJECT_UNREF (action);
 	}
     }
@@ -3088,19 +4395,26 @@ regularize_action (MPlist *action_list, MInputContextInfo *ic_info)
       action = mplist ();
       mplist_push (action, MPLIST_KEY (action_list), MPLIST_VAL (action_list));
       mplist_push (action, Msymbol, Minsert);
-      mplist_set (action_list, Mplist, action);
+      set_action (action_list, action);
       M17N_OBJECT_UNREF (action);
     }
+  else
+    action = value;
+  M17N_UNLOCK_REGISTRY ();
   return action;
 }
 
 /* Perform list of actions in ACTION_LIST for the current input
    context IC.  If "unhandle" action was performed or an error
    occurred, return -1.  Otherwise, return 0, 1, 2, or 3.  See the
-   comment in filter () for the detail. */
+   comment in filter () for the detail.  CACHEABLE is nonzero if
+   ACTION_LIST is a part of the input method, and zero if it was
+   returned by an external module.  The actual work is done by
+   take_action_list_1 (), which is wrapped here to measure the
+   time.  */
 
 static int
-take_action_list (MInputContext *ic, MPlist *action_list)
+take_action_list_1 (MInputContext *ic, MPlist *action_list, int cacheable)
 {
   MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
   MTextProperty *prop;
@@ -3133,10 +4447,13 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 	}
       else if (name == M_candidates)
 	{
-	  MPlist *plist = get_candidate_list (ic_info, args);
+	  MPlist *plist;
 	  MPlist *pl;
 	  int len;
 
+	  IM_PHASE_BEGIN (IM_PHASE_CANDIDATES);
+	  plist = get_candidate_list (ic, args, cacheable);
+	  IM_PHASE_END (IM_PHASE_CANDIDATES);
 	  if (! plist)
 	    continue;
 	  if (MPLIST_PLIST_P (plist) && MPLIST_TAIL_P (plist))
@@ -3320,6 +4637,8 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 
 	  if (code < 0)
 	    {
+	      if (! ic_info->markers)
+		ic_info->markers = mplist ();
 	      mplist_put (ic_info->markers, MPLIST_SYMBOL (args),
 			  (void *) ic->cursor_pos);
 	      MDEBUG_PRINT1 ("(%d)", ic->cursor_pos);
@@ -3435,7 +4754,7 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 	  val = (func) (func_args);
 	  M17N_OBJECT_UNREF (func_args);
 	  if (val && ! MPLIST_TAIL_P (val))
-	    result = take_action_list (ic, val);
+	    result = take_action_list (ic, val, 0);
 	  M17N_OBJECT_UNREF (val);
 	  if (result != 0)
 	    return result;
@@ -3451,10 +4770,12 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 			: integer_value (ic, args, 0));
 
 	  mtext_reset (ic->preedit);
-	  mtext_reset (ic_info->preedit_saved);
+	  if (ic_info->preedit_saved)
+	    mtext_reset (ic_info->preedit_saved);
 	  mtext_reset (ic->produced);
 	  M17N_OBJECT_UNREF (ic_info->vars);
-	  ic_info->vars = mplist_copy (ic_info->vars_saved);
+	  ic_info->vars = (ic_info->vars_saved
+			   ? mplist_copy (ic_info->vars_saved) : NULL);
 	  ic->cursor_pos = ic_info->state_pos = 0;
 	  ic_info->state_key_head = ic_info->key_head
 	    = ic_info->commit_key_head = 0;
@@ -3477,7 +4798,7 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 	       || name == Mmul || name == Mdiv)
 	{
 	  MSymbol sym = MPLIST_SYMBOL (args);
-	  MPlist *value = resolve_variable (ic_info, sym);
+	  MPlist *value = resolve_variable_for_set (ic_info, sym);
 	  int val1, val2;
 	  char *op;
 
@@ -3522,13 +4843,13 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 	      : val1 >= val2)
 	    {
 	      MDEBUG_PRINT ("ok");
-	      result = take_action_list (ic, actions1);
+	      result = take_action_list (ic, actions1, cacheable);
 	    }
 	  else
 	    {
 	      MDEBUG_PRINT ("no");
 	      if (actions2)
-		result = take_action_list (ic, actions2);
+		result = take_action_list (ic, actions2, cacheable);
 	    }
 	  if (result != 0)
 	    return result;
@@ -3548,7 +4869,7 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 	      if (resolve_expression (ic, cond) != 0)
 		{
 		  MDEBUG_PRINT1 ("(%dth)", idx);
-		  result = take_action_list (ic, MPLIST_NEXT (cond));
+		  result = take_action_list (ic, MPLIST_NEXT (cond), cacheable);
 		  if (result != 0)
 		    return result;
 		  break;
@@ -3589,7 +4910,7 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 	  if (im_info->macros
 	      && (actions = mplist_get (im_info->macros, name)))
 	    {
-	      result = take_action_list (ic, actions);
+	      result = take_action_list (ic, actions, 1);
 	      if (result != 0)
 		return result;
 	    };
@@ -3598,6 +4919,17 @@ take_action_list (MInputContext *ic, MPlist *action_list)
   return 0;
 }
 
+static int
+take_action_list (MInputContext *ic, MPlist *action_list, int cacheable)
+{
+  int result;
+
+  IM_PHASE_BEGIN (IM_PHASE_ACTIONS);
+  result = take_action_list_1 (ic, action_list, cacheable);
+  IM_PHASE_END (IM_PHASE_ACTIONS);
+  return result;
+}
+
 
 /* Handle the input key KEY in the current state and map specified in
    the input context IC.  If KEY was handled correctly, return 0
@@ -3622,8 +4954,8 @@ handle_key (MInputContext *ic)
 		     MSYMBOL_NAME (im_info->language),
 		     MSYMBOL_NAME (im_info->name),
 		     MSYMBOL_NAME (ic_info->state->name));
-      result = take_action_list (ic, ic_info->state_hook);
-      mtext_cpy (ic_info->preedit_saved, ic->preedit);
+      result = take_action_list (ic, ic_info->state_hook, 1);
+      save_preedit (ic, ic_info);
       ic_info->state_pos = ic->cursor_pos;
       ic_info->state_hook = NULL;
       if (result != 0)
@@ -3639,14 +4971,7 @@ handle_key (MInputContext *ic)
 		 MSYMBOL_NAME (ic_info->state->name), msymbol_name (key));
 
   if (map->submaps)
-    {
-      submap = mplist_get (map->submaps, key);
-      alias = key;
-      while (! submap
-	     && (alias = msymbol_get (alias, M_key_alias))
-	     && alias != key)
-	submap = mplist_get (map->submaps, alias);
-    }
+    submap = lookup_submap (map, key, &alias);
 
   if (submap)
     {
@@ -3654,7 +4979,10 @@ handle_key (MInputContext *ic)
 	MDEBUG_PRINT (" submap-found");
       else
 	MDEBUG_PRINT1 (" submap-found (by alias `%s')", MSYMBOL_NAME (alias));
-      mtext_cpy (ic->preedit, ic_info->preedit_saved);
+      if (ic_info->preedit_saved)
+	mtext_cpy (ic->preedit, ic_info->preedit_saved);
+      else
+	mtext_reset (ic->preedit);
       ic->preedit_changed = 1;
       ic->cursor_pos = ic_info->state_pos;
       ic_info->key_head++;
@@ -3662,7 +4990,7 @@ handle_key (MInputContext *ic)
       if (map->map_actions)
 	{
 	  MDEBUG_PRINT (" map-actions:");
-	  result = take_action_list (ic, map->map_actions);
+	  result = take_action_list (ic, map->map_actions, 1);
 	  if (result != 0)
 	    {
 	      MDEBUG_PRINT ("\n");
@@ -3688,7 +5016,7 @@ handle_key (MInputContext *ic)
 	  if (map->branch_actions)
 	    {
 	      MDEBUG_PRINT (" branch-actions:");
-	      result = take_action_list (ic, map->branch_actions);
+	      result = take_action_list (ic, map->branch_actions, 1);
 	      if (result != 0)
 		{
 		  MDEBUG_PRINT ("\n");
@@ -3709,7 +5037,7 @@ handle_key (MInputContext *ic)
       if (map->branch_actions)
 	{
 	  MDEBUG_PRINT (" branch-actions:");
-	  result = take_action_list (ic, map->branch_actions);
+	  result = take_action_list (ic, map->branch_actions, 1);
 	  if (result != 0)
 	    {
 	      MDEBUG_PRINT ("\n");
@@ -3841,30 +5169,11 @@ init_ic_info (MInputContext *ic)
   
   MLIST_INIT1 (ic_info, keys, 8);;
 
-  ic_info->markers = mplist ();
-
-  ic_info->vars = mplist ();
-  /* If this input method has its own setting of variables, record
-     those values in ic_info->vars.  */
-  if (im_info->configured_vars)
-    MPLIST_DO (plist, im_info->configured_vars)
-      {
-	MPlist *pl = MPLIST_PLIST (plist);
-	MSymbol name = MPLIST_SYMBOL (pl);
-
-	pl = MPLIST_NEXT (MPLIST_NEXT (MPLIST_NEXT (pl)));
-	if (MPLIST_KEY (pl) != Mt)
-	  {
-	    MPlist *p = mplist ();
-
-	    mplist_push (ic_info->vars, Mplist, p);
-	    M17N_OBJECT_UNREF (p);
-	    mplist_add (p, Msymbol, name);
-	    mplist_add (p, MPLIST_KEY (pl), MPLIST_VAL (pl));
-	  }
-      }
-  /* Remember the original values.  */
-  ic_info->vars_saved = mplist_copy (ic_info->vars);
+  /* Variables are shared with the input method until they are set.
+     Markers and the saved preedit text are created on demand.  */
+  ic_info->configured_vars = im_info->configured_vars;
+  if (ic_info->configured_vars)
+    M17N_OBJECT_REF (ic_info->configured_vars);
 
   /* If this input method uses external modules, initialize them.  */
   if (im_info->externals)
@@ -3884,8 +5193,6 @@ init_ic_info (MInputContext *ic)
       M17N_OBJECT_UNREF (func_args);
     }
 
-  ic_info->preedit_saved = mtext ();
-
   if (fallback_input_methods)
     {
       /* Record MInputContext of each fallback input method in
@@ -3960,6 +5267,7 @@ fini_ic_info (MInputContext *ic)
   M17N_OBJECT_UNREF (ic_info->markers);
   M17N_OBJECT_UNREF (ic_info->vars);
   M17N_OBJECT_UNREF (ic_info->vars_saved);
+  M17N_OBJECT_UNREF (ic_info->configured_vars);
   M17N_OBJECT_UNREF (ic_info->preceding_text);
   M17N_OBJECT_UNREF (ic_info->following_text);
   M17N_OBJECT_UNREF (ic_info->pushing_or_switching);
@@ -4078,6 +5386,8 @@ destroy_ic (MInputContext *ic)
 {
   fini_ic_info (ic);
   free (ic->info);
+  if (ic->candidate_list)
+    M17N_OBJECT_UNREF (ic->candidate_list);
 }
 
 
@@ -4133,7 +5443,9 @@ check_reload (MInputContext *ic, MSymbol key)
   MDEBUG_PRINT2 ("\n  [IM:%s-%s] reload",
 		 MSYMBOL_NAME (im_info->language),
 		 MSYMBOL_NAME (im_info->name));
+  M17N_LOCK_REGISTRY ();
   re_init_ic (ic, 1);
+  M17N_UNLOCK_REGISTRY ();
   return 1;
 }
 
@@ -4145,20 +5457,11 @@ check_fallback (MInputContext *ic, MSymbol key)
 
   MPLIST_DO (plist, ic_info->fallbacks)
     {
-      MSymbol alias = key;
       MInputContext *this_ic = (MInputContext *) MPLIST_VAL (plist);
       MInputMethodInfo *this_im_info = (MInputMethodInfo * )this_ic->im->info;
       MIMMap *map = ((MIMState *) MPLIST_VAL (this_im_info->states))->map;
-      MIMMap *submap;
-      
-      if (! map->submaps)
-	continue;
-      submap = mplist_get (map->submaps, key);
-      while (! submap
-	     && (alias = msymbol_get (alias, M_key_alias))
-	     && alias != key)
-	submap = mplist_get (map->submaps, alias);
-      if (submap)
+
+      if (lookup_submap (map, key, NULL))
 	return this_ic;
     }
   return NULL;
@@ -4208,7 +5511,9 @@ filter (MInputContext *ic, MSymbol key, void *arg)
     int candidate_show = ic->candidate_show;
     MTextProperty *prop;
 
+    IM_PHASE_BEGIN (IM_PHASE_HANDLE_KEY);
     result = handle_key (ic);
+    IM_PHASE_END (IM_PHASE_HANDLE_KEY);
     if (ic->candidate_list)
       {
 	M17N_OBJECT_UNREF (ic->candidate_list);
@@ -4382,6 +5687,8 @@ dump_im_map (MPlist *map_list, int indent)
   memset (prefix, 32, indent);
   prefix[indent] = '\0';
 
+  if (M17N_LOAD_ACQUIRE (map->image))
+    expand_map (map);
   fprintf (mdebug__output, "(\"%s\" ", msymbol_name (key));
   if (map->map_actions)
     mdebug_dump_plist (map->map_actions, indent + 2);
@@ -4487,6 +5794,20 @@ minput__fini ()
 
   M17N_OBJECT_UNREF (minput_default_driver.callback_list);
   M17N_OBJECT_UNREF (minput_driver->callback_list);
+
+  if (mdebug__flags[MDEBUG_INPUT_TIME])
+    {
+      int i;
+
+      fprintf (mdebug__output, "%-20s %10s %12s %10s\n",
+	       "phase", "calls", "usec", "usec/call");
+      for (i = 0; i < IM_PHASE_MAX; i++)
+	fprintf (mdebug__output, "%-20s %10ld %12ld %10.3f\n",
+		 im_phases[i].name, im_phases[i].count, im_phases[i].usec,
+		 (im_phases[i].count
+		  ? (double) im_phases[i].usec / im_phases[i].count : 0.0));
+      fflush (mdebug__output);
+    }
 }
 
 MSymbol
@@ -4774,6 +6095,7 @@ minput_open_im (MSymbol language, MSymbol name, void *arg)
 {
   MInputMethod *im;
   MInputDriver *driver;
+  int result;
 
   MINPUT__INIT ();
 
@@ -4797,7 +6119,10 @@ minput_open_im (MSymbol language, MSymbol name, void *arg)
   im->name = name;
   im->arg = arg;
   im->driver = *driver;
-  if ((*im->driver.open_im) (im) < 0)
+  M17N_LOCK_REGISTRY ();
+  result = (*im->driver.open_im) (im);
+  M17N_UNLOCK_REGISTRY ();
+  if (result < 0)
     {
       MDEBUG_PRINT (" failed\n");
       free (im);
@@ -4826,7 +6151,9 @@ minput_close_im (MInputMethod *im)
 {
   MDEBUG_PRINT2 ("  [IM:%s-%s] closing ... ",
 		 MSYMBOL_NAME (im->language), MSYMBOL_NAME (im->name));
+  M17N_LOCK_REGISTRY ();
   (*im->driver.close_im) (im);
+  M17N_UNLOCK_REGISTRY ();
   free (im);
   MDEBUG_PRINT (" done\n");
 }
@@ -4862,6 +6189,7 @@ MInputContext *
 minput_create_ic (MInputMethod *im, void *arg)
 {
   MInputContext *ic;
+  int result;
 
   MDEBUG_PRINT2 ("  [IM:%s-%s] creating context ... ",
 		 MSYMBOL_NAME (im->language), MSYMBOL_NAME (im->name));
@@ -4874,7 +6202,10 @@ minput_create_ic (MInputMethod *im, void *arg)
   ic->spot.x = ic->spot.y = 0;
   ic->active = 1;
   ic->plist = mplist ();
-  if ((*im->driver.create_ic) (ic) < 0)
+  M17N_LOCK_REGISTRY ();
+  result = (*im->driver.create_ic) (ic);
+  M17N_UNLOCK_REGISTRY ();
+  if (result < 0)
     {
       MDEBUG_PRINT (" failed\n");
       M17N_OBJECT_UNREF (ic->preedit);
@@ -4926,7 +6257,9 @@ minput_destroy_ic (MInputContext *ic)
       minput_callback (ic, Minput_status_done);
       minput_callback (ic, Minput_candidates_done);
     }
+  M17N_LOCK_REGISTRY ();
   (*ic->im->driver.destroy_ic) (ic);
+  M17N_UNLOCK_REGISTRY ();
   M17N_OBJECT_UNREF (ic->preedit);
   M17N_OBJECT_UNREF (ic->produced);
   M17N_OBJECT_UNREF (ic->plist);
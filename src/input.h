@@ -25,6 +25,10 @@
 
 typedef struct _MInputMethodInfo MInputMethodInfo;
 
+typedef struct MIMImage MIMImage;
+
+typedef struct MIMCandidatesCache MIMCandidatesCache;
+
 struct _MInputMethodInfo
 {
   MDatabase *mdb;
@@ -38,6 +42,12 @@ struct _MInputMethodInfo
   MPlist *macros;
   MPlist *externals;
   unsigned long tick;
+
+  /* Compiled image from which <states> are loaded, or NULL.  */
+  MIMImage *image;
+
+  /* Candidate lists built by "candidates" actions, or NULL.  */
+  MIMCandidatesCache *candidates_cache;
 };
 
 typedef struct MIMState MIMState;
@@ -79,11 +89,15 @@ typedef struct
   /** List of markers.  */
   MPlist *markers;
 
-  /** List of variables. */
+  /** List of variables set in this context.  A variable not in it
+      has the value in <configured_vars>.  */
   MPlist *vars;
 
   MPlist *vars_saved;
 
+  /** The configured variables of the input method, shared with it.  */
+  MPlist *configured_vars;
+
   MText *preceding_text, *following_text;
 
   int key_unhandled;
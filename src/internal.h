@@ -80,6 +80,76 @@ extern int mdebug_hook ();
     MERROR (MERROR_CHAR, (ret));	\
   else
 
+
+/** Thread support.
+
+    If M17N_THREADS is defined, the library can be used from multiple
+    threads as long as each thread works on its own objects (M-texts,
+    converters, input contexts, etc.).  In addition, threads can read
+    an M-text at the same time while no thread modifies it.  The parts
+    of an M-text updated while it is read (the position caches, the
+    position index, and the gap) are updated atomically or under the
+    lock of mtext.c.  Data private to a module (e.g. the symbol
+    table) are protected by an M17NLock of the module.  The registries
+    shared among modules (coding systems, charsets, character
+    properties, databases, and input methods), and the data loaded
+    into them on demand, are protected by the recursive registry lock.
+    Functions must release the locks they hold before returning, so
+    MERROR () must not be used while holding a lock.  */
+
+#ifdef M17N_THREADS
+
+#include <pthread.h>
+
+typedef pthread_mutex_t M17NLock;
+
+#define M17N_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define M17N_LOCK(lock) pthread_mutex_lock (&(lock))
+#define M17N_UNLOCK(lock) pthread_mutex_unlock (&(lock))
+
+extern void m17n__lock_registry (void);
+extern void m17n__unlock_registry (void);
+
+#define M17N_LOCK_REGISTRY() m17n__lock_registry ()
+#define M17N_UNLOCK_REGISTRY() m17n__unlock_registry ()
+
+/** Read and write a flag that tells other threads, which may read it
+    without a lock, that the data it guards are ready.  */
+
+#define M17N_LOAD_ACQUIRE(var) __atomic_load_n (&(var), __ATOMIC_ACQUIRE)
+#define M17N_STORE_RELEASE(var, val)			\
+  __atomic_store_n (&(var), (val), __ATOMIC_RELEASE)
+
+/** Storage class of a variable of which each thread has its own
+    copy.  */
+
+#define M17N_THREAD_LOCAL __thread
+
+/** Add VAL to a counter that threads update at the same time.  */
+
+#define M17N_ADD_COUNTER(var, val)			\
+  __atomic_add_fetch (&(var), (val), __ATOMIC_RELAXED)
+
+#else  /* not M17N_THREADS */
+
+typedef int M17NLock;
+
+#define M17N_LOCK_INITIALIZER 0
+#define M17N_LOCK(lock) ((void) (lock))
+#define M17N_UNLOCK(lock) ((void) (lock))
+
+#define M17N_LOCK_REGISTRY() ((void) 0)
+#define M17N_UNLOCK_REGISTRY() ((void) 0)
+
+#define M17N_LOAD_ACQUIRE(var) (var)
+#define M17N_STORE_RELEASE(var, val) ((var) = (val))
+
+#define M17N_THREAD_LOCAL
+
+#define M17N_ADD_COUNTER(var, val) ((var) += (val))
+
+#endif /* not M17N_THREADS */
+
 
 /** Memory allocation stuffs.  */
 
@@ -298,9 +368,15 @@ typedef struct
 
 typedef struct
 {
-  /**en Reference count of the object.  */
-  /**ja オブジェクトの参照数.  */
+  /**en Reference count of the object.  If M17N_ATOMIC_REFCOUNT is
+      defined, it is a 32-bit integer updated atomically.  */
+  /**ja オブジェクトの参照数.  M17N_ATOMIC_REFCOUNT が定義されていれば
+      不可分に更新される 32 ビット整数.  */
+#ifdef M17N_ATOMIC_REFCOUNT
+  unsigned ref_count;
+#else
   unsigned ref_count : 16;
+#endif
 
   unsigned ref_count_extended : 1;
 
@@ -330,6 +406,71 @@ typedef struct
     ((M17NObject *) (object))->u.freer = free_func;	\
   } while (0)
 
+extern void *m17n__alloc_small (int size);
+extern void m17n__free_small (void *block, int size);
+
+/** Like M17N_OBJECT, but allocate OBJECT from the pool of small
+    blocks.  FREE_FUNC must release OBJECT by M17N_POOLED_FREE.  */
+
+#define M17N_POOLED_OBJECT(object, free_func, err)		\
+  do {								\
+    if (! ((object) = m17n__alloc_small (sizeof (*(object)))))	\
+      MEMORY_FULL (err);					\
+    ((M17NObject *) (object))->ref_count = 1;			\
+    ((M17NObject *) (object))->u.freer = free_func;		\
+  } while (0)
+
+#define M17N_POOLED_FREE(object)			\
+  m17n__free_small ((object), sizeof (*(object)))
+
+
+#ifdef M17N_ATOMIC_REFCOUNT
+
+/* The reference count never overflows to M17NObjectRecord, and
+   ref_count_extended is always zero.  An object whose count is 0 is
+   not managed, and its count is never changed.  */
+
+#define M17N_OBJECT_REF_COUNT(object)					\
+  __atomic_load_n (&((M17NObject *) (object))->ref_count, __ATOMIC_RELAXED)
+
+#define M17N_OBJECT_REF(object)						\
+  do {									\
+    if (M17N_OBJECT_REF_COUNT (object) > 0)				\
+      __atomic_add_fetch (&((M17NObject *) (object))->ref_count, 1,	\
+			  __ATOMIC_RELAXED);				\
+  } while (0)
+
+#define M17N_OBJECT_REF_NTIMES(object, n)				\
+  do {									\
+    if (M17N_OBJECT_REF_COUNT (object) > 0)				\
+      __atomic_add_fetch (&((M17NObject *) (object))->ref_count, (n),	\
+			  __ATOMIC_RELAXED);				\
+  } while (0)
+
+#define M17N_OBJECT_UNREF(object)					\
+  do {									\
+    if (object)								\
+      {									\
+	if (mdebug__flags[MDEBUG_FINI])					\
+	  {								\
+	    if (m17n_object_unref (object) == 0)			\
+	      (object) = NULL;						\
+	  }								\
+	else if (M17N_OBJECT_REF_COUNT (object) == 0)			\
+	  break;							\
+	else if (__atomic_sub_fetch (&((M17NObject *) (object))->ref_count, \
+				     1, __ATOMIC_ACQ_REL) == 0)		\
+	  {								\
+	    if (((M17NObject *) (object))->u.freer)			\
+	      (((M17NObject *) (object))->u.freer) (object);		\
+	    else							\
+	      free (object);						\
+	    (object) = NULL;						\
+	  }								\
+      }									\
+  } while (0)
+
+#else  /* not M17N_ATOMIC_REFCOUNT */
 
 /**en Increment the reference count of OBJECT if the count is not
    0.  */
@@ -405,6 +546,8 @@ typedef struct
       }									\
   } while (0)
 
+#endif /* not M17N_ATOMIC_REFCOUNT */
+
 typedef struct _M17NObjectArray M17NObjectArray;
 
 struct _M17NObjectArray
@@ -441,6 +584,8 @@ extern void mdebug__unregister_object (M17NObjectArray *array, void *object);
 
 struct MTextPlist;
 
+struct MTextPosIndex;
+
 enum MTextCoverage
   {
     MTEXT_COVERAGE_ASCII,
@@ -477,7 +622,26 @@ struct MText
 
   /**en Caches of the character position and the corresponding byte position. */
   /**ja 文字位置および対応するバイト位置のキャッシュ */
+#ifdef M17N_THREADS
+  union
+  {
+    struct { int cache_char_pos, cache_byte_pos; };
+    /* Both caches as one word.  See MTEXT_CACHE_LOAD in mtext.h.  */
+    unsigned long long cache_pair;
+  };
+#else
   int cache_char_pos, cache_byte_pos;
+#endif
+
+  /**en Index of character and byte position pairs for a long M-text,
+     or NULL.  */
+  /**ja 長い M-text の文字位置とバイト位置の対の索引、または NULL */
+  struct MTextPosIndex *index;
+  /**en Unit position and size (in bytes) of the gap in the @c data
+     member of a long M-text, or 0 if there is no gap.  */
+  /**ja 長い M-text の @c data メンバ中のギャップの単位位置と大きさ（バ
+     イト数）、ギャップがなければ 0 */
+  int gap, gap_size;
 };
 
 /** short description of M_CHECK_POS */
@@ -555,6 +719,7 @@ enum MDebugFlag
     MDEBUG_FLT,
     MDEBUG_FONTSET,
     MDEBUG_INPUT,
+    MDEBUG_INPUT_TIME,
     MDEBUG_ALL,
     MDEBUG_MAX = MDEBUG_ALL
   };
@@ -563,6 +728,7 @@ extern int mdebug__flags[MDEBUG_MAX];
 extern FILE *mdebug__output;
 extern void mdebug__push_time ();
 extern void mdebug__pop_time ();
+extern long mdebug__pop_elapsed_time ();
 extern void mdebug__print_time ();
 
 #define MDEBUG_FLAG() mdebug__flags[mdebug_flag]
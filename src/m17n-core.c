@@ -409,6 +409,7 @@
 #include "m17n-misc.h"
 #include "internal.h"
 #include "symbol.h"
+#include "mtext.h"
 
 static void
 default_error_handler (enum MErrorCode err)
@@ -416,11 +417,232 @@ default_error_handler (enum MErrorCode err)
   exit (err);
 }
 
-static struct timeval time_stack[16];
-static int time_stack_index;
+/* Times pushed by mdebug__push_time ().  Each thread has its own
+   stack because the pushes and pops of threads interleave.  */
+static M17N_THREAD_LOCAL struct timeval time_stack[16];
+static M17N_THREAD_LOCAL int time_stack_index;
 
 static M17NObjectArray *object_array_root;
 
+static M17NLock object_array_lock = M17N_LOCK_INITIALIZER;
+
+/** Blocks of at most SMALL_BLOCK_MAX bytes are allocated from pools,
+    one for each size class of multiples of SMALL_BLOCK_UNIT bytes.
+    A pool carves blocks out of chunks of SMALL_CHUNK_SIZE bytes and
+    keeps freed blocks in a free list for reuse.  */
+
+#define SMALL_BLOCK_UNIT 16
+#define SMALL_BLOCK_MAX 256
+#define SMALL_CHUNK_SIZE 0x4000
+
+typedef struct
+{
+  /** Chain of freed blocks.  The first word of a freed block points
+      to the next one.  */
+  void *free_list;
+
+  /** Unused area of the newest chunk.  */
+  char *unused, *unused_end;
+
+  /** Chain of chunks.  The first word of a chunk points to the next
+      one.  */
+  void *chunks;
+
+  /** Statistics: the numbers of allocated chunks, of blocks carved
+      out of them, of reused blocks, and of blocks in use (including
+      those cached by threads).  */
+  int nchunks, nblocks, nreused, alive;
+} SmallPool;
+
+static SmallPool small_pools[SMALL_BLOCK_MAX / SMALL_BLOCK_UNIT];
+
+#ifdef M17N_THREADS
+
+static M17NLock small_pool_lock = M17N_LOCK_INITIALIZER;
+
+/** Each thread caches blocks of each size class, and takes
+    small_pool_lock only to move SMALL_CACHE_BATCH blocks at once
+    between a cache and the pool: when it allocates from an empty
+    cache, and when a cache gets SMALL_CACHE_MAX blocks by freeing.
+    The caches of a thread are returned to the pools when it
+    exits.  */
+
+#define SMALL_CACHE_BATCH 32
+#define SMALL_CACHE_MAX (SMALL_CACHE_BATCH * 2)
+
+typedef struct
+{
+  /** Chain of cached blocks, linked as in SmallPool.  */
+  void *free_list;
+
+  /** The number of blocks in free_list.  */
+  int count;
+} SmallCache;
+
+static __thread SmallCache small_caches[SMALL_BLOCK_MAX / SMALL_BLOCK_UNIT];
+
+/** Nonzero if small_caches of this thread are registered to be
+    drained at its exit.  */
+static __thread int small_caches_registered;
+
+static pthread_key_t small_cache_key;
+
+static pthread_once_t small_cache_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t registry_lock;
+
+static pthread_once_t registry_lock_once = PTHREAD_ONCE_INIT;
+
+static void
+init_registry_lock (void)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&registry_lock, &attr);
+  pthread_mutexattr_destroy (&attr);
+}
+
+#endif /* M17N_THREADS */
+
+/** Take a block of SIZE bytes out of POOL, or return NULL if memory
+    is exhausted.  Under M17N_THREADS, the caller must hold
+    small_pool_lock.  */
+
+static void *
+take_small_block (SmallPool *pool, int size)
+{
+  void *block;
+
+  if (pool->free_list)
+    {
+      block = pool->free_list;
+      pool->free_list = *(void **) block;
+      pool->nreused++;
+    }
+  else
+    {
+      if (pool->unused_end - pool->unused < size)
+	{
+	  char *chunk = malloc (SMALL_CHUNK_SIZE);
+
+	  if (! chunk)
+	    return NULL;
+	  *(void **) chunk = pool->chunks;
+	  pool->chunks = chunk;
+	  pool->nchunks++;
+	  /* Keep the first SMALL_BLOCK_UNIT bytes for the chain.  */
+	  pool->unused = chunk + SMALL_BLOCK_UNIT;
+	  pool->unused_end = chunk + SMALL_CHUNK_SIZE;
+	}
+      block = pool->unused;
+      pool->unused += size;
+      pool->nblocks++;
+    }
+  pool->alive++;
+  return block;
+}
+
+#ifdef M17N_THREADS
+
+/** Move N blocks of CACHE back to POOL.  The caller must hold
+    small_pool_lock.  */
+
+static void
+drain_small_cache (SmallPool *pool, SmallCache *cache, int n)
+{
+  void *block;
+
+  cache->count -= n;
+  pool->alive -= n;
+  while (n-- > 0)
+    {
+      block = cache->free_list;
+      cache->free_list = *(void **) block;
+      *(void **) block = pool->free_list;
+      pool->free_list = block;
+    }
+}
+
+/** Return all the blocks of CACHES, the caches of a thread, to the
+    pools.  */
+
+static void
+drain_small_caches (void *caches)
+{
+  SmallCache *cache = caches;
+  int i;
+
+  M17N_LOCK (small_pool_lock);
+  for (i = 0; i < SMALL_BLOCK_MAX / SMALL_BLOCK_UNIT; i++)
+    drain_small_cache (small_pools + i, cache + i, cache[i].count);
+  M17N_UNLOCK (small_pool_lock);
+}
+
+static void
+init_small_cache_key (void)
+{
+  pthread_key_create (&small_cache_key, drain_small_caches);
+}
+
+/** Arrange that the caches of this thread are drained at its
+    exit.  */
+
+static void
+register_small_caches (void)
+{
+  pthread_once (&small_cache_key_once, init_small_cache_key);
+  pthread_setspecific (small_cache_key, small_caches);
+  small_caches_registered = 1;
+}
+
+#endif /* M17N_THREADS */
+
+static void
+report_small_pools ()
+{
+  int i;
+
+  fprintf (mdebug__output, "%16s %7s %7s %7s %7s\n",
+	   "block size", "chunks", "carved", "reused", "alive");
+  fprintf (mdebug__output, "%16s %7s %7s %7s %7s\n",
+	   "----------", "------", "------", "------", "-----");
+  for (i = 0; i < SMALL_BLOCK_MAX / SMALL_BLOCK_UNIT; i++)
+    {
+      SmallPool *pool = small_pools + i;
+
+      if (pool->nchunks > 0)
+	fprintf (mdebug__output, "%16d %7d %7d %7d %7d\n",
+		 (i + 1) * SMALL_BLOCK_UNIT, pool->nchunks, pool->nblocks,
+		 pool->nreused, pool->alive);
+    }
+}
+
+/** Free the chunks of the pools no block of which is in use.  */
+
+static void
+free_small_pools ()
+{
+  int i;
+
+  for (i = 0; i < SMALL_BLOCK_MAX / SMALL_BLOCK_UNIT; i++)
+    {
+      SmallPool *pool = small_pools + i;
+
+      if (pool->alive > 0)
+	continue;
+      while (pool->chunks)
+	{
+	  void *next = *(void **) pool->chunks;
+
+	  free (pool->chunks);
+	  pool->chunks = next;
+	}
+      memset (pool, 0, sizeof (SmallPool));
+    }
+}
+
 static void
 report_object_array ()
 {
@@ -444,7 +666,7 @@ report_object_array ()
 	      MText *mt = (MText *) array->objects[i];
 
 	      if (mt->format <= MTEXT_FORMAT_UTF_8)
-		fprintf (mdebug__output, "\t\"%s\"\n", (char *) mt->data);
+		fprintf (mdebug__output, "\t\"%s\"\n", (char *) MTEXT_DATA (mt));
 	    }
 	  else if (strcmp (array->name, "Plist") == 0)
 	    {
@@ -455,11 +677,8 @@ report_object_array ()
 	    }
 	}
 
-      if (array->objects != NULL)
-	{
-	  free (array->objects);
-	  array->count = array->used = 0;
-	}
+      MLIST_FREE1 (array, objects);
+      array->count = 0;
     }
 }
 
@@ -474,6 +693,109 @@ int m17n__gui_initialized;
 int mdebug__flags[MDEBUG_MAX];
 FILE *mdebug__output;
 
+#ifdef M17N_THREADS
+
+void
+m17n__lock_registry (void)
+{
+  pthread_once (&registry_lock_once, init_registry_lock);
+  pthread_mutex_lock (&registry_lock);
+}
+
+void
+m17n__unlock_registry (void)
+{
+  pthread_mutex_unlock (&registry_lock);
+}
+
+#endif /* M17N_THREADS */
+
+/** Return a zero-cleared block of SIZE bytes.  A small block is
+    taken from the pool of its size class.  Return NULL if memory is
+    exhausted.  */
+
+void *
+m17n__alloc_small (int size)
+{
+  SmallPool *pool;
+  void *block;
+#ifdef M17N_THREADS
+  SmallCache *cache;
+#endif
+
+  if (size > SMALL_BLOCK_MAX)
+    return calloc (1, size);
+  size = (size + SMALL_BLOCK_UNIT - 1) / SMALL_BLOCK_UNIT;
+  pool = small_pools + size - 1;
+#ifdef M17N_THREADS
+  cache = small_caches + size - 1;
+#endif
+  size *= SMALL_BLOCK_UNIT;
+#ifdef M17N_THREADS
+  if (! cache->free_list)
+    {
+      if (! small_caches_registered)
+	register_small_caches ();
+      M17N_LOCK (small_pool_lock);
+      while (cache->count < SMALL_CACHE_BATCH
+	     && (block = take_small_block (pool, size)))
+	{
+	  *(void **) block = cache->free_list;
+	  cache->free_list = block;
+	  cache->count++;
+	}
+      M17N_UNLOCK (small_pool_lock);
+      if (! cache->free_list)
+	return NULL;
+    }
+  block = cache->free_list;
+  cache->free_list = *(void **) block;
+  cache->count--;
+#else  /* not M17N_THREADS */
+  block = take_small_block (pool, size);
+  if (! block)
+    return NULL;
+#endif /* not M17N_THREADS */
+  memset (block, 0, size);
+  return block;
+}
+
+/** Free BLOCK of SIZE bytes allocated by m17n__alloc_small ().  */
+
+void
+m17n__free_small (void *block, int size)
+{
+  SmallPool *pool;
+#ifdef M17N_THREADS
+  SmallCache *cache;
+#endif
+
+  if (size > SMALL_BLOCK_MAX)
+    {
+      free (block);
+      return;
+    }
+  size = (size + SMALL_BLOCK_UNIT - 1) / SMALL_BLOCK_UNIT;
+  pool = small_pools + size - 1;
+#ifdef M17N_THREADS
+  cache = small_caches + size - 1;
+  *(void **) block = cache->free_list;
+  cache->free_list = block;
+  if (++cache->count >= SMALL_CACHE_MAX)
+    {
+      if (! small_caches_registered)
+	register_small_caches ();
+      M17N_LOCK (small_pool_lock);
+      drain_small_cache (pool, cache, SMALL_CACHE_BATCH);
+      M17N_UNLOCK (small_pool_lock);
+    }
+#else  /* not M17N_THREADS */
+  *(void **) block = pool->free_list;
+  pool->free_list = block;
+  pool->alive--;
+#endif /* not M17N_THREADS */
+}
+
 void
 mdebug__push_time ()
 {
@@ -488,6 +810,21 @@ mdebug__pop_time ()
   time_stack_index--;
 }
 
+/* Pop the time pushed by mdebug__push_time, and return microseconds
+   elapsed since then.  */
+
+long
+mdebug__pop_elapsed_time ()
+{
+  struct timeval tv;
+  struct timezone tz;
+
+  gettimeofday (&tv, &tz);
+  time_stack_index--;
+  return ((tv.tv_sec - time_stack[time_stack_index].tv_sec) * 1000000
+	  + (tv.tv_usec - time_stack[time_stack_index].tv_usec));
+}
+
 void
 mdebug__print_time ()
 {
@@ -535,15 +872,18 @@ mdebug__add_object_array (M17NObjectArray *array, char *name)
 void
 mdebug__register_object (M17NObjectArray *array, void *object)
 {
+  M17N_LOCK (object_array_lock);
   if (array->objects == NULL)
     MLIST_INIT1 (array, objects, 256);
   array->count++;
   MLIST_APPEND1 (array, objects, object, MERROR_OBJECT);
+  M17N_UNLOCK (object_array_lock);
 }
 
 void
 mdebug__unregister_object (M17NObjectArray *array, void *object)
 {
+  M17N_LOCK (object_array_lock);
   array->count--;
   if (array->count >= 0)
     {
@@ -561,6 +901,7 @@ mdebug__unregister_object (M17NObjectArray *array, void *object)
     }
   else									\
     mdebug_hook ();
+  M17N_UNLOCK (object_array_lock);
 }
 
 
@@ -590,6 +931,7 @@ m17n_init_core (void)
   SET_DEBUG_FLAG ("MDEBUG_FLT", MDEBUG_FLT);
   SET_DEBUG_FLAG ("MDEBUG_FONTSET", MDEBUG_FONTSET);
   SET_DEBUG_FLAG ("MDEBUG_INPUT", MDEBUG_INPUT);
+  SET_DEBUG_FLAG ("MDEBUG_INPUT_TIME", MDEBUG_INPUT_TIME);
   /* for backward compatibility... */
   SET_DEBUG_FLAG ("MDEBUG_FONT_FLT", MDEBUG_FLT);
   SET_DEBUG_FLAG ("MDEBUG_FONT_OTF", MDEBUG_FLT);
@@ -677,6 +1019,13 @@ m17n_fini_core (void)
   if (mdebug__flags[MDEBUG_FINI])
     report_object_array ();
   msymbol__free_table ();
+#ifdef M17N_THREADS
+  /* Return the blocks cached by this thread before reporting.  */
+  drain_small_caches (small_caches);
+#endif
+  if (mdebug__flags[MDEBUG_FINI])
+    report_small_pools ();
+  free_small_pools ();
   if (mdebug__output != stderr)
     fclose (mdebug__output);
 }
@@ -863,6 +1212,19 @@ m17n_object (int size, void (*freer) (void *))
     @errors
     この関数は失敗しない。    */
 
+#ifdef M17N_ATOMIC_REFCOUNT
+
+int
+m17n_object_ref (void *object)
+{
+  M17NObject *obj = (M17NObject *) object;
+  unsigned count = __atomic_add_fetch (&obj->ref_count, 1, __ATOMIC_RELAXED);
+
+  return (count < 0x10000 ? (int) count : -1);
+}
+
+#else  /* not M17N_ATOMIC_REFCOUNT */
+
 int
 m17n_object_ref (void *object)
 {
@@ -893,6 +1255,8 @@ m17n_object_ref (void *object)
   return -1;
 }
 
+#endif /* not M17N_ATOMIC_REFCOUNT */
+
 /*=*/
 
 /***en
@@ -923,6 +1287,31 @@ m17n_object_ref (void *object)
 
     @errors
     この関数は失敗しない。    */
+
+#ifdef M17N_ATOMIC_REFCOUNT
+
+int
+m17n_object_unref (void *object)
+{
+  M17NObject *obj = (M17NObject *) object;
+  unsigned count;
+
+  if (object == NULL)
+    return -1;
+  count = __atomic_sub_fetch (&obj->ref_count, 1, __ATOMIC_ACQ_REL);
+  if (! count)
+    {
+      if (obj->u.freer)
+	(obj->u.freer) (object);
+      else
+	free (object);
+      return 0;
+    }
+  return (count < 0x10000 ? (int) count : -1);
+}
+
+#else  /* not M17N_ATOMIC_REFCOUNT */
+
 int
 m17n_object_unref (void *object)
 {
@@ -961,6 +1350,8 @@ m17n_object_unref (void *object)
   return -1;
 }
 
+#endif /* not M17N_ATOMIC_REFCOUNT */
+
 /*=*/
 
 /*** @} */
@@ -1014,7 +1405,9 @@ m17n_object_unref (void *object)
     m17n library.  When a library function is called with an invalid
     argument, it sets this variable to one of @c enum #MErrorCode.
 
-    This variable initially has the value 0.  */
+    This variable initially has the value 0.  If the library is
+    configured with --enable-threads, each thread has its own
+    #merror_code.  */
 
 /***ja 
     @brief m17n ライブラリのエラーコードを保持する外部変数.
@@ -1023,9 +1416,14 @@ m17n_object_unref (void *object)
     ライブラリ関数が妥当でない引数とともに呼ばれた際には、この変数を 
     @c enum #MErrorCode の一つにセットする。
 
-    この変数の初期値は 0 である。  */
+    この変数の初期値は 0 である。ライブラリが --enable-threads 付きで
+    configure された場合、#merror_code はスレッドごとに存在する。  */
 
+#ifdef M17N_THREADS
+__thread int merror_code;
+#else
 int merror_code;
+#endif
 
 /*=*/
 
@@ -1103,6 +1501,11 @@ void (*m17n_memory_full_handler) (enum MErrorCode err);
     <li> MDEBUG_INPUT -- If set to 1, print information about how an
     input method is running.
 
+    <li> MDEBUG_INPUT_TIME -- If set to 1, measure the time spent in
+    each phase of handling keys by input methods (handling a key,
+    taking actions, building candidate lists, and committing the
+    preedit text), and print the totals on finalizing the library.
+
     <li> MDEBUG_ALL -- Setting this variable to 1 is equivalent to
     setting all the above variables to 1.
 
@@ -1157,6 +1560,11 @@ void (*m17n_memory_full_handler) (enum MErrorCode err);
     <li> MDEBUG_INPUT -- 1 ならば、実行中の入力メソッドの状態に付いての
     情報をプリントする。
 
+    <li> MDEBUG_INPUT_TIME -- 1 ならば、入力メソッドがキーを処理する各
+    段階 (キーの処理、アクションの実行、候補リストの作成、preedit テキ
+    ストの確定) にかかった時間を測り、ライブラリの終了時にその合計をプ
+    リントする。
+
     <li> MDEBUG_ALL -- 1 ならば、上記すべての変数を 1 
     にしたのと同じ効果を持つ。
 
@@ -55,7 +55,11 @@ extern void m17n_init_core (void);
 extern void m17n_fini_core (void);
 #define M17N_FINI() m17n_fini_core ()
 
+#ifdef M17N_THREADS
+extern __thread int merror_code;
+#else
 extern int merror_code;
+#endif
 
 #endif
 
@@ -732,6 +732,9 @@ extern MConverter *mconv_buffer_converter (MSymbol coding,
 
 extern MConverter *mconv_stream_converter (MSymbol coding, FILE *fp);
 
+extern MConverter *mconv_file_converter (MSymbol coding,
+					 const char *filename);
+
 extern int mconv_reset_converter (MConverter *converter);
 
 extern void mconv_free_converter (MConverter *converter);
@@ -747,6 +750,26 @@ MText *mconv_decode_buffer (MSymbol name, const unsigned char *buf, int n);
 
 MText *mconv_decode_stream (MSymbol name, FILE *fp);   
 
+/***en
+    @brief Type of functions to receive decoded text.
+
+    This is the type of functions given to mconv_decode_sink ().  $MT
+    is an M-text holding a block of decoded characters, and $ARG is
+    the argument given to mconv_decode_sink ().  A function of this
+    type returns zero to continue decoding, or nonzero to stop it.  */
+/***ja
+    @brief デコードされたテキストを受け取る関数の型宣言.
+
+    mconv_decode_sink () に与えられる関数の型である。$MT はデコードさ
+    れた文字のブロックを保持する M-text、$ARG は mconv_decode_sink ()
+    に与えられた引数である。この型の関数は、デコードを続けるなら 0 を、
+    中止するなら 0 以外を返す。  */
+
+typedef int (*MConverterSinkFunc) (MText *mt, void *arg);
+
+extern int mconv_decode_sink (MConverter *converter, MConverterSinkFunc func,
+			      void *arg);
+
 extern int mconv_encode (MConverter *converter, MText *mt);
 
 extern int mconv_encode_range (MConverter *converter, MText *mt,
@@ -765,6 +788,33 @@ extern int mconv_putc (MConverter *converter, int c);
 
 extern MText *mconv_gets (MConverter *converter, MText *mt);
 
+/***en
+    @brief Type of coding system detectors.
+
+    The type #MCodingDetector is for a coding system detector created
+    by mconv_coding_detector ().  Its members are hidden from
+    applications.  */
+/***ja
+    @brief コード系検出器の型宣言.
+
+    #MCodingDetector は mconv_coding_detector () で作成されるコード系
+    検出器の型である。メンバはアプリケーションからは隠されている。  */
+
+typedef struct MCodingDetector MCodingDetector;
+
+extern MCodingDetector *mconv_coding_detector (MSymbol *codings, int n,
+					       int limit);
+
+extern int mconv_feed_detector (MCodingDetector *detector,
+				const unsigned char *buf, int n);
+
+extern int mconv_detected_codings (MCodingDetector *detector,
+				   MSymbol **codings);
+
+extern void mconv_free_detector (MCodingDetector *detector);
+
+extern MSymbol mconv_detect_coding (const unsigned char *buf, int n);
+
 /* (S4) Locale related functions corresponding to libc functions */
 /*=*/
 /*** @ingroup m17nShell */
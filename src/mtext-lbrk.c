@@ -33,6 +33,7 @@
 #include "m17n-misc.h"
 #include "internal.h"
 #include "mtext.h"
+#include "chartab.h"
 
 enum LineBreakClass
   {
@@ -125,6 +126,9 @@ static char *lba_pair_table[] =
 
 static MCharTable *lbc_table;
 
+/* Frozen copy of lbc_table for fast lookup.  */
+static MFrozenCharTable *lbc_frozen;
+
 /* Set LBC to enum LineBreakClass of the character at POS of MT
    (length is LEN) while converting LBC_AI and LBC_XX to LBC_AL,
    LBC_CB to LBC_B2, LBC_CR, LBC_LF, and LBC_NL to LBC_BK.  If POS is
@@ -137,7 +141,10 @@ static MCharTable *lbc_table;
     else								\
       {									\
 	int c = mtext_ref_char ((MT), (POS));				\
-	(LBC) = (enum LineBreakClass) mchartable_lookup (lbc_table, c);	\
+	(LBC) = (enum LineBreakClass) (lbc_frozen			\
+				       ? MFROZEN_CHARTABLE_LOOKUP	\
+				       (lbc_frozen, c)			\
+				       : mchartable_lookup (lbc_table, c)); \
 	if ((LBC) == LBC_NL)						\
 	  (LBC) = LBC_BK;						\
 	else if ((LBC) == LBC_AI)					\
@@ -153,6 +160,19 @@ static MCharTable *lbc_table;
   } while (0)
 
 
+/* Internal API */
+
+void
+mtext__lbrk_fini ()
+{
+  if (lbc_frozen)
+    {
+      M17N_OBJECT_UNREF (lbc_frozen);
+      lbc_frozen = NULL;
+    }
+  lbc_table = NULL;
+}
+
 /*** @} */
 #endif /* !FOR_DOXYGEN || DOXYGEN_INTERNAL_MODULE */
 
@@ -196,11 +216,19 @@ mtext_line_break (MText *mt, int pos, int option, int *after)
       return pos;
     }
 
-  if (! lbc_table)
+  if (! M17N_LOAD_ACQUIRE (lbc_table))
     {
-      MSymbol key = mchar_define_property ("linebreak", Minteger);
+      M17N_LOCK_REGISTRY ();
+      if (! lbc_table)
+	{
+	  MSymbol key = mchar_define_property ("linebreak", Minteger);
+	  MCharTable *table = mchar_get_prop_table (key, NULL);
 
-      lbc_table = mchar_get_prop_table (key, NULL);
+	  if (table)
+	    lbc_frozen = mchartable__freeze (table);
+	  M17N_STORE_RELEASE (lbc_table, table);
+	}
+      M17N_UNLOCK_REGISTRY ();
     }
 
   GET_LBC (lbc, mt, len, pos, option);
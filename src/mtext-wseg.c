@@ -359,18 +359,12 @@ mtext__wseg_fini ()
     }
 }
 
-/* Find word boundaries around POS of MT.  Set *FROM to the word
-   boundary position at or previous to POS, and update *TO to the word
-   boundary position after POS.
-
-   @return 
-   If word boundaries were found successfully, return 1 (if
-   the character at POS is a part of a word) or 0 (otherwise).  If the
-   operation was not successful, return -1 without setting *FROM and
-   *TO.  */
+/* Subroutine of mtext__word_segment.  The word segmenters may keep
+   state in static variables, so this is called with the registry
+   lock held.  */
 
-int
-mtext__word_segment (MText *mt, int pos, int *from, int *to)
+static int
+word_segment (MText *mt, int pos, int *from, int *to)
 {
   int c = mtext_ref_char (mt, pos);
   MWordseg_Function *wordseg;
@@ -416,5 +410,26 @@ mtext__word_segment (MText *mt, int pos, int *from, int *to)
   return -1;
 }
 
+/* Find word boundaries around POS of MT.  Set *FROM to the word
+   boundary position at or previous to POS, and update *TO to the word
+   boundary position after POS.
+
+   @return 
+   If word boundaries were found successfully, return 1 (if
+   the character at POS is a part of a word) or 0 (otherwise).  If the
+   operation was not successful, return -1 without setting *FROM and
+   *TO.  */
+
+int
+mtext__word_segment (MText *mt, int pos, int *from, int *to)
+{
+  int ret;
+
+  M17N_LOCK_REGISTRY ();
+  ret = word_segment (mt, pos, from, to);
+  M17N_UNLOCK_REGISTRY ();
+  return ret;
+}
+
 /*** @} */
 #endif /* !FOR_DOXYGEN || DOXYGEN_INTERNAL_MODULE */
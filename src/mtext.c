@@ -85,6 +85,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <locale.h>
+#if defined (__SSE2__) && defined (__GNUC__)
+#include <immintrin.h>
+#endif
 
 #include "m17n.h"
 #include "m17n-misc.h"
@@ -93,11 +96,72 @@
 #include "character.h"
 #include "mtext.h"
 #include "plist.h"
+#include "chartab.h"
 
 static M17NObjectArray mtext_table;
 
 static MSymbol M_charbag;
 
+/* Gap.
+
+   Inserting or deleting characters in the middle of a long M-text
+   requires moving all the following characters.  To avoid that, an
+   M-text in UTF-8 or US-ASCII whose size reaches MTEXT_GAP_THRESHOLD
+   bytes gets a gap at the place of the last insertion or deletion.
+   The MT->gap_size bytes from MT->gap of MT->data are not used, and
+   the bytes at and after the unit position MT->gap are stored after
+   them.  Thus, successive edits near the same place move only a few
+   bytes.  An edit far from the previous one still moves all the bytes
+   between them, i.e. up to the whole text.
+
+   insert (), mtext_del () and mtext_ins_char () move the gap.
+   mtext_ref_char (), mtext__bol (), mtext__eol (), the conversion
+   between character and unit positions, and copying text from an
+   M-text by copy_units () see through the gap.  All the other code
+   expects contiguous data, and closes the gap by MTEXT_FLATTEN () or
+   MTEXT_DATA () before accessing MT->data.
+
+   As the gap may be closed while MT is read, threads reading MT at
+   the same time must not see through the gap while another thread
+   closes it.  So, mtext__flatten () closes the gap under mtext_lock
+   and clears MT->gap_size with release semantics, and the code seeing
+   through the gap holds mtext_lock by GAP_LOCK () if MT has a gap.
+   The gap is never reopened until MT is modified.  */
+
+/** Minimum number of bytes of an M-text to have a gap.  */
+#define MTEXT_GAP_THRESHOLD 0x10000
+
+/** Minimum number of bytes of a gap newly made.  */
+#define MTEXT_GAP_MIN 0x1000
+
+/** Nonzero if M-text MT can have a gap.  */
+#define GAP_ALLOWED_P(mt)					\
+  ((mt)->format <= MTEXT_FORMAT_UTF_8				\
+   && ((mt)->gap_size > 0 || (mt)->nbytes >= MTEXT_GAP_THRESHOLD))
+
+/** Return the offset in MT->data of the unit at UNIT_POS.  */
+#define GAP_AFTER(mt, unit_pos)					\
+  ((unit_pos) < (mt)->gap ? (unit_pos) : (unit_pos) + (mt)->gap_size)
+
+/** Return the offset in MT->data next to the unit at UNIT_POS - 1.  */
+#define GAP_BEFORE(mt, unit_pos)				\
+  ((unit_pos) <= (mt)->gap ? (unit_pos) : (unit_pos) + (mt)->gap_size)
+
+/** Lock mtext_lock if M-text MT has a gap, and set LOCKED to nonzero
+    if locked.  */
+#define GAP_LOCK(mt, locked)					\
+  do {								\
+    if (((locked) = M17N_LOAD_ACQUIRE ((mt)->gap_size) > 0))	\
+      M17N_LOCK (mtext_lock);					\
+  } while (0)
+
+/** Unlock mtext_lock if LOCKED is nonzero.  */
+#define GAP_UNLOCK(locked)			\
+  do {						\
+    if (locked)					\
+      M17N_UNLOCK (mtext_lock);			\
+  } while (0)
+
 /** Increment character position CHAR_POS and unit position UNIT_POS
     so that they point to the next character in M-text MT.  No range
     check for CHAR_POS and UNIT_POS.  */
@@ -108,7 +172,7 @@ static MSymbol M_charbag;
 								\
     if ((mt)->format <= MTEXT_FORMAT_UTF_8)			\
       {								\
-	c = (mt)->data[(unit_pos)];				\
+	c = (mt)->data[GAP_AFTER ((mt), (unit_pos))];		\
 	(unit_pos) += CHAR_UNITS_BY_HEAD_UTF8 (c);		\
       }								\
     else if ((mt)->format <= MTEXT_FORMAT_UTF_16BE)		\
@@ -133,7 +197,7 @@ static MSymbol M_charbag;
   do {									\
     if ((mt)->format <= MTEXT_FORMAT_UTF_8)				\
       {									\
-	unsigned char *p1 = (mt)->data + (unit_pos);			\
+	unsigned char *p1 = (mt)->data + GAP_BEFORE ((mt), (unit_pos));	\
 	unsigned char *p0 = p1 - 1;					\
 									\
 	while (! CHAR_HEAD_P (p0)) p0--;				\
@@ -158,12 +222,386 @@ static MSymbol M_charbag;
    : fmt >= MTEXT_FORMAT_UTF_32LE ? MTEXT_COVERAGE_FULL		\
    : MTEXT_COVERAGE_UNICODE)
 
+/* Index of character and byte positions.
+
+   For a long M-text in a variable length format (UTF-8 or UTF-16),
+   converting a character position to a unit position (and vice
+   versa) requires walking the text from the cached position.  To
+   avoid that, such an M-text gets an index of checkpoints, i.e. pairs
+   of character position and unit position, sorted in ascending order.
+   The first checkpoint is always (0, 0), and the distance between two
+   adjacent checkpoints is kept at most MTEXT_INDEX_MAX_GAP
+   characters.
+
+   The index is created lazily by get_index () and is updated by
+   insert (), mtext_del (), mtext_ins_char (), mtext_set_char () and
+   mtext_replace ().  Characters appended at the tail of an M-text are
+   indexed on demand.
+
+   As get_index () is called while reading MT, threads reading MT at
+   the same time share the index.  They use a valid index without a
+   lock.  An index is made or extended under mtext_lock, and published
+   by storing MT->index or INDEX->used with release semantics.  The
+   checkpoints already published are never changed nor freed while
+   reading MT.  An index that is replaced because it has no more room
+   is kept in the retired list of the new one until MT is freed.  */
+
+/** Distance (in characters) between two checkpoints recorded while
+    scanning a text.  */
+#define MTEXT_INDEX_INTERVAL 256
+
+/** Maximum distance (in characters) between two adjacent
+    checkpoints.  */
+#define MTEXT_INDEX_MAX_GAP (MTEXT_INDEX_INTERVAL * 2)
+
+/** Minimum number of characters of an M-text to be indexed.  */
+#define MTEXT_INDEX_THRESHOLD (MTEXT_INDEX_INTERVAL * 16)
+
+typedef struct
+{
+  int char_pos, unit_pos;
+} MTextPosCheckpoint;
+
+struct MTextPosIndex
+{
+  int size, inc, used;
+  MTextPosCheckpoint *points;
+  struct MTextPosIndex *retired;
+};
+
+/** Lock for updating the parts of M-texts that are changed while
+    they are read.  */
+static M17NLock mtext_lock = M17N_LOCK_INITIALIZER;
+
+static void
+free_index (MText *mt)
+{
+  struct MTextPosIndex *index = mt->index;
+
+  while (index)
+    {
+      struct MTextPosIndex *next = index->retired;
+
+      MLIST_FREE1 (index, points);
+      free (index);
+      index = next;
+    }
+  mt->index = NULL;
+}
+
+/* Make or extend the index of MT so that it covers the whole text of
+   MT, and return it.  The caller must hold mtext_lock.  See
+   get_index () for USED.  */
+
+static struct MTextPosIndex *
+update_index (MText *mt, int *used)
+{
+  struct MTextPosIndex *index = mt->index;
+  MTextPosCheckpoint point;
+  int limit = mt->nchars - MTEXT_INDEX_INTERVAL;
+  int n = index ? index->used : 0;
+
+  if (n > 0)
+    {
+      point = index->points[n - 1];
+      if (point.char_pos > mt->nchars || point.unit_pos > mt->nbytes)
+	/* The text was shrunk behind our back.  Start over.  */
+	n = 0;
+      else if (mt->nchars - point.char_pos <= MTEXT_INDEX_MAX_GAP)
+	{
+	  /* Another thread has just updated the index.  */
+	  *used = n;
+	  return index;
+	}
+    }
+  if (n == 0)
+    point.char_pos = point.unit_pos = 0;
+  if (n == 0
+      || index->size < n + (limit - point.char_pos) / MTEXT_INDEX_INTERVAL + 1)
+    {
+      struct MTextPosIndex *new;
+
+      MSTRUCT_CALLOC (new, MERROR_MTEXT);
+      new->inc = mt->nchars / MTEXT_INDEX_INTERVAL + 16;
+      new->size = (n + (limit - point.char_pos) / MTEXT_INDEX_INTERVAL
+		   + new->inc);
+      MTABLE_MALLOC (new->points, new->size, MERROR_MTEXT);
+      if (n > 0)
+	memcpy (new->points, index->points, sizeof (MTextPosCheckpoint) * n);
+      else
+	new->points[n++] = point;
+      new->used = n;
+      new->retired = index;
+      index = new;
+    }
+  while (point.char_pos < limit)
+    {
+      int next = point.char_pos + MTEXT_INDEX_INTERVAL;
+
+      while (point.char_pos < next)
+	INC_POSITION (mt, point.char_pos, point.unit_pos);
+      index->points[n++] = point;
+    }
+  M17N_STORE_RELEASE (index->used, n);
+  if (index != mt->index)
+    M17N_STORE_RELEASE (mt->index, index);
+  *used = n;
+  return index;
+}
+
+/* Return the index of MT, and set *USED to the number of checkpoints
+   in it.  The caller must use only that many checkpoints, because
+   another thread may append more.  If MT is not worth being indexed,
+   return NULL.  LOCKED is nonzero if the caller holds mtext_lock.  */
+
+static struct MTextPosIndex *
+get_index (MText *mt, int *used, int locked)
+{
+  struct MTextPosIndex *index;
+
+  if (mt->nchars < MTEXT_INDEX_THRESHOLD
+      || mt->nchars == mt->nbytes
+      || mt->format > MTEXT_FORMAT_UTF_16BE)
+    return NULL;
+  index = M17N_LOAD_ACQUIRE (mt->index);
+  if (index)
+    {
+      MTextPosCheckpoint *last;
+
+      *used = M17N_LOAD_ACQUIRE (index->used);
+      last = index->points + *used - 1;
+      if (last->char_pos <= mt->nchars && last->unit_pos <= mt->nbytes
+	  && mt->nchars - last->char_pos <= MTEXT_INDEX_MAX_GAP)
+	return index;
+    }
+  if (locked)
+    return update_index (mt, used);
+  M17N_LOCK (mtext_lock);
+  index = update_index (mt, used);
+  M17N_UNLOCK (mtext_lock);
+  return index;
+}
+
+/* Return the index of the last checkpoint among the first USED ones
+   in INDEX whose character position (if BYTEP is zero) or unit
+   position (if BYTEP is nonzero) is equal to or less than POS.  */
+
+static int
+search_index (struct MTextPosIndex *index, int used, int pos, int bytep)
+{
+  int low = 0, high = used;
+
+  while (high - low > 1)
+    {
+      int mid = (low + high) / 2;
+      int mid_pos = (bytep ? index->points[mid].unit_pos
+		     : index->points[mid].char_pos);
+
+      if (mid_pos <= pos)
+	low = mid;
+      else
+	high = mid;
+    }
+  return low;
+}
+
+/* Insert checkpoints at FROM, FROM + MTEXT_INDEX_INTERVAL, ..., and
+   TO into the index of MT at IDX.  FROM_UNIT is the unit position of
+   FROM.  */
+
+static void
+fill_index (MText *mt, int idx, int from, int from_unit, int to)
+{
+  struct MTextPosIndex *index = mt->index;
+  MTextPosCheckpoint point;
+  int skip = index->points[idx - 1].char_pos == from;
+  int n = (to - from + MTEXT_INDEX_INTERVAL - 1) / MTEXT_INDEX_INTERVAL + 1;
+
+  MLIST_INSERT1 (index, points, idx, n - skip, MERROR_MTEXT);
+  point.char_pos = from, point.unit_pos = from_unit;
+  while (1)
+    {
+      int next = point.char_pos + MTEXT_INDEX_INTERVAL;
+
+      if (skip)
+	skip = 0;
+      else
+	index->points[idx++] = point;
+      if (point.char_pos == to)
+	break;
+      if (next > to)
+	next = to;
+      while (point.char_pos < next)
+	INC_POSITION (mt, point.char_pos, point.unit_pos);
+    }
+}
+
+/* Update the index of MT for NCHARS characters (NUNITS units)
+   inserted at POS.  POS_UNIT is the unit position of POS.  If NCHARS
+   is zero, just shift the unit positions of the checkpoints after POS
+   by NUNITS.  This must be called after MT->data, MT->nchars and
+   MT->nbytes are updated.  */
+
+static void
+index_adjust_for_insert (MText *mt, int pos, int pos_unit,
+			 int nchars, int nunits)
+{
+  struct MTextPosIndex *index = mt->index;
+  int i, j;
+
+  if (! index)
+    return;
+  i = search_index (index, index->used, pos, 0) + 1;
+  for (j = i; j < index->used; j++)
+    {
+      index->points[j].char_pos += nchars;
+      index->points[j].unit_pos += nunits;
+    }
+  /* A gap at the tail is filled lazily by extend_index ().  */
+  if (i < index->used
+      && (index->points[i].char_pos - index->points[i - 1].char_pos
+	  > MTEXT_INDEX_MAX_GAP))
+    fill_index (mt, i, pos, pos_unit, pos + nchars);
+}
+
+/* Update the index of MT for NCHARS characters (NUNITS units)
+   deleted at FROM.  FROM_UNIT is the unit position of FROM.  This
+   must be called after MT->data, MT->nchars and MT->nbytes are
+   updated.  */
+
+static void
+index_adjust_for_delete (MText *mt, int from, int from_unit,
+			 int nchars, int nunits)
+{
+  struct MTextPosIndex *index = mt->index;
+  int to = from + nchars;
+  int i, j;
+
+  if (! index)
+    return;
+  i = search_index (index, index->used, from, 0) + 1;
+  for (j = i; j < index->used && index->points[j].char_pos < to; j++);
+  if (j > i)
+    MLIST_DELETE1 (index, points, i, j - i);
+  for (j = i; j < index->used; j++)
+    {
+      index->points[j].char_pos -= nchars;
+      index->points[j].unit_pos -= nunits;
+    }
+  if (i < index->used
+      && index->points[i].char_pos - index->points[i - 1].char_pos
+      > MTEXT_INDEX_MAX_GAP
+      && index->points[i - 1].char_pos < from)
+    {
+      MLIST_INSERT1 (index, points, i, 1, MERROR_MTEXT);
+      index->points[i].char_pos = from;
+      index->points[i].unit_pos = from_unit;
+    }
+}
+
+/* Move the gap of MT to unit position POS_UNIT, and make it at least
+   NBYTES bytes long.  MT must be in UTF-8 or US-ASCII.  */
+
+static void
+move_gap (MText *mt, int pos_unit, int nbytes)
+{
+  if (mt->gap_size == 0)
+    mt->gap = pos_unit;
+  if (mt->gap_size < nbytes)
+    {
+      int size = (mt->nbytes + nbytes + MTEXT_GAP_MIN + mt->nbytes / 16
+		  + 1);
+
+      mtext__flatten (mt);
+      if (mt->allocated < size)
+	{
+	  mt->allocated = size;
+	  MTABLE_REALLOC (mt->data, mt->allocated, MERROR_MTEXT);
+	}
+      mt->gap = pos_unit;
+      mt->gap_size = mt->allocated - mt->nbytes - 1;
+      memmove (mt->data + pos_unit + mt->gap_size, mt->data + pos_unit,
+	       mt->nbytes - pos_unit + 1);
+    }
+  else if (pos_unit < mt->gap)
+    {
+      memmove (mt->data + pos_unit + mt->gap_size, mt->data + pos_unit,
+	       mt->gap - pos_unit);
+      mt->gap = pos_unit;
+    }
+  else if (pos_unit > mt->gap)
+    {
+      memmove (mt->data + mt->gap, mt->data + mt->gap + mt->gap_size,
+	       pos_unit - mt->gap);
+      mt->gap = pos_unit;
+    }
+}
+
+/* Make room for NUNITS units at unit position POS_UNIT of MT, and
+   return the address of the room.  If USE_GAP is nonzero, the room
+   is taken from the gap if MT can have one.  The caller must update
+   MT->nbytes.  */
+
+static unsigned char *
+make_room (MText *mt, int pos_unit, int nunits, int use_gap)
+{
+  int unit_bytes = UNIT_BYTES (mt->format);
+  int total_bytes;
+
+  if (use_gap && GAP_ALLOWED_P (mt))
+    {
+      move_gap (mt, pos_unit, nunits);
+      mt->gap += nunits;
+      mt->gap_size -= nunits;
+      return mt->data + pos_unit;
+    }
+  MTEXT_FLATTEN (mt);
+  total_bytes = (mt->nbytes + nunits + 1) * unit_bytes;
+  if (total_bytes > mt->allocated)
+    {
+      mt->allocated = total_bytes;
+      if (mt->data)
+	MTABLE_REALLOC (mt->data, mt->allocated, MERROR_MTEXT);
+      else
+	MTABLE_CALLOC (mt->data, mt->allocated, MERROR_MTEXT);
+    }
+  memmove (mt->data + (pos_unit + nunits) * unit_bytes,
+	   mt->data + pos_unit * unit_bytes,
+	   (mt->nbytes - pos_unit + 1) * unit_bytes);
+  return mt->data + pos_unit * unit_bytes;
+}
+
+/* Copy NUNITS units from the unit position FROM_UNIT of MT to P.  */
+
+static void
+copy_units (MText *mt, int from_unit, int nunits, unsigned char *p)
+{
+  int unit_bytes = UNIT_BYTES (mt->format);
+  int locked;
+
+  GAP_LOCK (mt, locked);
+  if (mt->gap_size == 0 || from_unit + nunits <= mt->gap)
+    memcpy (p, mt->data + from_unit * unit_bytes, nunits * unit_bytes);
+  else if (from_unit >= mt->gap)
+    memcpy (p, mt->data + from_unit + mt->gap_size, nunits);
+  else
+    {
+      int n = mt->gap - from_unit;
+
+      memcpy (p, mt->data + from_unit, n);
+      memcpy (p + n, mt->data + mt->gap + mt->gap_size, nunits - n);
+    }
+  GAP_UNLOCK (locked);
+}
+
 /* Compoare sub-texts in MT1 (range FROM1 and TO1) and MT2 (range
    FROM2 to TO2). */
 
 static int
 compare (MText *mt1, int from1, int to1, MText *mt2, int from2, int to2)
 {
+  MTEXT_FLATTEN (mt1);
+  MTEXT_FLATTEN (mt2);
   if (mt1->format == mt2->format
       && (mt1->format <= MTEXT_FORMAT_UTF_8))
     {
@@ -241,7 +679,6 @@ insert (MText *mt1, int pos, MText *mt2, int from, int to)
   int pos_unit = POS_CHAR_TO_BYTE (mt1, pos);
   int from_unit = POS_CHAR_TO_BYTE (mt2, from);
   int new_units = POS_CHAR_TO_BYTE (mt2, to) - from_unit;
-  int unit_bytes;
 
   if (mt1->nchars == 0)
     mt1->format = mt2->format, mt1->coverage = mt2->coverage;
@@ -272,42 +709,19 @@ insert (MText *mt1, int pos, MText *mt2, int from, int to)
 	}
     }
 
-  unit_bytes = UNIT_BYTES (mt1->format);
-
   if (mt1->format == mt2->format)
     {
-      int pos_byte = pos_unit * unit_bytes;
-      int total_bytes = (mt1->nbytes + new_units) * unit_bytes;
-      int new_bytes = new_units * unit_bytes;
+      unsigned char *p = make_room (mt1, pos_unit, new_units, mt1 != mt2);
 
-      if (total_bytes + unit_bytes > mt1->allocated)
-	{
-	  mt1->allocated = total_bytes + unit_bytes;
-	  if (mt1->data)
-	    MTABLE_REALLOC (mt1->data, mt1->allocated, MERROR_MTEXT);
-	  else
-	    MTABLE_CALLOC (mt1->data, mt1->allocated, MERROR_MTEXT);
-	}
-      memmove (mt1->data + pos_byte + new_bytes, mt1->data + pos_byte,
-	       (mt1->nbytes - pos_unit + 1) * unit_bytes);
-      memcpy (mt1->data + pos_byte, mt2->data + from_unit * unit_bytes,
-	      new_bytes);
+      copy_units (mt2, from_unit, new_units, p);
     }
   else if (mt1->format == MTEXT_FORMAT_UTF_8)
     {
       unsigned char *p;
-      int total_bytes, i, c;
+      int i, c;
 
       new_units = count_by_utf_8 (mt2, from, to);
-      total_bytes = mt1->nbytes + new_units;
-
-      if (total_bytes + 1 > mt1->allocated)
-	{
-	  mt1->allocated = total_bytes + 1;
-	  MTABLE_REALLOC (mt1->data, mt1->allocated, MERROR_MTEXT);
-	}
-      p = mt1->data + pos_unit;
-      memmove (p + new_units, p, mt1->nbytes - pos_unit + 1);
+      p = make_room (mt1, pos_unit, new_units, 1);
       for (i = from; i < to; i++)
 	{
 	  c = mtext_ref_char (mt2, i);
@@ -317,19 +731,10 @@ insert (MText *mt1, int pos, MText *mt2, int from, int to)
   else if (mt1->format == MTEXT_FORMAT_UTF_16)
     {
       unsigned short *p;
-      int total_bytes, i, c;
+      int i, c;
 
       new_units = count_by_utf_16 (mt2, from, to);
-      total_bytes = (mt1->nbytes + new_units) * USHORT_SIZE;
-
-      if (total_bytes + USHORT_SIZE > mt1->allocated)
-	{
-	  mt1->allocated = total_bytes + USHORT_SIZE;
-	  MTABLE_REALLOC (mt1->data, mt1->allocated, MERROR_MTEXT);
-	}
-      p = (unsigned short *) mt1->data + pos_unit;
-      memmove (p + new_units, p,
-	       (mt1->nbytes - pos_unit + 1) * USHORT_SIZE);
+      p = (unsigned short *) make_room (mt1, pos_unit, new_units, 1);
       for (i = from; i < to; i++)
 	{
 	  c = mtext_ref_char (mt2, i);
@@ -339,26 +744,17 @@ insert (MText *mt1, int pos, MText *mt2, int from, int to)
   else				/* MTEXT_FORMAT_UTF_32 */
     {
       unsigned int *p;
-      int total_bytes, i;
+      int i;
 
       new_units = to - from;
-      total_bytes = (mt1->nbytes + new_units) * UINT_SIZE;
-
-      if (total_bytes + UINT_SIZE > mt1->allocated)
-	{
-	  mt1->allocated = total_bytes + UINT_SIZE;
-	  MTABLE_REALLOC (mt1->data, mt1->allocated, MERROR_MTEXT);
-	}
-      p = (unsigned *) mt1->data + pos_unit;
-      memmove (p + new_units, p,
-	       (mt1->nbytes - pos_unit + 1) * UINT_SIZE);
+      p = (unsigned *) make_room (mt1, pos_unit, new_units, 1);
       for (i = from; i < to; i++)
 	*p++ = mtext_ref_char (mt2, i);
     }
 
   mtext__adjust_plist_for_insert
     (mt1, pos, to - from,
-     mtext__copy_plist (mt2->plist, from, to, mt1, pos));
+     mtext__copy_plist (mt2->plist, from, to, mt1));
   mt1->nchars += to - from;
   mt1->nbytes += new_units;
   if (mt1->cache_char_pos > pos)
@@ -366,6 +762,7 @@ insert (MText *mt1, int pos, MText *mt2, int from, int to)
       mt1->cache_char_pos += to - from;
       mt1->cache_byte_pos += new_units;
     }
+  index_adjust_for_insert (mt1, pos, pos_unit, to - from, new_units);
 
   return mt1;
 }
@@ -380,7 +777,7 @@ get_charbag (MText *mt)
 
   if (prop)
     {
-      if (prop->end == mt->nchars)
+      if (MTEXTPROP_END (prop) == mt->nchars)
 	return ((MCharTable *) prop->val);
       mtext_detach_property (prop);
     }
@@ -413,6 +810,83 @@ span (MText *mt1, MText *mt2, int pos, MSymbol not)
 }
 
 
+/* Scanner of ASCII runs.
+
+   ascii_span_sse2 () checks 16 bytes at a time, and ascii_span_avx2
+   () 32 bytes at a time.  The latter is used only if the running CPU
+   supports it, which mtext__init () checks.  On the other machines,
+   ascii_span_word () checks a word at a time.  */
+
+#if defined (__SSE2__) && defined (__GNUC__)
+
+static int
+ascii_span_sse2 (const unsigned char *p, const unsigned char *pend)
+{
+  const unsigned char *p0 = p;
+
+  for (; pend - p >= 16; p += 16)
+    {
+      int mask = _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *) p));
+
+      if (mask)
+	return (p - p0) + __builtin_ctz (mask);
+    }
+  while (p < pend && *p < 0x80)
+    p++;
+  return p - p0;
+}
+
+#define ascii_span_default ascii_span_sse2
+
+#if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) \
+  && ! defined (__clang__)
+#define USE_ASCII_SPAN_AVX2
+
+__attribute__ ((target ("avx2")))
+static int
+ascii_span_avx2 (const unsigned char *p, const unsigned char *pend)
+{
+  const unsigned char *p0 = p;
+
+  for (; pend - p >= 32; p += 32)
+    {
+      unsigned mask = _mm256_movemask_epi8 (_mm256_loadu_si256
+					    ((const __m256i *) p));
+
+      if (mask)
+	return (p - p0) + __builtin_ctz (mask);
+    }
+  return (p - p0) + ascii_span_sse2 (p, pend);
+}
+#endif	/* GCC 4.9 or later */
+
+#else  /* not (__SSE2__ && __GNUC__) */
+
+static int
+ascii_span_word (const unsigned char *p, const unsigned char *pend)
+{
+  const unsigned char *p0 = p;
+  unsigned long high_bits = ((unsigned long) -1 / 0xFF) * 0x80;
+  unsigned long word;
+
+  for (; pend - p >= (int) sizeof word; p += sizeof word)
+    {
+      memcpy (&word, p, sizeof word);
+      if (word & high_bits)
+	break;
+    }
+  while (p < pend && *p < 0x80)
+    p++;
+  return p - p0;
+}
+
+#define ascii_span_default ascii_span_word
+
+#endif	/* not (__SSE2__ && __GNUC__) */
+
+static int (*ascii_span) (const unsigned char *, const unsigned char *)
+     = ascii_span_default;
+
 static int
 count_utf_8_chars (const void *data, int nitems)
 {
@@ -424,7 +898,8 @@ count_utf_8_chars (const void *data, int nitems)
     {
       int i, n;
 
-      for (; p < pend && *p < 128; nchars++, p++);
+      n = ascii_span (p, pend);
+      p += n, nchars += n;
       if (p == pend)
 	return nchars;
       if (! CHAR_HEAD_P_UTF8 (p))
@@ -477,8 +952,10 @@ count_utf_16_chars (const void *data, int nitems, int swap)
 static int
 find_char_forward (MText *mt, int from, int to, int c)
 {
-  int from_byte = POS_CHAR_TO_BYTE (mt, from);
+  int from_byte;
 
+  MTEXT_FLATTEN (mt);
+  from_byte = POS_CHAR_TO_BYTE (mt, from);
   if (mt->format <= MTEXT_FORMAT_UTF_8)
     {
       unsigned char *p = mt->data + from_byte;
@@ -533,8 +1010,10 @@ find_char_forward (MText *mt, int from, int to, int c)
 static int
 find_char_backward (MText *mt, int from, int to, int c)
 {
-  int to_byte = POS_CHAR_TO_BYTE (mt, to);
+  int to_byte;
 
+  MTEXT_FLATTEN (mt);
+  to_byte = POS_CHAR_TO_BYTE (mt, to);
   if (mt->format <= MTEXT_FORMAT_UTF_8)
     {
       unsigned char *p = mt->data + to_byte;
@@ -609,8 +1088,9 @@ free_mtext (void *object)
     mtext__free_plist (mt);
   if (mt->data && mt->allocated >= 0)
     free (mt->data);
+  free_index (mt);
   M17N_OBJECT_UNREGISTER (mtext_table, mt);
-  free (object);
+  M17N_POOLED_FREE (mt);
 }
 
 /** Case handler (case-folding comparison and case conversion) */
@@ -691,6 +1171,10 @@ case_compare (MText *mt1, int from1, int to1, MText *mt2, int from2, int to2)
 static MCharTable *tricky_chars, *cased, *soft_dotted, *case_mapping;
 static MCharTable *combining_class;
 
+/* Frozen copies of the above tables for fast lookup.  */
+static MFrozenCharTable *cased_frozen, *case_mapping_frozen;
+static MFrozenCharTable *combining_class_frozen;
+
 /* Languages that require special handling in case-conversion.  */
 static MSymbol Mlt, Mtr, Maz;
 
@@ -701,6 +1185,8 @@ static MText *tr0130, *tr0049, *tr0069;
 static int
 init_case_conversion ()
 {
+  MCharTable *table;
+
   Mlt = msymbol ("lt");
   Mtr = msymbol ("tr");
   Maz = msymbol ("az");
@@ -752,25 +1238,43 @@ init_case_conversion ()
     return -1;
   if (! (combining_class = mchar_get_prop_table (Mcombining_class, NULL)))
     return -1;
-
-  tricky_chars = mchartable (Mnil, 0);
-  mchartable_set (tricky_chars, 0x0049, (void *) 1);
-  mchartable_set (tricky_chars, 0x004A, (void *) 1);
-  mchartable_set (tricky_chars, 0x00CC, (void *) 1);
-  mchartable_set (tricky_chars, 0x00CD, (void *) 1);
-  mchartable_set (tricky_chars, 0x0128, (void *) 1);
-  mchartable_set (tricky_chars, 0x012E, (void *) 1);
-  mchartable_set (tricky_chars, 0x0130, (void *) 1);
-  mchartable_set (tricky_chars, 0x0307, (void *) 1);
-  mchartable_set (tricky_chars, 0x03A3, (void *) 1);
+  cased_frozen = mchartable__freeze (cased);
+  case_mapping_frozen = mchartable__freeze (case_mapping);
+  combining_class_frozen = mchartable__freeze (combining_class);
+
+  /* Setting tricky_chars tells the other threads that the above
+     are ready.  */
+  table = mchartable (Mnil, 0);
+  mchartable_set (table, 0x0049, (void *) 1);
+  mchartable_set (table, 0x004A, (void *) 1);
+  mchartable_set (table, 0x00CC, (void *) 1);
+  mchartable_set (table, 0x00CD, (void *) 1);
+  mchartable_set (table, 0x0128, (void *) 1);
+  mchartable_set (table, 0x012E, (void *) 1);
+  mchartable_set (table, 0x0130, (void *) 1);
+  mchartable_set (table, 0x0307, (void *) 1);
+  mchartable_set (table, 0x03A3, (void *) 1);
+  M17N_STORE_RELEASE (tricky_chars, table);
   return 0;
 }
 
-#define CASE_CONV_INIT(ret)		\
-  do {					\
-    if (! tricky_chars			\
-	&& init_case_conversion () < 0)	\
-      MERROR (MERROR_MTEXT, ret);	\
+static int
+prepare_case_conversion ()
+{
+  int ret = 0;
+
+  M17N_LOCK_REGISTRY ();
+  if (! tricky_chars)
+    ret = init_case_conversion ();
+  M17N_UNLOCK_REGISTRY ();
+  return ret;
+}
+
+#define CASE_CONV_INIT(ret)				\
+  do {							\
+    if (! M17N_LOAD_ACQUIRE (tricky_chars)		\
+	&& prepare_case_conversion () < 0)		\
+      MERROR (MERROR_MTEXT, ret);			\
   } while (0)
 
 /* Replace the character at POS of MT with VAR and increment I and LEN.  */
@@ -794,7 +1298,8 @@ init_case_conversion ()
 
 #define LOOKUP								\
   do {									\
-    MPlist *pl = (MPlist *) mchartable_lookup (case_mapping, c);	\
+    MPlist *pl							\
+      = (MPlist *) MFROZEN_CHARTABLE_LOOKUP (case_mapping_frozen, c);	\
 									\
     if (pl)								\
       {									\
@@ -866,7 +1371,8 @@ final_sigma (MText *mt, int pos)
 
   for (i = pos - 1; i >= 0; i--)
     {
-      c = (int) mchartable_lookup (cased, mtext_ref_char (mt, i));
+      c = mtext_ref_char (mt, i);
+      c = (int) MFROZEN_CHARTABLE_LOOKUP (cased_frozen, c);
       if (c == -1)
 	c = 0;
       if (c & CASED)
@@ -880,7 +1386,8 @@ final_sigma (MText *mt, int pos)
 
   for (i = pos + 1; i < len; i++)
     {
-      c = (int) mchartable_lookup (cased, mtext_ref_char (mt, i));
+      c = mtext_ref_char (mt, i);
+      c = (int) MFROZEN_CHARTABLE_LOOKUP (cased_frozen, c);
       if (c == -1)
 	c = 0;
       if (c & CASED)
@@ -902,7 +1409,7 @@ after_soft_dotted (MText *mt, int i)
       c = mtext_ref_char (mt, i);
       if ((MSymbol) mchartable_lookup (soft_dotted, c) == Mt)
 	return 1;
-      class = (int) mchartable_lookup (combining_class, c);
+      class = (int) MFROZEN_CHARTABLE_LOOKUP (combining_class_frozen, c);
       if (class == 0 || class == 230)
 	return 0;
     }
@@ -913,12 +1420,12 @@ after_soft_dotted (MText *mt, int i)
 int
 more_above (MText *mt, int i)
 {
-  int class, len = mtext_len (mt);
+  int c, class, len = mtext_len (mt);
 
   for (i++; i < len; i++)
     {
-      class = (int) mchartable_lookup (combining_class,
-				       mtext_ref_char (mt, i));
+      c = mtext_ref_char (mt, i);
+      class = (int) MFROZEN_CHARTABLE_LOOKUP (combining_class_frozen, c);
       if (class == 230)
 	return 1;
       if (class == 0)
@@ -938,7 +1445,7 @@ before_dot (MText *mt, int i)
       c = mtext_ref_char (mt, i);
       if (c == 0x0307)
 	return 1;
-      class = (int) mchartable_lookup (combining_class, c);
+      class = (int) MFROZEN_CHARTABLE_LOOKUP (combining_class_frozen, c);
       if (class == 230 || class == 0)
 	return 0;
     }
@@ -956,7 +1463,7 @@ after_i (MText *mt, int i)
       c = mtext_ref_char (mt, i);
       if (c == (int) 'I')
 	return 1;
-      class = (int) mchartable_lookup (combining_class, c);
+      class = (int) MFROZEN_CHARTABLE_LOOKUP (combining_class_frozen, c);
       if (class == 230 || class == 0)
 	return 0;
     }
@@ -971,6 +1478,11 @@ int
 mtext__init ()
 {
   M17N_OBJECT_ADD_ARRAY (mtext_table, "M-text");
+#ifdef USE_ASCII_SPAN_AVX2
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    ascii_span = ascii_span_avx2;
+#endif
   M_charbag = msymbol_as_managing_key ("  charbag");
   mtext_table.count = 0;
   Mlanguage = msymbol ("language");
@@ -981,40 +1493,74 @@ mtext__init ()
 void
 mtext__fini (void)
 {
+  if (tricky_chars)
+    {
+      M17N_OBJECT_UNREF (cased_frozen);
+      M17N_OBJECT_UNREF (case_mapping_frozen);
+      M17N_OBJECT_UNREF (combining_class_frozen);
+      M17N_OBJECT_UNREF (tricky_chars);
+    }
+  mtext__lbrk_fini ();
   mtext__wseg_fini ();
 }
 
 
-int
-mtext__char_to_byte (MText *mt, int pos)
+/* Return the unit position of POS in MT.  LOCKED is nonzero if the
+   caller holds mtext_lock.  */
+
+static int
+char_to_byte (MText *mt, int pos, int locked)
 {
-  int char_pos, byte_pos;
-  int forward;
+  int char_pos, byte_pos, cache_char, cache_byte;
+  int forward, used;
+  struct MTextPosIndex *index;
+
+  if (pos == mt->nchars)
+    return mt->nbytes;
+  MTEXT_CACHE_LOAD (mt, cache_char, cache_byte);
+  if (pos == cache_char)
+    return cache_byte;
+  if ((pos < cache_char - MTEXT_INDEX_INTERVAL
+       || pos > cache_char + MTEXT_INDEX_INTERVAL)
+      && (index = get_index (mt, &used, locked)))
+    {
+      int i = search_index (index, used, pos, 0);
 
-  if (pos < mt->cache_char_pos)
+      char_pos = index->points[i].char_pos;
+      byte_pos = index->points[i].unit_pos;
+      forward = 1;
+      if (i + 1 < used
+	  && index->points[i + 1].char_pos - pos < pos - char_pos)
+	{
+	  char_pos = index->points[i + 1].char_pos;
+	  byte_pos = index->points[i + 1].unit_pos;
+	  forward = 0;
+	}
+    }
+  else if (pos < cache_char)
     {
-      if (mt->cache_char_pos == mt->cache_byte_pos)
+      if (cache_char == cache_byte)
 	return pos;
-      if (pos < mt->cache_char_pos - pos)
+      if (pos < cache_char - pos)
 	{
 	  char_pos = byte_pos = 0;
 	  forward = 1;
 	}
       else
 	{
-	  char_pos = mt->cache_char_pos;
-	  byte_pos = mt->cache_byte_pos;
+	  char_pos = cache_char;
+	  byte_pos = cache_byte;
 	  forward = 0;
 	}
     }
   else
     {
-      if (mt->nchars - mt->cache_char_pos == mt->nbytes - mt->cache_byte_pos)
-	return (mt->cache_byte_pos + (pos - mt->cache_char_pos));
-      if (pos - mt->cache_char_pos < mt->nchars - pos)
+      if (mt->nchars - cache_char == mt->nbytes - cache_byte)
+	return (cache_byte + (pos - cache_char));
+      if (pos - cache_char < mt->nchars - pos)
 	{
-	  char_pos = mt->cache_char_pos;
-	  byte_pos = mt->cache_byte_pos;
+	  char_pos = cache_char;
+	  byte_pos = cache_byte;
 	  forward = 1;
 	}
       else
@@ -1030,43 +1576,66 @@ mtext__char_to_byte (MText *mt, int pos)
   else
     while (char_pos > pos)
       DEC_POSITION (mt, char_pos, byte_pos);
-  mt->cache_char_pos = char_pos;
-  mt->cache_byte_pos = byte_pos;
+  MTEXT_CACHE_STORE (mt, char_pos, byte_pos);
   return byte_pos;
 }
 
-/* mtext__byte_to_char () */
+/* Return the character position of the unit position POS_BYTE in
+   MT.  LOCKED is nonzero if the caller holds mtext_lock.  */
 
-int
-mtext__byte_to_char (MText *mt, int pos_byte)
+static int
+byte_to_char (MText *mt, int pos_byte, int locked)
 {
-  int char_pos, byte_pos;
-  int forward;
+  int char_pos, byte_pos, cache_char, cache_byte;
+  int forward, used;
+  struct MTextPosIndex *index;
+
+  if (pos_byte == mt->nbytes)
+    return mt->nchars;
+  MTEXT_CACHE_LOAD (mt, cache_char, cache_byte);
+  if (pos_byte == cache_byte)
+    return cache_char;
+  if ((pos_byte < cache_byte - MTEXT_INDEX_INTERVAL
+       || pos_byte > cache_byte + MTEXT_INDEX_INTERVAL)
+      && (index = get_index (mt, &used, locked)))
+    {
+      int i = search_index (index, used, pos_byte, 1);
 
-  if (pos_byte < mt->cache_byte_pos)
+      char_pos = index->points[i].char_pos;
+      byte_pos = index->points[i].unit_pos;
+      forward = 1;
+      if (i + 1 < used
+	  && index->points[i + 1].unit_pos - pos_byte < pos_byte - byte_pos)
+	{
+	  char_pos = index->points[i + 1].char_pos;
+	  byte_pos = index->points[i + 1].unit_pos;
+	  forward = 0;
+	}
+    }
+  else if (pos_byte < cache_byte)
     {
-      if (mt->cache_char_pos == mt->cache_byte_pos)
+      if (cache_char == cache_byte)
 	return pos_byte;
-      if (pos_byte < mt->cache_byte_pos - pos_byte)
+      if (pos_byte < cache_byte - pos_byte)
 	{
 	  char_pos = byte_pos = 0;
 	  forward = 1;
 	}
       else
 	{
-	  char_pos = mt->cache_char_pos;
-	  byte_pos = mt->cache_byte_pos;
+	  char_pos = cache_char;
+	  byte_pos = cache_byte;
 	  forward = 0;
 	}
     }
   else
     {
-      if (mt->nchars - mt->cache_char_pos == mt->nbytes - mt->cache_byte_pos)
-	return (mt->cache_char_pos + (pos_byte - mt->cache_byte_pos));
-      if (pos_byte - mt->cache_byte_pos < mt->nbytes - pos_byte)
+      if (mt->nchars - cache_char == mt->nbytes - cache_byte)
+	return (cache_char + (pos_byte - cache_byte));
+      if (pos_byte - cache_byte < mt->nbytes - pos_byte)
 	{
-	  char_pos = mt->cache_char_pos;
-	  byte_pos = mt->cache_byte_pos;
+	  char_pos = cache_char;
+	  byte_pos = cache_byte;
 	  forward = 1;
 	}
       else
@@ -1082,19 +1651,69 @@ mtext__byte_to_char (MText *mt, int pos_byte)
   else
     while (byte_pos > pos_byte)
       DEC_POSITION (mt, char_pos, byte_pos);
-  mt->cache_char_pos = char_pos;
-  mt->cache_byte_pos = byte_pos;
+  MTEXT_CACHE_STORE (mt, char_pos, byte_pos);
   return char_pos;
 }
 
+int
+mtext__char_to_byte (MText *mt, int pos)
+{
+  int pos_byte, locked;
+
+  GAP_LOCK (mt, locked);
+  pos_byte = char_to_byte (mt, pos, locked);
+  GAP_UNLOCK (locked);
+  return pos_byte;
+}
+
+/* mtext__byte_to_char () */
+
+int
+mtext__byte_to_char (MText *mt, int pos_byte)
+{
+  int pos, locked;
+
+  GAP_LOCK (mt, locked);
+  pos = byte_to_char (mt, pos_byte, locked);
+  GAP_UNLOCK (locked);
+  return pos;
+}
+
+/* Close the gap of MT, and return MT->data.  See the comment at
+   "Gap" for the lock.  */
+
+unsigned char *
+mtext__flatten (MText *mt)
+{
+  M17N_LOCK (mtext_lock);
+  if (mt->gap_size > 0)
+    {
+      memmove (mt->data + mt->gap, mt->data + mt->gap + mt->gap_size,
+	       mt->nbytes - mt->gap + 1);
+      M17N_STORE_RELEASE (mt->gap_size, 0);
+    }
+  M17N_UNLOCK (mtext_lock);
+  return mt->data;
+}
+
 /* Estimated extra bytes that malloc will use for its own purpose on
    each memory allocation.  */
 #define MALLOC_OVERHEAD 4
 #define MALLOC_MININUM_BYTES 12
 
+/* Return the number of bytes of the run of ASCII characters at the
+   head of the byte sequence between P and PEND.  */
+
+int
+mtext__ascii_span (const unsigned char *p, const unsigned char *pend)
+{
+  return ascii_span (p, pend);
+}
+
 void
 mtext__enlarge (MText *mt, int nbytes)
 {
+  MTEXT_FLATTEN (mt);
   nbytes += MAX_UTF8_CHAR_BYTES;
   if (mt->allocated >= nbytes)
     return;
@@ -1108,6 +1727,7 @@ mtext__enlarge (MText *mt, int nbytes)
 int
 mtext__takein (MText *mt, int nchars, int nbytes)
 {
+  MTEXT_FLATTEN (mt);
   if (mt->plist)
     mtext__adjust_plist_for_insert (mt, mt->nchars, nchars, NULL);
   mt->nchars += nchars;
@@ -1146,11 +1766,10 @@ mtext__from_data (const void *data, int nitems, enum MTextFormat format,
 
   if (format == MTEXT_FORMAT_US_ASCII)
     {
-      const char *p = (char *) data, *pend = p + nitems;
+      const unsigned char *p = data;
 
-      while (p < pend)
-	if (*p++ < 0)
-	  MERROR (MERROR_MTEXT, NULL);
+      if (ascii_span (p, p + nitems) < nitems)
+	MERROR (MERROR_MTEXT, NULL);
       nchars = nbytes = nitems;
       unit_bytes = 1;
     }
@@ -1199,6 +1818,8 @@ mtext__adjust_format (MText *mt, enum MTextFormat format)
 {
   int i, c;
 
+  MTEXT_FLATTEN (mt);
+  free_index (mt);
   if (mt->nchars > 0)
     switch (format)
       {
@@ -1286,17 +1907,17 @@ mtext__bol (MText *mt, int pos)
   byte_pos = POS_CHAR_TO_BYTE (mt, pos);
   if (mt->format <= MTEXT_FORMAT_UTF_8)
     {
-      unsigned char *p = mt->data + byte_pos;
+      int bol_byte = byte_pos, locked;
 
-      if (p[-1] == '\n')
+      GAP_LOCK (mt, locked);
+      while (bol_byte > 0 && mt->data[GAP_BEFORE (mt, bol_byte) - 1] != '\n')
+	bol_byte--;
+      GAP_UNLOCK (locked);
+      if (bol_byte == byte_pos)
 	return pos;
-      p--;
-      while (p > mt->data && p[-1] != '\n')
-	p--;
-      if (p == mt->data)
+      if (bol_byte == 0)
 	return 0;
-      byte_pos = p - mt->data;
-      return POS_BYTE_TO_CHAR (mt, byte_pos);
+      return POS_BYTE_TO_CHAR (mt, bol_byte);
     }
   else if (mt->format <= MTEXT_FORMAT_UTF_16BE)
     {
@@ -1343,19 +1964,18 @@ mtext__eol (MText *mt, int pos)
   byte_pos = POS_CHAR_TO_BYTE (mt, pos);
   if (mt->format <= MTEXT_FORMAT_UTF_8)
     {
-      unsigned char *p = mt->data + byte_pos;
-      unsigned char *endp;
-
-      if (*p == '\n')
+      int eol_byte = byte_pos, locked;
+
+      GAP_LOCK (mt, locked);
+      while (eol_byte < mt->nbytes
+	     && mt->data[GAP_AFTER (mt, eol_byte)] != '\n')
+	eol_byte++;
+      GAP_UNLOCK (locked);
+      if (eol_byte == byte_pos)
 	return pos + 1;
-      p++;
-      endp = mt->data + mt->nbytes;
-      while (p < endp && *p != '\n')
-	p++;
-      if (p == endp)
+      if (eol_byte == mt->nbytes)
 	return mt->nchars;
-      byte_pos = p + 1 - mt->data;
-      return POS_BYTE_TO_CHAR (mt, byte_pos);
+      return POS_BYTE_TO_CHAR (mt, eol_byte + 1);
     }
   else if (mt->format <= MTEXT_FORMAT_UTF_16BE)
     {
@@ -1480,7 +2100,8 @@ mtext__titlecase (MText *mt, int pos, int end)
       else if (lang == Mlt && c == 0x0307 && after_soft_dotted (orig, opos))
 	DELETE;
 
-      else if ((pl = (MPlist *) mchartable_lookup (case_mapping, c)))
+      else if ((pl = (MPlist *) MFROZEN_CHARTABLE_LOOKUP (case_mapping_frozen,
+							    c)))
 	{
 	  /* Titlecase is the 2nd element. */
 	  MText *title
@@ -1535,7 +2156,8 @@ mtext__uppercase (MText *mt, int pos, int end)
 	       
       else
 	{
-	  if ((pl = (MPlist *) mchartable_lookup (case_mapping, c)) != NULL)
+	  if ((pl = (MPlist *) MFROZEN_CHARTABLE_LOOKUP (case_mapping_frozen,
+							 c)) != NULL)
 	    {
 	      MText *upper;
 	      int ulen;
@@ -1620,7 +2242,7 @@ mtext ()
 {
   MText *mt;
 
-  M17N_OBJECT (mt, free_mtext, MERROR_MTEXT);
+  M17N_POOLED_OBJECT (mt, free_mtext, MERROR_MTEXT);
   mt->format = MTEXT_FORMAT_US_ASCII;
   mt->coverage = MTEXT_COVERAGE_ASCII;
   M17N_OBJECT_REGISTER (mtext_table, mt);
@@ -1830,9 +2452,11 @@ mtext_ref_char (MText *mt, int pos)
   M_CHECK_POS (mt, pos, -1);
   if (mt->format <= MTEXT_FORMAT_UTF_8)
     {
-      unsigned char *p = mt->data + POS_CHAR_TO_BYTE (mt, pos);
+      int pos_unit = POS_CHAR_TO_BYTE (mt, pos), locked;
 
-      c = STRING_CHAR_UTF8 (p);
+      GAP_LOCK (mt, locked);
+      c = STRING_CHAR_UTF8 (mt->data + GAP_AFTER (mt, pos_unit));
+      GAP_UNLOCK (locked);
     }
   else if (mt->format <= MTEXT_FORMAT_UTF_16BE)
     {
@@ -1899,6 +2523,7 @@ mtext_set_char (MText *mt, int pos, int c)
   M_CHECK_POS (mt, pos, -1);
   M_CHECK_READONLY (mt, -1);
 
+  MTEXT_FLATTEN (mt);
   mtext__adjust_plist_for_change (mt, pos, 1, 1);
 
   if (mt->format <= MTEXT_FORMAT_UTF_8)
@@ -1939,6 +2564,7 @@ mtext_set_char (MText *mt, int pos, int c)
 	       (mt->nbytes - pos_unit - old_units + 1) * unit_bytes);
       mt->nbytes += delta;
       mt->data[mt->nbytes * unit_bytes] = 0;
+      index_adjust_for_insert (mt, pos, pos_unit, 0, delta);
     }
   switch (mt->format)
     {
@@ -1999,6 +2625,7 @@ mtext_cat_char (MText *mt, int c)
   M_CHECK_READONLY (mt, NULL);
   if (c < 0 || c > MCHAR_MAX)
     return NULL;
+  MTEXT_FLATTEN (mt);
   mtext__adjust_plist_for_insert (mt, mt->nchars, 1, NULL);
 
   if (c >= 0x80
@@ -2417,11 +3044,23 @@ mtext_del (MText *mt, int from, int to)
     }
 
   mtext__adjust_plist_for_delete (mt, from, to - from);
-  memmove (mt->data + from_byte * unit_bytes, 
-	   mt->data + to_byte * unit_bytes,
-	   (mt->nbytes - to_byte + 1) * unit_bytes);
+  if (GAP_ALLOWED_P (mt))
+    {
+      move_gap (mt, from_byte, 0);
+      mt->gap_size += to_byte - from_byte;
+    }
+  else
+    {
+      MTEXT_FLATTEN (mt);
+      memmove (mt->data + from_byte * unit_bytes, 
+	       mt->data + to_byte * unit_bytes,
+	       (mt->nbytes - to_byte + 1) * unit_bytes);
+    }
   mt->nchars -= (to - from);
   mt->nbytes -= (to_byte - from_byte);
+  if (mt->nchars == 0)
+    MTEXT_FLATTEN (mt);
+  index_adjust_for_delete (mt, from, from_byte, to - from, to_byte - from_byte);
   mt->cache_char_pos = from;
   mt->cache_byte_pos = from_byte;
   return 0;
@@ -2555,8 +3194,8 @@ int
 mtext_ins_char (MText *mt, int pos, int c, int n)
 {
   int nunits;
-  int unit_bytes = UNIT_BYTES (mt->format);
   int pos_unit;
+  unsigned char *p0;
   int i;
 
   M_CHECK_READONLY (mt, -1);
@@ -2571,10 +3210,7 @@ mtext_ins_char (MText *mt, int pos, int c, int n)
       && (mt->format == MTEXT_FORMAT_US_ASCII
 	  || (c >= 0x10000 && (mt->format == MTEXT_FORMAT_UTF_16LE
 			       || mt->format == MTEXT_FORMAT_UTF_16BE))))
-    {
-      mtext__adjust_format (mt, MTEXT_FORMAT_UTF_8);
-      unit_bytes = 1;
-    }
+    mtext__adjust_format (mt, MTEXT_FORMAT_UTF_8);
   else if (mt->format >= MTEXT_FORMAT_UTF_32LE)
     {
       if (mt->format != MTEXT_FORMAT_UTF_32)
@@ -2587,43 +3223,37 @@ mtext_ins_char (MText *mt, int pos, int c, int n)
     }
 
   nunits = CHAR_UNITS (c, mt->format);
-  if ((mt->nbytes + nunits * n + 1) * unit_bytes > mt->allocated)
-    {
-      mt->allocated = (mt->nbytes + nunits * n + 1) * unit_bytes;
-      MTABLE_REALLOC (mt->data, mt->allocated, MERROR_MTEXT);
-    }
   pos_unit = POS_CHAR_TO_BYTE (mt, pos);
   if (mt->cache_char_pos > pos)
     {
       mt->cache_char_pos += n;
       mt->cache_byte_pos += nunits * n;
     }
-  memmove (mt->data + (pos_unit + nunits * n) * unit_bytes,
-	   mt->data + pos_unit * unit_bytes,
-	   (mt->nbytes - pos_unit + 1) * unit_bytes);
+  p0 = make_room (mt, pos_unit, nunits * n, 1);
   if (mt->format <= MTEXT_FORMAT_UTF_8)
     {
-      unsigned char *p = mt->data + pos_unit;
+      unsigned char *p = p0;
 
       for (i = 0; i < n; i++)
 	p += CHAR_STRING_UTF8 (c, p);
     }
   else if (mt->format == MTEXT_FORMAT_UTF_16)
     {
-      unsigned short *p = (unsigned short *) mt->data + pos_unit;
+      unsigned short *p = (unsigned short *) p0;
 
       for (i = 0; i < n; i++)
 	p += CHAR_STRING_UTF16 (c, p);
     }
   else
     {
-      unsigned *p = (unsigned *) mt->data + pos_unit;
+      unsigned *p = (unsigned *) p0;
 
       for (i = 0; i < n; i++)
 	*p++ = c;
     }
   mt->nchars += n;
   mt->nbytes += nunits * n;
+  index_adjust_for_insert (mt, pos, pos_unit, n, nunits * n);
   return 0;
 }
 
@@ -2675,6 +3305,7 @@ mtext_replace (MText *mt1, int from1, int to1,
   M_CHECK_READONLY (mt1, -1);
   M_CHECK_RANGE_X (mt1, from1, to1, -1);
   M_CHECK_RANGE_X (mt2, from2, to2, -1);
+  MTEXT_FLATTEN (mt1);
 
   if (from1 == to1)
     {
@@ -2734,19 +3365,23 @@ mtext_replace (MText *mt1, int from1, int to1,
       && old_bytes != new_bytes)
     memmove (p + new_bytes, p + old_bytes,
 	     (mt1->nbytes + 1) * unit_bytes - (from1_byte + old_bytes));
-  memcpy (p, mt2->data + from2_byte, new_bytes);
+  copy_units (mt2, from2_byte / unit_bytes, new_bytes / unit_bytes, p);
   mt1->nchars += len2 - len1;
   mt1->nbytes += (new_bytes - old_bytes) / unit_bytes;
   if (mt1->cache_char_pos >= to1)
     {
       mt1->cache_char_pos += len2 - len1;
-      mt1->cache_byte_pos += new_bytes - old_bytes;
+      mt1->cache_byte_pos += (new_bytes - old_bytes) / unit_bytes;
     }
   else if (mt1->cache_char_pos > from1)
     {
       mt1->cache_char_pos = from1;
-      mt1->cache_byte_pos = from1_byte;
+      mt1->cache_byte_pos = from1_byte / unit_bytes;
     }
+  index_adjust_for_delete (mt1, from1, from1_byte / unit_bytes,
+			   len1, old_bytes / unit_bytes);
+  index_adjust_for_insert (mt1, from1, from1_byte / unit_bytes,
+			   len2, new_bytes / unit_bytes);
 
   if (free_mt2)
     M17N_OBJECT_UNREF (mt2);
@@ -3195,6 +3830,8 @@ mtext_text (MText *mt1, int pos, MText *mt2)
 			&& mt2->format == MTEXT_FORMAT_UTF_8));
   int unit_bytes = UNIT_BYTES (mt1->format);
 
+  MTEXT_FLATTEN (mt1);
+  MTEXT_FLATTEN (mt2);
   if (from + mtext_nchars (mt2) > mtext_nchars (mt1))
     return -1;
   limit = mtext_nchars (mt1) - mtext_nchars (mt2) + 1;
@@ -3254,6 +3891,8 @@ mtext_search (MText *mt1, int from, int to, MText *mt2)
   if (mt1->format > MTEXT_FORMAT_UTF_8
       || mt2->format > MTEXT_FORMAT_UTF_8)
     MERROR (MERROR_MTEXT, -1);
+  MTEXT_FLATTEN (mt1);
+  MTEXT_FLATTEN (mt2);
 
   if (from < to)
     {
@@ -3503,7 +4142,8 @@ mtext_titlecase (MText *mt)
   /* Find 1st cased character. */
   for (from = 0; from < len; from++)
     {
-      int csd = (int) mchartable_lookup (cased, mtext_ref_char (mt, from));
+      int c = mtext_ref_char (mt, from);
+      int csd = (int) MFROZEN_CHARTABLE_LOOKUP (cased_frozen, c);
 
       if (csd > 0 && csd & CASED)
 	break;
@@ -3516,11 +4156,13 @@ mtext_titlecase (MText *mt)
     return (mtext__titlecase (mt, from, len));
 
   /* Go through following combining characters. */
-  for (to = from + 1;
-       (to < len
-	&& ((int) mchartable_lookup (combining_class, mtext_ref_char (mt, to))
-	    > 0));
-       to++);
+  for (to = from + 1; to < len; to++)
+    {
+      int c = mtext_ref_char (mt, to);
+
+      if ((int) MFROZEN_CHARTABLE_LOOKUP (combining_class_frozen, c) <= 0)
+	break;
+    }
 
   /* Titlecase the region and prepare for next lowercase operation.
      MT may be shortened or lengthened. */
@@ -3609,6 +4251,7 @@ mdebug_dump_mtext (MText *mt, int indent, int fullp)
 {
   int i;
 
+  MTEXT_FLATTEN (mt);
   if (! fullp)
     {
       fprintf (mdebug__output, "\"");
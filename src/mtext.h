@@ -27,6 +27,53 @@
     @brief Header for M-text handling.
 */
 
+#ifdef M17N_THREADS
+
+/* Threads may read a shared M-text at the same time, and each of
+   them updates the position caches.  Load and store the pair of
+   caches as one word so that a thread never sees a character
+   position with the byte position of another.  */
+
+typedef union
+{
+  struct { int char_pos, byte_pos; } pos;
+  unsigned long long pair;
+} MTextPosCache;
+
+#define MTEXT_CACHE_LOAD(mt, cpos, bpos)				\
+  do {									\
+    MTextPosCache cache;						\
+									\
+    cache.pair = __atomic_load_n (&(mt)->cache_pair, __ATOMIC_RELAXED);	\
+    (cpos) = cache.pos.char_pos;					\
+    (bpos) = cache.pos.byte_pos;					\
+  } while (0)
+
+#define MTEXT_CACHE_STORE(mt, cpos, bpos)				\
+  do {									\
+    MTextPosCache cache;						\
+									\
+    cache.pos.char_pos = (cpos);					\
+    cache.pos.byte_pos = (bpos);					\
+    __atomic_store_n (&(mt)->cache_pair, cache.pair, __ATOMIC_RELAXED);	\
+  } while (0)
+
+#define POS_CHAR_TO_BYTE(mt, pos)				\
+  (mtext_nchars (mt) == mtext_nbytes (mt) ? (pos)		\
+   : mtext__char_to_byte ((mt), (pos)))
+
+#define POS_BYTE_TO_CHAR(mt, pos_byte)				\
+  (mtext_nchars (mt) == mtext_nbytes (mt) ? (pos_byte)		\
+   : mtext__byte_to_char ((mt), (pos_byte)))
+
+#else  /* not M17N_THREADS */
+
+#define MTEXT_CACHE_LOAD(mt, cpos, bpos)				\
+  ((cpos) = (mt)->cache_char_pos, (bpos) = (mt)->cache_byte_pos)
+
+#define MTEXT_CACHE_STORE(mt, cpos, bpos)				\
+  ((mt)->cache_char_pos = (cpos), (mt)->cache_byte_pos = (bpos))
+
 #define POS_CHAR_TO_BYTE(mt, pos)				\
   (mtext_nchars (mt) == mtext_nbytes (mt) ? (pos)		\
    : (pos) == (mt)->cache_char_pos ? (mt)->cache_byte_pos	\
@@ -37,13 +84,31 @@
    : (pos_byte) == (mt)->cache_byte_pos ? (mt)->cache_char_pos	\
    : mtext__byte_to_char ((mt), (pos_byte)))
 
+#endif /* not M17N_THREADS */
+
+
+/* Make the data of M-text MT contiguous by closing the gap (if any)
+   in it.  See the comment at "Gap" in mtext.c.  */
 
-#define MTEXT_DATA(mt) ((mt)->data)
+#define MTEXT_FLATTEN(mt)				\
+  do {							\
+    if (M17N_LOAD_ACQUIRE ((mt)->gap_size) > 0)		\
+      mtext__flatten (mt);				\
+  } while (0)
+
+#define MTEXT_DATA(mt)						\
+  (M17N_LOAD_ACQUIRE ((mt)->gap_size) > 0 ? mtext__flatten (mt)	\
+   : (mt)->data)
+
+extern unsigned char *mtext__flatten (MText *mt);
 
 extern int mtext__char_to_byte (MText *mt, int pos);
 
 extern int mtext__byte_to_char (MText *mt, int pos_byte);
 
+extern int mtext__ascii_span (const unsigned char *p,
+			     const unsigned char *pend);
+
 extern void mtext__enlarge (MText *mt, int nbytes);
 
 extern int mtext__takein (MText *mt, int nchars, int nbytes);
@@ -64,6 +129,8 @@ extern int mtext__bol (MText *mt, int pos);
 
 extern int mtext__eol (MText *mt, int pos);
 
+extern void mtext__lbrk_fini ();
+
 extern void mtext__wseg_fini ();
 
 extern int mtext__word_segment (MText *mt, int pos, int *from, int *to);
@@ -90,10 +90,10 @@ static M17NObjectArray plist_table;
 
 /** Set PLIST to a newly allocated plist object.  */
 
-#define MPLIST_NEW(plist)				\
-  do {							\
-    M17N_OBJECT (plist, free_plist, MERROR_PLIST);	\
-    M17N_OBJECT_REGISTER (plist_table, plist);		\
+#define MPLIST_NEW(plist)					\
+  do {								\
+    M17N_POOLED_OBJECT (plist, free_plist, MERROR_PLIST);	\
+    M17N_OBJECT_REGISTER (plist_table, plist);			\
   } while (0)
 
 
@@ -133,7 +133,7 @@ free_plist (void *object)
 	&& MPLIST_KEY (plist)->managing_key)
       M17N_OBJECT_UNREF (MPLIST_VAL (plist));
     M17N_OBJECT_UNREGISTER (plist_table, plist);
-    free (plist);
+    M17N_POOLED_FREE (plist);
     plist = next;
   } while (plist && plist->control.ref_count == 1);
   M17N_OBJECT_UNREF (plist);
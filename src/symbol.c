@@ -93,25 +93,94 @@
 
 static int num_symbols;
 
-#define SYMBOL_TABLE_SIZE 1024
+/* Symbols are stored in an open-addressing hash table with linear
+   probing.  The size of the table is a power of 2, and the table is
+   doubled when it gets half full.  As symbols are never removed
+   (except by msymbol__free_table), no deleted mark is needed.  */
 
-static MSymbol symbol_table[SYMBOL_TABLE_SIZE];
+#define SYMBOL_TABLE_INITIAL_SIZE 1024
+
+static MSymbol *symbol_table;
+
+static int symbol_table_size;
+
+static M17NLock symbol_lock = M17N_LOCK_INITIALIZER;
+
+/* Return a hash value of STR of length LEN by FNV-1a followed by the
+   finalizer of MurmurHash3 so that the lower bits are well mixed.  */
 
 static unsigned
 hash_string (const char *str, int len)
 {
-  unsigned hash = 0;
+  unsigned hash = 2166136261u;
   const char *end = str + len;
-  unsigned c;
 
   while (str < end)
-    {
-      c = *((unsigned char *) str++);
-      if (c >= 0140)
-	c -= 40;
-      hash = ((hash << 3) + (hash >> 28) + c);
-    }
-  return hash & (SYMBOL_TABLE_SIZE - 1);
+    hash = (hash ^ *((unsigned char *) str++)) * 16777619u;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+/* Return a pointer to the slot of the symbol table for the symbol
+   whose name is NAME.  LEN is the byte length of NAME including the
+   terminating '\0', and HASH is its hash value.  If there is no such
+   symbol, the slot is empty.  */
+
+static MSymbol *
+find_symbol (const char *name, int len, unsigned hash)
+{
+  unsigned mask = symbol_table_size - 1;
+  unsigned i = hash & mask;
+  MSymbol sym;
+
+  while ((sym = symbol_table[i])
+	 && (sym->hash != hash || sym->length != len
+	     || memcmp (name, sym->name, len)))
+    i = (i + 1) & mask;
+  return symbol_table + i;
+}
+
+/* Make the symbol table large enough to store one more symbol.  */
+
+static void
+grow_symbol_table ()
+{
+  MSymbol *old_table = symbol_table;
+  int old_size = symbol_table_size;
+  int i;
+
+  symbol_table_size = (old_size ? old_size * 2 : SYMBOL_TABLE_INITIAL_SIZE);
+  MTABLE_CALLOC (symbol_table, symbol_table_size, MERROR_SYMBOL);
+  for (i = 0; i < old_size; i++)
+    if (old_table[i])
+      {
+	MSymbol sym = old_table[i];
+
+	*find_symbol (sym->name, sym->length, sym->hash) = sym;
+      }
+  free (old_table);
+}
+
+/* Create a symbol whose name is NAME and store it in SLOT of the
+   symbol table.  LEN and HASH are the same as find_symbol ().  */
+
+static MSymbol
+make_symbol (MSymbol *slot, const char *name, int len, unsigned hash)
+{
+  MSymbol sym;
+
+  num_symbols++;
+  MTABLE_CALLOC (sym, 1, MERROR_SYMBOL);
+  MTABLE_MALLOC (sym->name, len, MERROR_SYMBOL);
+  memcpy (sym->name, name, len);
+  sym->length = len;
+  sym->hash = hash;
+  *slot = sym;
+  return sym;
 }
 
 
@@ -150,38 +219,36 @@ msymbol__fini ()
   int i;
   MSymbol sym;
 
-  for (i = 0; i < SYMBOL_TABLE_SIZE; i++)
-    for (sym = symbol_table[i]; sym; sym = sym->next)
-      if (! MPLIST_TAIL_P (&sym->plist))
-	{
-	  if (sym->plist.key->managing_key)
-	    M17N_OBJECT_UNREF (MPLIST_VAL (&sym->plist));
-	  M17N_OBJECT_UNREF (sym->plist.next);
-	  sym->plist.key = Mnil;
-	}
+  for (i = 0; i < symbol_table_size; i++)
+    if ((sym = symbol_table[i]) && ! MPLIST_TAIL_P (&sym->plist))
+      {
+	if (sym->plist.key->managing_key)
+	  M17N_OBJECT_UNREF (MPLIST_VAL (&sym->plist));
+	M17N_OBJECT_UNREF (sym->plist.next);
+	sym->plist.key = Mnil;
+      }
 }
 
 void
 msymbol__free_table ()
 {
   int i;
-  MSymbol sym, next;
+  MSymbol sym;
   int freed_symbols = 0;
 
-  for (i = 0; i < SYMBOL_TABLE_SIZE; i++)
-    {
-      for (sym = symbol_table[i]; sym; sym = next)
-	{
-	  next = sym->next;
-	  free (sym->name);
-	  free (sym);
-	  freed_symbols++;
-	}
-      symbol_table[i] = NULL;
-    }
+  for (i = 0; i < symbol_table_size; i++)
+    if ((sym = symbol_table[i]))
+      {
+	free (sym->name);
+	free (sym);
+	freed_symbols++;
+      }
   if (mdebug__flags[MDEBUG_FINI])
     fprintf (mdebug__output, "%16s %7d %7d %7d\n", "Symbol",
 	     num_symbols, freed_symbols, num_symbols - freed_symbols);
+  free (symbol_table);
+  symbol_table = NULL;
+  symbol_table_size = 0;
   num_symbols = 0;
 }
 
@@ -207,10 +274,12 @@ msymbol__list (MSymbol prop)
   int i;
   MSymbol sym;
 
-  for (i = 0; i < SYMBOL_TABLE_SIZE; i++)
-    for (sym = symbol_table[i]; sym; sym = sym->next)
-      if (prop == Mnil || msymbol_get (sym, prop))
-	mplist_push (plist, sym, NULL);
+  M17N_LOCK (symbol_lock);
+  for (i = 0; i < symbol_table_size; i++)
+    if ((sym = symbol_table[i])
+	&& (prop == Mnil || msymbol_get (sym, prop)))
+      mplist_push (plist, sym, NULL);
+  M17N_UNLOCK (symbol_lock);
   return plist;
 }
 
@@ -397,7 +466,7 @@ MSymbol Msymbol;
 MSymbol
 msymbol (const char *name)
 {
-  MSymbol sym;
+  MSymbol sym, *slot;
   int len;
   unsigned hash;
 
@@ -406,19 +475,12 @@ msymbol (const char *name)
     return Mnil;
   hash = hash_string (name, len);
   len++;
-  for (sym = symbol_table[hash]; sym; sym = sym->next)
-    if (len == sym->length
-	&& *name == *(sym->name)
-	&& ! memcmp (name, sym->name, len))
-      return sym;
-
-  num_symbols++;
-  MTABLE_CALLOC (sym, 1, MERROR_SYMBOL);
-  MTABLE_MALLOC (sym->name, len, MERROR_SYMBOL);
-  memcpy (sym->name, name, len);
-  sym->length = len;
-  sym->next = symbol_table[hash];
-  symbol_table[hash] = sym;
+  M17N_LOCK (symbol_lock);
+  if ((num_symbols + 1) * 2 > symbol_table_size)
+    grow_symbol_table ();
+  slot = find_symbol (name, len, hash);
+  sym = *slot ? *slot : make_symbol (slot, name, len, hash);
+  M17N_UNLOCK (symbol_lock);
   return sym;
 }
 
@@ -458,7 +520,7 @@ msymbol (const char *name)
 MSymbol
 msymbol_as_managing_key (const char *name)
 {
-  MSymbol sym;
+  MSymbol sym, *slot;
   int len;
   unsigned hash;
 
@@ -467,20 +529,20 @@ msymbol_as_managing_key (const char *name)
     MERROR (MERROR_SYMBOL, Mnil);
   hash = hash_string (name, len);
   len++;
-  for (sym = symbol_table[hash]; sym; sym = sym->next)
-    if (len == sym->length
-	&& *name == *(sym->name)
-	&& ! memcmp (name, sym->name, len))
-      MERROR (MERROR_SYMBOL, Mnil);
-
-  num_symbols++;
-  MTABLE_CALLOC (sym, 1, MERROR_SYMBOL);
-  sym->managing_key = 1;
-  MTABLE_MALLOC (sym->name, len, MERROR_SYMBOL);
-  memcpy (sym->name, name, len);
-  sym->length = len;
-  sym->next = symbol_table[hash];
-  symbol_table[hash] = sym;
+  M17N_LOCK (symbol_lock);
+  if ((num_symbols + 1) * 2 > symbol_table_size)
+    grow_symbol_table ();
+  slot = find_symbol (name, len, hash);
+  if (*slot)
+    sym = Mnil;
+  else
+    {
+      sym = make_symbol (slot, name, len, hash);
+      sym->managing_key = 1;
+    }
+  M17N_UNLOCK (symbol_lock);
+  if (! sym)
+    MERROR (MERROR_SYMBOL, Mnil);
   return sym;
 }
 
@@ -543,12 +605,10 @@ msymbol_exist (const char *name)
     return Mnil;
   hash = hash_string (name, len);
   len++;
-  for (sym = symbol_table[hash]; sym; sym = sym->next)
-    if (len == sym->length
-	&& *name == *(sym->name)
-	&& ! memcmp (name, sym->name, len))
-      return sym;
-  return Mnil;
+  M17N_LOCK (symbol_lock);
+  sym = symbol_table ? *find_symbol (name, len, hash) : Mnil;
+  M17N_UNLOCK (symbol_lock);
+  return sym;
 }
 
 /*=*/
@@ -793,6 +853,12 @@ mdebug_dump_symbol (MSymbol symbol, int indent)
     variable MDEBUG_OUTPUT_FILE.  $INDENT specifies how many columns
     to indent the lines but the first one.
 
+    Symbols stored in consecutive slots of the symbol table are
+    printed in one line headed by the index of the first slot.  The
+    statistics of the symbol table (the number of slots, the load
+    factor, and the average and maximum numbers of probes to find a
+    symbol) are printed at the end.
+
     @return
     This function returns #Mnil.
 
@@ -805,6 +871,11 @@ mdebug_dump_symbol (MSymbol symbol, int indent)
     ラー出力もしくは環境変数 MDEBUG_DUMP_FONT で指定されたファイルに印
     刷する。 $INDENT は２行目以降のインデントを指定する。
 
+    シンボル表の連続したスロットに格納されたシンボルは、先頭スロットの
+    番号に続けて１行に印刷される。最後にシンボル表の統計（スロット数、
+    負荷率、シンボルを見つけるまでの平均および最大の探索回数）を印刷す
+    る。
+
     @return
     この関数は #Mnil を返す。 
 
@@ -818,6 +889,7 @@ mdebug_dump_all_symbols (int indent)
   char *prefix;
   int i, n;
   MSymbol sym;
+  int probes, total_probes = 0, max_probes = 0;
 
   if (indent < 0)
     MERROR (MERROR_DEBUG, Mnil);
@@ -826,15 +898,30 @@ mdebug_dump_all_symbols (int indent)
   prefix[indent] = 0;
 
   fprintf (mdebug__output, "(symbol-list");
-  for (i = n = 0; i < SYMBOL_TABLE_SIZE; i++)
+  M17N_LOCK (symbol_lock);
+  for (i = n = 0; i < symbol_table_size; i++)
     if ((sym = symbol_table[i]))
       {
-	fprintf (mdebug__output, "\n%s  (%4d", prefix, i);
-	for (; sym; sym = sym->next, n++)
-	  fprintf (mdebug__output, " '%s'", sym->name);
-	fprintf (mdebug__output, ")");
+	if (i == 0 || ! symbol_table[i - 1])
+	  fprintf (mdebug__output, "\n%s  (%4d", prefix, i);
+	fprintf (mdebug__output, " '%s'", sym->name);
+	if (i + 1 == symbol_table_size || ! symbol_table[i + 1])
+	  fprintf (mdebug__output, ")");
+	n++;
+	probes = ((i - (sym->hash & (symbol_table_size - 1)))
+		  & (symbol_table_size - 1)) + 1;
+	total_probes += probes;
+	if (max_probes < probes)
+	  max_probes = probes;
       }
+  M17N_UNLOCK (symbol_lock);
   fprintf (mdebug__output, "\n%s  (total %d)", prefix, n);
+  fprintf (mdebug__output, "\n%s  (table-size %d)", prefix,
+	   symbol_table_size);
+  fprintf (mdebug__output, "\n%s  (load-factor %.3f)", prefix,
+	   symbol_table_size ? (double) n / symbol_table_size : 0.0);
+  fprintf (mdebug__output, "\n%s  (probes average %.3f max %d)", prefix,
+	   n ? (double) total_probes / n : 0.0, max_probes);
   fprintf (mdebug__output, ")");
   return Mnil;
 }
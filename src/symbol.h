@@ -40,7 +40,8 @@ struct MSymbolStruct
   /* Plist of the symbol.  */
   MPlist plist;
 
-  struct MSymbolStruct *next;
+  /* Hash value of <name>.  */
+  unsigned hash;
 };
 
 #define MSYMBOL_NAME(sym) ((sym)->name)
@@ -78,8 +78,6 @@
 #include "mtext.h"
 #include "textprop.h"
 
-#define TEXT_PROP_DEBUG
-
 #undef xassert
 #ifdef TEXT_PROP_DEBUG
 #define xassert(X)	do {if (!(X)) mdebug_hook ();} while (0)
@@ -127,7 +125,16 @@ MTextPlist b     |-intvl1-|--intvl2--|--intvl3--|-intvl4-|--intvl5--|
 
 /** MInterval is the structure for an interval that holds text
     properties of the same key in a specific range of M-text.
-    All intervals are stored in MIntervalPool.  */
+    All intervals are stored in MIntervalPool.
+
+    Intervals of a plist are chained by <prev> and <next>, and also
+    form a treap (a binary search tree balanced by random priorities)
+    ordered by position.  An interval does not record its position.
+    Instead, each node of the treap records the total length of its
+    subtree, from which the start position of an interval is
+    calculated in O(log N) time by interval_start ().  Thus, inserting
+    or deleting characters changes the lengths of only the intervals
+    at the modified place and of their ancestors in the treap.  */
 
 typedef struct MInterval MInterval;
 
@@ -144,16 +151,32 @@ struct MInterval
   /** Length of <stack>.  */
   int stack_length;
 
-  /** Start and end character positions of the interval.  If <end> is
-      negative, this interval is not in use.  */
-  int start, end;
+  /** Number of characters in the interval.  If negative, this
+      interval is not in use.  */
+  int length;
+
+  /** Sum of <length>s of the intervals in the subtree of the treap
+      rooted by this interval.  */
+  int total;
 
-  /** Pointers to the previous and next intervals.  If <start> is 0,
-      <prev> is NULL and this interval is pointed by MTextPlist->head.
-      If <end> is the size of the M-text, <next> is NULL, and this
-      interval is pointed by MTextPlist->tail.  */
+  /** Priority in the treap.  It is not less than the priorities of
+      the children.  */
+  unsigned priority;
+
+  /** The parent and the children in the treap.  */
+  MInterval *parent, *left, *right;
+
+  /** Pointers to the previous and next intervals.  If the interval
+      starts at 0, <prev> is NULL and this interval is pointed by
+      MTextPlist->head.  If the interval ends at the end of the M-text,
+      <next> is NULL, and this interval is pointed by
+      MTextPlist->tail.  If the interval is not in use, <next> points
+      the next unused interval in the same interval-pool.  */
   MInterval *prev, *next;
-};  
+
+  /** Interval-pool containing the interval.  */
+  struct MIntervalPool *pool;
+};
 
 /** MTextPlist is a structure to hold text properties of an M-text by
    chain.  Each element in the chain is for a specific key.  */
@@ -165,12 +188,12 @@ struct MTextPlist
   /** Key of the property.  */
   MSymbol key;
 
-  /** The head and tail intervals.  <head>->start is always 0.
-      <tail->end is always MText->nchars.  */
+  /** The head and tail intervals.  <head> always starts at 0.  <tail>
+      always ends at MText->nchars.  */
   MInterval *head, *tail;
 
-  /** Lastly accessed interval.  */
-  MInterval *cache;
+  /** Root of the treap of the intervals.  */
+  MInterval *root;
 
   /* Not yet implemented.  */
   int (*modification_hook) (MText *mt, MSymbol key, int from, int to);
@@ -190,29 +213,77 @@ typedef struct MIntervalPool MIntervalPool;
 
 /** MIntervalPool is the structure for an interval-pool which store
     intervals.  Each interval-pool contains INTERVAL_POOL_SIZE number
-    of intervals, and is chained from the root #interval_pool.  */
+    of intervals.  Pools that have unused intervals are chained from
+    #interval_pools.  */
 
 struct MIntervalPool
 {
   /** Array of intervals.  */
   MInterval intervals[INTERVAL_POOL_SIZE];
 
-  /** The smallest index to an unused interval.  */
-  int free_slot;
+  /** Chain of unused intervals linked by their <next>.  */
+  MInterval *free_list;
 
-  /** Pointer to the next interval-pool.  */
-  MIntervalPool *next;
+  /** Number of intervals in use.  */
+  int nused;
+
+  /** Pointers to the previous and next interval-pools in the chain
+      of #interval_pools.  */
+  MIntervalPool *prev, *next;
 };
 
 
-/** Root of interval-pools.  */
+/** Chain of interval-pools that have unused intervals.  A pool all
+    intervals of which are in use is removed from the chain until one
+    of them is freed.  */
+
+static MIntervalPool *interval_pools;
+
+/** An interval-pool none of whose intervals is in use.  Only one
+    such pool is kept so that a pool is not allocated and freed
+    repeatedly; any other pool is freed as soon as it becomes
+    empty.  */
+
+static MIntervalPool *spare_interval_pool;
 
-static MIntervalPool interval_pool_root;
+/** Statistics: the numbers of allocated and freed interval-pools,
+    and the current and the maximum numbers of intervals in use.  */
+
+static int interval_pools_allocated, interval_pools_freed;
+static int intervals_alive, intervals_peak;
+
+static M17NLock interval_pool_lock = M17N_LOCK_INITIALIZER;
 
 /* For debugging. */
 
 static M17NObjectArray text_property_table;
 
+/** Put POOL at the head of #interval_pools.  */
+
+static void
+link_interval_pool (MIntervalPool *pool)
+{
+  pool->prev = NULL;
+  pool->next = interval_pools;
+  if (interval_pools)
+    interval_pools->prev = pool;
+  interval_pools = pool;
+}
+
+/** Remove POOL from #interval_pools.  */
+
+static void
+unlink_interval_pool (MIntervalPool *pool)
+{
+  if (pool->prev)
+    pool->prev->next = pool->next;
+  else
+    interval_pools = pool->next;
+  if (pool->next)
+    pool->next->prev = pool->prev;
+  pool->prev = pool->next = NULL;
+}
+
 /** Return a newly allocated interval pool.  */
 
 static MIntervalPool *
@@ -221,44 +292,67 @@ new_interval_pool ()
   MIntervalPool *pool;
   int i;
 
-  MSTRUCT_CALLOC (pool, MERROR_TEXTPROP);
+  MSTRUCT_MALLOC (pool, MERROR_TEXTPROP);
   for (i = 0; i < INTERVAL_POOL_SIZE; i++)
-    pool->intervals[i].end = -1;
-  pool->free_slot = 0;
-  pool->next = NULL;
+    {
+      pool->intervals[i].length = -1;
+      pool->intervals[i].pool = pool;
+      pool->intervals[i].next = pool->intervals + i + 1;
+    }
+  pool->intervals[INTERVAL_POOL_SIZE - 1].next = NULL;
+  pool->free_list = pool->intervals;
+  pool->nused = 0;
+  link_interval_pool (pool);
+  interval_pools_allocated++;
   return pool;
 }
 
 
-/** Return a new interval for the region START and END.  */
+/** Return the treap priority of INTERVAL.  A hash of its address
+    serves as a random number.  */
+
+static unsigned
+interval_priority (MInterval *interval)
+{
+  unsigned h = (unsigned) ((size_t) interval / sizeof (MInterval));
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+
+/** Return a new interval of LENGTH characters.  It does not belong
+    to any plist yet.  */
 
 static MInterval *
-new_interval (int start, int end)
+new_interval (int length)
 {
   MIntervalPool *pool;
   MInterval *interval;
 
-  for (pool = &interval_pool_root;
-       pool->free_slot >= INTERVAL_POOL_SIZE;
-       pool = pool->next)
-    {
-      if (! pool->next)
-	pool->next = new_interval_pool ();
-    }
+  M17N_LOCK (interval_pool_lock);
+  pool = interval_pools ? interval_pools : new_interval_pool ();
+  interval = pool->free_list;
+  pool->free_list = interval->next;
+  if (pool == spare_interval_pool)
+    spare_interval_pool = NULL;
+  if (++pool->nused == INTERVAL_POOL_SIZE)
+    unlink_interval_pool (pool);
+  if (++intervals_alive > intervals_peak)
+    intervals_peak = intervals_alive;
+  M17N_UNLOCK (interval_pool_lock);
 
-  interval = &(pool->intervals[pool->free_slot]);
   interval->stack = NULL;
   interval->nprops = 0;
   interval->stack_length = 0;
+  interval->length = interval->total = length;
+  interval->priority = interval_priority (interval);
+  interval->parent = interval->left = interval->right = NULL;
   interval->prev = interval->next = NULL;
-  interval->start = start;
-  interval->end = end;
-
-  pool->free_slot++;
-  while (pool->free_slot < INTERVAL_POOL_SIZE
-	 && pool->intervals[pool->free_slot].end >= 0)
-    pool->free_slot++;
-
   return interval;
 }
 
@@ -269,22 +363,189 @@ new_interval (int start, int end)
 static MInterval *
 free_interval (MInterval *interval)
 {
-  MIntervalPool *pool = &interval_pool_root;
-  int i;
+  MIntervalPool *pool = interval->pool;
+  MInterval *next = interval->next;
 
   xassert (interval->nprops == 0);
+  xassert (interval->length >= 0);
   if (interval->stack)
     free (interval->stack);
-  while ((interval < pool->intervals
-	  || interval >= pool->intervals + INTERVAL_POOL_SIZE)
-	 && pool->next)
-    pool = pool->next;
-
-  i = interval - pool->intervals;
-  interval->end = -1;
-  if (i < pool->free_slot)
-    pool->free_slot = i;
-  return interval->next;
+  interval->length = -1;
+  M17N_LOCK (interval_pool_lock);
+  interval->next = pool->free_list;
+  pool->free_list = interval;
+  intervals_alive--;
+  if (pool->nused-- == INTERVAL_POOL_SIZE)
+    link_interval_pool (pool);
+  else if (pool->nused == 0)
+    {
+      if (! spare_interval_pool)
+	spare_interval_pool = pool;
+      else
+	{
+	  unlink_interval_pool (pool);
+	  free (pool);
+	  interval_pools_freed++;
+	}
+    }
+  M17N_UNLOCK (interval_pool_lock);
+  return next;
+}
+
+
+#define INTERVAL_TOTAL(interval) ((interval) ? (interval)->total : 0)
+
+/** Recalculate INTERVAL->total from the children.  */
+
+#define UPDATE_INTERVAL_TOTAL(interval)				\
+  ((interval)->total = ((interval)->length			\
+			+ INTERVAL_TOTAL ((interval)->left)	\
+			+ INTERVAL_TOTAL ((interval)->right)))
+
+
+/** Return the start position of INTERVAL.  */
+
+static int
+interval_start (MInterval *interval)
+{
+  int pos = INTERVAL_TOTAL (interval->left);
+
+  for (; interval->parent; interval = interval->parent)
+    if (interval == interval->parent->right)
+      pos += interval->parent->total - interval->total;
+  return pos;
+}
+
+#define INTERVAL_END(interval) (interval_start (interval) + (interval)->length)
+
+
+/** Change the length of INTERVAL to LENGTH.  */
+
+static void
+set_interval_length (MInterval *interval, int length)
+{
+  int diff = length - interval->length;
+
+  interval->length = length;
+  for (; interval; interval = interval->parent)
+    interval->total += diff;
+}
+
+
+/** Exchange INTERVAL and its parent in the treap of PLIST by a
+    rotation.  */
+
+static void
+rotate_interval (MTextPlist *plist, MInterval *interval)
+{
+  MInterval *parent = interval->parent, *grandparent = parent->parent;
+
+  if (interval == parent->left)
+    {
+      parent->left = interval->right;
+      if (parent->left)
+	parent->left->parent = parent;
+      interval->right = parent;
+    }
+  else
+    {
+      parent->right = interval->left;
+      if (parent->right)
+	parent->right->parent = parent;
+      interval->left = parent;
+    }
+  parent->parent = interval;
+  interval->parent = grandparent;
+  if (! grandparent)
+    plist->root = interval;
+  else if (grandparent->left == parent)
+    grandparent->left = interval;
+  else
+    grandparent->right = interval;
+  UPDATE_INTERVAL_TOTAL (parent);
+  UPDATE_INTERVAL_TOTAL (interval);
+}
+
+
+/** Insert INTERVAL in PLIST next to PREV.  If PREV is NULL, INTERVAL
+    becomes the head of PLIST.  The intervals following INTERVAL are
+    shifted by the length of INTERVAL.  */
+
+static void
+insert_interval (MTextPlist *plist, MInterval *interval, MInterval *prev)
+{
+  MInterval *next = prev ? prev->next : plist->head;
+  MInterval *parent;
+
+  interval->prev = prev;
+  interval->next = next;
+  if (prev)
+    prev->next = interval;
+  else
+    plist->head = interval;
+  if (next)
+    next->prev = interval;
+  else
+    plist->tail = interval;
+
+  interval->left = interval->right = NULL;
+  interval->total = interval->length;
+  if (! plist->root)
+    {
+      interval->parent = NULL;
+      plist->root = interval;
+      return;
+    }
+  /* If PREV has no right child, INTERVAL becomes it.  Otherwise, NEXT
+     is the leftmost of that child, and INTERVAL becomes the left
+     child of NEXT.  */
+  if (prev && ! prev->right)
+    prev->right = interval, parent = prev;
+  else
+    next->left = interval, parent = next;
+  interval->parent = parent;
+  for (; parent; parent = parent->parent)
+    parent->total += interval->length;
+  while (interval->parent
+	 && interval->parent->priority < interval->priority)
+    rotate_interval (plist, interval);
+}
+
+
+/** Remove INTERVAL from PLIST.  The intervals following INTERVAL are
+    shifted back by the length of INTERVAL.  */
+
+static void
+remove_interval (MTextPlist *plist, MInterval *interval)
+{
+  MInterval *parent;
+
+  while (interval->left || interval->right)
+    rotate_interval (plist,
+		     (! interval->right ? interval->left
+		      : ! interval->left ? interval->right
+		      : (interval->left->priority > interval->right->priority
+			 ? interval->left : interval->right)));
+  parent = interval->parent;
+  if (! parent)
+    plist->root = NULL;
+  else if (parent->left == interval)
+    parent->left = NULL;
+  else
+    parent->right = NULL;
+  for (; parent; parent = parent->parent)
+    parent->total -= interval->length;
+  interval->parent = NULL;
+
+  if (interval->prev)
+    interval->prev->next = interval->next;
+  else
+    plist->head = interval->next;
+  if (interval->next)
+    interval->next->prev = interval->prev;
+  else
+    plist->tail = interval->prev;
+  interval->prev = interval->next = NULL;
 }
 
 
@@ -308,7 +569,7 @@ free_interval (MInterval *interval)
 static MInterval *
 copy_interval (MInterval *interval, int mask_bits)
 {
-  MInterval *new = new_interval (interval->start, interval->end);
+  MInterval *new = new_interval (interval->length);
   int nprops = interval->nprops;
   MTextProperty **props = alloca (sizeof (MTextProperty *) * nprops);
   int i, n;
@@ -321,7 +582,7 @@ copy_interval (MInterval *interval, int mask_bits)
     {
       PREPARE_INTERVAL_STACK (new, n);
       memcpy (new->stack, props, sizeof (MTextProperty *) * n);
-    }	
+    }
 
   return new;
 }
@@ -345,8 +606,7 @@ free_text_property (void *object)
     is VAL.  */
 
 static MTextProperty *
-new_text_property (MText *mt, int from, int to, MSymbol key, void *val,
-		   int control_bits)
+new_text_property (MText *mt, MSymbol key, void *val, int control_bits)
 {
   MTextProperty *prop;
 
@@ -354,12 +614,11 @@ new_text_property (MText *mt, int from, int to, MSymbol key, void *val,
   prop->control.flag = control_bits;
   prop->attach_count = 0;
   prop->mt = mt;
-  prop->start = from;
-  prop->end = to;
+  prop->head = prop->tail = NULL;
   prop->key = key;
   prop->val = val;
   if (key->managing_key)
-    M17N_OBJECT_REF (val);    
+    M17N_OBJECT_REF (val);
   M17N_OBJECT_REGISTER (text_property_table, prop);
   return prop;
 }
@@ -368,37 +627,48 @@ new_text_property (MText *mt, int from, int to, MSymbol key, void *val,
 /** Return a newly allocated copy of text property PROP.  */
 
 #define COPY_TEXT_PROPERTY(prop)				\
-  new_text_property ((prop)->mt, (prop)->start, (prop)->end,	\
-		     (prop)->key, (prop)->val, (prop)->control.flag)
+  new_text_property ((prop)->mt, (prop)->key, (prop)->val,	\
+		     (prop)->control.flag)
+
+
+/** Return the start and end positions of an attached text property
+    PROP.  */
+
+#define PROP_START(prop) interval_start ((prop)->head)
+#define PROP_END(prop) INTERVAL_END ((prop)->tail)
 
 
-/** Split text property PROP at position INTERVAL->start, and make all
+/** Split text property PROP at the start of INTERVAL, and make all
     the following intervals contain the copy of PROP instead of PROP.
     It assumes that PROP starts before INTERVAL.  */
 
 static void
 split_property (MTextProperty *prop, MInterval *interval)
 {
-  int end = prop->end;
   MTextProperty *copy;
   int i;
 
-  prop->end = interval->start;
   copy = COPY_TEXT_PROPERTY (prop);
-  copy->start = interval->start;
-  copy->end = end;
+  copy->head = interval;
+  copy->tail = prop->tail;
+  prop->tail = interval->prev;
   /* Check all stacks of the following intervals, and if it contains
      PROP, change it to the copy of it.  */
-  for (; interval && interval->start < end; interval = interval->next)
-    for (i = 0; i < interval->nprops; i++)
-      if (interval->stack[i] == prop)
-	{
-	  interval->stack[i] = copy;
-	  M17N_OBJECT_REF (copy);
-	  copy->attach_count++;
-	  prop->attach_count--;
-	  M17N_OBJECT_UNREF (prop);
-	}
+  while (1)
+    {
+      for (i = 0; i < interval->nprops; i++)
+	if (interval->stack[i] == prop)
+	  {
+	    interval->stack[i] = copy;
+	    M17N_OBJECT_REF (copy);
+	    copy->attach_count++;
+	    prop->attach_count--;
+	    M17N_OBJECT_UNREF (prop);
+	  }
+      if (interval == copy->tail)
+	break;
+      interval = interval->next;
+    }
   M17N_OBJECT_UNREF (copy);
 }
 
@@ -409,23 +679,21 @@ static void
 divide_interval (MTextPlist *plist, MInterval *interval, int pos)
 {
   MInterval *new;
+  int start = interval_start (interval);
   int i;
 
-  if (pos == interval->start || pos == interval->end)
+  if (pos == start || pos == start + interval->length)
     return;
   new = copy_interval (interval, 0);
-  interval->end = new->start = pos;
-  new->prev = interval;
-  new->next = interval->next;
-  interval->next = new;
-  if (new->next)
-    new->next->prev = new;
-  if (plist->tail == interval)
-    plist->tail = new;
+  new->length = start + interval->length - pos;
+  set_interval_length (interval, pos - start);
+  insert_interval (plist, new, interval);
   for (i = 0; i < new->nprops; i++)
     {
       new->stack[i]->attach_count++;
       M17N_OBJECT_REF (new->stack[i]);
+      if (new->stack[i]->tail == interval)
+	new->stack[i]->tail = new;
     }
 }
 
@@ -452,7 +720,8 @@ maybe_merge_interval (MTextPlist *plist, MInterval *interval)
 
       if (prop != old
 	  && (prop->val != old->val
-	      || prop->end != old->start
+	      || prop->tail != interval
+	      || old->head != next
 	      || prop->control.flag & MTEXTPROP_NO_MERGE
 	      || old->control.flag & MTEXTPROP_NO_MERGE))
 	return interval->next;
@@ -468,145 +737,66 @@ maybe_merge_interval (MTextPlist *plist, MInterval *interval)
 	{
 	  MInterval *tail;
 
-	  for (tail = next->next; tail && tail->start < old->end;
-	       tail = tail->next)
-	    for (j = 0; j < tail->nprops; j++)
-	      if (tail->stack[j] == old)
-		{
-		  old->attach_count--;
-		  xassert (old->attach_count);
-		  tail->stack[j] = prop;
-		  prop->attach_count++;
-		  M17N_OBJECT_REF (prop);
-		}
+	  for (tail = next; tail != old->tail; )
+	    {
+	      tail = tail->next;
+	      for (j = 0; j < tail->nprops; j++)
+		if (tail->stack[j] == old)
+		  {
+		    old->attach_count--;
+		    xassert (old->attach_count);
+		    tail->stack[j] = prop;
+		    prop->attach_count++;
+		    M17N_OBJECT_REF (prop);
+		  }
+	    }
 	  xassert (old->attach_count == 1);
 	  old->mt = NULL;
-	  prop->end = old->end;
+	  prop->tail = old->tail;
+	  old->head = old->tail = NULL;
 	}
       old->attach_count--;
       M17N_OBJECT_UNREF (old);
     }
 
-  interval->end = next->end;
-  interval->next = next->next;
-  if (next->next)
-    next->next->prev = interval;
-  if (plist->tail == next)
-    plist->tail = interval;
-  plist->cache = interval;
+  remove_interval (plist, next);
+  set_interval_length (interval, interval->length + next->length);
+  for (i = 0; i < nprops; i++)
+    if (interval->stack[i]->tail == next)
+      interval->stack[i]->tail = interval;
   next->nprops = 0;
   free_interval (next);
   return interval;
 }
 
 
-/** Adjust start and end positions of intervals between HEAD and TAIL
-     (both inclusive) by diff.  Adjust also start and end positions
-     of text properties belonging to those intervals.  */
-
-static void
-adjust_intervals (MInterval *head, MInterval *tail, int diff)
-{
-  int i;
-  MTextProperty *prop;
-
-  if (diff < 0)
-    {
-      /* Adjust end positions of properties starting before HEAD.  */
-      for (i = 0; i < head->nprops; i++)
-	{
-	  prop = head->stack[i];
-	  if (prop->start < head->start)
-	    prop->end += diff;
-	}
-
-      /* Adjust start and end positions of properties starting at
-	 HEAD, and adjust HEAD itself.  */
-      while (1)
-	{
-	  for (i = 0; i < head->nprops; i++)
-	    {
-	      prop = head->stack[i];
-	      if (prop->start == head->start)
-		prop->start += diff, prop->end += diff;
-	    }
-	  head->start += diff;
-	  head->end += diff;
-	  if (head == tail)
-	    break;
-	  head = head->next;
-	}
-    }
-  else
-    {
-      /* Adjust start poistions of properties ending after TAIL.  */
-      for (i = 0; i < tail->nprops; i++)
-	{
-	  prop = tail->stack[i];
-	  if (prop->end > tail->end)
-	    prop->start += diff;
-	}
-
-      /* Adjust start and end positions of properties ending at
-	 TAIL, and adjust TAIL itself.  */
-      while (1)
-	{
-	  for (i = 0; i < tail->nprops; i++)
-	    {
-	      prop = tail->stack[i];
-	      if (prop->end == tail->end)
-		prop->start += diff, prop->end += diff;
-	    }
-	  tail->start += diff;
-	  tail->end += diff;
-	  if (tail == head)
-	    break;
-	  tail = tail->prev;
-	}
-    }
-}
-
 /* Return an interval of PLIST that covers the position POS.  */
 
 static MInterval *
 find_interval (MTextPlist *plist, int pos)
 {
-  MInterval *interval;
-  MInterval *highest;
-
-  if (pos < plist->head->end)
-    return plist->head;
-  if (pos >= plist->tail->start)
-    return (pos < plist->tail->end ? plist->tail : NULL);
-
-  interval = plist->cache;
+  MInterval *interval = plist->root;
 
-  if (pos < interval->start)
-    highest = interval->prev, interval = plist->head->next;
-  else if (pos < interval->end)
-    return interval;
-  else
-    highest = plist->tail->prev, interval = interval->next;
-
-  if (pos - interval->start < highest->end - pos)
-    {
-      while (interval->end <= pos)
-	/* Here, we are sure that POS is not included in PLIST->tail,
-	   thus, INTERVAL->next always points a valid next
-	   interval.  */
-	interval = interval->next;
-    }
-  else
+  if (pos >= interval->total)
+    return NULL;
+  while (1)
     {
-      while (highest->start > pos)
-	highest = highest->prev;
-      interval = highest;
+      int left = INTERVAL_TOTAL (interval->left);
+
+      if (pos < left)
+	interval = interval->left;
+      else if ((pos -= left) < interval->length)
+	return interval;
+      else
+	{
+	  pos -= interval->length;
+	  interval = interval->right;
+	}
     }
-  plist->cache = interval;
-  return interval;
 }
 
-/* Push text property PROP on the stack of INTERVAL.  */
+/* Push text property PROP on the stack of INTERVAL.  INTERVAL must
+   be adjacent to the intervals PROP is already attached to.  */
 
 #define PUSH_PROP(interval, prop)		\
   do {						\
@@ -617,15 +807,17 @@ find_interval (MTextPlist *plist, int pos)
     (interval)->nprops += 1;			\
     (prop)->attach_count++;			\
     M17N_OBJECT_REF (prop);			\
-    if ((prop)->start > (interval)->start)	\
-      (prop)->start = (interval)->start;	\
-    if ((prop)->end < (interval)->end)		\
-      (prop)->end = (interval)->end;		\
+    if (! (prop)->head)				\
+      (prop)->head = (prop)->tail = (interval);	\
+    else if ((prop)->tail->next == (interval))	\
+      (prop)->tail = (interval);		\
+    else if ((prop)->head->prev == (interval))	\
+      (prop)->head = (interval);		\
   } while (0)
 
 
 /* Pop the topmost text property of INTERVAL from the stack.  If it
-   ends after INTERVAL->end, split it.  */
+   ends after INTERVAL, split it.  */
 
 #define POP_PROP(interval)				\
   do {							\
@@ -635,17 +827,20 @@ find_interval (MTextPlist *plist, int pos)
     prop = (interval)->stack[(interval)->nprops];	\
     xassert (prop->control.ref_count > 0);		\
     xassert (prop->attach_count > 0);			\
-    if (prop->start < (interval)->start)		\
+    if (prop->head != (interval))			\
       {							\
-	if (prop->end > (interval)->end)		\
+	if (prop->tail != (interval))			\
 	  split_property (prop, (interval)->next);	\
-	prop->end = (interval)->start;			\
+	prop->tail = (interval)->prev;			\
       }							\
-    else if (prop->end > (interval)->end)		\
-      prop->start = (interval)->end;			\
+    else if (prop->tail != (interval))			\
+      prop->head = (interval)->next;			\
     prop->attach_count--;				\
     if (! prop->attach_count)				\
-      prop->mt = NULL;					\
+      {							\
+	prop->mt = NULL;				\
+	prop->head = prop->tail = NULL;			\
+      }							\
     M17N_OBJECT_UNREF (prop);				\
   } while (0)
 
@@ -664,21 +859,44 @@ find_interval (MTextPlist *plist, int pos)
       (interval)->stack[i] = (interval)->stack[i + 1];	\
     (prop)->attach_count--;				\
     if (! (prop)->attach_count)				\
-      (prop)->mt = NULL;				\
+      {							\
+	(prop)->mt = NULL;				\
+	(prop)->head = (prop)->tail = NULL;		\
+      }							\
     M17N_OBJECT_UNREF (prop);				\
   } while (0)
 
 
 #ifdef TEXT_PROP_DEBUG
+/* Check the treap rooted by INTERVAL whose parent is PARENT.  */
+
 static int
-check_plist (MTextPlist *plist, int start)
+check_interval_tree (MInterval *interval, MInterval *parent)
+{
+  if (! interval)
+    return 0;
+  if (interval->parent != parent
+      || interval->length <= 0
+      || (parent && parent->priority < interval->priority)
+      || (interval->total
+	  != (interval->length + INTERVAL_TOTAL (interval->left)
+	      + INTERVAL_TOTAL (interval->right))))
+    return mdebug_hook ();
+  if (check_interval_tree (interval->left, interval) < 0
+      || check_interval_tree (interval->right, interval) < 0)
+    return -1;
+  return 0;
+}
+
+static int
+check_plist (MTextPlist *plist)
 {
   MInterval *interval = plist->head;
-  MInterval *cache = plist->cache;
-  int cache_found = 0;
+  int start = 0;
 
-  if (interval->start != start
-      || interval->start >= interval->end)
+  if (check_interval_tree (plist->root, NULL) < 0)
+    return -1;
+  if (plist->head->prev || plist->tail->next)
     return mdebug_hook ();
   while (interval)
     {
@@ -686,96 +904,67 @@ check_plist (MTextPlist *plist, int start)
 
       if (interval == interval->next)
 	return mdebug_hook ();
-
-      if (interval == cache)
-	cache_found = 1;
-
-      if (interval->start >= interval->end)
+      if (interval_start (interval) != start
+	  || find_interval (plist, start) != interval)
 	return mdebug_hook ();
       if ((interval->next
-	   ? (interval->end != interval->next->start
-	      || interval != interval->next->prev)
+	   ? interval != interval->next->prev
 	   : interval != plist->tail))
 	return mdebug_hook ();
       for (i = 0; i < interval->nprops; i++)
 	{
-	  if (interval->stack[i]->start > interval->start
-	      || interval->stack[i]->end < interval->end)
-	    return mdebug_hook ();
+	  MTextProperty *prop = interval->stack[i];
 
-	  if (! interval->stack[i]->attach_count)
+	  if (! prop->attach_count || ! prop->mt
+	      || ! prop->head || ! prop->tail)
 	    return mdebug_hook ();
-	  if (! interval->stack[i]->mt)
+	  if (PROP_START (prop) > start
+	      || PROP_END (prop) < start + interval->length)
 	    return mdebug_hook ();
-	  if (interval->stack[i]->start == interval->start)
-	    {
-	      MTextProperty *prop = interval->stack[i];
-	      int count = prop->attach_count - 1;
-	      MInterval *interval2;
-
-	      for (interval2 = interval->next;
-		   interval2 && interval2->start < prop->end;
-		   count--, interval2 = interval2->next)
-		if (count == 0)
-		  return mdebug_hook ();
-	    }	      
-
-	  if (interval->stack[i]->end > interval->end)
+	  if (prop->head == interval)
 	    {
-	      MTextProperty *prop = interval->stack[i];
+	      /* PROP must be in all the intervals from its head to its
+		 tail, and only in them.  */
 	      MInterval *interval2;
-	      int j;
+	      int count = 0, j;
 
-	      for (interval2 = interval->next;
-		   interval2 && interval2->start < prop->end;
-		   interval2 = interval2->next)
+	      for (interval2 = interval; ; interval2 = interval2->next)
 		{
-		  for (j = 0; j < interval2->nprops; j++)
-		    if (interval2->stack[j] == prop)
-		      break;
-		  if (j == interval2->nprops)
+		  if (! interval2)
 		    return mdebug_hook ();
-		}
-	    }
-	  if (interval->stack[i]->start < interval->start)
-	    {
-	      MTextProperty *prop = interval->stack[i];
-	      MInterval *interval2;
-	      int j;
-
-	      for (interval2 = interval->prev;
-		   interval2 && interval2->end > prop->start;
-		   interval2 = interval2->prev)
-		{
 		  for (j = 0; j < interval2->nprops; j++)
 		    if (interval2->stack[j] == prop)
 		      break;
 		  if (j == interval2->nprops)
 		    return mdebug_hook ();
+		  count++;
+		  if (interval2 == prop->tail)
+		    break;
 		}
+	      if (count != prop->attach_count)
+		return mdebug_hook ();
 	    }
 	}
+      start += interval->length;
       interval = interval->next;
     }
-  if (! cache_found)
+  if (start != plist->root->total)
     return mdebug_hook ();
-  if (plist->head->prev || plist->tail->next)
-    return mdebug_hook ();    
   return 0;
 }
 #endif
 
 
 /** Return a copy of plist that contains intervals between FROM and TO
-    of PLIST.  The copy goes to the position POS of M-text MT.  */
+    of PLIST.  The copy is for M-text MT, and starts at 0.  */
 
 static MTextPlist *
-copy_single_property (MTextPlist *plist, int from, int to, MText *mt, int pos)
+copy_single_property (MTextPlist *plist, int from, int to, MText *mt)
 {
   MTextPlist *new;
-  MInterval *interval1, *interval2;
+  MInterval *interval1, *interval2, *interval3, *head;
   MTextProperty *prop;
-  int diff = pos - from;
+  int start;
   int i, j;
   int mask_bits = MTEXTPROP_VOLATILE_STRONG | MTEXTPROP_VOLATILE_WEAK;
 
@@ -783,46 +972,50 @@ copy_single_property (MTextPlist *plist, int from, int to, MText *mt, int pos)
   new->key = plist->key;
   new->next = NULL;
 
-  interval1 = find_interval (plist, from);
-  new->head = copy_interval (interval1, mask_bits);
-  for (interval1 = interval1->next, interval2 = new->head;
-       interval1 && interval1->start < to;
-       interval1 = interval1->next, interval2 = interval2->next)
+  head = interval1 = find_interval (plist, from);
+  start = interval_start (interval1);
+  for (interval2 = NULL; interval1 && start < to;
+       start += interval1->length, interval1 = interval1->next)
     {
-      interval2->next = copy_interval (interval1, mask_bits);
-      interval2->next->prev = interval2;
+      int end = start + interval1->length;
+
+      interval3 = copy_interval (interval1, mask_bits);
+      interval3->length = ((end < to ? end : to)
+			   - (start > from ? start : from));
+      insert_interval (new, interval3, interval2);
+      interval2 = interval3;
     }
-  new->tail = interval2;
-  new->head->start = from;
-  new->tail->end = to;
-  for (interval1 = new->head; interval1; interval1 = interval1->next)
-    for (i = 0; i < interval1->nprops; i++)
-      if (interval1->start == interval1->stack[i]->start
-	  || interval1 == new->head)
+
+  /* Replace each text property with a copy of it clipped to the
+     region.  A property not yet replaced is found in the first
+     interval of the copy, or in the interval where it starts.  */
+  for (interval1 = head, interval2 = new->head; interval2;
+       interval1 = interval1->next, interval2 = interval2->next)
+    for (i = 0; i < interval2->nprops; i++)
+      if (interval2 == new->head || interval2->stack[i]->head == interval1)
 	{
-	  prop = interval1->stack[i];
-	  interval1->stack[i] = COPY_TEXT_PROPERTY (prop);
-	  interval1->stack[i]->mt = mt;
-	  interval1->stack[i]->attach_count++;
-	  if (interval1->stack[i]->start < from)
-	    interval1->stack[i]->start = from;
-	  if (interval1->stack[i]->end > to)
-	    interval1->stack[i]->end = to;
-	  for (interval2 = interval1->next; interval2;
-	       interval2 = interval2->next)
-	    for (j = 0; j < interval2->nprops; j++)
-	      if (interval2->stack[j] == prop)
-		{
-		  interval2->stack[j] = interval1->stack[i];
-		  interval1->stack[i]->attach_count++;
-		  M17N_OBJECT_REF (interval1->stack[i]);
-		}
+	  prop = interval2->stack[i];
+	  interval2->stack[i] = COPY_TEXT_PROPERTY (prop);
+	  interval2->stack[i]->mt = mt;
+	  interval2->stack[i]->attach_count++;
+	  interval2->stack[i]->head = interval2->stack[i]->tail = interval2;
+	  for (interval3 = interval2->next; interval3;
+	       interval3 = interval3->next)
+	    {
+	      for (j = 0; j < interval3->nprops; j++)
+		if (interval3->stack[j] == prop)
+		  break;
+	      if (j == interval3->nprops)
+		break;
+	      interval3->stack[j] = interval2->stack[i];
+	      interval2->stack[i]->attach_count++;
+	      interval2->stack[i]->tail = interval3;
+	      M17N_OBJECT_REF (interval2->stack[i]);
+	    }
 	}
-  adjust_intervals (new->head, new->tail, diff);
-  new->cache = new->head;
   for (interval1 = new->head; interval1 && interval1->next;
        interval1 = maybe_merge_interval (new, interval1));
-  xassert (check_plist (new, pos) == 0);
+  xassert (check_plist (new) == 0);
   if (new->head == new->tail
       && new->head->nprops == 0)
     {
@@ -843,9 +1036,8 @@ new_plist (MText *mt, MSymbol key)
 
   MSTRUCT_MALLOC (plist, MERROR_TEXTPROP);
   plist->key = key;
-  plist->head = new_interval (0, mtext_nchars (mt));
-  plist->tail = plist->head;
-  plist->cache = plist->head;
+  plist->head = plist->tail = plist->root = NULL;
+  insert_interval (plist, new_interval (mtext_nchars (mt)), NULL);
   plist->next = mt->plist;
   mt->plist = plist;
   return plist;
@@ -888,37 +1080,34 @@ get_plist_create (MText *mt, MSymbol key, int create)
   return plist;
 }
 
-/* Detach PROP.  INTERVAL (if not NULL) contains PROP.  */
+/* Detach PROP from PLIST.  */
 
 static void
-detach_property (MTextPlist *plist, MTextProperty *prop, MInterval *interval)
+detach_property (MTextPlist *plist, MTextProperty *prop)
 {
-  MInterval *head;
-  int to = prop->end;
+  MInterval *head, *tail, *interval;
+  int to;
 
   xassert (prop->mt);
   xassert (plist);
 
   M17N_OBJECT_REF (prop);
-  if (interval)
-    while (interval->start > prop->start)
-      interval = interval->prev;
-  else
-    interval = find_interval (plist, prop->start);
-  head = interval;
+  head = interval = prop->head;
+  tail = prop->tail;
+  to = INTERVAL_END (tail);
   while (1)
     {
       REMOVE_PROP (interval, prop);
-      if (interval->end == to)
+      if (interval == tail)
 	break;
       interval = interval->next;
     }
   xassert (prop->attach_count == 0 && prop->mt == NULL);
   M17N_OBJECT_UNREF (prop);
 
-  while (head && head->end <= to)
+  while (head && INTERVAL_END (head) <= to)
     head = maybe_merge_interval (plist, head);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
 }
 
 /* Delete text properties of PLIST between FROM and TO.  MASK_BITS
@@ -941,7 +1130,7 @@ delete_properties (MTextPlist *plist, int from, int to,
 
  retry:
   for (interval = find_interval (plist, from);
-       interval && interval->start < to;
+       interval && interval_start (interval) < to;
        interval = interval->next)
     for (i = 0; i < interval->nprops; i++)
       {
@@ -949,17 +1138,17 @@ delete_properties (MTextPlist *plist, int from, int to,
 
 	if (prop->control.flag & mask_bits)
 	  {
-	    if (prop->start < modified_from)
-	      modified_from = prop->start;
-	    if (prop->end > modified_to)
-	      modified_to = prop->end;
-	    detach_property (plist, prop, interval);
+	    if (PROP_START (prop) < modified_from)
+	      modified_from = PROP_START (prop);
+	    if (PROP_END (prop) > modified_to)
+	      modified_to = PROP_END (prop);
+	    detach_property (plist, prop);
 	    modified++;
 	    goto retry;
 	  }
-	else if (deleting && prop->start >= from && prop->end <= to)
+	else if (deleting && PROP_START (prop) >= from && PROP_END (prop) <= to)
 	  {
-	    detach_property (plist, prop, interval);
+	    detach_property (plist, prop);
 	    modified++;
 	    goto retry;
 	  }
@@ -968,7 +1157,7 @@ delete_properties (MTextPlist *plist, int from, int to,
   if (modified)
     {
       interval = find_interval (plist, modified_from);
-      while (interval && interval->start < modified_to)
+      while (interval && interval_start (interval) < modified_to)
 	interval = maybe_merge_interval (plist, interval);
     }
 
@@ -987,34 +1176,30 @@ MInterval *
 pop_all_properties (MTextPlist *plist, int from, int to)
 {
   MInterval *interval;
+  int end;
 
   /* Be sure to have interval boundary at TO.  */
   interval = find_interval (plist, to);
-  if (interval && interval->start < to)
+  if (interval && interval_start (interval) < to)
     divide_interval (plist, interval, to);
 
   /* Be sure to have interval boundary at FROM.  */
   interval = find_interval (plist, from);
-  if (interval->start < from)
+  if (interval_start (interval) < from)
     {
       divide_interval (plist, interval, from);
       interval = interval->next;
     }
 
   pop_interval_properties (interval);
-  while (interval->end < to)
+  for (end = INTERVAL_END (interval); end < to; )
     {
       MInterval *next = interval->next;
 
       pop_interval_properties (next);
-      interval->end = next->end;
-      interval->next = next->next;
-      if (interval->next)
-	interval->next->prev = interval;
-      if (next == plist->tail)
-	plist->tail = interval;
-      if (plist->cache == next)
-	plist->cache = interval;
+      remove_interval (plist, next);
+      set_interval_length (interval, interval->length + next->length);
+      end += next->length;
       free_interval (next);
     }
   return interval;
@@ -1057,15 +1242,17 @@ extract_text_properties (MText *mt, int from, int to, MSymbol key,
   MPlist *top;
   MTextPlist *list = get_plist_create (mt, key, 0);
   MInterval *interval;
+  int start;
 
   if (! list)
     return;
   interval = find_interval (list, from);
+  start = interval_start (interval);
   if (interval->nprops == 0
-      && interval->start <= from && interval->end >= to)
+      && start <= from && start + interval->length >= to)
     return;
   top = plist;
-  while (interval && interval->start < to)
+  while (interval && start < to)
     {
       if (interval->nprops == 0)
 	top = mplist_find_by_key (top, Mnil);
@@ -1095,6 +1282,7 @@ extract_text_properties (MText *mt, int from, int to, MSymbol key,
 		}
 	    }
 	}
+      start += interval->length;
       interval = interval->next;
     }
   return;
@@ -1128,13 +1316,14 @@ dump_interval (MInterval *interval, int indent)
   prefix[indent] = 0;
 
   fprintf (mdebug__output, "(interval %d-%d (%d)",
-	   interval->start, interval->end, interval->nprops);
+	   interval_start (interval), INTERVAL_END (interval),
+	   interval->nprops);
   for (i = 0; i < interval->nprops; i++)
     fprintf (mdebug__output, "\n%s (%d %d/%d %d-%d 0x%x)",
 	     prefix, i,
 	     interval->stack[i]->control.ref_count,
 	     interval->stack[i]->attach_count,
-	     interval->stack[i]->start, interval->stack[i]->end,
+	     PROP_START (interval->stack[i]), PROP_END (interval->stack[i]),
 	     (unsigned) interval->stack[i]->val);
   fprintf (mdebug__output, ")");
 }
@@ -1156,12 +1345,13 @@ dump_textplist (MTextPlist *plist, int indent)
       while (plist)
 	{
 	  MInterval *interval = plist->head;
+	  int start = 0;
 
 	  fprintf (mdebug__output, "%s (%s", prefix, msymbol_name (plist->key));
 	  while (interval)
 	    {
 	      fprintf (mdebug__output, " (%d %d",
-		       interval->start, interval->end);
+		       start, start + interval->length);
 	      if (interval->nprops > 0)
 		{
 		  int i;
@@ -1171,10 +1361,11 @@ dump_textplist (MTextPlist *plist, int indent)
 			     (int) interval->stack[i]->val);
 		}
 	      fprintf (mdebug__output, ")");
+	      start += interval->length;
 	      interval = interval->next;
 	    }
 	  fprintf (mdebug__output, ")\n");
-	  xassert (check_plist (plist, 0) == 0);
+	  xassert (check_plist (plist) == 0);
 	  plist = plist->next;
 	}
     }
@@ -1195,15 +1386,30 @@ mtext__prop_init ()
 void
 mtext__prop_fini ()
 {
-  MIntervalPool *pool = interval_pool_root.next;
+  MIntervalPool *pool, *next;
 
-  while (pool)
+  if (mdebug__flags[MDEBUG_FINI])
     {
-      MIntervalPool *next = pool->next;
-      free (pool);
-      pool = next;
+      fprintf (mdebug__output, "%16s %7s %7s %7s %7s\n",
+	       "object", "blocks", "freed", "alive", "peak");
+      fprintf (mdebug__output, "%16s %7d %7d %7d %7d\n", "Interval",
+	       interval_pools_allocated, interval_pools_freed,
+	       intervals_alive, intervals_peak);
     }
-  interval_pool_root.next = NULL;  
+
+  /* Free the pools none of whose intervals is in use.  Those still in
+     use are kept because they belong to M-texts not yet freed.  */
+  for (pool = interval_pools; pool; pool = next)
+    {
+      next = pool->next;
+      if (pool->nused == 0)
+	{
+	  unlink_interval_pool (pool);
+	  free (pool);
+	  interval_pools_freed++;
+	}
+    }
+  spare_interval_pool = NULL;
 }
 
 
@@ -1225,18 +1431,18 @@ mtext__free_plist (MText *mt){
     M-text MT.  */
 
 MTextPlist *
-mtext__copy_plist (MTextPlist *plist, int from, int to, MText *mt, int pos)
+mtext__copy_plist (MTextPlist *plist, int from, int to, MText *mt)
 {
   MTextPlist *copy, *this;
 
   if (from == to)
     return NULL;
   for (copy = NULL; plist && ! copy; plist = plist->next)
-    copy = copy_single_property (plist, from, to, mt, pos);
+    copy = copy_single_property (plist, from, to, mt);
   if (! plist)
     return copy;
   for (; plist; plist = plist->next)
-    if ((this = copy_single_property (plist, from, to, mt, pos)))
+    if ((this = copy_single_property (plist, from, to, mt)))
       {
 	this->next = copy;
 	copy = this;
@@ -1266,22 +1472,11 @@ mtext__adjust_plist_for_delete (MText *mt, int pos, int len)
       MInterval *interval = pop_all_properties (plist, pos, to);
       MInterval *prev = interval->prev, *next = interval->next;
 
-      if (prev)
-	prev->next = next;
-      else
-	plist->head = next;
-      if (next)
-	{
-	  adjust_intervals (next, plist->tail, -len);
-	  next->prev = prev;
-	}
-      else
-	plist->tail = prev;
+      remove_interval (plist, interval);
       if (prev && next)
-	next = maybe_merge_interval (plist, prev);
-      plist->cache = next ? next : prev;
+	maybe_merge_interval (plist, prev);
       free_interval (interval);
-      xassert (check_plist (plist, 0) == 0);
+      xassert (check_plist (plist) == 0);
     }
 }
 
@@ -1291,7 +1486,6 @@ mtext__adjust_plist_for_insert (MText *mt, int pos, int nchars,
 {
   MTextPlist *pl, *pl_last, *pl2, *p;
   int i;
-  MInterval *interval;
 
   if (mt->nchars == 0)
     {
@@ -1304,7 +1498,7 @@ mtext__adjust_plist_for_insert (MText *mt, int pos, int nchars,
 
   for (pl_last = NULL, pl = mt->plist; pl; pl_last = pl, pl = pl->next)
     {
-      MInterval *interval, *prev, *next, *head, *tail;
+      MInterval *interval, *prev, *next, *head;
 
       if (pos == 0)
 	prev = NULL, next = pl->head;
@@ -1313,50 +1507,46 @@ mtext__adjust_plist_for_insert (MText *mt, int pos, int nchars,
       else
 	{
 	  next = find_interval (pl, pos);
-	  if (next->start < pos)
+	  if (interval_start (next) < pos)
 	    {
 	      divide_interval (pl, next, pos);
 	      next = next->next;
 	    }
 	  for (i = 0; i < next->nprops; i++)
-	    if (next->stack[i]->start < pos)
+	    if (next->stack[i]->head != next)
 	      split_property (next->stack[i], next);
 	  prev = next->prev;
 	}
 
-      xassert (check_plist (pl, 0) == 0);
+      xassert (check_plist (pl) == 0);
       for (p = NULL, pl2 = plist; pl2 && pl->key != pl2->key;
 	   p = pl2, pl2 = p->next);
       if (pl2)
 	{
-	  xassert (check_plist (pl2, pl2->head->start) == 0);
+	  xassert (check_plist (pl2) == 0);
 	  if (p)
 	    p->next = pl2->next;
 	  else
 	    plist = plist->next;
 
 	  head = pl2->head;
-	  tail = pl2->tail;
 	  free (pl2);
 	}
       else
 	{
-	  head = tail = new_interval (pos, pos + nchars);
+	  head = new_interval (nchars);
+	}
+      /* Move the intervals from HEAD into PL one by one.  */
+      for (interval = prev; head; )
+	{
+	  MInterval *this = head;
+
+	  head = head->next;
+	  insert_interval (pl, this, interval);
+	  interval = this;
 	}
-      head->prev = prev;
-      tail->next = next;
-      if (prev)
-	prev->next = head;
-      else
-	pl->head = head;
-      if (next)
-	next->prev = tail;
-      else
-	pl->tail = tail;
-      if (next)
-	adjust_intervals (next, pl->tail, nchars);
 
-      xassert (check_plist (pl, 0) == 0);
+      xassert (check_plist (pl) == 0);
       if (prev && prev->nprops > 0)
 	{
 	  for (interval = prev;
@@ -1370,7 +1560,7 @@ mtext__adjust_plist_for_insert (MText *mt, int pos, int nchars,
 		  PUSH_PROP (interval->next, prop);
 	      }
 	}
-      xassert (check_plist (pl, 0) == 0);
+      xassert (check_plist (pl) == 0);
       if (next && next->nprops > 0)
 	{
 	  for (interval = next;
@@ -1386,10 +1576,9 @@ mtext__adjust_plist_for_insert (MText *mt, int pos, int nchars,
 	}
 
       interval = prev ? prev : pl->head;
-      pl->cache = interval;
-      while (interval && interval->start <= pos + nchars)
+      while (interval && interval_start (interval) <= pos + nchars)
 	interval = maybe_merge_interval (pl, interval);
-      xassert (check_plist (pl, 0) == 0);
+      xassert (check_plist (pl) == 0);
     }
 
   if (pl_last)
@@ -1399,33 +1588,23 @@ mtext__adjust_plist_for_insert (MText *mt, int pos, int nchars,
 
   for (; plist; plist = plist->next)
     {
-      plist->cache = plist->head;
       if (pos > 0)
 	{
 	  if (plist->head->nprops)
-	    {
-	      interval = new_interval (0, pos);
-	      interval->next = plist->head;
-	      plist->head->prev = interval;
-	      plist->head = interval;
-	    }
+	    insert_interval (plist, new_interval (pos), NULL);
 	  else
-	    plist->head->start = 0;
+	    set_interval_length (plist->head, plist->head->length + pos);
 	}
       if (pos < mtext_nchars (mt))
 	{
+	  int len = mtext_nchars (mt) - pos;
+
 	  if (plist->tail->nprops)
-	    {
-	      interval = new_interval (pos + nchars,
-				       mtext_nchars (mt) + nchars);
-	      interval->prev = plist->tail;
-	      plist->tail->next = interval;
-	      plist->tail = interval;
-	    }
+	    insert_interval (plist, new_interval (len), plist->tail);
 	  else
-	    plist->tail->end = mtext_nchars (mt) + nchars;
+	    set_interval_length (plist->tail, plist->tail->length + len);
 	}
-      xassert (check_plist (plist, 0) == 0);
+      xassert (check_plist (plist) == 0);
     }
 }
 
@@ -1443,33 +1622,13 @@ mtext__adjust_plist_for_change (MText *mt, int pos, int len1, int len2)
       int diff = len2 - len1;
       MTextPlist *plist;
 
+      /* Extend the interval containing the last changed character.
+	 The following intervals are shifted implicitly.  */
       for (plist = mt->plist; plist; plist = plist->next)
 	{
-	  MInterval *head = find_interval (plist, pos2);
-	  MInterval *tail = plist->tail;
-	  MTextProperty *prop;
-	  int i;
+	  MInterval *interval = find_interval (plist, pos2 - 1);
 
-	  if (head)
-	    {
-	      if (head->start == pos2)
-		head = head->prev;
-	      while (tail != head)
-		{
-		  for (i = 0; i < tail->nprops; i++)
-		    {
-		      prop = tail->stack[i];
-		      if (prop->start == tail->start)
-			prop->start += diff, prop->end += diff;
-		    }
-		  tail->start += diff;
-		  tail->end += diff;
-		  tail = tail->prev;
-		}
-	    }
-	  for (i = 0; i < tail->nprops; i++)
-	    tail->stack[i]->end += diff;
-	  tail->end += diff;
+	  set_interval_length (interval, interval->length + diff);
 	}
     }
   else if (len1 > len2)
@@ -1478,7 +1637,6 @@ mtext__adjust_plist_for_change (MText *mt, int pos, int len1, int len2)
     }
 }
 
-
 /*** @} */
 #endif /* !FOR_DOXYGEN || DOXYGEN_INTERNAL_MODULE */
 
@@ -1786,14 +1944,14 @@ mtext_put_prop (MText *mt, int from, int to, MSymbol key, void *val)
   prepare_to_modify (mt, from, to, key, 0);
   plist = get_plist_create (mt, key, 1);
   interval = pop_all_properties (plist, from, to);
-  prop = new_text_property (mt, from, to, key, val, 0);
+  prop = new_text_property (mt, key, val, 0);
   PUSH_PROP (interval, prop);
   M17N_OBJECT_UNREF (prop);
   if (interval->next)
     maybe_merge_interval (plist, interval);
   if (interval->prev)
     maybe_merge_interval (plist, interval->prev);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   return 0;
 }
 
@@ -1852,8 +2010,7 @@ mtext_put_prop_values (MText *mt, int from, int to,
       PREPARE_INTERVAL_STACK (interval, num);
       for (i = 0; i < num; i++)
 	{
-	  MTextProperty *prop
-	    = new_text_property (mt, from, to, key, values[i], 0);
+	  MTextProperty *prop = new_text_property (mt, key, values[i], 0);
 	  PUSH_PROP (interval, prop);
 	  M17N_OBJECT_UNREF (prop);
 	}
@@ -1862,7 +2019,7 @@ mtext_put_prop_values (MText *mt, int from, int to,
     maybe_merge_interval (plist, interval);
   if (interval->prev)
     maybe_merge_interval (plist, interval->prev);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   return 0;
 }
 
@@ -1938,7 +2095,7 @@ mtext_push_prop (MText *mt, int from, int to,
   MTextPlist *plist;
   MInterval *head, *tail, *interval;
   MTextProperty *prop;
-  int check_head, check_tail;
+  int start, check_head, check_tail;
 
   M_CHECK_RANGE (mt, from, to, -1, 0);
 
@@ -1947,12 +2104,14 @@ mtext_push_prop (MText *mt, int from, int to,
 
   /* Find an interval that covers the position FROM.  */
   head = find_interval (plist, from);
+  start = interval_start (head);
 
   /* If the found interval starts before FROM, divide it at FROM.  */
-  if (head->start < from)
+  if (start < from)
     {
       divide_interval (plist, head, from);
       head = head->next;
+      start = from;
       check_head = 0;
     }
   else
@@ -1960,12 +2119,12 @@ mtext_push_prop (MText *mt, int from, int to,
 
   /* Find an interval that ends at TO.  If TO is not at the end of an
      interval, make one that ends at TO.  */
-  if (head->end == to)
+  if (start + head->length == to)
     {
       tail = head;
       check_tail = 1;
     }
-  else if (head->end > to)
+  else if (start + head->length > to)
     {
       divide_interval (plist, head, to);
       tail = head;
@@ -1979,7 +2138,7 @@ mtext_push_prop (MText *mt, int from, int to,
 	  tail = plist->tail;
 	  check_tail = 0;
 	}
-      else if (tail->start == to)
+      else if (interval_start (tail) == to)
 	{
 	  tail = tail->prev;
 	  check_tail = 1;
@@ -1991,7 +2150,7 @@ mtext_push_prop (MText *mt, int from, int to,
 	}
     }
 
-  prop = new_text_property (mt, from, to, key, val, 0);
+  prop = new_text_property (mt, key, val, 0);
 
   /* Push PROP to the current values of intervals between HEAD and TAIL
      (both inclusive).  */
@@ -2014,7 +2173,7 @@ mtext_push_prop (MText *mt, int from, int to,
   if (head->prev && check_head)
     maybe_merge_interval (plist, head->prev);
 
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   return 0;
 }
 
@@ -2091,6 +2250,7 @@ mtext_pop_prop (MText *mt, int from, int to, MSymbol key)
 {
   MTextPlist *plist;
   MInterval *head, *tail;
+  int start;
   int check_head = 1;
 
   if (key == Mnil)
@@ -2102,7 +2262,8 @@ mtext_pop_prop (MText *mt, int from, int to, MSymbol key)
 
   /* Find an interval that covers the position FROM.  */
   head = find_interval (plist, from);
-  if (head->end >= to
+  start = interval_start (head);
+  if (start + head->length >= to
       && head->nprops == 0)
     /* No property to pop.  */
     return 0;
@@ -2111,7 +2272,7 @@ mtext_pop_prop (MText *mt, int from, int to, MSymbol key)
 
   /* If the found interval starts before FROM and has value(s), divide
      it at FROM.  */
-  if (head->start < from)
+  if (start < from)
     {
       if (head->nprops > 0)
 	{
@@ -2119,42 +2280,44 @@ mtext_pop_prop (MText *mt, int from, int to, MSymbol key)
 	  check_head = 0;
 	}
       else
-	from = head->end;
+	from = start + head->length;
+      start += head->length;
       head = head->next;
     }
 
   /* Pop the topmost text property from each interval following HEAD.
      Stop at an interval that ends after TO.  */
-  for (tail = head; tail && tail->end <= to; tail = tail->next)
+  for (tail = head; tail && start + tail->length <= to;
+       start += tail->length, tail = tail->next)
     if (tail->nprops > 0)
       POP_PROP (tail);
 
   if (tail)
     {
-      if (tail->start < to)
+      if (start < to)
 	{
 	  if (tail->nprops > 0)
 	    {
 	      divide_interval (plist, tail, to);
 	      POP_PROP (tail);
 	    }
-	  to = tail->start;
+	  to = start;
 	}
       else
-	to = tail->end;
+	to = start + tail->length;
     }
   else
-    to = plist->tail->start;
+    to = interval_start (plist->tail);
 
   /* If there is a possibility that HEAD now has the same text
      properties as the previous one, check it and concatenate them if
      necessary.  */
   if (head->prev && check_head)
     head = head->prev;
-  while (head && head->end <= to)
+  while (head && INTERVAL_END (head) <= to)
     head = maybe_merge_interval (plist, head);
 
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   return 0;
 }
 
@@ -2243,8 +2406,8 @@ mtext_prop_range (MText *mt, MSymbol key, int pos,
   nprops = interval->nprops;
   if (deeper || ! nprops)
     {
-      if (from) *from = interval->start;
-      if (to) *to = interval->end;
+      if (from) *from = interval_start (interval);
+      if (to) *to = INTERVAL_END (interval);
       return interval->nprops;
     }
 
@@ -2259,7 +2422,7 @@ mtext_prop_range (MText *mt, MSymbol key, int pos,
 		    && (val == temp->prev->stack[temp->prev->nprops - 1]))
 		 : ! nprops);
 	   temp = temp->prev);
-      *from = temp->start;
+      *from = interval_start (temp);
     }
 
   if (to)
@@ -2271,7 +2434,7 @@ mtext_prop_range (MText *mt, MSymbol key, int pos,
 		    && val == temp->next->stack[temp->next->nprops - 1])
 		 : ! nprops);
 	   temp = temp->next);
-      *to = temp->end;
+      *to = INTERVAL_END (temp);
     }
 
   return nprops;
@@ -2300,7 +2463,7 @@ mtext_prop_range (MText *mt, MSymbol key, int pos,
 MTextProperty *
 mtext_property (MSymbol key, void *val, int control_bits)
 {
-  return new_text_property (NULL, 0, 0, key, val, control_bits);
+  return new_text_property (NULL, key, val, control_bits);
 }
 
 /***en
@@ -2377,7 +2540,7 @@ mtext_property_value (MTextProperty *prop)
 int
 mtext_property_start (MTextProperty *prop)
 {
-  return (prop->mt ? prop->start : -1);
+  return (prop->mt ? PROP_START (prop) : -1);
 }
 
 /***en
@@ -2398,7 +2561,7 @@ mtext_property_start (MTextProperty *prop)
 int
 mtext_property_end (MTextProperty *prop)
 {
-  return (prop->mt ? prop->end : -1);
+  return (prop->mt ? PROP_END (prop) : -1);
 }
 
 /***en
@@ -2553,20 +2716,18 @@ mtext_attach_property (MText *mt, int from, int to, MTextProperty *prop)
     mtext_detach_property (prop);
   prepare_to_modify (mt, from, to, prop->key, 0);
   plist = get_plist_create (mt, prop->key, 1);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   interval = pop_all_properties (plist, from, to);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   prop->mt = mt;
-  prop->start = from;
-  prop->end = to;
   PUSH_PROP (interval, prop);
   M17N_OBJECT_UNREF (prop);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   if (interval->next)
     maybe_merge_interval (plist, interval);
   if (interval->prev)
     maybe_merge_interval (plist, interval->prev);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   return 0;
 }
 
@@ -2591,14 +2752,16 @@ int
 mtext_detach_property (MTextProperty *prop)
 {
   MTextPlist *plist;
-  int start = prop->start, end = prop->end;
+  int start, end;
 
   if (! prop->mt)
     return 0;
+  start = PROP_START (prop);
+  end = PROP_END (prop);
   prepare_to_modify (prop->mt, start, end, prop->key, 0);
   plist = get_plist_create (prop->mt, prop->key, 0);
   xassert (plist);
-  detach_property (plist, prop, NULL);
+  detach_property (plist, prop);
   return 0;
 }
 
@@ -2631,7 +2794,7 @@ mtext_push_property (MText *mt, int from, int to, MTextProperty *prop)
 {
   MTextPlist *plist;
   MInterval *head, *tail, *interval;
-  int check_head, check_tail;
+  int start, check_head, check_tail;
 
   M_CHECK_RANGE (mt, from, to, -1, 0);
 
@@ -2641,17 +2804,17 @@ mtext_push_property (MText *mt, int from, int to, MTextProperty *prop)
   prepare_to_modify (mt, from, to, prop->key, 0);
   plist = get_plist_create (mt, prop->key, 1);
   prop->mt = mt;
-  prop->start = from;
-  prop->end = to;
 
   /* Find an interval that covers the position FROM.  */
   head = find_interval (plist, from);
+  start = interval_start (head);
 
   /* If the found interval starts before FROM, divide it at FROM.  */
-  if (head->start < from)
+  if (start < from)
     {
       divide_interval (plist, head, from);
       head = head->next;
+      start = from;
       check_head = 0;
     }
   else
@@ -2659,12 +2822,12 @@ mtext_push_property (MText *mt, int from, int to, MTextProperty *prop)
 
   /* Find an interval that ends at TO.  If TO is not at the end of an
      interval, make one that ends at TO.  */
-  if (head->end == to)
+  if (start + head->length == to)
     {
       tail = head;
       check_tail = 1;
     }
-  else if (head->end > to)
+  else if (start + head->length > to)
     {
       divide_interval (plist, head, to);
       tail = head;
@@ -2678,7 +2841,7 @@ mtext_push_property (MText *mt, int from, int to, MTextProperty *prop)
 	  tail = plist->tail;
 	  check_tail = 0;
 	}
-      else if (tail->start == to)
+      else if (interval_start (tail) == to)
 	{
 	  tail = tail->prev;
 	  check_tail = 1;
@@ -2710,7 +2873,7 @@ mtext_push_property (MText *mt, int from, int to, MTextProperty *prop)
     maybe_merge_interval (plist, head->prev);
 
   M17N_OBJECT_UNREF (prop);
-  xassert (check_plist (plist, 0) == 0);
+  xassert (check_plist (plist) == 0);
   return 0;
 }
 
@@ -2895,9 +3058,9 @@ mtext_serialize (MText *mt, int from, int to, MPlist *property_list)
       xmlSetProp (child, (xmlChar *) "key",
 		  (xmlChar *) MSYMBOL_NAME (prop->key));
       xmlSetProp (child, (xmlChar *) "value", (xmlChar *) MTEXT_DATA (work));
-      sprintf (buf, "%d", prop->start - from);
+      sprintf (buf, "%d", PROP_START (prop) - from);
       xmlSetProp (child, (xmlChar *) "from", (xmlChar *) buf);
-      sprintf (buf, "%d", prop->end - from);
+      sprintf (buf, "%d", PROP_END (prop) - from);
       xmlSetProp (child, (xmlChar *) "to", (xmlChar *) buf);
       sprintf (buf, "%d", prop->control.flag);
       xmlSetProp (child, (xmlChar *) "control", (xmlChar *) buf);
@@ -24,8 +24,8 @@
 #define _M17N_TEXTPROP_H_
 
 /** MTextProperty is the structure for a text property object.  While
-    attached, it is stored in the stacks of intervals covering the
-    range from MTextProperty->start to MTextProperty->end.  */
+    attached, it is stored in the stacks of intervals from
+    MTextProperty->head to MTextProperty->tail.  */
 
 struct MTextProperty
 {
@@ -40,8 +40,10 @@ struct MTextProperty
       that the property is detached.  */
   MText *mt;
 
-  /** Region of <mt> if the property is attached to it.  */
-  int start, end;
+  /** The first and last intervals of <mt> containing the property
+      if it is attached to <mt>, or NULL if it is detached.  The
+      region of the property is calculated from them.  */
+  struct MInterval *head, *tail;
 
   /** Key of the property.  */
   MSymbol key;
@@ -50,14 +52,13 @@ struct MTextProperty
   void *val;
 };
 
-#define MTEXTPROP_START(prop) (prop)->start
-#define MTEXTPROP_END(prop) (prop)->end
+#define MTEXTPROP_START(prop) mtext_property_start (prop)
+#define MTEXTPROP_END(prop) mtext_property_end (prop)
 #define MTEXTPROP_KEY(prop) (prop)->key
 #define MTEXTPROP_VAL(prop) (prop)->val
 
 extern struct MTextPlist *mtext__copy_plist (struct MTextPlist *, 
-					     int from, int to,
-					     MText *mt, int pos);
+					     int from, int to, MText *mt);
 
 extern void mtext__free_plist (MText *mt);
 